@@ -117,8 +117,16 @@
 /* The maximum allowable number of concurrent connections. */
 unsigned M_CONNECTIONS = 0;
 
+/* The minimum amount of a file read ahead after each read. */
+#define  PREFETCH_MIN_LEN      (256 * 1024)
+
 static const char* clo_serverpath = ".";
 
+/* The version of the protocol spoken.  With 1, VER2 and SECT requests
+   are rejected, as by the servers before version 2, so that clients'
+   fallback can be tested. */
+static int clo_protocol = 2;
+
 
 /*---------------------------------------------------------------*/
 
@@ -187,6 +195,9 @@ typedef
       ULong stats_n_rdok_frames;
       ULong stats_n_read_unz_bytes; // bytes via READ (uncompressed)
       ULong stats_n_read_z_bytes;   // bytes via READ (compressed)
+      // How many READ and SECT requests?
+      ULong stats_n_read_reqs;
+      ULong stats_n_sect_reqs;
    }
    ConnState;
 
@@ -497,6 +508,24 @@ static Bool parse_Frame_le64_le64_le64 ( Frame* fr, const HChar* tag,
    return True;
 }
 
+static Bool parse_Frame_le64_le64_le64_le64 ( Frame* fr, const HChar* tag,
+                                              /*OUT*/ULong* n1,
+                                              /*OUT*/ULong* n2,
+                                              /*OUT*/ULong* n3,
+                                              /*OUT*/ULong* n4 )
+{
+   assert(strlen(tag) == 4);
+   if (!fr || !fr->data) return False;
+   if (fr->n_data < 4) return False;
+   if (memcmp(&fr->data[0], tag, 4) != 0) return False;
+   if (fr->n_data != 4 + 4*8) return False;
+   *n1 = read_ULong_le(&fr->data[4 + 0*8]);
+   *n2 = read_ULong_le(&fr->data[4 + 1*8]);
+   *n3 = read_ULong_le(&fr->data[4 + 2*8]);
+   *n4 = read_ULong_le(&fr->data[4 + 3*8]);
+   return True;
+}
+
 static Frame* mk_Frame_le64_le64_le64_bytes ( 
                  const HChar* tag,
                  ULong n1, ULong n2, ULong n3, ULong n_data,
@@ -674,6 +703,113 @@ static UInt calc_gnu_debuglink_crc32(/*OUT*/Bool* ok, int fd, ULong size)
    }
 
 
+/*---------------------------------------------------------------*/
+
+/* Send the frame |fr| to the client on |sd|.  Returns False if the
+   connection failed. */
+static Bool send_Frame ( int sd, Frame* fr )
+{
+   /* What goes on the wire is:
+         adler(le32) n_data(le32) data[0 .. n_data-1]
+      where the checksum covers n_data as well as data[].
+   */
+   /* The initial Adler-32 value */
+   UInt adler = adler32(0, NULL, 0);
+
+   /* Fold in the length field, encoded as le32. */
+   UChar wr_first8[8];
+   write_UInt_le(&wr_first8[4], fr->n_data);
+   adler = adler32(adler, &wr_first8[4], 4);
+   /* Fold in the data values */
+   adler = adler32(adler, fr->data, fr->n_data);
+   write_UInt_le(&wr_first8[0], adler);
+
+   Int r = my_write(sd, &wr_first8[0], 8);
+   if (r != 8) return False;
+   assert(fr->n_data >= 4); // else ill formed -- no KIND field
+   r = my_write(sd, fr->data, fr->n_data);
+   if (r != fr->n_data) return False;
+   return True;
+}
+
+/* Read [offset, +len) from the file of conn_state[conn_no], which the
+   caller has range-checked, and return it in a RDOK frame, compressed
+   with LZO.  Or return a FAIL frame, whose reason starts with |what|,
+   the name of the request. */
+static Frame* mk_RDOK_Frame ( int conn_no, const HChar* what,
+                              ULong offset, ULong len )
+{
+   Frame* res = NULL;
+   HChar  reason[64];
+
+   /* First, allocate a temp buf and read from the file into it. */
+   /* FIXME: what if pread reads short and we have to redo it? */
+   UChar* unzBuf = my_malloc(len);
+   size_t nRead = pread(conn_state[conn_no].file_fd, unzBuf, len, offset);
+   if (nRead != len) {
+      snprintf(reason, sizeof(reason), "%s: I/O error reading file", what);
+      res = mk_Frame_asciiz("FAIL", reason);
+   } else {
+      // Now compress it with LZO.  LZO appears to recommend
+      // the worst-case output size as (in_len + in_len / 16 + 67).
+      // Be more conservative here.
+#     define STACK_ALLOC(var,size) \
+         lzo_align_t __LZO_MMODEL \
+            var [ ((size) \
+                  + (sizeof(lzo_align_t) - 1)) / sizeof(lzo_align_t) ]
+      STACK_ALLOC(wrkmem, LZO1X_1_MEM_COMPRESS);
+#     undef STACK_ALLOC
+      UInt zLenMax = len + len / 4 + 1024;
+      UChar* zBuf = my_malloc(zLenMax);
+      lzo_uint zLen = zLenMax;
+      Int lzo_rc = lzo1x_1_compress(unzBuf, len, zBuf, &zLen, wrkmem);
+      if (lzo_rc == LZO_E_OK) {
+         //printf("XXXXX len %u  zLen %u\n", (UInt)len, (UInt)zLen);
+         assert(zLen <= zLenMax);
+         /* Make a frame to put the results in.  Bytes 24 and
+            onwards need to be filled from the compressed data,
+            and 'buf' is set to point to the right bit. */
+         UChar* buf = NULL;
+         res = mk_Frame_le64_le64_le64_bytes
+           ("RDOK", conn_state[conn_no].session_id, offset, len, zLen, &buf);
+         assert(res);
+         assert(buf);
+         memcpy(buf, zBuf, zLen);
+         // Update stats
+         conn_state[conn_no].stats_n_rdok_frames++;
+         conn_state[conn_no].stats_n_read_unz_bytes += len;
+         conn_state[conn_no].stats_n_read_z_bytes   += zLen;
+      } else {
+         snprintf(reason, sizeof(reason), "%s: LZO failed", what);
+         res = mk_Frame_asciiz("FAIL", reason);
+      }
+      free(zBuf);
+   }
+   free(unzBuf);
+   return res;
+}
+
+/* Having just sent [.., offset) of the file of conn_state[conn_no],
+   ask the kernel to read ahead the |len| bytes after it (at least
+   PREFETCH_MIN_LEN), since clients mostly read files sequentially.
+   This way the disk reads overlap with the client processing the data
+   it has just been sent, and with the network round trip. */
+static void prefetch ( int conn_no, ULong offset, ULong len )
+{
+#  if defined(POSIX_FADV_WILLNEED)
+   ULong file_size = conn_state[conn_no].file_size;
+   if (offset >= file_size)
+      return;
+   if (len < PREFETCH_MIN_LEN)
+      len = PREFETCH_MIN_LEN;
+   if (len > file_size - offset)
+      len = file_size - offset;
+   (void)posix_fadvise(conn_state[conn_no].file_fd, offset, len,
+                       POSIX_FADV_WILLNEED);
+#  endif
+}
+
+
 /*---------------------------------------------------------------*/
 
 /* Handle a transaction for conn_state[conn_no].  There is incoming
@@ -727,12 +863,18 @@ static Bool handle_transaction ( int conn_no )
    assert(res == NULL);
 
    UChar* filename = NULL;
-   ULong req_session_id = 0, req_offset = 0, req_len = 0;
+   ULong req_session_id = 0, req_offset = 0, req_len = 0, req_block_len = 0;
 
    if (parse_Frame_noargs(req, "VERS")) {
       res = mk_Frame_asciiz("VEOK", "Valgrind Debuginfo Server, Version 1");
    }
    else
+   if (clo_protocol >= 2 && parse_Frame_noargs(req, "VER2")) {
+      /* Version 2 adds the SECT request.  Clients ask for it first,
+         and fall back to VERS if they get a FAIL frame back. */
+      res = mk_Frame_asciiz("VEOK", "Valgrind Debuginfo Server, Version 2");
+   }
+   else
    if (parse_Frame_noargs(req, "CRC3")) {
       /* FIXME: add a session ID to this request, and check it */
       if (conn_state[conn_no].file_fd == 0) {
@@ -822,55 +964,57 @@ static Bool handle_transaction ( int conn_no )
       }
       /* Try to read the file. */
       if (ok) {
-         /* First, allocate a temp buf and read from the file into it. */
-         /* FIXME: what if pread reads short and we have to redo it? */
-         UChar* unzBuf = my_malloc(req_len);
-         size_t nRead = pread(conn_state[conn_no].file_fd,
-                              unzBuf, req_len, req_offset);
-         if (nRead != req_len) {
+         conn_state[conn_no].stats_n_read_reqs++;
+         res = mk_RDOK_Frame(conn_no, "READ", req_offset, req_len);
+         prefetch(conn_no, req_offset + req_len, req_len);
+      }
+   }
+   else
+   if (clo_protocol >= 2
+       && parse_Frame_le64_le64_le64_le64(req, "SECT", &req_session_id,
+                                          &req_offset, &req_len,
+                                          &req_block_len)) {
+      /* Send the section [req_offset, +req_len) as a sequence of RDOK
+         frames of req_block_len bytes each, except the last one, as
+         if the client had sent a READ request for each block.  The
+         client expects exactly that many frames, so if something
+         goes wrong half way, the FAIL frame is the last one. */
+      Bool ok = True;
+      if (req_session_id != conn_state[conn_no].session_id) {
+         res = mk_Frame_asciiz("FAIL", "SECT: invalid session ID");
+         ok = False;
+      }
+      if (ok && conn_state[conn_no].file_fd == 0) {
+         res = mk_Frame_asciiz("FAIL", "SECT: no associated file");
+         ok = False;
+      }
+      if (ok && (req_block_len == 0 || req_block_len > 4*1024*1024
+                 || req_len == 0 || req_len > 256*1024*1024)) {
+         res = mk_Frame_asciiz("FAIL", "SECT: invalid request size");
+         ok = False;
+      }
+      if (ok && req_len + req_offset > conn_state[conn_no].file_size) {
+         res = mk_Frame_asciiz("FAIL", "SECT: request exceeds file size");
+         ok = False;
+      }
+      if (ok) {
+         ULong off = req_offset;
+         ULong end = req_offset + req_len;
+         conn_state[conn_no].stats_n_sect_reqs++;
+         while (True) {
+            ULong len = end - off;
+            if (len > req_block_len)
+               len = req_block_len;
+            res = mk_RDOK_Frame(conn_no, "SECT", off, len);
+            off += len;
+            if (off == end || memcmp(res->data, "FAIL", 4) == 0)
+               break;
+            if (!send_Frame(sd, res))
+               goto fail;
             free_Frame(res);
-            res = mk_Frame_asciiz("FAIL", "READ: I/O error reading file");
-            ok = False;
-         }         
-         if (ok) {
-            // Now compress it with LZO.  LZO appears to recommend
-            // the worst-case output size as (in_len + in_len / 16 + 67).
-            // Be more conservative here.
-#           define STACK_ALLOC(var,size) \
-               lzo_align_t __LZO_MMODEL \
-                  var [ ((size) \
-                        + (sizeof(lzo_align_t) - 1)) / sizeof(lzo_align_t) ]
-            STACK_ALLOC(wrkmem, LZO1X_1_MEM_COMPRESS);
-#           undef STACK_ALLOC
-            UInt zLenMax = req_len + req_len / 4 + 1024;
-            UChar* zBuf = my_malloc(zLenMax);
-            lzo_uint zLen = zLenMax;
-            Int lzo_rc = lzo1x_1_compress(unzBuf, req_len,
-                                          zBuf, &zLen, wrkmem); 
-            if (lzo_rc == LZO_E_OK) {
-              //printf("XXXXX req_len %u  zLen %u\n", (UInt)req_len, (UInt)zLen);
-               assert(zLen <= zLenMax);
-               /* Make a frame to put the results in.  Bytes 24 and
-                  onwards need to be filled from the compressed data,
-                  and 'buf' is set to point to the right bit. */
-               UChar* buf = NULL;
-               res = mk_Frame_le64_le64_le64_bytes
-                 ("RDOK", req_session_id, req_offset, req_len, zLen, &buf);
-               assert(res);
-               assert(buf);
-               memcpy(buf, zBuf, zLen);
-               // Update stats
-               conn_state[conn_no].stats_n_rdok_frames++;
-               conn_state[conn_no].stats_n_read_unz_bytes += req_len;
-               conn_state[conn_no].stats_n_read_z_bytes   += zLen;
-            } else {
-               ok = False;
-               free_Frame(res);
-               res = mk_Frame_asciiz("FAIL", "READ: LZO failed");
-            }
-            free(zBuf);
+            res = NULL;
          }
-         free(unzBuf);
+         prefetch(conn_no, end, req_len);
       }
    }
    else {
@@ -881,26 +1025,7 @@ static Bool handle_transaction ( int conn_no )
    assert(res != NULL);
 
    /* And send the response frame back to the client. */
-   /* What goes on the wire is:
-         adler(le32) n_data(le32) data[0 .. n_data-1]
-      where the checksum covers n_data as well as data[].
-   */
-   /* The initial Adler-32 value */
-   adler = adler32(0, NULL, 0);
-
-   /* Fold in the length field, encoded as le32. */
-   UChar wr_first8[8];
-   write_UInt_le(&wr_first8[4], res->n_data);
-   adler = adler32(adler, &wr_first8[4], 4);
-   /* Fold in the data values */
-   adler = adler32(adler, res->data, res->n_data);
-   write_UInt_le(&wr_first8[0], adler);
-
-   Int r = my_write(sd, &wr_first8[0], 8);
-   if (r != 8) goto fail;
-   assert(res->n_data >= 4); // else ill formed -- no KIND field
-   r = my_write(sd, res->data, res->n_data);
-   if (r != res->n_data) goto fail;
+   if (!send_Frame(sd, res)) goto fail;
 
 //printf("SERVER: send %c%c%c%c\n", res->data[0], res->data[1], res->data[2], res->data[3]); fflush(stdout);
 
@@ -926,6 +1051,10 @@ static Bool handle_transaction ( int conn_no )
              conn_state[conn_no].stats_n_read_z_bytes / 1000000,
              (double)conn_state[conn_no].stats_n_read_unz_bytes
                / (double)conn_state[conn_no].stats_n_read_z_bytes);
+      printf("(%d) SessionID %llu:   %llu READ and %llu SECT requests\n",
+             conn_count, conn_state[conn_no].session_id,
+             conn_state[conn_no].stats_n_read_reqs,
+             conn_state[conn_no].stats_n_sect_reqs);
       printf("(%d) SessionID %llu: closed\n",
              conn_count, conn_state[conn_no].session_id);
 
@@ -1021,7 +1150,8 @@ static void usage ( void )
       "\n"
       "usage is:\n"
       "\n"
-      "   valgrind-di-server [--exit-at-zero|-e] [port-number]\n"
+      "   valgrind-di-server [--exit-at-zero|-e] [--protocol=1|2]\n"
+      "                      [port-number]\n"
       "\n"
       "   where   --exit-at-zero or -e causes the listener to exit\n"
       "           when the number of connections falls back to zero\n"
@@ -1031,6 +1161,10 @@ static void usage ( void )
       "           number of connected processes (default = %d).\n"
       "           INT must be positive and less than %d.\n"
       "\n"
+      "           --protocol=1 makes the server reject the requests\n"
+      "           added by version 2 of the protocol, as older servers\n"
+      "           do, to test clients (the default is 2)\n"
+      "\n"
       "           port-number is the default port on which to listen for\n"
       "           connections.  It must be between 1024 and 65535.\n"
       "           Current default is %d.\n"
@@ -1079,6 +1213,12 @@ int main (int argc, char** argv)
           || 0==strcmp(argv[i], "-e")) {
          exit_when_zero = 1;
       }
+      else if (0 == strcmp(argv[i], "--protocol=1")) {
+         clo_protocol = 1;
+      }
+      else if (0 == strcmp(argv[i], "--protocol=2")) {
+         clo_protocol = 2;
+      }
       else if (0 == strncmp(argv[i], "--max-connect=", 14)) {
          M_CONNECTIONS = atoi_with_bound(strchr(argv[i], '=') + 1, 5000);
          if (M_CONNECTIONS <= 0 || M_CONNECTIONS > M_CONNECTIONS_MAX)
@@ -1097,7 +1237,6 @@ int main (int argc, char** argv)
 
    conn_state = my_malloc(M_CONNECTIONS * sizeof conn_state[0]);
 
-   banner("started");
    signal(SIGINT, sigint_handler);
 
    conn_count = 0;
@@ -1136,6 +1275,9 @@ int main (int argc, char** argv)
       panic("main -- listen");
    }
 
+   /* Only now can clients connect. */
+   banner("started");
+
    Bool do_snooze = False;  
    while (1) {
 
@@ -28,6 +28,7 @@
 */
 
 #include "pub_tool_basics.h"
+#include "pub_tool_aspacemgr.h"     // VG_(am_find_nsegment)
 #include "pub_tool_debuginfo.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
@@ -40,7 +41,9 @@
 #include "pub_tool_tooliface.h"
 #include "pub_tool_xarray.h"
 #include "pub_tool_clientstate.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
+#include "pub_tool_transtab.h"     // VG_(discard_translations_safely)
 
 #include "cg_arch.h"
 #include "cg_sim.c"
@@ -59,6 +62,15 @@
 
 static Bool  clo_cache_sim  = True;  /* do cache simulation? */
 static Bool  clo_branch_sim = False; /* do branch simulation? */
+static Int   clo_cores      = 1;     /* number of simulated cores */
+static Bool  clo_tlb_sim    = False; /* do TLB simulation? */
+static Bool  clo_tlb_hugepages = False; /* 2M pages for anonymous memory? */
+static Bool  clo_prefetch   = False; /* simulate hardware prefetchers? */
+static Int   clo_prefetch_degree = 2; /* lines prefetched ahead */
+static Bool  clo_sampling   = False; /* simulate sampling windows only? */
+static Long  clo_sample_period = 10000000; /* blocks from window to window */
+static Long  clo_sample_warmup = 200000;   /* blocks simulated before one */
+static Long  clo_sample_window = 100000;   /* blocks of a window */
 static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
 
 /*------------------------------------------------------------*/
@@ -67,6 +79,15 @@ static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
 
 static Int min_line_size = 0; /* min of L1 and LL cache line sizes */
 
+/* Do instruction/data references go through the helpers of the
+   optional models (--cores, --tlb-sim, --prefetch)? */
+static Bool ext_I_sim = False;
+static Bool ext_D_sim = False;
+
+/* With --sampling, are new translations only counting instructions,
+   data accesses and branches, between the sampling windows? */
+static Bool samp_fast = False;
+
 /*------------------------------------------------------------*/
 /*--- Types and Data Structures                            ---*/
 /*------------------------------------------------------------*/
@@ -100,15 +121,106 @@ typedef struct {
 }
 CodeLoc;
 
+/* With --sampling, the sums over the sampling windows of the Ir count
+   of a line (y) and of the count of each of its other events (x), for
+   the ratio estimate of the event: Ir * sum(x) / sum(y). */
+typedef struct {
+   double x;    /* sum of the counts of the event */
+   double xx;   /* sum of their squares */
+   double xy;   /* sum of their products with the Ir counts */
+   ULong  ci;   /* in the end, half width of the 95% confidence interval */
+}
+SampleEv;
+
+typedef struct {
+   ULong    ir_start;   /* Ir count at the start of the current window */
+   double   y;          /* sum of the Ir counts */
+   double   yy;         /* sum of their squares */
+   SampleEv ev[0];      /* one per event after Ir, see out_events */
+}
+SampleCC;
+
 typedef struct {
    CodeLoc  loc; /* Source location that these counts pertain to */
    CacheCC  Ir;  /* Insn read counts */
    CacheCC  Dr;  /* Data read counts */
    CacheCC  Dw;  /* Data write/modify counts */
+   ExtCC    X;   /* Optional model counts */
    BranchCC Bc;  /* Conditional branch counts */
    BranchCC Bi;  /* Indirect branch counts */
+   SampleCC* samp; /* Sums of the sampling windows (with --sampling) */
 } LineCC;
 
+/* The events of the output file after Ir, as offsets of their counts
+   in a LineCC.  With --sampling, the events that are not exact are
+   estimated. */
+#define MAX_OUT_EVENTS 20
+
+typedef struct {
+   const HChar* name;
+   SizeT        offset;
+   Bool         exact;  /* counted in every phase with --sampling */
+}
+OutEvent;
+
+static OutEvent out_events[MAX_OUT_EVENTS];
+static Int      n_out_events = 0;
+
+#define EVENT_COUNT(lineCC, i) \
+   (*(ULong*)((HChar*)(lineCC) + out_events[i].offset))
+
+static void add_out_event(const HChar* name, SizeT offset, Bool exact)
+{
+   tl_assert(n_out_events < MAX_OUT_EVENTS);
+   out_events[n_out_events].name   = name;
+   out_events[n_out_events].offset = offset;
+   out_events[n_out_events].exact  = exact;
+   n_out_events++;
+}
+
+static void init_out_events(void)
+{
+   if (clo_cache_sim) {
+      add_out_event("I1mr", offsetof(LineCC, Ir.m1),  False);
+      add_out_event("ILmr", offsetof(LineCC, Ir.mL),  False);
+      add_out_event("Dr",   offsetof(LineCC, Dr.a),   True);
+      add_out_event("D1mr", offsetof(LineCC, Dr.m1),  False);
+      add_out_event("DLmr", offsetof(LineCC, Dr.mL),  False);
+      add_out_event("Dw",   offsetof(LineCC, Dw.a),   True);
+      add_out_event("D1mw", offsetof(LineCC, Dw.m1),  False);
+      add_out_event("DLmw", offsetof(LineCC, Dw.mL),  False);
+   }
+   if (clo_cores > 1) {
+      add_out_event("Dcm",  offsetof(LineCC, X.cm),   False);
+      add_out_event("Dfs",  offsetof(LineCC, X.fs),   False);
+   }
+   if (clo_tlb_sim) {
+      add_out_event("ITm",  offsetof(LineCC, X.itm),  False);
+      add_out_event("ITw",  offsetof(LineCC, X.itw),  False);
+      add_out_event("DTm",  offsetof(LineCC, X.dtm),  False);
+      add_out_event("DTw",  offsetof(LineCC, X.dtw),  False);
+   }
+   if (clo_prefetch) {
+      add_out_event("D1pf", offsetof(LineCC, X.pf1),  False);
+      add_out_event("LLpf", offsetof(LineCC, X.pfL),  False);
+   }
+   if (clo_branch_sim) {
+      add_out_event("Bc",   offsetof(LineCC, Bc.b),   True);
+      add_out_event("Bcm",  offsetof(LineCC, Bc.mp),  False);
+      add_out_event("Bi",   offsetof(LineCC, Bi.b),   True);
+      add_out_event("Bim",  offsetof(LineCC, Bi.mp),  False);
+   }
+}
+
+static SampleCC* new_SampleCC(void)
+{
+   SizeT     size = sizeof(SampleCC) + n_out_events * sizeof(SampleEv);
+   SampleCC* samp = VG_(malloc)("cg.main.nsc.1", size);
+
+   VG_(memset)(samp, 0, size);
+   return samp;
+}
+
 // First compare file, then fn, then line.
 static Word cmp_CodeLoc_LineCC(const void *vloc, const void *vcc)
 {
@@ -274,10 +386,12 @@ static LineCC* get_lineCC(Addr origAddr)
       lineCC->Dw.a     = 0;
       lineCC->Dw.m1    = 0;
       lineCC->Dw.mL    = 0;
+      VG_(memset)(&lineCC->X, 0, sizeof(ExtCC));
       lineCC->Bc.b     = 0;
       lineCC->Bc.mp    = 0;
       lineCC->Bi.b     = 0;
       lineCC->Bi.mp    = 0;
+      lineCC->samp     = clo_sampling ? new_SampleCC() : NULL;
       VG_(OSetGen_Insert)(CC_table, lineCC);
    }
 
@@ -294,20 +408,28 @@ static LineCC* get_lineCC(Addr origAddr)
  * As this can be detected at instrumentation time, and results
  * in faster simulation, special-casing is benefical.
  *
+ *
+ * Another common case is an IrNoX that reads from the same I1 cache line
+ * as the instruction executed just before it in the same superblock.
+ * That line was made the MRU entry of its set by the previous read, and
+ * only instruction reads change the I1 state, so this read is sure to
+ * hit in I1 and does not need to be simulated.
+ *
  * Abbreviations used in var/function names:
  *  IrNoX - instruction read does not cross cache lines
+ *  IrHit - IrNoX known at instrumentation time to hit in I1
  *  IrGen - generic instruction read; not detected as IrNoX
  *  Ir    - not known / not important whether it is an IrNoX
  */
 
-// Only used with --cache-sim=no.
+// Used with --cache-sim=no, and for IrHit's.
 static VG_REGPARM(1)
 void log_1Ir(InstrInfo* n)
 {
    n->parent->Ir.a++;
 }
 
-// Only used with --cache-sim=no.
+// Used with --cache-sim=no, and for IrHit's.
 static VG_REGPARM(2)
 void log_2Ir(InstrInfo* n, InstrInfo* n2)
 {
@@ -315,7 +437,7 @@ void log_2Ir(InstrInfo* n, InstrInfo* n2)
    n2->parent->Ir.a++;
 }
 
-// Only used with --cache-sim=no.
+// Used with --cache-sim=no, and for IrHit's.
 static VG_REGPARM(3)
 void log_3Ir(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
 {
@@ -381,6 +503,26 @@ void log_3IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
    n3->parent->Ir.a++;
 }
 
+static VG_REGPARM(2)
+void log_1IrNoX_1IrHit_0D_cache_access(InstrInfo* n, InstrInfo* n2)
+{
+   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+   n->parent->Ir.a++;
+   n2->parent->Ir.a++;
+}
+
+static VG_REGPARM(3)
+void log_1IrNoX_2IrHit_0D_cache_access(InstrInfo* n, InstrInfo* n2,
+                                       InstrInfo* n3)
+{
+   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+   n->parent->Ir.a++;
+   n2->parent->Ir.a++;
+   n3->parent->Ir.a++;
+}
+
 static VG_REGPARM(3)
 void log_1IrNoX_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 {
@@ -411,6 +553,26 @@ void log_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    n->parent->Dw.a++;
 }
 
+static VG_REGPARM(3)
+void log_1IrHit_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   n->parent->Ir.a++;
+
+   cachesim_D1_doref(data_addr, data_size, 
+                     &n->parent->Dr.m1, &n->parent->Dr.mL);
+   n->parent->Dr.a++;
+}
+
+static VG_REGPARM(3)
+void log_1IrHit_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   n->parent->Ir.a++;
+
+   cachesim_D1_doref(data_addr, data_size, 
+                     &n->parent->Dw.m1, &n->parent->Dw.mL);
+   n->parent->Dw.a++;
+}
+
 /* Note that addEvent_D_guarded assumes that log_0Ir_1Dr_cache_access
    and log_0Ir_1Dw_cache_access have exactly the same prototype.  If
    you change them, you must change addEvent_D_guarded too. */
@@ -435,6 +597,46 @@ void log_0Ir_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    n->parent->Dw.a++;
 }
 
+/* Instruction and data references when simulating several cores, TLBs
+   or prefetchers.  The data ones have the same prototype as
+   log_0Ir_1Dr_cache_access, see the comment on it.  A data modify is
+   counted as a read, but invalidates the other cores' copies. */
+static VG_REGPARM(1)
+void log_1Ir_ext_cache_access(InstrInfo* n)
+{
+   cachesim_I1_doref_ext(n->instr_addr, n->instr_len,
+                         &n->parent->Ir.m1, &n->parent->Ir.mL,
+                         &n->parent->X);
+   n->parent->Ir.a++;
+}
+
+static VG_REGPARM(3)
+void log_0Ir_1Dr_ext_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   cachesim_D1_doref_ext(n->instr_addr, data_addr, data_size, False,
+                         &n->parent->Dr.m1, &n->parent->Dr.mL,
+                         &n->parent->X);
+   n->parent->Dr.a++;
+}
+
+static VG_REGPARM(3)
+void log_0Ir_1Dm_ext_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   cachesim_D1_doref_ext(n->instr_addr, data_addr, data_size, True,
+                         &n->parent->Dr.m1, &n->parent->Dr.mL,
+                         &n->parent->X);
+   n->parent->Dr.a++;
+}
+
+static VG_REGPARM(3)
+void log_0Ir_1Dw_ext_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   cachesim_D1_doref_ext(n->instr_addr, data_addr, data_size, True,
+                         &n->parent->Dw.m1, &n->parent->Dw.mL,
+                         &n->parent->X);
+   n->parent->Dw.a++;
+}
+
 /* For branches, we consult two different predictors, one which
    predicts taken/untaken for conditional branches, and the other
    which predicts the branch target address for indirect branches
@@ -501,6 +703,7 @@ typedef
 typedef 
    enum { 
       Ev_IrNoX,  // Instruction read not crossing cache lines
+      Ev_IrHit,  // IrNoX from the I1 line of the previous instruction
       Ev_IrGen,  // Generic Ir, not being detected as IrNoX
       Ev_Dr,     // Data read
       Ev_Dw,     // Data write
@@ -519,6 +722,8 @@ typedef
          } IrGen;
          struct {
          } IrNoX;
+         struct {
+         } IrHit;
          struct {
             IRAtom* ea;
             Int     szB;
@@ -541,6 +746,12 @@ typedef
    }
    Event;
 
+/* Is ev an instruction read not crossing cache lines, including the
+   ones known to hit in I1? */
+static Bool is_Ev_IrNoX ( const Event* ev ) {
+   return ev->tag == Ev_IrNoX || ev->tag == Ev_IrHit;
+}
+
 static void init_Event ( Event* ev ) {
    VG_(memset)(ev, 0, sizeof(Event));
 }
@@ -587,6 +798,15 @@ typedef
 
       /* The output SB being constructed. */
       IRSB* sbOut;
+
+      /* The I1 line read by the previous instruction of the SB, if
+         that was an IrNoX, or ~0 otherwise. */
+      UWord prev_Ir_line;
+
+      /* With --sampling, between the windows: the line of the last
+         instructions of the SB, and their number, not yet counted. */
+      LineCC* ir_cc;
+      Int     ir_n;
    }
    CgState;
 
@@ -639,6 +859,9 @@ static void showEvent ( Event* ev )
       case Ev_IrNoX:
          VG_(printf)("IrNoX %p\n", ev->inode);
          break;
+      case Ev_IrHit:
+         VG_(printf)("IrHit %p\n", ev->inode);
+         break;
       case Ev_Dr:
          VG_(printf)("Dr %p %d EA=", ev->inode, ev->Ev.Dr.szB);
          ppIRExpr(ev->Ev.Dr.ea); 
@@ -686,6 +909,85 @@ InstrInfo* setup_InstrInfo ( CgState* cgs, Addr instr_addr, UInt instr_len )
 }
 
 
+#if defined(VG_BIGENDIAN)
+# define CGEndness Iend_BE
+#elif defined(VG_LITTLEENDIAN)
+# define CGEndness Iend_LE
+#else
+# error "Unknown endianness"
+#endif
+
+/* Adds inline n to the count at *count, if guard (an Ity_I1) is true
+   or NULL. */
+static void addCount ( CgState* cgs, ULong* count, ULong n, IRExpr* guard )
+{
+   IRTemp  t1, t2;
+   IRExpr* addr;
+
+   addr = mkIRExpr_HWord( (HWord)count );
+   t1   = newIRTemp(cgs->sbOut->tyenv, Ity_I64);
+   t2   = newIRTemp(cgs->sbOut->tyenv, Ity_I64);
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(t1, IRExpr_Load(CGEndness, Ity_I64, addr)) );
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(t2, IRExpr_Binop(Iop_Add64,
+                                                IRExpr_RdTmp(t1),
+                                                IRExpr_Const(
+                                                   IRConst_U64(n)))) );
+   if (guard)
+      addStmtToIRSB( cgs->sbOut,
+                     IRStmt_StoreG(CGEndness, addr, IRExpr_RdTmp(t2),
+                                   guard) );
+   else
+      addStmtToIRSB( cgs->sbOut,
+                     IRStmt_Store(CGEndness, addr, IRExpr_RdTmp(t2)) );
+}
+
+/* Between the sampling windows, instructions are counted by adding
+   inline the number of instructions of each run of instructions of the
+   same line, instead of calling a helper per (group of) instructions. */
+static void flushIrCount ( CgState* cgs )
+{
+   if (cgs->ir_n == 0)
+      return;
+   addCount(cgs, &cgs->ir_cc->Ir.a, cgs->ir_n, NULL);
+   cgs->ir_cc = NULL;
+   cgs->ir_n  = 0;
+}
+
+/* The count of the line of the event that is incremented by its helper,
+   without simulating anything. */
+static ULong* event_count ( Event* ev )
+{
+   switch (ev->tag) {
+      case Ev_Dr:
+      case Ev_Dm: return &ev->inode->parent->Dr.a;
+      case Ev_Dw: return &ev->inode->parent->Dw.a;
+      case Ev_Bc: return &ev->inode->parent->Bc.b;
+      case Ev_Bi: return &ev->inode->parent->Bi.b;
+      default:    tl_assert(0);
+   }
+}
+
+/* Between the sampling windows, the data accesses and branches are
+   queued as in the windows, so that they are merged the same way, but
+   are only counted inline, one add per run of events with the same
+   count. */
+static void flushFastEvents ( CgState* cgs )
+{
+   Int    i, n;
+   ULong* count;
+
+   for (i = 0; i < cgs->events_used; i += n) {
+      count = event_count(&cgs->events[i]);
+      for (n = 1; i + n < cgs->events_used
+                  && event_count(&cgs->events[i + n]) == count; n++)
+         ;
+      addCount(cgs, count, n, NULL);
+   }
+   cgs->events_used = 0;
+}
+
 /* Generate code for all outstanding memory events, and mark the queue
    empty.  Code is generated into cgs->bbOut, and this activity
    'consumes' slots in cgs->sbInfo. */
@@ -702,6 +1004,12 @@ static void flushEvents ( CgState* cgs )
    Event*     ev2;
    Event*     ev3;
 
+   flushIrCount(cgs);
+   if (samp_fast) {
+      flushFastEvents(cgs);
+      return;
+   }
+
    i = 0;
    while (i < cgs->events_used) {
 
@@ -729,8 +1037,49 @@ static void flushEvents ( CgState* cgs )
          i appropriately. */
       switch (ev->tag) {
          case Ev_IrNoX:
-            /* Merge an IrNoX with a following Dr/Dm. */
-            if (ev2 && (ev2->tag == Ev_Dr || ev2->tag == Ev_Dm)) {
+         case Ev_IrHit:
+            /* With the optional models, an IrNoX has its own helper,
+               and only IrHit's are merged. */
+            if (ext_I_sim && ev->tag == Ev_IrNoX) {
+               helperName = "log_1Ir_ext_cache_access";
+               helperAddr = &log_1Ir_ext_cache_access;
+               argv = mkIRExprVec_1( i_node_expr );
+               regparms = 1;
+               i++;
+            }
+            else
+            if (ext_I_sim && ev2 && ev3
+                && ev2->tag == Ev_IrHit && ev3->tag == Ev_IrHit) {
+               helperName = "log_3Ir";
+               helperAddr = &log_3Ir;
+               argv = mkIRExprVec_3( i_node_expr,
+                                     mkIRExpr_HWord( (HWord)ev2->inode ),
+                                     mkIRExpr_HWord( (HWord)ev3->inode ) );
+               regparms = 3;
+               i += 3;
+            }
+            else
+            if (ext_I_sim && ev2 && ev2->tag == Ev_IrHit) {
+               helperName = "log_2Ir";
+               helperAddr = &log_2Ir;
+               argv = mkIRExprVec_2( i_node_expr,
+                                     mkIRExpr_HWord( (HWord)ev2->inode ) );
+               regparms = 2;
+               i += 2;
+            }
+            else
+            if (ext_I_sim) {
+               helperName = "log_1Ir";
+               helperAddr = &log_1Ir;
+               argv = mkIRExprVec_1( i_node_expr );
+               regparms = 1;
+               i++;
+            }
+            /* Merge an IrNoX with a following Dr/Dm.  Not done when
+               data references have their own helpers. */
+            else
+            if (!ext_D_sim
+                && ev2 && (ev2->tag == Ev_Dr || ev2->tag == Ev_Dm)) {
                /* Why is this true?  It's because we're merging an Ir
                   with a following Dr or Dm.  The Ir derives from the
                   instruction's IMark and the Dr/Dm from data
@@ -740,8 +1089,13 @@ static void flushEvents ( CgState* cgs )
                   immediately preceding Ir.  Same applies to analogous
                   assertions in the subsequent cases. */
                tl_assert(ev2->inode == ev->inode);
-               helperName = "log_1IrNoX_1Dr_cache_access";
-               helperAddr = &log_1IrNoX_1Dr_cache_access;
+               if (ev->tag == Ev_IrHit) {
+                  helperName = "log_1IrHit_1Dr_cache_access";
+                  helperAddr = &log_1IrHit_1Dr_cache_access;
+               } else {
+                  helperName = "log_1IrNoX_1Dr_cache_access";
+                  helperAddr = &log_1IrNoX_1Dr_cache_access;
+               }
                argv = mkIRExprVec_3( i_node_expr,
                                      get_Event_dea(ev2),
                                      mkIRExpr_HWord( get_Event_dszB(ev2) ) );
@@ -750,10 +1104,15 @@ static void flushEvents ( CgState* cgs )
             }
             /* Merge an IrNoX with a following Dw. */
             else
-            if (ev2 && ev2->tag == Ev_Dw) {
+            if (!ext_D_sim && ev2 && ev2->tag == Ev_Dw) {
                tl_assert(ev2->inode == ev->inode);
-               helperName = "log_1IrNoX_1Dw_cache_access";
-               helperAddr = &log_1IrNoX_1Dw_cache_access;
+               if (ev->tag == Ev_IrHit) {
+                  helperName = "log_1IrHit_1Dw_cache_access";
+                  helperAddr = &log_1IrHit_1Dw_cache_access;
+               } else {
+                  helperName = "log_1IrNoX_1Dw_cache_access";
+                  helperAddr = &log_1IrNoX_1Dw_cache_access;
+               }
                argv = mkIRExprVec_3( i_node_expr,
                                      get_Event_dea(ev2),
                                      mkIRExpr_HWord( get_Event_dszB(ev2) ) );
@@ -762,14 +1121,19 @@ static void flushEvents ( CgState* cgs )
             }
             /* Merge an IrNoX with two following IrNoX's. */
             else
-            if (ev2 && ev3 && ev2->tag == Ev_IrNoX && ev3->tag == Ev_IrNoX)
+            if (ev2 && ev3 && is_Ev_IrNoX(ev2) && is_Ev_IrNoX(ev3))
             {
-               if (clo_cache_sim) {
-                  helperName = "log_3IrNoX_0D_cache_access";
-                  helperAddr = &log_3IrNoX_0D_cache_access;
-               } else {
+               if (!clo_cache_sim || (ev->tag == Ev_IrHit
+                                      && ev2->tag == Ev_IrHit
+                                      && ev3->tag == Ev_IrHit)) {
                   helperName = "log_3Ir";
                   helperAddr = &log_3Ir;
+               } else if (ev2->tag == Ev_IrHit && ev3->tag == Ev_IrHit) {
+                  helperName = "log_1IrNoX_2IrHit_0D_cache_access";
+                  helperAddr = &log_1IrNoX_2IrHit_0D_cache_access;
+               } else {
+                  helperName = "log_3IrNoX_0D_cache_access";
+                  helperAddr = &log_3IrNoX_0D_cache_access;
                }
                argv = mkIRExprVec_3( i_node_expr, 
                                      mkIRExpr_HWord( (HWord)ev2->inode ), 
@@ -779,13 +1143,17 @@ static void flushEvents ( CgState* cgs )
             }
             /* Merge an IrNoX with one following IrNoX. */
             else
-            if (ev2 && ev2->tag == Ev_IrNoX) {
-               if (clo_cache_sim) {
-                  helperName = "log_2IrNoX_0D_cache_access";
-                  helperAddr = &log_2IrNoX_0D_cache_access;
-               } else {
+            if (ev2 && is_Ev_IrNoX(ev2)) {
+               if (!clo_cache_sim || (ev->tag == Ev_IrHit
+                                      && ev2->tag == Ev_IrHit)) {
                   helperName = "log_2Ir";
                   helperAddr = &log_2Ir;
+               } else if (ev2->tag == Ev_IrHit) {
+                  helperName = "log_1IrNoX_1IrHit_0D_cache_access";
+                  helperAddr = &log_1IrNoX_1IrHit_0D_cache_access;
+               } else {
+                  helperName = "log_2IrNoX_0D_cache_access";
+                  helperAddr = &log_2IrNoX_0D_cache_access;
                }
                argv = mkIRExprVec_2( i_node_expr,
                                      mkIRExpr_HWord( (HWord)ev2->inode ) );
@@ -794,7 +1162,7 @@ static void flushEvents ( CgState* cgs )
             }
             /* No merging possible; emit as-is. */
             else {
-               if (clo_cache_sim) {
+               if (clo_cache_sim && ev->tag == Ev_IrNoX) {
                   helperName = "log_1IrNoX_0D_cache_access";
                   helperAddr = &log_1IrNoX_0D_cache_access;
                } else {
@@ -807,7 +1175,10 @@ static void flushEvents ( CgState* cgs )
             }
             break;
          case Ev_IrGen:
-            if (clo_cache_sim) {
+            if (ext_I_sim) {
+               helperName = "log_1Ir_ext_cache_access";
+               helperAddr = &log_1Ir_ext_cache_access;
+            } else if (clo_cache_sim) {
 	       helperName = "log_1IrGen_0D_cache_access";
 	       helperAddr = &log_1IrGen_0D_cache_access;
 	    } else {
@@ -821,8 +1192,16 @@ static void flushEvents ( CgState* cgs )
          case Ev_Dr:
          case Ev_Dm:
             /* Data read or modify */
-            helperName = "log_0Ir_1Dr_cache_access";
-            helperAddr = &log_0Ir_1Dr_cache_access;
+            if (ext_D_sim && ev->tag == Ev_Dm) {
+               helperName = "log_0Ir_1Dm_ext_cache_access";
+               helperAddr = &log_0Ir_1Dm_ext_cache_access;
+            } else if (ext_D_sim) {
+               helperName = "log_0Ir_1Dr_ext_cache_access";
+               helperAddr = &log_0Ir_1Dr_ext_cache_access;
+            } else {
+               helperName = "log_0Ir_1Dr_cache_access";
+               helperAddr = &log_0Ir_1Dr_cache_access;
+            }
             argv = mkIRExprVec_3( i_node_expr, 
                                   get_Event_dea(ev), 
                                   mkIRExpr_HWord( get_Event_dszB(ev) ) );
@@ -831,8 +1210,13 @@ static void flushEvents ( CgState* cgs )
             break;
          case Ev_Dw:
             /* Data write */
-            helperName = "log_0Ir_1Dw_cache_access";
-            helperAddr = &log_0Ir_1Dw_cache_access;
+            if (ext_D_sim) {
+               helperName = "log_0Ir_1Dw_ext_cache_access";
+               helperAddr = &log_0Ir_1Dw_ext_cache_access;
+            } else {
+               helperName = "log_0Ir_1Dw_cache_access";
+               helperAddr = &log_0Ir_1Dw_cache_access;
+            }
             argv = mkIRExprVec_3( i_node_expr,
                                   get_Event_dea(ev), 
                                   mkIRExpr_HWord( get_Event_dszB(ev) ) );
@@ -875,6 +1259,13 @@ static void flushEvents ( CgState* cgs )
 static void addEvent_Ir ( CgState* cgs, InstrInfo* inode )
 {
    Event* evt;
+   if (samp_fast) {
+      if (cgs->ir_cc != inode->parent)
+         flushIrCount(cgs);
+      cgs->ir_cc = inode->parent;
+      cgs->ir_n++;
+      return;
+   }
    if (cgs->events_used == N_EVENTS)
       flushEvents(cgs);
    tl_assert(cgs->events_used >= 0 && cgs->events_used < N_EVENTS);
@@ -882,10 +1273,13 @@ static void addEvent_Ir ( CgState* cgs, InstrInfo* inode )
    init_Event(evt);
    evt->inode    = inode;
    if (cachesim_is_IrNoX(inode->instr_addr, inode->instr_len)) {
-      evt->tag = Ev_IrNoX;
+      UWord line = cachesim_I1_line(inode->instr_addr);
+      evt->tag = line == cgs->prev_Ir_line ? Ev_IrHit : Ev_IrNoX;
+      cgs->prev_Ir_line = line;
       distinct_instrsNoX++;
    } else {
       evt->tag = Ev_IrGen;
+      cgs->prev_Ir_line = ~(UWord)0;
       distinct_instrsGen++;
    }
    cgs->events_used++;
@@ -970,6 +1364,11 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
    tl_assert(cgs->events_used >= 0);
    flushEvents(cgs);
    tl_assert(cgs->events_used == 0);
+   if (samp_fast) {
+      addCount(cgs, isWrite ? &inode->parent->Dw.a : &inode->parent->Dr.a,
+               1, guard);
+      return;
+   }
    /* Same as case Ev_Dw / case Ev_Dr in flushEvents, except with guard */
    IRExpr*      i_node_expr;
    const HChar* helperName;
@@ -978,10 +1377,17 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
    Int          regparms;
    IRDirty*     di;
    i_node_expr = mkIRExpr_HWord( (HWord)inode );
-   helperName  = isWrite ? "log_0Ir_1Dw_cache_access"
-                         : "log_0Ir_1Dr_cache_access";
-   helperAddr  = isWrite ? &log_0Ir_1Dw_cache_access
-                         : &log_0Ir_1Dr_cache_access;
+   if (ext_D_sim) {
+      helperName = isWrite ? "log_0Ir_1Dw_ext_cache_access"
+                           : "log_0Ir_1Dr_ext_cache_access";
+      helperAddr = isWrite ? &log_0Ir_1Dw_ext_cache_access
+                           : &log_0Ir_1Dr_ext_cache_access;
+   } else {
+      helperName = isWrite ? "log_0Ir_1Dw_cache_access"
+                           : "log_0Ir_1Dr_cache_access";
+      helperAddr = isWrite ? &log_0Ir_1Dw_cache_access
+                           : &log_0Ir_1Dr_cache_access;
+   }
    argv        = mkIRExprVec_3( i_node_expr,
                                 ea, mkIRExpr_HWord( datasize ) );
    regparms    = 3;
@@ -1082,9 +1488,12 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 
    // Set up running state and get block info
    tl_assert(closure->readdr == vge->base[0]);
-   cgs.events_used = 0;
-   cgs.sbInfo      = get_SB_info(sbIn, (Addr)closure->readdr);
-   cgs.sbInfo_i    = 0;
+   cgs.events_used  = 0;
+   cgs.sbInfo       = get_SB_info(sbIn, (Addr)closure->readdr);
+   cgs.sbInfo_i     = 0;
+   cgs.prev_Ir_line = ~(UWord)0;
+   cgs.ir_cc        = NULL;
+   cgs.ir_n         = 0;
 
    if (DEBUG_CG)
       VG_(printf)("\n\n---------- cg_instrument ----------\n");
@@ -1359,6 +1768,187 @@ static cache_t clo_I1_cache = UNDEFINED_CACHE;
 static cache_t clo_D1_cache = UNDEFINED_CACHE;
 static cache_t clo_LL_cache = UNDEFINED_CACHE;
 
+/*------------------------------------------------------------*/
+/*--- Sampling                                             ---*/
+/*------------------------------------------------------------*/
+
+// With --sampling, each sampling period is made of:
+// - a fast phase, where the translations only count instructions, data
+//   accesses and branches, which are then exact;
+// - a warm-up phase, fully simulated to warm up the caches, whose counts
+//   of the other events are discarded;
+// - a sampling window, fully simulated and counted.
+// The phases change when a thread starts running, ie. at least once per
+// scheduling time slice, according to the number of blocks executed.
+// Entering or leaving the fast phase discards all the translations, so
+// that the code gets instrumented again.
+//
+// At the end, the counts of the other events of each line are estimated
+// from the windows by the ratio of the event count to the Ir count.  The
+// 95% confidence intervals assume independent windows.  A line executed
+// in no window has no estimate: its other events are 0, and its Ir count
+// is also given as Iu (unsampled Ir).
+
+typedef enum { SampFast, SampWarmup, SampWindow } SampPhase;
+
+static SampPhase samp_phase = SampFast;
+static ULong     samp_next;       /* blocks executed when the phase ends */
+static Int       samp_windows;    /* number of windows done */
+static SampleCC* samp_total;      /* sums over all lines */
+
+static void samp_set_fast(Bool fast)
+{
+   samp_fast = fast;
+   VG_(discard_translations_safely)( (Addr)0x1000, ~(SizeT)0xfff,
+                                     "cachegrind" );
+}
+
+// Discards the counts of the warm-up phase.
+static void samp_start_window(void)
+{
+   LineCC* lineCC;
+   Int     i;
+
+   VG_(OSetGen_ResetIter)(CC_table);
+   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+      lineCC->samp->ir_start = lineCC->Ir.a;
+      for (i = 0; i < n_out_events; i++)
+         if (!out_events[i].exact)
+            EVENT_COUNT(lineCC, i) = 0;
+   }
+}
+
+static void samp_add(SampleCC* samp, double y, const double* x)
+{
+   Int i;
+
+   samp->y  += y;
+   samp->yy += y * y;
+   for (i = 0; i < n_out_events; i++) {
+      if (out_events[i].exact)
+         continue;
+      samp->ev[i].x  += x[i];
+      samp->ev[i].xx += x[i] * x[i];
+      samp->ev[i].xy += x[i] * y;
+   }
+}
+
+// Adds the counts of the window to the sums.
+static void samp_end_window(void)
+{
+   LineCC* lineCC;
+   double  x[MAX_OUT_EVENTS];
+   double  x_total[MAX_OUT_EVENTS];
+   double  y_total = 0;
+   Int     i;
+
+   for (i = 0; i < n_out_events; i++)
+      x_total[i] = 0;
+
+   VG_(OSetGen_ResetIter)(CC_table);
+   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+      double y = lineCC->Ir.a - lineCC->samp->ir_start;
+
+      for (i = 0; i < n_out_events; i++) {
+         if (out_events[i].exact)
+            continue;
+         x[i] = EVENT_COUNT(lineCC, i);
+         x_total[i] += x[i];
+         EVENT_COUNT(lineCC, i) = 0;
+      }
+      samp_add(lineCC->samp, y, x);
+      y_total += y;
+   }
+   samp_add(samp_total, y_total, x_total);
+   samp_windows++;
+}
+
+static void samp_next_phase(ULong blocks)
+{
+   switch (samp_phase) {
+      case SampFast:
+         samp_phase = SampWarmup;
+         samp_next  = blocks + clo_sample_warmup;
+         samp_set_fast(False);
+         break;
+      case SampWarmup:
+         samp_start_window();
+         samp_phase = SampWindow;
+         samp_next  = blocks + clo_sample_window;
+         break;
+      case SampWindow:
+         samp_end_window();
+         samp_phase = SampFast;
+         samp_next  = blocks + clo_sample_period
+                      - clo_sample_warmup - clo_sample_window;
+         samp_set_fast(True);
+         break;
+   }
+}
+
+// No sqrt() without libm.  Newton's method, from above.
+static double cg_sqrt(double x)
+{
+   double r = x > 1 ? x : 1;
+   Int    i;
+
+   for (i = 0; i < 2000; i++) {
+      double next = (r + x / r) / 2;
+      if (next >= r)
+         break;
+      r = next;
+   }
+   return r;
+}
+
+// Half width of the 95% confidence interval of the estimate of event i
+// for ir instructions, from the sums in samp.
+static ULong samp_ci(const SampleCC* samp, Int i, ULong ir)
+{
+   const SampleEv* ev = &samp->ev[i];
+   double          n  = samp_windows;
+   double          r, var;
+
+   if (samp_windows < 2 || samp->y == 0)
+      return 0;
+   r   = ev->x / samp->y;
+   var = (ev->xx - 2 * r * ev->xy + r * r * samp->yy) * n
+         / ((n - 1) * samp->y * samp->y);
+   if (var <= 0)
+      return 0;
+   return (ULong)(1.96 * ir * cg_sqrt(var) + 0.5);
+}
+
+// Replaces the counts of the events that are not exact by their
+// estimates.  The lines not executed in any window get 0.
+static void samp_finish(void)
+{
+   LineCC* lineCC;
+   Int     i;
+
+   if (samp_phase == SampWindow)
+      samp_end_window();
+
+   VG_(OSetGen_ResetIter)(CC_table);
+   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+      SampleCC* samp = lineCC->samp;
+
+      for (i = 0; i < n_out_events; i++) {
+         if (out_events[i].exact)
+            continue;
+         EVENT_COUNT(lineCC, i) = samp->y == 0 ? 0
+            : (ULong)(samp->ev[i].x / samp->y * lineCC->Ir.a + 0.5);
+         samp->ev[i].ci = samp_ci(samp, i, lineCC->Ir.a);
+      }
+   }
+}
+
+// The Ir count of a line executed in no window.
+static ULong samp_unsampled(const LineCC* lineCC)
+{
+   return lineCC->samp->y == 0 ? lineCC->Ir.a : 0;
+}
+
 /*------------------------------------------------------------*/
 /*--- cg_fini() and related function                       ---*/
 /*------------------------------------------------------------*/
@@ -1368,8 +1958,10 @@ static cache_t clo_LL_cache = UNDEFINED_CACHE;
 static CacheCC  Ir_total;
 static CacheCC  Dr_total;
 static CacheCC  Dw_total;
+static ExtCC    X_total;
 static BranchCC Bc_total;
 static BranchCC Bi_total;
+static ULong    Iu_total;
 
 static void fprint_CC_table_and_calc_totals(void)
 {
@@ -1378,6 +1970,10 @@ static void fprint_CC_table_and_calc_totals(void)
    HChar   *currFile = NULL;
    const HChar *currFn = NULL;
    LineCC* lineCC;
+   LineCC  total;
+
+   if (clo_sampling)
+      samp_finish();
 
    // Setup output filename.  Nb: it's important to do this now, ie. as late
    // as possible.  If we do it at start-up and the program forks and the
@@ -1407,6 +2003,18 @@ static void fprint_CC_table_and_calc_totals(void)
                      "desc: D1 cache:         %s\n"
                      "desc: LL cache:         %s\n",
                      I1.desc_line, D1.desc_line, LL.desc_line);
+   if (clo_tlb_sim)
+      VG_(fprintf)(fp,  "desc: iTLB:             %s\n"
+                        "desc: dTLB:             %s\n"
+                        "desc: STLB:             %s\n",
+                        ITLB.desc_line, DTLB.desc_line, STLB.desc_line);
+   if (clo_prefetch)
+      VG_(fprintf)(fp,  "desc: Prefetchers:      D1 stride, LL stream,"
+                        " degree %d\n", clo_prefetch_degree);
+   if (clo_sampling)
+      VG_(fprintf)(fp,  "desc: Sampling:         %d windows of %lld blocks,"
+                        " every %lld blocks\n",
+                        samp_windows, clo_sample_window, clo_sample_period);
 
    // "cmd:" line
    VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
@@ -1414,21 +2022,21 @@ static void fprint_CC_table_and_calc_totals(void)
       HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
       VG_(fprintf)(fp, " %s", arg);
    }
-   // "events:" line
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "Bc Bcm Bi Bim\n");
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "\n");
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir Bc Bcm Bi Bim\n");
-   }
-   else {
-      VG_(fprintf)(fp, "\nevents: Ir\n");
+   // "events:" line.  With --sampling, the events are followed by the half
+   // widths of the confidence intervals of the estimated ones, and by the
+   // unsampled Ir.
+   VG_(fprintf)(fp, "\nevents: Ir");
+   for (i = 0; i < n_out_events; i++)
+      VG_(fprintf)(fp, " %s", out_events[i].name);
+   if (clo_sampling) {
+      for (i = 0; i < n_out_events; i++)
+         if (!out_events[i].exact)
+            VG_(fprintf)(fp, " %sci", out_events[i].name);
+      VG_(fprintf)(fp, " Iu");
    }
+   VG_(fprintf)(fp, "\n");
+
+   VG_(memset)(&total, 0, sizeof(LineCC));
 
    // Traverse every lineCC
    VG_(OSetGen_ResetIter)(CC_table);
@@ -1456,95 +2064,45 @@ static void fprint_CC_table_and_calc_totals(void)
       }
 
       // Print the LineCC
-      if (clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL,
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else if (clo_cache_sim && !clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL);
-      }
-      else if (!clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, 
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else {
-         VG_(fprintf)(fp,  "%d %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a);
+      VG_(fprintf)(fp, "%d %llu", lineCC->loc.line, lineCC->Ir.a);
+      for (i = 0; i < n_out_events; i++)
+         VG_(fprintf)(fp, " %llu", EVENT_COUNT(lineCC, i));
+      if (clo_sampling) {
+         for (i = 0; i < n_out_events; i++)
+            if (!out_events[i].exact)
+               VG_(fprintf)(fp, " %llu", lineCC->samp->ev[i].ci);
+         VG_(fprintf)(fp, " %llu", samp_unsampled(lineCC));
+         Iu_total += samp_unsampled(lineCC);
       }
+      VG_(fprintf)(fp, "\n");
 
       // Update summary stats
-      Ir_total.a  += lineCC->Ir.a;
-      Ir_total.m1 += lineCC->Ir.m1;
-      Ir_total.mL += lineCC->Ir.mL;
-      Dr_total.a  += lineCC->Dr.a;
-      Dr_total.m1 += lineCC->Dr.m1;
-      Dr_total.mL += lineCC->Dr.mL;
-      Dw_total.a  += lineCC->Dw.a;
-      Dw_total.m1 += lineCC->Dw.m1;
-      Dw_total.mL += lineCC->Dw.mL;
-      Bc_total.b  += lineCC->Bc.b;
-      Bc_total.mp += lineCC->Bc.mp;
-      Bi_total.b  += lineCC->Bi.b;
-      Bi_total.mp += lineCC->Bi.mp;
+      total.Ir.a += lineCC->Ir.a;
+      for (i = 0; i < n_out_events; i++)
+         EVENT_COUNT(&total, i) += EVENT_COUNT(lineCC, i);
 
       distinct_lines++;
    }
 
+   Ir_total = total.Ir;
+   Dr_total = total.Dr;
+   Dw_total = total.Dw;
+   X_total  = total.X;
+   Bc_total = total.Bc;
+   Bi_total = total.Bi;
+
    // Summary stats must come after rest of table, since we calculate them
    // during traversal.  */
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu\n",
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL);
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else {
-      VG_(fprintf)(fp, "summary:"
-                        " %llu\n", 
-                        Ir_total.a);
+   VG_(fprintf)(fp, "summary: %llu", Ir_total.a);
+   for (i = 0; i < n_out_events; i++)
+      VG_(fprintf)(fp, " %llu", EVENT_COUNT(&total, i));
+   if (clo_sampling) {
+      for (i = 0; i < n_out_events; i++)
+         if (!out_events[i].exact)
+            VG_(fprintf)(fp, " %llu", samp_ci(samp_total, i, Ir_total.a));
+      VG_(fprintf)(fp, " %llu", Iu_total);
    }
+   VG_(fprintf)(fp, "\n");
 
    VG_(fclose)(fp);
 }
@@ -1590,6 +2148,16 @@ static void cg_fini(Int exitcode)
    /* Always print this */
    VG_(umsg)(fmt, "I   refs:     ", Ir_total.a);
 
+   /* With --sampling, the miss counts are estimates */
+   if (clo_sampling) {
+      VG_(umsg)("Sampled:      %*d windows, %.2f%% of I refs\n", l1,
+                samp_windows, Ir_total.a == 0 ? 0.0
+                              : samp_total->y * 100.0 / Ir_total.a);
+      VG_(umsg)("Unsampled:    %*.2f%% of I refs, in lines executed in"
+                " no window\n", l1, Ir_total.a == 0 ? 0.0
+                                    : Iu_total * 100.0 / Ir_total.a);
+   }
+
    /* If cache profiling is enabled, show D access numbers and all
       miss numbers */
    if (clo_cache_sim) {
@@ -1651,6 +2219,32 @@ static void cg_fini(Int exitcode)
                 l1, LL_total_m  * 100.0 / (Ir_total.a + D_total.a),
                 l2, LL_total_mr * 100.0 / (Ir_total.a + Dr_total.a),
                 l3, LL_total_mw * 100.0 / Dw_total.a);
+
+      /* Coherence results, if several cores were simulated */
+      if (clo_cores > 1) {
+         VG_(sprintf)(fmt, "%%s %%,%dllu\n", l1);
+         VG_(umsg)("\n");
+         VG_(umsg)(fmt, "Coh misses:   ", X_total.cm);
+         VG_(umsg)(fmt, "False sharing:", X_total.fs);
+      }
+
+      /* TLB results */
+      if (clo_tlb_sim) {
+         VG_(sprintf)(fmt, "%%s %%,%dllu\n", l1);
+         VG_(umsg)("\n");
+         VG_(umsg)(fmt, "I TLB misses: ", X_total.itm);
+         VG_(umsg)(fmt, "I page walks: ", X_total.itw);
+         VG_(umsg)(fmt, "D TLB misses: ", X_total.dtm);
+         VG_(umsg)(fmt, "D page walks: ", X_total.dtw);
+      }
+
+      /* Prefetcher results */
+      if (clo_prefetch) {
+         VG_(sprintf)(fmt, "%%s %%,%dllu\n", l1);
+         VG_(umsg)("\n");
+         VG_(umsg)(fmt, "D1  prefetch: ", X_total.pf1);
+         VG_(umsg)(fmt, "LL  prefetch: ", X_total.pfL);
+      }
    }
 
    /* If branch profiling is enabled, show branch overall results. */
@@ -1705,6 +2299,9 @@ static void cg_fini(Int exitcode)
                 VG_(OSetGen_Size)(CC_table));
       VG_(dmsg)("cachegrind: InstrInfo table size: %u\n",
                 VG_(OSetGen_Size)(instrInfoTable));
+      if (clo_cores > 1)
+         VG_(dmsg)("cachegrind: D1 invalidations: %llu\n",
+                   coher_invalidations);
    }
 }
 
@@ -1749,6 +2346,18 @@ static Bool cg_process_cmd_line_option(const HChar* arg)
    else if VG_STR_CLO( arg, "--cachegrind-out-file", clo_cachegrind_out_file) {}
    else if VG_BOOL_CLO(arg, "--cache-sim",  clo_cache_sim)  {}
    else if VG_BOOL_CLO(arg, "--branch-sim", clo_branch_sim) {}
+   else if VG_BINT_CLO(arg, "--cores",      clo_cores, 1, MAX_CORES) {}
+   else if VG_BOOL_CLO(arg, "--tlb-sim",    clo_tlb_sim)    {}
+   else if VG_BOOL_CLO(arg, "--tlb-hugepages", clo_tlb_hugepages) {}
+   else if VG_BOOL_CLO(arg, "--prefetch",   clo_prefetch)   {}
+   else if VG_BINT_CLO(arg, "--prefetch-degree", clo_prefetch_degree, 1, 16) {}
+   else if VG_BOOL_CLO(arg, "--sampling",   clo_sampling)   {}
+   else if VG_BINT_CLO(arg, "--sample-period", clo_sample_period,
+                       1, 1000000000000LL) {}
+   else if VG_BINT_CLO(arg, "--sample-warmup", clo_sample_warmup,
+                       0, 1000000000000LL) {}
+   else if VG_BINT_CLO(arg, "--sample-window", clo_sample_window,
+                       1, 1000000000000LL) {}
    else
       return False;
 
@@ -1761,6 +2370,25 @@ static void cg_print_usage(void)
    VG_(printf)(
 "    --cache-sim=yes|no               collect cache stats? [yes]\n"
 "    --branch-sim=yes|no              collect branch prediction stats? [no]\n"
+"    --cores=<number>                 simulate <number> cores, each with its\n"
+"                                     own I1 and D1 caches [1]\n"
+"    --tlb-sim=yes|no                 simulate iTLB, dTLB and second level\n"
+"                                     TLB? [no]\n"
+"    --tlb-hugepages=yes|no           assume 2M pages for anonymous memory\n"
+"                                     in the TLB simulation? [no]\n"
+"    --prefetch=yes|no                simulate stride (D1) and stream (LL)\n"
+"                                     hardware prefetchers? [no]\n"
+"    --prefetch-degree=<number>       lines prefetched ahead [2]\n"
+"    --sampling=yes|no                only simulate sampling windows, and\n"
+"                                     estimate the counts from them? [no]\n"
+"    --sample-period=<number>         blocks from one window to the next\n"
+"                                     [10000000]\n"
+"    --sample-warmup=<number>         blocks simulated, not counted, before\n"
+"                                     each window [200000]\n"
+"    --sample-window=<number>         blocks simulated in a window [100000]\n"
+"                                     (phases only change when a thread\n"
+"                                     starts a time slice, so each one can\n"
+"                                     last up to 100000 blocks longer)\n"
 "    --cachegrind-out-file=<file>     output file name [cachegrind.out.%%p]\n"
    );
 }
@@ -1778,6 +2406,16 @@ static void cg_print_debug_usage(void)
 
 static void cg_post_clo_init(void); /* just below */
 
+/* Threads are assigned to the simulated cores round-robin, by
+   thread id.  With --sampling, this is where the phases change. */
+static void cg_start_client_code(ThreadId tid, ULong blocks_dispatched)
+{
+   if (clo_cores > 1)
+      cachesim_set_core((tid - 1) % clo_cores);
+   if (clo_sampling && blocks_dispatched >= samp_next)
+      samp_next_phase(blocks_dispatched);
+}
+
 static void cg_pre_clo_init(void)
 {
    VG_(details_name)            ("Cachegrind");
@@ -1797,6 +2435,7 @@ static void cg_pre_clo_init(void)
                                    cg_fini);
 
    VG_(needs_superblock_discards)(cg_discard_superblock_info);
+   VG_(track_start_client_code)  (cg_start_client_code);
    VG_(needs_command_line_options)(cg_process_cmd_line_option,
                                    cg_print_usage,
                                    cg_print_debug_usage);
@@ -1847,7 +2486,29 @@ static void cg_post_clo_init(void)
       VG_(exit)(1);
    }
 
-   cachesim_initcaches(I1c, D1c, LLc);
+   if (!clo_cache_sim) {
+      clo_cores    = 1;
+      clo_tlb_sim  = False;
+      clo_prefetch = False;
+   }
+   cachesim_initcaches(I1c, D1c, LLc, clo_cores);
+   if (clo_tlb_sim)
+      cachesim_inittlbs(clo_tlb_hugepages);
+   if (clo_prefetch)
+      cachesim_initprefetch(clo_prefetch_degree);
+   ext_I_sim = clo_tlb_sim || clo_prefetch;
+   ext_D_sim = ext_I_sim || clo_cores > 1;
+
+   init_out_events();
+   if (clo_sampling) {
+      if (clo_sample_period <= clo_sample_warmup + clo_sample_window)
+         VG_(fmsg_bad_option)("--sample-period",
+            "The sampling period must be larger than the warm-up and "
+            "the window together.\n");
+      samp_total = new_SampleCC();
+      samp_fast  = True;
+      samp_next  = clo_sample_period - clo_sample_warmup - clo_sample_window;
+   }
 }
 
 VG_DETERMINE_INTERFACE_VERSION(cg_pre_clo_init)
@@ -34,8 +34,33 @@
       - both blocks hit                  --> one hit
       - one block hits, the other misses --> one miss
       - both blocks miss                 --> one miss (not two)
+  - with more than one simulated core (--cores), each core has its own
+    I1 and D1, and the LL is shared.  A write invalidates the copies of
+    the line held by the D1 of the other cores (as for a MESI protocol,
+    but only invalidations are modelled).
+  - with --tlb-sim, each instruction/data reference also looks up its
+    page in a first level iTLB/dTLB, then in a shared second level TLB.
+    Every TLB level holds 4K and 2M pages in separate arrays.  A
+    reference straddling two pages counts as two TLB references.
+  - with --prefetch, a stride prefetcher (one entry per load/store
+    instruction) fills D1, and a stream prefetcher, trained on LL
+    misses, fills LL.  Neither crosses a 4K page.  Prefetches are not
+    counted as accesses, only as prefetched lines.
+  - the TLBs and prefetchers are not replicated per simulated core.
 */
 
+/* Counts of the optional models, kept per source line. */
+typedef struct {
+   ULong cm;   /* D1 misses due to a write of another core (--cores) */
+   ULong fs;   /* those of them due to false sharing */
+   ULong itm;  /* first level iTLB misses (--tlb-sim) */
+   ULong itw;  /* page walks for instruction reads */
+   ULong dtm;  /* first level dTLB misses */
+   ULong dtw;  /* page walks for data references */
+   ULong pf1;  /* lines prefetched into D1 (--prefetch) */
+   ULong pfL;  /* lines prefetched into LL */
+} ExtCC;
+
 typedef struct {
    Int          size;                   /* bytes */
    Int          assoc;
@@ -119,6 +144,48 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
    return True;
 }
 
+/* Same as cachesim_setref_is_miss, but a missing tag is not installed. */
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_setref_is_hit(cache_t2* c, UInt set_no, UWord tag)
+{
+   Int    i, j;
+   UWord* set = &(c->tags[set_no * c->assoc]);
+
+   for (i = 0; i < c->assoc; i++) {
+      if (tag == set[i]) {
+         for (j = i; j > 0; j--)
+            set[j] = set[j - 1];
+         set[0] = tag;
+         return True;
+      }
+   }
+   return False;
+}
+
+/* Install a tag known to be missing as MRU, evicting the LRU one. */
+static void cachesim_setref_fill(cache_t2* c, UInt set_no, UWord tag)
+{
+   Int    j;
+   UWord* set = &(c->tags[set_no * c->assoc]);
+
+   for (j = c->assoc - 1; j > 0; j--)
+      set[j] = set[j - 1];
+   set[0] = tag;
+}
+
+/* Is tag in the set?  The LRU order is left unchanged. */
+static Bool cachesim_set_has(const cache_t2* c, UInt set_no, UWord tag)
+{
+   Int          i;
+   const UWord* set = &(c->tags[set_no * c->assoc]);
+
+   for (i = 0; i < c->assoc; i++)
+      if (tag == set[i])
+         return True;
+   return False;
+}
+
 __attribute__((always_inline))
 static __inline__
 Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
@@ -165,11 +232,484 @@ static cache_t2 LL;
 static cache_t2 I1;
 static cache_t2 D1;
 
-static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
+/* I1 and D1 always simulate the caches of the core the current thread
+ * runs on:  their tags are switched when another core is selected.
+ */
+#define MAX_CORES 32
+
+static Int    n_cores = 1;
+static Int    current_core;
+static UInt   cores_used = 1;      /* bit i set if core i ever ran */
+static UWord* I1_core_tags[MAX_CORES];
+static UWord* D1_core_tags[MAX_CORES];
+
+/* Tag of a D1 entry invalidated by another core.  Never matches a block
+ * number, and the invalidated entry is moved to the LRU spot, so that
+ * it is the next one to be replaced.
+ */
+#define INVALID_TAG (~(UWord)0)
+
+/* Lines of which the copy held by some cores was invalidated by a write
+ * of another core, and not read back since.  This tells coherence misses
+ * from other misses.  written has a bit set for each part of the line
+ * (of line_size/64 bytes, at least one) written since.  A coherence miss
+ * on parts that have not been written is due to false sharing.
+ */
+typedef struct _CoherNode {
+   struct _CoherNode* next;
+   UWord              block;       /* key */
+   UInt               invalid_in;  /* bit i set if core i lost its copy */
+   ULong              written;
+} CoherNode;
+
+static VgHashTable* coher_table;
+static Int          coher_granule_bits;
+static ULong        coher_invalidations;
+
+static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc,
+                                Int cores)
 {
+   Int i;
+
    cachesim_initcache(I1c, &I1);
    cachesim_initcache(D1c, &D1);
    cachesim_initcache(LLc, &LL);
+
+   tl_assert(cores >= 1 && cores <= MAX_CORES);
+   n_cores = cores;
+   I1_core_tags[0] = I1.tags;
+   D1_core_tags[0] = D1.tags;
+   for (i = 1; i < n_cores; i++) {
+      cachesim_initcache(I1c, &I1);
+      cachesim_initcache(D1c, &D1);
+      I1_core_tags[i] = I1.tags;
+      D1_core_tags[i] = D1.tags;
+   }
+   I1.tags = I1_core_tags[0];
+   D1.tags = D1_core_tags[0];
+
+   if (n_cores > 1) {
+      coher_table = VG_(HT_construct)("cg.sim.cic.1");
+      coher_granule_bits = D1.line_size_bits > 6 ? D1.line_size_bits - 6 : 0;
+   }
+}
+
+/* Simulate the caches of core from now on. */
+static void cachesim_set_core(Int core)
+{
+   tl_assert(core >= 0 && core < n_cores);
+   current_core = core;
+   cores_used |= 1U << core;
+   I1.tags = I1_core_tags[core];
+   D1.tags = D1_core_tags[core];
+}
+
+/* Bits of the parts of block written or read by an access of size bytes
+ * at a, for CoherNode.written.
+ */
+static ULong cachesim_coher_mask(UWord block, Addr a, UChar size)
+{
+   Addr  start = block << D1.line_size_bits;
+   Addr  lo    = a < start ? start : a;
+   Addr  hi    = a + size - 1;
+   UInt  first, last;
+
+   if (hi >= start + D1.line_size)
+      hi = start + D1.line_size - 1;
+   first = (lo - start) >> coher_granule_bits;
+   last  = (hi - start) >> coher_granule_bits;
+   if (last == 63)
+      return ~0ULL << first;
+   return (~0ULL << first) & ((2ULL << last) - 1);
+}
+
+/* Invalidate the copies of block held by the D1 of the other cores. */
+static void cachesim_invalidate_others(UWord block, ULong mask)
+{
+   UInt       set_no = block & D1.sets_min_1;
+   UInt       lost = 0;
+   CoherNode* n;
+   Int        core, i;
+
+   for (core = 0; core < n_cores; core++) {
+      UWord* set;
+
+      if (core == current_core || !(cores_used & (1U << core)))
+         continue;
+      set = &D1_core_tags[core][set_no * D1.assoc];
+      for (i = 0; i < D1.assoc; i++) {
+         if (set[i] == block) {
+            for (; i < D1.assoc - 1; i++)
+               set[i] = set[i + 1];
+            set[D1.assoc - 1] = INVALID_TAG;
+            lost |= 1U << core;
+            coher_invalidations++;
+            break;
+         }
+      }
+   }
+
+   n = VG_(HT_lookup)(coher_table, block);
+   if (lost && !n) {
+      n = VG_(malloc)("cg.sim.cio.1", sizeof(CoherNode));
+      n->block      = block;
+      n->invalid_in = 0;
+      n->written    = 0;
+      VG_(HT_add_node)(coher_table, n);
+   }
+   if (n) {
+      n->invalid_in |= lost;
+      n->written    |= mask;
+   }
+}
+
+/* The current core gets block back into its D1.  Returns whether it had
+ * lost its copy to a write of another core, and then sets *fs if that
+ * write was not to the parts of the line in mask.
+ */
+static Bool cachesim_coher_reload(UWord block, ULong mask, Bool* fs)
+{
+   CoherNode* n = VG_(HT_lookup)(coher_table, block);
+
+   if (!n || !(n->invalid_in & (1U << current_core)))
+      return False;
+   *fs = !(n->written & mask);
+   n->invalid_in &= ~(1U << current_core);
+   if (!n->invalid_in) {
+      VG_(HT_remove)(coher_table, block);
+      VG_(free)(n);
+   }
+   return True;
+}
+
+/* Reference to block by the current core.  Returns whether it misses
+ * in D1, and counts coherence and false sharing misses.
+ */
+static Bool cachesim_D1_blockref_mc(UWord block, Addr a, UChar size,
+                                    Bool is_write, ExtCC* x)
+{
+   ULong mask = cachesim_coher_mask(block, a, size);
+   Bool  miss = cachesim_setref_is_miss(&D1, block & D1.sets_min_1, block);
+   Bool  fs;
+
+   if (miss && cachesim_coher_reload(block, mask, &fs)) {
+      x->cm++;
+      if (fs)
+         x->fs++;
+   }
+   if (is_write)
+      cachesim_invalidate_others(block, mask);
+
+   return miss;
+}
+
+/* TLBs.  Each level has one array per page size, looked up in turn. */
+#define PAGE_4K_BITS 12
+#define PAGE_2M_BITS 21
+
+typedef struct {
+   cache_t2 p4K;
+   cache_t2 p2M;
+   HChar    desc_line[128];
+} tlb_t;
+
+static Bool  tlb_sim;
+static Bool  tlb_hugepages;
+static tlb_t ITLB;
+static tlb_t DTLB;
+static tlb_t STLB;
+
+static void cachesim_inittlbarray(cache_t2* c, Int entries, Int assoc,
+                                  Int page_bits)
+{
+   Int i;
+
+   c->size           = entries;
+   c->assoc          = assoc;
+   c->line_size      = 1 << page_bits;
+   c->sets           = entries / assoc;
+   c->sets_min_1     = c->sets - 1;
+   c->line_size_bits = page_bits;
+   c->tag_shift      = page_bits + VG_(log2)(c->sets);
+
+   if (c->sets == 1)
+      VG_(sprintf)(c->desc_line, "%d entries, fully associative", entries);
+   else
+      VG_(sprintf)(c->desc_line, "%d entries, %d-way", entries, assoc);
+
+   c->tags = VG_(malloc)("cg.sim.cita.1", sizeof(UWord) * entries);
+   for (i = 0; i < entries; i++)
+      c->tags[i] = 0;
+}
+
+static void cachesim_inittlb(tlb_t* t, Int entries4K, Int assoc4K,
+                             Int entries2M, Int assoc2M)
+{
+   cachesim_inittlbarray(&t->p4K, entries4K, assoc4K, PAGE_4K_BITS);
+   cachesim_inittlbarray(&t->p2M, entries2M, assoc2M, PAGE_2M_BITS);
+   VG_(sprintf)(t->desc_line, "4K: %s; 2M: %s",
+                t->p4K.desc_line, t->p2M.desc_line);
+}
+
+/* The geometries are those of recent x86 cores. */
+static void cachesim_inittlbs(Bool hugepages)
+{
+   tlb_sim       = True;
+   tlb_hugepages = hugepages;
+   cachesim_inittlb(&ITLB,  128,  8,    8, 8);
+   cachesim_inittlb(&DTLB,   64,  4,   32, 4);
+   cachesim_inittlb(&STLB, 1536, 12, 1024, 8);
+}
+
+/* Looks up the page of a in t.  Returns the page size bits of the
+ * entry found, or 0 if none.
+ */
+static Int cachesim_tlb_lookup(tlb_t* t, Addr a)
+{
+   UWord p4K = a >> PAGE_4K_BITS;
+   UWord p2M = a >> PAGE_2M_BITS;
+
+   if (cachesim_setref_is_hit(&t->p4K, p4K & t->p4K.sets_min_1, p4K))
+      return PAGE_4K_BITS;
+   if (cachesim_setref_is_hit(&t->p2M, p2M & t->p2M.sets_min_1, p2M))
+      return PAGE_2M_BITS;
+   return 0;
+}
+
+static void cachesim_tlb_fill(tlb_t* t, Addr a, Int page_bits)
+{
+   cache_t2* c    = page_bits == PAGE_2M_BITS ? &t->p2M : &t->p4K;
+   UWord     page = a >> page_bits;
+
+   cachesim_setref_fill(c, page & c->sets_min_1, page);
+}
+
+/* Size of the page mapping a, as found by a page walk.  With
+ * --tlb-hugepages=yes, anonymous client memory is assumed to be backed
+ * by 2M pages wherever an aligned 2M region fits in the mapping, as
+ * done by transparent huge pages.
+ */
+static Int cachesim_page_bits(Addr a)
+{
+   const NSegment* seg;
+   Addr            base = a & ~(((Addr)1 << PAGE_2M_BITS) - 1);
+
+   if (!tlb_hugepages)
+      return PAGE_4K_BITS;
+   seg = VG_(am_find_nsegment)(a);
+   if (seg && seg->kind == SkAnonC
+       && seg->start <= base
+       && base + ((Addr)1 << PAGE_2M_BITS) - 1 <= seg->end)
+      return PAGE_2M_BITS;
+   return PAGE_4K_BITS;
+}
+
+static void cachesim_tlb_pageref(tlb_t* t, Addr a, ULong* tm, ULong* tw)
+{
+   Int page_bits;
+
+   if (cachesim_tlb_lookup(t, a))
+      return;
+   (*tm)++;
+   page_bits = cachesim_tlb_lookup(&STLB, a);
+   if (!page_bits) {
+      (*tw)++;
+      page_bits = cachesim_page_bits(a);
+      cachesim_tlb_fill(&STLB, a, page_bits);
+   }
+   cachesim_tlb_fill(t, a, page_bits);
+}
+
+static void cachesim_tlb_doref(tlb_t* t, Addr a, UChar size,
+                               ULong* tm, ULong* tw)
+{
+   cachesim_tlb_pageref(t, a, tm, tw);
+   if ((a >> PAGE_4K_BITS) != ((a + size - 1) >> PAGE_4K_BITS))
+      cachesim_tlb_pageref(t, a + size - 1, tm, tw);
+}
+
+/* Prefetchers.  The stride prefetcher has one entry per load/store
+ * instruction (up to collisions), which prefetches the next
+ * prefetch_degree strides into D1 once the same stride was seen twice
+ * in a row.  The stream prefetcher detects LL misses to consecutive
+ * lines, and then prefetches the next prefetch_degree lines of the
+ * stream into LL.
+ */
+#define N_STRIDE_ENTRIES 256
+#define N_STREAMS        16
+
+typedef struct {
+   Addr pc;
+   Addr last;
+   Word stride;
+   Int  conf;
+} StrideEntry;
+
+typedef struct {
+   UWord last;   /* last block covered */
+   Word  dir;    /* +1 or -1, 0 if not yet known */
+} Stream;
+
+static Bool        prefetch_sim;
+static Int         prefetch_degree;
+static StrideEntry stride_table[N_STRIDE_ENTRIES];
+static Stream      streams[N_STREAMS];
+static Int         next_stream;
+
+static void cachesim_initprefetch(Int degree)
+{
+   prefetch_sim    = True;
+   prefetch_degree = degree;
+}
+
+/* Prefetch block of LL.  Returns whether it was missing. */
+static Bool cachesim_LL_prefetch(UWord block)
+{
+   UInt set = block & LL.sets_min_1;
+
+   if (cachesim_set_has(&LL, set, block))
+      return False;
+   cachesim_setref_fill(&LL, set, block);
+   return True;
+}
+
+static void cachesim_LL_stream(UWord block, ExtCC* x)
+{
+   Stream* s = NULL;
+   UWord   page = block >> (PAGE_4K_BITS - LL.line_size_bits);
+   Int     i, k;
+
+   for (i = 0; i < N_STREAMS; i++) {
+      Stream* t = &streams[i];
+      if (t->dir != 0 ? block == t->last + t->dir
+                      : block == t->last + 1 || block == t->last - 1) {
+         s = t;
+         break;
+      }
+   }
+   if (!s) {
+      s = &streams[next_stream];
+      next_stream = (next_stream + 1) % N_STREAMS;
+      s->last = block;
+      s->dir  = 0;
+      return;
+   }
+
+   s->dir  = block - s->last;
+   s->last = block;
+   for (k = 1; k <= prefetch_degree; k++) {
+      UWord b = block + k * s->dir;
+      if (b >> (PAGE_4K_BITS - LL.line_size_bits) != page)
+         break;
+      if (cachesim_LL_prefetch(b))
+         x->pfL++;
+      s->last = b;
+   }
+}
+
+/* Prefetch block of D1, and so of LL. */
+static void cachesim_D1_prefetch(UWord block, ExtCC* x)
+{
+   UInt set = block & D1.sets_min_1;
+   Bool fs;
+
+   if (cachesim_set_has(&D1, set, block))
+      return;
+   cachesim_setref_fill(&D1, set, block);
+   x->pf1++;
+   if (n_cores > 1)
+      cachesim_coher_reload(block, 0, &fs);
+   cachesim_ref_is_miss(&LL, block << D1.line_size_bits, 1);
+}
+
+static void cachesim_D1_stride(Addr pc, Addr a, ExtCC* x)
+{
+   StrideEntry* e = &stride_table[(pc ^ (pc >> 8)) % N_STRIDE_ENTRIES];
+   Word         stride = a - e->last;
+   UWord        block = a >> D1.line_size_bits;
+   Int          k;
+
+   if (e->pc != pc) {
+      e->pc     = pc;
+      e->last   = a;
+      e->stride = 0;
+      e->conf   = 0;
+      return;
+   }
+   e->last = a;
+   if (stride != e->stride) {
+      e->stride = stride;
+      e->conf   = 0;
+      return;
+   }
+   if (e->conf < 2)
+      e->conf++;
+   if (e->conf < 2 || stride == 0)
+      return;
+
+   for (k = 1; k <= prefetch_degree; k++) {
+      Addr  t = a + k * stride;
+      UWord b = t >> D1.line_size_bits;
+      if ((t >> PAGE_4K_BITS) != (a >> PAGE_4K_BITS))
+         break;
+      if (b != block) {
+         cachesim_D1_prefetch(b, x);
+         block = b;
+      }
+   }
+}
+
+/* References when simulating several cores, TLBs or prefetchers. */
+static void cachesim_LL_doref_ext(Addr a, UChar size, ULong* mL, ExtCC* x)
+{
+   if (cachesim_ref_is_miss(&LL, a, size)) {
+      (*mL)++;
+      if (prefetch_sim)
+         cachesim_LL_stream(a >> LL.line_size_bits, x);
+   }
+}
+
+static void cachesim_I1_doref_ext(Addr a, UChar size,
+                                  ULong* m1, ULong* mL, ExtCC* x)
+{
+   if (tlb_sim)
+      cachesim_tlb_doref(&ITLB, a, size, &x->itm, &x->itw);
+   if (cachesim_ref_is_miss(&I1, a, size)) {
+      (*m1)++;
+      cachesim_LL_doref_ext(a, size, mL, x);
+   }
+}
+
+/* Data reference by the instruction at pc.  A write invalidates the
+ * copies of the other cores.
+ */
+static void cachesim_D1_doref_ext(Addr pc, Addr a, UChar size, Bool is_write,
+                                  ULong* m1, ULong* mL, ExtCC* x)
+{
+   Bool miss;
+
+   if (tlb_sim)
+      cachesim_tlb_doref(&DTLB, a, size, &x->dtm, &x->dtw);
+
+   if (n_cores > 1) {
+      UWord block1 =  a         >> D1.line_size_bits;
+      UWord block2 = (a+size-1) >> D1.line_size_bits;
+
+      /* always do both, as state is updated as side effect */
+      miss = cachesim_D1_blockref_mc(block1, a, size, is_write, x);
+      if (block2 != block1)
+         miss = cachesim_D1_blockref_mc(block2, a, size, is_write, x)
+                || miss;
+   } else {
+      miss = cachesim_ref_is_miss(&D1, a, size);
+   }
+
+   if (miss) {
+      (*m1)++;
+      cachesim_LL_doref_ext(a, size, mL, x);
+   }
+   if (prefetch_sim)
+      cachesim_D1_stride(pc, a, x);
 }
 
 __attribute__((always_inline))
@@ -212,6 +752,14 @@ void cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL)
    }
 }
 
+/* Number of the I1 cache line containing a. Called at instrumentation
+ * time to find instruction reads that are sure to hit in I1.
+ */
+static UWord cachesim_I1_line(Addr a)
+{
+   return a >> I1.line_size_bits;
+}
+
 /* Check for special case IrNoX. Called at instrumentation time.
  *
  * Does this Ir only touch one cache line, and are L1I/LL cache
@@ -0,0 +1,60 @@
+/* Two threads that take turns to update their own counter, in the same
+   cache line as the other thread's counter (false sharing), and a turn
+   variable in a line of its own (true sharing).  Each line is only
+   accessed by the lines of worker marked below, so that with --cores=2
+   each of them has exactly one coherence miss per handoff of the turn,
+   that is 2 * ROUNDS - 1 misses. */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define ROUNDS 1000
+#define LINE   64
+
+static struct {
+   volatile int    turn;
+   char            pad[LINE - sizeof(int)];
+} turn __attribute__((aligned(LINE))) = { 1 };
+
+static struct {
+   int             count[2];
+   char            pad[LINE - 2 * sizeof(int)];
+} counts __attribute__((aligned(LINE)));
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond  = PTHREAD_COND_INITIALIZER;
+
+static void* worker(void* arg)
+{
+   int me = *(int*)arg;
+   int i;
+
+   for (i = 0; i < ROUNDS; i++) {
+      pthread_mutex_lock(&mutex);
+      while (turn.turn != me)           /* true sharing */
+         pthread_cond_wait(&cond, &mutex);
+      pthread_mutex_unlock(&mutex);
+      counts.count[me]++;               /* false sharing */
+      pthread_mutex_lock(&mutex);
+      turn.turn = 1 - me;
+      pthread_cond_signal(&cond);
+      pthread_mutex_unlock(&mutex);
+   }
+   return NULL;
+}
+
+int main(void)
+{
+   pthread_t thread;
+   int       ids[2] = { 0, 1 };
+
+   /* Get both lines in the first core, so that the first writes of the
+      other thread invalidate them. */
+   if (turn.turn + counts.count[0] != 1)
+      return 1;
+   pthread_create(&thread, NULL, worker, &ids[1]);
+   worker(&ids[0]);
+   pthread_join(thread, NULL);
+   printf("%d %d\n", counts.count[0], counts.count[1]);
+   return 0;
+}
@@ -0,0 +1,26 @@
+/* Reads and writes random bytes of a buffer twice as large as the D1
+   cache used by the sampling test.  The number of misses of each
+   sampling window varies around the same mean all along the run, as
+   the sampled simulation assumes. */
+
+#include <stdio.h>
+
+#define SIZE  (64 * 1024)
+#define ITERS 4000000
+
+static unsigned char buf[SIZE];
+
+int main(void)
+{
+   unsigned x = 1;
+   long     sum = 0;
+   int      i;
+
+   for (i = 0; i < ITERS; i++) {
+      x = x * 1103515245 + 12345;
+      sum += buf[(x >> 8) % SIZE];
+      buf[(x >> 12) % SIZE] = i;
+   }
+   printf("%s\n", sum != 0 ? "done" : "zero");
+   return 0;
+}
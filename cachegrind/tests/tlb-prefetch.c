@@ -0,0 +1,33 @@
+/* Walks twice through an array larger than the reach of the second
+   level TLB, with a constant stride of one cache line.  The array is
+   aligned on 2M, so that it spans exactly SIZE / 4K pages of 4K, or
+   SIZE / 2M pages of 2M with --tlb-hugepages=yes. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#define SIZE   (16 * 1024 * 1024)
+#define ALIGN  (2 * 1024 * 1024)
+#define STRIDE 64
+
+int main(void)
+{
+   char* m = mmap(NULL, SIZE + ALIGN, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   char* a;
+   long  sum = 0;
+   int   i, r;
+
+   if (m == MAP_FAILED)
+      return 1;
+   a = (char*)(((uintptr_t)m + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1));
+   for (r = 0; r < 2; r++)
+      for (i = 0; i < SIZE; i += STRIDE) {
+         a[i] = i;
+         sum += a[i];
+      }
+   printf("%s\n", sum != 0 ? "done" : "zero");
+   munmap(m, SIZE + ALIGN);
+   return 0;
+}
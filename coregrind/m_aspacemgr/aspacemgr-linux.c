@@ -2750,6 +2750,45 @@ void* VG_(am_shadow_alloc)(SizeT size)
    return sr_isError(sres) ? NULL : (void*)(Addr)sr_Res(sres);
 }
 
+/* Like VG_(am_shadow_alloc), but the returned area is aligned to
+   'align' (a power of two multiple of the page size), and on Linux the
+   kernel is asked to back it with transparent huge pages.  The over-
+   allocated head and tail are given back, so the segment array ends up
+   holding exactly one segment of 'size' bytes.  The madvise is only a
+   hint: if the kernel does not support THP the area is still usable. */
+
+void* VG_(am_shadow_alloc_aligned)(SizeT size, SizeT align)
+{
+   SysRes sres;
+   Addr   base, aligned, end;
+
+   aspacem_assert(align >= VKI_PAGE_SIZE);
+   aspacem_assert((align & (align - 1)) == 0);
+   aspacem_assert(VG_IS_PAGE_ALIGNED(size));
+
+   sres = VG_(am_mmap_anon_float_valgrind)( size + align );
+   if (sr_isError(sres))
+      return NULL;
+
+   base    = sr_Res(sres);
+   aligned = VG_ROUNDUP(base, align);
+   end     = base + size + align;
+   if (aligned > base) {
+      sres = VG_(am_munmap_valgrind)( base, aligned - base );
+      aspacem_assert(!sr_isError(sres));
+   }
+   if (end > aligned + size) {
+      sres = VG_(am_munmap_valgrind)( aligned + size,
+                                      end - (aligned + size) );
+      aspacem_assert(!sr_isError(sres));
+   }
+
+#  if defined(VGO_linux)
+   (void)VG_(do_syscall3)(__NR_madvise, aligned, size, VKI_MADV_HUGEPAGE);
+#  endif
+   return (void*)aligned;
+}
+
 /* Map a file at an unconstrained address for V, and update the
    segment array accordingly. Use the provided flags */
 
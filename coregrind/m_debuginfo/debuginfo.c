@@ -57,6 +57,7 @@
 #include "priv_tytypes.h"
 #include "priv_storage.h"
 #include "priv_readdwarf.h"
+#include "priv_dicache.h"
 #if defined(VGO_linux) || defined(VGO_solaris) || defined(VGO_freebsd)
 # include "priv_readelf.h"
 # include "priv_readdwarf3.h"
@@ -107,6 +108,7 @@
 /*------------------------------------------------------------*/
 
 static void caches__invalidate (void);
+static void addr_caches__invalidate (void);
 
 
 /*------------------------------------------------------------*/
@@ -327,6 +329,18 @@ DebugInfo* alloc_DebugInfo( const HChar* filename )
 }
 
 
+/* Read di's line number, inline and variable info, if its reading
+   was deferred.  Must be called before looking at any of these. */
+static inline void read_deferred_dinfo ( DebugInfo* di )
+{
+#  if defined(VGO_linux) || defined(VGO_solaris) || defined(VGO_freebsd)
+   if (UNLIKELY(di->deferred != NULL))
+      ML_(read_elf_deferred_debug_info)(di);
+#  else
+   vg_assert(di->deferred == NULL);
+#  endif
+}
+
 /* Free a DebugInfo, and also all the stuff hanging off it. */
 static void free_DebugInfo ( DebugInfo* di )
 {
@@ -335,6 +349,12 @@ static void free_DebugInfo ( DebugInfo* di )
    GExpr* gexpr;
 
    vg_assert(di != NULL);
+#  if defined(VGO_linux) || defined(VGO_solaris) || defined(VGO_freebsd)
+   if (di->deferred)     ML_(free_elf_deferred_debug_info)(di);
+#  endif
+   if (di->cache_name)   ML_(dinfo_free)(di->cache_name);
+   if (di->cache_avma)   VG_(am_munmap_valgrind)(di->cache_avma,
+                                                 di->cache_szB);
    if (di->fsm.maps)     VG_(deleteXA)(di->fsm.maps);
    if (di->fsm.filename) ML_(dinfo_free)(di->fsm.filename);
    if (di->fsm.dbgname)  ML_(dinfo_free)(di->fsm.dbgname);
@@ -344,6 +364,7 @@ static void free_DebugInfo ( DebugInfo* di )
    if (di->inltab)       ML_(dinfo_free)(di->inltab);
    if (di->cfsi_base)    ML_(dinfo_free)(di->cfsi_base);
    if (di->cfsi_m_ix)    ML_(dinfo_free)(di->cfsi_m_ix);
+   if (di->cfsi_dir)     ML_(dinfo_free)(di->cfsi_dir);
    if (di->cfsi_rd)      ML_(dinfo_free)(di->cfsi_rd);
    if (di->cfsi_m_pool)  VG_(deleteDedupPA)(di->cfsi_m_pool);
    if (di->cfsi_exprs)   VG_(deleteXA)(di->cfsi_exprs);
@@ -479,6 +500,8 @@ static void discard_or_archive_DebugInfo ( DebugInfo* di )
          } else {
             free_DebugInfo(curr);
          }
+         /* The address index and loc cache may refer to it. */
+         addr_caches__invalidate();
          return;
       }
       prev_next_ptr = &curr->next;
@@ -782,7 +805,9 @@ static void check_CFSI_related_invariants ( const DebugInfo* di )
             vg_assert(cfsip->base + cfsip->len <= cfsi->base);
          }
       }
-   } else {
+   } else if (di->cache_avma == 0) {
+      /* (Tables loaded from the debuginfo cache are already in their
+         final form: these were checked when they were saved.) */
       vg_assert(di->cfsi_used == 0);
       vg_assert(di->cfsi_size == 0);
    }
@@ -979,13 +1004,19 @@ static ULong di_notify_ACHIEVE_ACCEPT_STATE ( struct _DebugInfo* di )
                    "acquired info ------\n");
       /* invalidate the debug info caches. */
       caches__invalidate();
-      /* prepare read data for use */
-      ML_(canonicaliseTables)( di );
+      /* prepare read data for use, unless it was loaded ready for
+         use from the debuginfo cache */
+      if (di->cache_avma == 0)
+         ML_(canonicaliseTables)( di );
       /* Check invariants listed in
          Comment_on_IMPORTANT_REPRESENTATIONAL_INVARIANTS in
          priv_storage.h. */
       check_CFSI_related_invariants(di);
-      ML_(finish_CFSI_arrays)(di);
+      if (di->cache_avma == 0)
+         ML_(finish_CFSI_arrays)(di);
+      /* and save it in the debuginfo cache, if wanted */
+      if (di->cache_name)
+         ML_(dicache_save)(di);
 
       // Mark di's first epoch point as a valid epoch.  Because its
       // last_epoch value is still invalid, this changes di's state from
@@ -993,6 +1024,7 @@ static ULong di_notify_ACHIEVE_ACCEPT_STATE ( struct _DebugInfo* di )
       vg_assert(is_DebugInfo_allocated(di));
       di->first_epoch = VG_(current_DiEpoch)();
       vg_assert(is_DebugInfo_active(di));
+      addr_caches__invalidate();
       show_epochs("di_notify_ACHIEVE_ACCEPT_STATE success");
 
       /* notify m_redir about it */
@@ -2025,6 +2057,193 @@ void VG_(delete_IIPC)(InlIPCursor *iipc)
 /*--- plausible-looking stack dumps.                       ---*/
 /*------------------------------------------------------------*/
 
+/* Searching the symtab or loctab of a code address first has to find
+   the DebugInfo containing it.  Walking debugInfo_list does that in
+   time linear in the number of loaded objects, with a cache miss or
+   two per object.  So the r-x mappings of the active DebugInfos are
+   indexed by a sorted array, laid out in Eytzinger (breadth-first)
+   order: the top levels of the implicit search tree are shared by
+   all searches and so stay in the data cache.
+
+   The index is rebuilt on the first search after it is invalidated.
+   It only describes the active DebugInfos, so it can only answer for
+   epochs after the last epoch of every archived DebugInfo.  It is
+   not used at all if the indexed mappings overlap.  In these cases,
+   debugInfo_list is searched as before. */
+
+typedef
+   struct {
+      Addr       lo;   // first address of the r-x mapping
+      Addr       hi;   // last address of the r-x mapping
+      DebugInfo* di;
+   }
+   DiIndexEnt;
+
+/* Entries [1 .. di_index_used], in Eytzinger order. */
+static DiIndexEnt* di_index           = NULL;
+static UWord       di_index_used      = 0;
+static UWord       di_index_size      = 0;
+static Bool        di_index_valid     = False;
+static Bool        di_index_usable    = False;
+/* The index can only answer for epochs >= di_index_min_epoch. */
+static UInt        di_index_min_epoch = 1;
+
+/* Stats */
+static ULong stats__di_index_searches  = 0;
+static ULong stats__di_index_fallbacks = 0;
+static UWord stats__di_index_builds    = 0;
+
+static Int cmp_DiIndexEnt ( const void* v1, const void* v2 )
+{
+   const DiIndexEnt* e1 = v1;
+   const DiIndexEnt* e2 = v2;
+   if (e1->lo < e2->lo) return -1;
+   if (e1->lo > e2->lo) return 1;
+   return 0;
+}
+
+/* Copy the sorted entries, from *next onwards, to the subtree of
+   di_index rooted at k. */
+static void di_index__fill ( const DiIndexEnt* sorted, UWord* next, UWord k )
+{
+   if (k > di_index_used)
+      return;
+   di_index__fill(sorted, next, 2*k);
+   di_index[k] = sorted[(*next)++];
+   di_index__fill(sorted, next, 2*k+1);
+}
+
+static void di_index__build ( void )
+{
+   DebugInfo*  di;
+   DiIndexEnt* sorted;
+   UWord       n = 0, i;
+
+   stats__di_index_builds++;
+   di_index_valid     = True;
+   di_index_usable    = True;
+   di_index_min_epoch = 1;
+
+   for (di = debugInfo_list; di != NULL; di = di->next) {
+      if (is_DebugInfo_archived(di)) {
+         if (di->last_epoch.n + 1 > di_index_min_epoch)
+            di_index_min_epoch = di->last_epoch.n + 1;
+         continue;
+      }
+      if (!is_DebugInfo_active(di) || !di->fsm.have_rx_map)
+         continue;
+      for (i = 0; i < VG_(sizeXA)(di->fsm.maps); i++) {
+         const DebugInfoMapping* map = VG_(indexXA)(di->fsm.maps, i);
+         if (map->rx && map->size > 0)
+            n++;
+      }
+   }
+
+   if (n + 1 > di_index_size) {
+      ML_(dinfo_free)(di_index);
+      di_index_size = n + 1 + n / 2;
+      di_index = ML_(dinfo_zalloc)("di.debuginfo.dib.1",
+                                   di_index_size * sizeof(DiIndexEnt));
+   }
+   di_index_used = n;
+   if (n == 0)
+      return;
+
+   sorted = ML_(dinfo_zalloc)("di.debuginfo.dib.2", n * sizeof(DiIndexEnt));
+   n = 0;
+   for (di = debugInfo_list; di != NULL; di = di->next) {
+      if (!is_DebugInfo_active(di) || !di->fsm.have_rx_map)
+         continue;
+      for (i = 0; i < VG_(sizeXA)(di->fsm.maps); i++) {
+         const DebugInfoMapping* map = VG_(indexXA)(di->fsm.maps, i);
+         if (map->rx && map->size > 0) {
+            sorted[n].lo = map->avma;
+            sorted[n].hi = map->avma + map->size - 1;
+            sorted[n].di = di;
+            n++;
+         }
+      }
+   }
+   vg_assert(n == di_index_used);
+   VG_(ssort)(sorted, n, sizeof(DiIndexEnt), cmp_DiIndexEnt);
+   for (i = 1; i < n; i++) {
+      if (sorted[i].lo <= sorted[i-1].hi) {
+         di_index_usable = False;
+         break;
+      }
+   }
+
+   i = 0;
+   di_index__fill(sorted, &i, 1);
+   vg_assert(i == n);
+   ML_(dinfo_free)(sorted);
+}
+
+/* Find the DebugInfo valid in epoch ep having an r-x mapping that
+   contains a.  Sets *usable to False, and returns NULL, if the index
+   cannot tell: the caller must then search debugInfo_list. */
+static DebugInfo* di_index__find ( DiEpoch ep, Addr a, /*OUT*/Bool* usable )
+{
+   UWord k;
+
+   if (UNLIKELY(!di_index_valid))
+      di_index__build();
+   if (UNLIKELY(!di_index_usable || ep.n < di_index_min_epoch)) {
+      stats__di_index_fallbacks++;
+      *usable = False;
+      return NULL;
+   }
+   stats__di_index_searches++;
+   *usable = True;
+
+   /* Descend the tree, going right when the entry starts at or before
+      a.  The entry wanted is then the last one where we went right,
+      which is found by dropping the trailing left steps (zero bits)
+      and the right step itself. */
+   k = 1;
+   while (k <= di_index_used)
+      k = 2*k + (di_index[k].lo <= a ? 1 : 0);
+   while ((k & 1) == 0)
+      k >>= 1;
+   k >>= 1;
+
+   if (k == 0 || a > di_index[k].hi
+       || !is_DI_valid_for_epoch(di_index[k].di, ep))
+      return NULL;
+   return di_index[k].di;
+}
+
+/* Caching of the loctab entries found for code addresses.  Errors,
+   XTrees and profile dumps look up the same addresses over and over
+   again. */
+// Prime number, giving about 64Kbytes cache on 32 bits,
+//                          128Kbytes cache on 64 bits.
+#define N_LOC_CACHE 4093
+
+typedef
+   struct {
+      // (epoch, avma) are the hash table key.  An epoch of 0 (never
+      // valid) marks an unused entry.
+      Addr       avma;
+      UInt       epoch;
+      // Fields below here are not part of the key.
+      DebugInfo* di;     // NULL if no loctab entry contains avma
+      Word       locno;
+   }
+   Loc_CacheEnt;
+
+static Loc_CacheEnt loc_cache[N_LOC_CACHE];
+
+/* Stats */
+static ULong stats__loc_cache_queries = 0;
+static ULong stats__loc_cache_misses  = 0;
+
+/* Called whenever the set of DebugInfos, or their epochs, change. */
+static void addr_caches__invalidate ( void ) {
+   di_index_valid = False;
+   VG_(memset)(&loc_cache, 0, sizeof(loc_cache));
+}
+
 /* Search all symtabs that we know about to locate ptr.  If found, set
    *pdi to the relevant DebugInfo, and *symno to the symtab entry
    *number within that.  If not found, *psi is set to NULL.
@@ -2039,6 +2258,23 @@ static void search_all_symtabs ( DiEpoch ep, Addr ptr,
    DebugInfo* di;
    Bool       inRange;
 
+   if (findText) {
+      Bool usable;
+      di = di_index__find(ep, ptr, &usable);
+      if (usable) {
+         /* Same range check as in the loop below. */
+         if (di == NULL
+             || !di->fsm.have_rx_map
+             || ML_(find_rx_mapping)(di, ptr, ptr) == NULL)
+            goto not_found;
+         sno = ML_(search_one_symtab) ( di, ptr, findText );
+         if (sno == -1) goto not_found;
+         *symno = sno;
+         *pdi = di;
+         return;
+      }
+   }
+
    for (di = debugInfo_list; di != NULL; di = di->next) {
 
       if (!is_DI_valid_for_epoch(di, ep))
@@ -2094,29 +2330,62 @@ static void search_all_symtabs ( DiEpoch ep, Addr ptr,
 /* Search all loctabs that we know about to locate ptr at epoch ep.  If
    *found, set pdi to the relevant DebugInfo, and *locno to the loctab entry
    *number within that.  If not found, *pdi is set to NULL. */
-static void search_all_loctabs ( DiEpoch ep, Addr ptr,
-                                 /*OUT*/DebugInfo** pdi, /*OUT*/Word* locno )
+static void search_all_loctabs_uncached ( DiEpoch ep, Addr ptr,
+                                          /*OUT*/DebugInfo** pdi,
+                                          /*OUT*/Word* locno )
 {
    Word       lno;
    DebugInfo* di;
-   for (di = debugInfo_list; di != NULL; di = di->next) {
-      if (!is_DI_valid_for_epoch(di, ep))
-         continue;
-      if (di->text_present
-          && di->text_size > 0
-          && di->text_avma <= ptr 
-          && ptr < di->text_avma + di->text_size) {
-         lno = ML_(search_one_loctab) ( di, ptr );
-         if (lno == -1) goto not_found;
-         *locno = lno;
-         *pdi = di;
-         return;
+   Bool       usable;
+
+   di = di_index__find(ep, ptr, &usable);
+   if (!usable) {
+      for (di = debugInfo_list; di != NULL; di = di->next) {
+         if (!is_DI_valid_for_epoch(di, ep))
+            continue;
+         if (di->text_present
+             && di->text_size > 0
+             && di->text_avma <= ptr 
+             && ptr < di->text_avma + di->text_size)
+            break;
       }
    }
+   if (di != NULL
+       && di->text_present
+       && di->text_size > 0
+       && di->text_avma <= ptr 
+       && ptr < di->text_avma + di->text_size) {
+      read_deferred_dinfo(di);
+      lno = ML_(search_one_loctab) ( di, ptr );
+      if (lno == -1) goto not_found;
+      *locno = lno;
+      *pdi = di;
+      return;
+   }
   not_found:
    *pdi = NULL;
 }
 
+static void search_all_loctabs ( DiEpoch ep, Addr ptr,
+                                 /*OUT*/DebugInfo** pdi, /*OUT*/Word* locno )
+{
+   vg_assert(!is_DiEpoch_INVALID(ep));
+   UWord hash = ptr ^ (UWord)(ep.n ^ ROL32(ep.n, 5)
+                                   ^ ROL32(ep.n, 13) ^ ROL32(ep.n, 19));
+   Loc_CacheEnt* le = &loc_cache[hash % N_LOC_CACHE];
+
+   stats__loc_cache_queries++;
+   if (UNLIKELY(le->epoch != ep.n || le->avma != ptr)) {
+      stats__loc_cache_misses++;
+      search_all_loctabs_uncached(ep, ptr, &le->di, &le->locno);
+      le->epoch = ep.n;
+      le->avma  = ptr;
+   }
+   *pdi = le->di;
+   if (le->di != NULL)
+      *locno = le->locno;
+}
+
 /* Caching of queries to symbol names. */
 // Prime number, giving about 6Kbytes cache on 32 bits,
 //                           12Kbytes cache on 64 bits.
@@ -2506,6 +2775,17 @@ DebugInfo* VG_(find_DebugInfo) ( DiEpoch ep, Addr a )
 {
    static UWord n_search = 0;
    DebugInfo* di;
+   Bool usable;
+   di = di_index__find(ep, a, &usable);
+   if (usable) {
+      if (di != NULL
+          && di->text_present
+          && di->text_size > 0
+          && di->text_avma <= a
+          && a < di->text_avma + di->text_size)
+         return di;
+      return NULL;
+   }
    n_search++;
    for (di = debugInfo_list; di != NULL; di = di->next) {
       if (!is_DI_valid_for_epoch(di, ep))
@@ -3139,60 +3419,143 @@ static void find_DiCfSI ( /*OUT*/DebugInfo** diP,
    di is (DebugInfo*)1           ==>  cache slot in use, no associated di
    di is NULL                    ==>  cache slot not in use
 
-   Hence simply zeroing out the entire cache invalidates all
-   entries.
+   Hence simply zeroing out a cache invalidates all its entries.
 
    We can map an ip value directly to a (di, cfsi_m*) pair as
    once a DebugInfo is read, adding new DiCfSI_m* is not possible
    anymore, as the cfsi_m_pool is frozen once the reading is terminated.
-   Also, the cache is invalidated when new debuginfo is read due to
-   an mmap or some debuginfo is discarded due to an munmap. */
+   Also, the caches are invalidated when new debuginfo is read due to
+   an mmap or some debuginfo is discarded due to an munmap.
 
-// Prime number, giving about 6Kbytes cache on 32 bits,
-//                           12Kbytes cache on 64 bits.
-#define N_CFSI_M_CACHE 509
+   Each thread has its own cache (the threads of a program usually
+   run different code), allocated when it first unwinds a stack.  A
+   cache is VG_(clo_cfi_cache_size) entries, organised in sets of
+   N_CFSI_M_CACHE_WAYS entries kept in LRU order, so that return
+   addresses which happen to hash to the same set don't keep evicting
+   each other.  Invalidating all the caches just bumps
+   cfsi_m_cache_gen; a cache is zeroed out when it is next used. */
+
+#define N_CFSI_M_CACHE_WAYS 4
 
 typedef
    struct { Addr ip; DebugInfo* di; DiCfSI_m* cfsi_m; }
    CFSI_m_CacheEnt;
 
-static CFSI_m_CacheEnt cfsi_m_cache[N_CFSI_M_CACHE];
+typedef
+   struct {
+      UWord            gen;   /* entries are valid if == cfsi_m_cache_gen */
+      CFSI_m_CacheEnt* ents;  /* cfsi_m_cache_n_sets * N_CFSI_M_CACHE_WAYS */
+   }
+   CFSI_m_Cache;
+
+/* Indexed by ThreadId, allocated at the first lookup.  Entry 0
+   (VG_INVALID_THREADID) is used when no thread is running. */
+static CFSI_m_Cache* cfsi_m_caches       = NULL;
+static UInt          cfsi_m_caches_n     = 0;
+static UWord         cfsi_m_cache_n_sets = 0;
+static UWord         cfsi_m_cache_gen    = 1;
+
+/* Stats */
+static ULong stats__cfsi_m_cache_queries = 0;
+static ULong stats__cfsi_m_cache_misses  = 0;
+static UWord stats__cfsi_m_caches_used   = 0;
 
 static void cfsi_m_cache__invalidate ( void ) {
-   VG_(memset)(&cfsi_m_cache, 0, sizeof(cfsi_m_cache));
+   cfsi_m_cache_gen++;
 }
 
-static inline CFSI_m_CacheEnt* cfsi_m_cache__find ( Addr ip )
+static CFSI_m_Cache* cfsi_m_cache__get ( void )
 {
-   UWord         hash = ip % N_CFSI_M_CACHE;
-   CFSI_m_CacheEnt* ce = &cfsi_m_cache[hash];
-#  ifdef N_Q_M_STATS
-   static UWord  n_q = 0, n_m = 0;
-   n_q++;
-   if (0 == (n_q & 0x1FFFFF))
-      VG_(printf)("QQQ %lu %lu\n", n_q, n_m);
-#  endif
+   ThreadId      tid = VG_(get_running_tid)();
+   CFSI_m_Cache* cache;
+
+   if (UNLIKELY(cfsi_m_caches == NULL)) {
+      /* VG_N_THREADS is 0 if we unwind Valgrind's own stack before
+         the scheduler is initialised. */
+      cfsi_m_caches_n = VG_N_THREADS > 0 ? VG_N_THREADS : 1;
+      cfsi_m_cache_n_sets = VG_(clo_cfi_cache_size) / N_CFSI_M_CACHE_WAYS;
+      vg_assert(cfsi_m_cache_n_sets > 0);
+      cfsi_m_caches = ML_(dinfo_zalloc)("di.debuginfo.cmcg.1",
+                                        cfsi_m_caches_n
+                                        * sizeof(CFSI_m_Cache));
+   }
+   if (UNLIKELY(tid >= cfsi_m_caches_n))
+      tid = VG_INVALID_THREADID;
+   cache = &cfsi_m_caches[tid];
+
+   if (UNLIKELY(cache->gen != cfsi_m_cache_gen)) {
+      SizeT szB = cfsi_m_cache_n_sets * N_CFSI_M_CACHE_WAYS
+                  * sizeof(CFSI_m_CacheEnt);
+      if (cache->ents == NULL) {
+         cache->ents = ML_(dinfo_zalloc)("di.debuginfo.cmcg.2", szB);
+         stats__cfsi_m_caches_used++;
+      } else {
+         VG_(memset)(cache->ents, 0, szB);
+      }
+      cache->gen = cfsi_m_cache_gen;
+   }
+   return cache;
+}
 
-   if (LIKELY(ce->ip == ip) && LIKELY(ce->di != NULL)) {
+static inline CFSI_m_CacheEnt* cfsi_m_cache__find ( Addr ip )
+{
+   CFSI_m_Cache*    cache = cfsi_m_cache__get();
+   CFSI_m_CacheEnt* set
+      = &cache->ents[(ip % cfsi_m_cache_n_sets) * N_CFSI_M_CACHE_WAYS];
+   CFSI_m_CacheEnt  ent;
+   UInt             w;
+
+   stats__cfsi_m_cache_queries++;
+   if (LIKELY(set[0].ip == ip) && LIKELY(set[0].di != NULL)) {
       /* found an entry in the cache .. */
    } else {
-      /* not found in cache.  Search and update. */
-#     ifdef N_Q_M_STATS
-      n_m++;
-#     endif
-      ce->ip = ip;
-      find_DiCfSI( &ce->di, &ce->cfsi_m, ip );
+      for (w = 1; w < N_CFSI_M_CACHE_WAYS; w++)
+         if (set[w].ip == ip && set[w].di != NULL)
+            break;
+      if (w < N_CFSI_M_CACHE_WAYS) {
+         /* .. in another way: move it to the front. */
+         ent = set[w];
+      } else {
+         /* not found in cache.  Search, and evict the LRU entry. */
+         stats__cfsi_m_cache_misses++;
+         w = N_CFSI_M_CACHE_WAYS - 1;
+         ent.ip = ip;
+         find_DiCfSI( &ent.di, &ent.cfsi_m, ip );
+      }
+      for (; w > 0; w--)
+         set[w] = set[w-1];
+      set[0] = ent;
    }
 
-   if (UNLIKELY(ce->di == (DebugInfo*)1)) {
+   if (UNLIKELY(set[0].di == (DebugInfo*)1)) {
       /* no DiCfSI for this address */
       return NULL;
    } else {
       /* found a DiCfSI for this address */
-      return ce;
+      return &set[0];
    }
 }
 
+void VG_(print_debuginfo_stats) ( void )
+{
+   VG_(dmsg)(
+      "debuginfo: %'llu CFI cache queries, %'llu misses, "
+      "%'lu thread caches of %u entries\n",
+      stats__cfsi_m_cache_queries, stats__cfsi_m_cache_misses,
+      stats__cfsi_m_caches_used, VG_(clo_cfi_cache_size)
+   );
+   VG_(dmsg)(
+      "debuginfo: %'llu address index searches, %'llu list searches, "
+      "%'lu index builds\n",
+      stats__di_index_searches, stats__di_index_fallbacks,
+      stats__di_index_builds
+   );
+   VG_(dmsg)(
+      "debuginfo: %'llu loc cache queries, %'llu misses\n",
+      stats__loc_cache_queries, stats__loc_cache_misses
+   );
+}
+
 Bool VG_(has_CF_info)(Addr a)
 {
    return cfsi_m_cache__find (a) != NULL;
@@ -3347,28 +3710,27 @@ Addr ML_(get_CFA) ( Addr ip, Addr sp, Addr fp,
 
 void VG_(ppUnwindInfo) (Addr from, Addr to)
 {
-   DebugInfo*         di;
-   CFSI_m_CacheEnt*   ce;
+   /* Copy the cache entries, as a lookup can move the entries of
+      its set. */
+   const CFSI_m_CacheEnt none = { 0, NULL, NULL };
+   CFSI_m_CacheEnt*   found;
+   CFSI_m_CacheEnt    ce, next_ce;
    Addr ce_from;
-   CFSI_m_CacheEnt*   next_ce;
-
 
-   ce = cfsi_m_cache__find(from);
+   found = cfsi_m_cache__find(from);
+   ce = found != NULL ? *found : none;
    ce_from = from;
    while (from <= to) {
       from++;
-      next_ce = cfsi_m_cache__find(from);
-      if ((ce == NULL && next_ce != NULL)
-          || (ce != NULL && next_ce == NULL)
-          || (ce != NULL && next_ce != NULL && ce->cfsi_m != next_ce->cfsi_m)
-          || from > to) {
-         if (ce == NULL) {
+      found = cfsi_m_cache__find(from);
+      next_ce = found != NULL ? *found : none;
+      if (ce.cfsi_m != next_ce.cfsi_m || from > to) {
+         if (ce.cfsi_m == NULL) {
             VG_(printf)("[%#lx .. %#lx]: no CFI info\n", ce_from, from-1);
          } else {
-            di = ce->di;
-            ML_(ppDiCfSI)(di->cfsi_exprs,
+            ML_(ppDiCfSI)(ce.di->cfsi_exprs,
                           ce_from, from - ce_from,
-                          ce->cfsi_m);
+                          ce.cfsi_m);
          }
          ce = next_ce;
          ce_from = from;
@@ -4153,6 +4515,7 @@ Bool consider_vars_in_frame ( /*MOD*/XArray* /* of HChar */ dname1,
    }
    /* End of performance-enhancing hack. */
 
+   read_deferred_dinfo(di);
    /* any var info at all? */
    if (!di->varinfo)
       return False;
@@ -4271,6 +4634,7 @@ Bool VG_(get_data_description)(
       /* text segment missing? unlikely, but handle it .. */
       if (!di->text_present || di->text_size == 0)
          continue;
+      read_deferred_dinfo(di);
       /* any var info at all? */
       if (!di->varinfo)
          continue;
@@ -4597,6 +4961,7 @@ VG_(di_get_stack_blocks_at_ip)( Addr ip, Bool arrays_only )
    }
    /* End of performance-enhancing hack. */
 
+   read_deferred_dinfo(di);
    /* any var info at all? */
    if (!di->varinfo)
       return res; /* currently empty */
@@ -4689,6 +5054,7 @@ VG_(di_get_global_blocks_from_dihandle) ( ULong di_handle, Bool  arrays_only )
    gvars = VG_(newXA)( ML_(dinfo_zalloc), "di.debuginfo.dggbfd.1",
                        ML_(dinfo_free), sizeof(GlobalBlock) );
 
+   read_deferred_dinfo(di);
    /* any var info at all? */
    if (!di->varinfo)
       return gvars;
@@ -5019,6 +5385,7 @@ UInt VG_(debuginfo_generation) (void)
 static void caches__invalidate ( void ) {
    cfsi_m_cache__invalidate();
    sym_name_cache__invalidate();
+   addr_caches__invalidate();
    debuginfo_generation++;
 }
 
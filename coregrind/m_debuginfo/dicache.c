@@ -0,0 +1,1087 @@
+/* -*- mode: C; c-basic-offset: 3; -*- */
+
+/*--------------------------------------------------------------------*/
+/*--- Persistent cache of canonicalised debug info.                ---*/
+/*---                                                    dicache.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* A cache entry is a file holding a header followed by sections, each
+   an array of fixed size records aligned on 8 bytes.  The tables are
+   stored in their canonical form, with the addresses they had when
+   saved: a later run relocates them by the difference between the
+   new and the saved text avmas, after checking that all segments of
+   the object moved by that same difference.  Pointers to strings are
+   replaced by offsets in the strings section, which is used in place
+   in the mapped file, and so shared between processes.
+
+   The layout of the records is the one of the Valgrind build writing
+   them, so the entry records the Valgrind version and platform, and
+   is ignored by any other build.  An entry is written to a temporary
+   file which is renamed once complete, so that processes running
+   concurrently never see a partially written entry.  The temporary
+   file is created exclusively, so that whatever was left there, e.g.
+   by a crashed process having had the same pid, is removed rather
+   than followed or written through.
+
+   An entry is validated before use as if it came from an untrusted
+   source: all offsets and indices it holds, including those of the
+   CFI expressions, must be within their sections.
+
+   After saving an entry, the oldest entries are removed if the
+   cache directory holds more than --debuginfo-cache-size MB of
+   entries. */
+
+#include "pub_core_basics.h"
+#include "pub_core_vki.h"
+#include "pub_core_debuginfo.h"    /* SymAVMAs */
+#include "pub_core_libcbase.h"
+#include "pub_core_libcassert.h"
+#include "pub_core_libcprint.h"
+#include "pub_core_libcfile.h"
+#include "pub_core_libcproc.h"     /* VG_(getpid) */
+#include "pub_core_syscall.h"       /* VG_(do_syscall2) */
+#include "pub_core_vkiscnums.h"     /* __NR_kill */
+#include "pub_core_aspacemgr.h"
+#include "pub_core_options.h"
+#include "pub_core_xarray.h"
+#include "priv_misc.h"             /* dinfo_zalloc/free/strdup */
+#include "priv_storage.h"
+#include "priv_dicache.h"          /* self */
+
+#define DICACHE_MAGIC   "VGDICACH"
+#define DICACHE_VERSION 1
+
+/* A string offset denoting the NULL string, or the end of a list of
+   secondary names. */
+#define DICACHE_NO_STR  0xFFFFFFFF
+
+/* The segments whose layout must be the same for the tables to be
+   reused, modulo a relocation. */
+enum { SEG_TEXT, SEG_DATA, SEG_SDATA, SEG_RODATA, SEG_BSS, SEG_SBSS,
+       N_SEGS };
+
+/* The sections following the header. */
+enum { SECT_STRS,          /* HChar: NUL terminated strings */
+       SECT_SYMS,          /* CSym */
+       SECT_SEC_NAMES,     /* UInt: lists of string offsets */
+       SECT_FNDNS,         /* CFnDn: di->fndnpool elements 1 .. n */
+       SECT_LOCS,          /* DiLoc */
+       SECT_LOC_FNDN_IX,   /* UChar: di->loctab_fndn_ix */
+       SECT_INLS,          /* CInlLoc */
+       SECT_CFSI_BASE,     /* Addr */
+       SECT_CFSI_M_IX,     /* UChar: di->cfsi_m_ix */
+       SECT_CFSI_MS,       /* DiCfSI_m: di->cfsi_m_pool elements 1 .. n */
+       SECT_CFSI_EXPRS,    /* CfiExpr */
+       N_SECTS };
+
+typedef
+   struct {
+      Bool  present;
+      Addr  svma;
+      Addr  avma;
+      SizeT size;
+   }
+   CSeg;
+
+typedef
+   struct {
+      ULong off;   /* file offset of the first record */
+      ULong n;     /* number of records */
+   }
+   CSect;
+
+typedef
+   struct {
+      HChar magic[8];        /* DICACHE_MAGIC, written last */
+      UInt  version;         /* DICACHE_VERSION */
+      UInt  szB_hdr;         /* sizeof(CHdr) */
+      HChar vg_version[32];  /* VERSION of the writer */
+      HChar platform[32];    /* VG_PLATFORM of the writer */
+      UInt  name;            /* string offset of the entry name */
+      UInt  sizeof_fndn_ix;
+      UInt  sizeof_cfsi_m_ix;
+      SizeT maxinl_codesz;
+      Addr  cfsi_minavma;
+      Addr  cfsi_maxavma;
+      CSeg  segs[N_SEGS];
+      CSect sects[N_SECTS];
+   }
+   CHdr;
+
+typedef
+   struct {
+      SymAVMAs avmas;
+      UInt     pri_name;   /* string offset */
+      UInt     sec_names;  /* index in SECT_SEC_NAMES, or DICACHE_NO_STR */
+      UInt     size;
+      Bool     isText;
+      Bool     isIFunc;
+      Bool     isGlobal;
+   }
+   CSym;
+
+typedef
+   struct {
+      UInt filename;   /* string offset */
+      UInt dirname;    /* string offset, or DICACHE_NO_STR */
+   }
+   CFnDn;
+
+typedef
+   struct {
+      Addr  addr_lo;
+      Addr  addr_hi;
+      UInt  inlinedfn; /* string offset */
+      UInt  fndn_ix;
+      UInt  lineno;
+      UInt  level;
+   }
+   CInlLoc;
+
+
+/*------------------------------------------------------------*/
+/*--- Helpers                                              ---*/
+/*------------------------------------------------------------*/
+
+Bool ML_(dicache_enabled) ( const struct _DebugInfo* di )
+{
+   return VG_(clo_debuginfo_cache) != NULL
+          && !VG_(clo_read_var_info)
+          && !di->trace_symtab && !di->trace_cfi
+          && !di->ddump_syms && !di->ddump_line && !di->ddump_frames
+          && di->text_present && di->text_size > 0;
+}
+
+void ML_(dicache_set_name) ( struct _DebugInfo* di,
+                             const HChar* buildid,
+                             Bool with_debug_file,
+                             Bool with_alt_file )
+{
+   /* The tables depend on what is read, so each combination gets its
+      own entry. */
+   UInt what = (with_debug_file ? 1 : 0) | (with_alt_file ? 2 : 0)
+               | (VG_(clo_read_inline_info) ? 4 : 0);
+
+   vg_assert(di->cache_name == NULL);
+   di->cache_name = ML_(dinfo_zalloc)("di.dicache.sn.1",
+                                      VG_(strlen)(buildid) + 3);
+   VG_(sprintf)(di->cache_name, "%s-%x", buildid, what);
+}
+
+static HChar* entry_path ( const HChar* name, Int pid )
+{
+   HChar* path = ML_(dinfo_zalloc)("di.dicache.ep.1",
+                                   VG_(strlen)(VG_(clo_debuginfo_cache))
+                                   + VG_(strlen)(name) + 32);
+   if (pid == 0)
+      VG_(sprintf)(path, "%s/%s.vgdi", VG_(clo_debuginfo_cache), name);
+   else
+      VG_(sprintf)(path, "%s/%s.vgdi.%d", VG_(clo_debuginfo_cache),
+                   name, pid);
+   return path;
+}
+
+static void get_segs ( const struct _DebugInfo* di,
+                       /*OUT*/CSeg segs[N_SEGS] )
+{
+#  define GET_SEG(_ix, _sec) \
+      segs[_ix].present = di->_sec##_present; \
+      segs[_ix].svma    = di->_sec##_present ? di->_sec##_svma : 0; \
+      segs[_ix].avma    = di->_sec##_present ? di->_sec##_avma : 0; \
+      segs[_ix].size    = di->_sec##_present ? di->_sec##_size : 0;
+   VG_(memset)(segs, 0, N_SEGS * sizeof(CSeg));
+   GET_SEG(SEG_TEXT,   text);
+   GET_SEG(SEG_DATA,   data);
+   GET_SEG(SEG_SDATA,  sdata);
+   GET_SEG(SEG_RODATA, rodata);
+   GET_SEG(SEG_BSS,    bss);
+   GET_SEG(SEG_SBSS,   sbss);
+#  undef GET_SEG
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Saving                                               ---*/
+/*------------------------------------------------------------*/
+
+#define WBUF_SZB 65536
+
+typedef
+   struct {
+      Int   fd;
+      Bool  ok;        /* no write failed so far */
+      ULong off;       /* file offset of buf[0] */
+      UInt  used;
+      UChar buf[WBUF_SZB];
+   }
+   Writer;
+
+typedef
+   struct {
+      const HChar* str;
+      UInt         off;
+   }
+   StrOff;
+
+static Int cmp_StrOff ( const void* v1, const void* v2 )
+{
+   const StrOff* s1 = v1;
+   const StrOff* s2 = v2;
+   if (s1->str < s2->str) return -1;
+   if (s1->str > s2->str) return 1;
+   return 0;
+}
+
+static void w_flush ( Writer* w )
+{
+   if (w->used > 0 && w->ok
+       && VG_(write)(w->fd, w->buf, w->used) != (Int)w->used)
+      w->ok = False;
+   w->off += w->used;
+   w->used = 0;
+}
+
+static void w_put ( Writer* w, const void* p, SizeT szB )
+{
+   const UChar* b = p;
+   while (szB > 0) {
+      SizeT n = WBUF_SZB - w->used;
+      if (n > szB) n = szB;
+      VG_(memcpy)(&w->buf[w->used], b, n);
+      w->used += n;
+      b += n;
+      szB -= n;
+      if (w->used == WBUF_SZB)
+         w_flush(w);
+   }
+}
+
+/* Start a section of n records: align it, and note where it is. */
+static void w_sect ( Writer* w, CHdr* hdr, UInt s, ULong n )
+{
+   static const UChar zeroes[8] = { 0 };
+   ULong here = w->off + w->used;
+   w_put(w, zeroes, VG_ROUNDUP(here, 8) - here);
+   hdr->sects[s].off = w->off + w->used;
+   hdr->sects[s].n   = n;
+}
+
+static void add_str ( XArray* strs, const HChar* str )
+{
+   StrOff so;
+   if (str == NULL)
+      return;
+   so.str = str;
+   so.off = DICACHE_NO_STR;
+   VG_(addToXA)(strs, &so);
+}
+
+static UInt str_off ( const XArray* strs, const HChar* str )
+{
+   StrOff key;
+   Word   first;
+   if (str == NULL)
+      return DICACHE_NO_STR;
+   key.str = str;
+   key.off = 0;
+   if (!VG_(lookupXA)(strs, &key, &first, NULL))
+      vg_assert(0);
+   return ((StrOff*)VG_(indexXA)(strs, first))->off;
+}
+
+typedef
+   struct {
+      HChar* path;
+      Long   szB;
+      ULong  mtime;
+   }
+   CEntry;
+
+static Int cmp_CEntry_by_mtime ( const void* v1, const void* v2 )
+{
+   const CEntry* e1 = v1;
+   const CEntry* e2 = v2;
+   if (e1->mtime < e2->mtime) return -1;
+   if (e1->mtime > e2->mtime) return 1;
+   return 0;
+}
+
+/* Is name the name of an entry, or of the temporary file of a process
+   saving an entry?  In the latter case, set *pid to its pid. */
+static Bool is_entry_name ( const HChar* name, /*OUT*/Int* pid )
+{
+   const HChar* suffix = VG_(strstr)(name, ".vgdi");
+   HChar*       end;
+   *pid = 0;
+   if (suffix == NULL || suffix == name)
+      return False;
+   suffix += 5;
+   if (*suffix == 0)
+      return True;
+   if (*suffix != '.')
+      return False;
+   *pid = VG_(strtoll10)(suffix + 1, &end);
+   return *pid > 0 && *end == 0;
+}
+
+/* If the cache directory holds more than --debuginfo-cache-size MB of
+   entries, remove the oldest ones, but not the entry just saved at
+   'saved'.  Entries used by other processes stay mapped by them.  The
+   temporary files of processes which no longer exist are removed
+   too. */
+static void trim_cache ( const HChar* saved )
+{
+#  if defined(VGO_linux) || defined(VGO_solaris)
+   const ULong limit = (ULong)VG_(clo_debuginfo_cache_size) * 1024 * 1024;
+   const SizeT dir_len = VG_(strlen)(VG_(clo_debuginfo_cache));
+   HChar   buf[4096] __attribute__((aligned(8)));
+   XArray* entries;
+   SysRes  sres, kres;
+   ULong   total = 0;
+   Int     ret, pid;
+   Word    i;
+
+   sres = VG_(open)(VG_(clo_debuginfo_cache), VKI_O_RDONLY, 0);
+   if (sr_isError(sres))
+      return;
+   entries = VG_(newXA)(ML_(dinfo_zalloc), "di.dicache.tc.1",
+                        ML_(dinfo_free), sizeof(CEntry));
+   while ((ret = VG_(getdents64)(sr_Res(sres), (struct vki_dirent64*)buf,
+                                 sizeof(buf))) > 0) {
+      Int off = 0;
+      while (off < ret) {
+         const struct vki_dirent64* d = (struct vki_dirent64*)(buf + off);
+         struct vg_stat stat_buf;
+         CEntry e;
+         off += d->d_reclen;
+         if (!is_entry_name(d->d_name, &pid))
+            continue;
+         e.path = ML_(dinfo_zalloc)("di.dicache.tc.2",
+                                    dir_len + VG_(strlen)(d->d_name) + 2);
+         VG_(sprintf)(e.path, "%s/%s", VG_(clo_debuginfo_cache), d->d_name);
+         if (pid != 0
+             && sr_isError(kres = VG_(do_syscall2)(__NR_kill, pid, 0))
+             && sr_Err(kres) == VKI_ESRCH) {
+            /* Left by a process which died while saving it. */
+            VG_(unlink)(e.path);
+            ML_(dinfo_free)(e.path);
+            continue;
+         }
+         if (pid != 0 || sr_isError(VG_(stat)(e.path, &stat_buf))) {
+            ML_(dinfo_free)(e.path);
+            continue;
+         }
+         e.szB   = stat_buf.size;
+         e.mtime = stat_buf.mtime;
+         total  += e.szB;
+         VG_(addToXA)(entries, &e);
+      }
+   }
+   VG_(close)(sr_Res(sres));
+
+   if (total > limit) {
+      VG_(setCmpFnXA)(entries, cmp_CEntry_by_mtime);
+      VG_(sortXA)(entries);
+   }
+   for (i = 0; i < VG_(sizeXA)(entries); i++) {
+      CEntry* e = VG_(indexXA)(entries, i);
+      if (total > limit && VG_(strcmp)(e->path, saved) != 0
+          && VG_(unlink)(e->path) == 0) {
+         if (VG_(clo_verbosity) > 1)
+            VG_(message)(Vg_DebugMsg,
+                         "Removed debuginfo cache entry %s\n", e->path);
+         total -= e->szB;
+      }
+      ML_(dinfo_free)(e->path);
+   }
+   VG_(deleteXA)(entries);
+#  endif
+}
+
+void ML_(dicache_save) ( struct _DebugInfo* di )
+{
+   Writer* w;
+   CHdr    hdr;
+   XArray* strs;
+   HChar*  path;
+   HChar*  tmp_path;
+   SysRes  sres;
+   UInt    n_fndns, n_cfsi_ms, n_sec_names, n_exprs, sec_ix;
+   ULong   strs_szB;
+   Word    i, n;
+
+   vg_assert(di->cache_name != NULL);
+   vg_assert(di->cfsi_rd == NULL);
+
+   path     = entry_path(di->cache_name, 0);
+   tmp_path = entry_path(di->cache_name, VG_(getpid)());
+   sres = VG_(open)(tmp_path, VKI_O_CREAT|VKI_O_EXCL|VKI_O_WRONLY,
+                    VKI_S_IRUSR|VKI_S_IWUSR|VKI_S_IRGRP|VKI_S_IROTH);
+   if (sr_isError(sres) && sr_Err(sres) == VKI_EEXIST
+       && VG_(unlink)(tmp_path) == 0)
+      sres = VG_(open)(tmp_path, VKI_O_CREAT|VKI_O_EXCL|VKI_O_WRONLY,
+                       VKI_S_IRUSR|VKI_S_IWUSR|VKI_S_IRGRP|VKI_S_IROTH);
+   if (sr_isError(sres)) {
+      if (VG_(clo_verbosity) > 1)
+         VG_(message)(Vg_DebugMsg, "Can't create debuginfo cache entry %s\n",
+                                   tmp_path);
+      goto out;
+   }
+
+   /* Give an offset to each distinct string. */
+   strs = VG_(newXA)(ML_(dinfo_zalloc), "di.dicache.save.1",
+                     ML_(dinfo_free), sizeof(StrOff));
+   VG_(setCmpFnXA)(strs, cmp_StrOff);
+   add_str(strs, di->cache_name);
+   n_sec_names = 0;
+   for (i = 0; i < di->symtab_used; i++) {
+      const DiSym* sym = &di->symtab[i];
+      add_str(strs, sym->pri_name);
+      if (sym->sec_names) {
+         const HChar** sec;
+         for (sec = sym->sec_names; *sec; sec++, n_sec_names++)
+            add_str(strs, *sec);
+         n_sec_names++;
+      }
+   }
+   n_fndns = di->fndnpool ? VG_(sizeDedupPA)(di->fndnpool) : 0;
+   for (i = 1; i <= n_fndns; i++) {
+      const FnDn* fndn = VG_(indexEltNumber)(di->fndnpool, i);
+      add_str(strs, fndn->filename);
+      add_str(strs, fndn->dirname);
+   }
+   for (i = 0; i < di->inltab_used; i++)
+      add_str(strs, di->inltab[i].inlinedfn);
+   VG_(sortXA)(strs);
+   n = VG_(sizeXA)(strs);
+   strs_szB = 0;
+   for (i = 0; i < n; i++) {
+      StrOff* so = VG_(indexXA)(strs, i);
+      if (i > 0 && so->str == ((StrOff*)VG_(indexXA)(strs, i-1))->str) {
+         so->off = ((StrOff*)VG_(indexXA)(strs, i-1))->off;
+         continue;
+      }
+      so->off = strs_szB;
+      strs_szB += VG_(strlen)(so->str) + 1;
+   }
+
+   w = ML_(dinfo_zalloc)("di.dicache.save.2", sizeof(Writer));
+   w->fd = sr_Res(sres);
+   w->ok = strs_szB < DICACHE_NO_STR;
+
+   VG_(memset)(&hdr, 0, sizeof(hdr));
+   hdr.version = DICACHE_VERSION;
+   hdr.szB_hdr = sizeof(CHdr);
+   VG_(strncpy)(hdr.vg_version, VERSION, sizeof(hdr.vg_version) - 1);
+   VG_(strncpy)(hdr.platform, VG_PLATFORM, sizeof(hdr.platform) - 1);
+   hdr.name             = str_off(strs, di->cache_name);
+   hdr.sizeof_fndn_ix   = di->sizeof_fndn_ix;
+   hdr.sizeof_cfsi_m_ix = di->sizeof_cfsi_m_ix;
+   hdr.maxinl_codesz    = di->maxinl_codesz;
+   hdr.cfsi_minavma     = di->cfsi_minavma;
+   hdr.cfsi_maxavma     = di->cfsi_maxavma;
+   get_segs(di, hdr.segs);
+   /* Leave room for the header, written last. */
+   w_put(w, &hdr, sizeof(hdr));
+
+   w_sect(w, &hdr, SECT_STRS, strs_szB);
+   for (i = 0; i < n; i++) {
+      const StrOff* so = VG_(indexXA)(strs, i);
+      if (i == 0 || so->str != ((StrOff*)VG_(indexXA)(strs, i-1))->str)
+         w_put(w, so->str, VG_(strlen)(so->str) + 1);
+   }
+
+   w_sect(w, &hdr, SECT_SYMS, di->symtab_used);
+   sec_ix = 0;
+   for (i = 0; i < di->symtab_used; i++) {
+      const DiSym* sym = &di->symtab[i];
+      CSym csym;
+      VG_(memset)(&csym, 0, sizeof(csym));
+      csym.avmas     = sym->avmas;
+      csym.pri_name  = str_off(strs, sym->pri_name);
+      csym.sec_names = DICACHE_NO_STR;
+      if (sym->sec_names) {
+         const HChar** sec;
+         csym.sec_names = sec_ix;
+         for (sec = sym->sec_names; *sec; sec++)
+            sec_ix++;
+         sec_ix++;
+      }
+      csym.size      = sym->size;
+      csym.isText    = sym->isText;
+      csym.isIFunc   = sym->isIFunc;
+      csym.isGlobal  = sym->isGlobal;
+      w_put(w, &csym, sizeof(csym));
+   }
+   vg_assert(sec_ix == n_sec_names);
+
+   w_sect(w, &hdr, SECT_SEC_NAMES, n_sec_names);
+   for (i = 0; i < di->symtab_used; i++) {
+      const HChar** sec = di->symtab[i].sec_names;
+      UInt off;
+      if (sec == NULL)
+         continue;
+      for (; *sec; sec++) {
+         off = str_off(strs, *sec);
+         w_put(w, &off, sizeof(off));
+      }
+      off = DICACHE_NO_STR;
+      w_put(w, &off, sizeof(off));
+   }
+
+   w_sect(w, &hdr, SECT_FNDNS, n_fndns);
+   for (i = 1; i <= n_fndns; i++) {
+      const FnDn* fndn = VG_(indexEltNumber)(di->fndnpool, i);
+      CFnDn cfndn;
+      cfndn.filename = str_off(strs, fndn->filename);
+      cfndn.dirname  = str_off(strs, fndn->dirname);
+      w_put(w, &cfndn, sizeof(cfndn));
+   }
+
+   w_sect(w, &hdr, SECT_LOCS, di->loctab_used);
+   w_put(w, di->loctab, di->loctab_used * sizeof(DiLoc));
+   w_sect(w, &hdr, SECT_LOC_FNDN_IX, di->loctab_used * di->sizeof_fndn_ix);
+   w_put(w, di->loctab_fndn_ix, di->loctab_used * di->sizeof_fndn_ix);
+
+   w_sect(w, &hdr, SECT_INLS, di->inltab_used);
+   for (i = 0; i < di->inltab_used; i++) {
+      const DiInlLoc* inl = &di->inltab[i];
+      CInlLoc cinl;
+      VG_(memset)(&cinl, 0, sizeof(cinl));
+      cinl.addr_lo   = inl->addr_lo;
+      cinl.addr_hi   = inl->addr_hi;
+      cinl.inlinedfn = str_off(strs, inl->inlinedfn);
+      cinl.fndn_ix   = inl->fndn_ix;
+      cinl.lineno    = inl->lineno;
+      cinl.level     = inl->level;
+      w_put(w, &cinl, sizeof(cinl));
+   }
+
+   w_sect(w, &hdr, SECT_CFSI_BASE, di->cfsi_used);
+   w_put(w, di->cfsi_base, di->cfsi_used * sizeof(Addr));
+   w_sect(w, &hdr, SECT_CFSI_M_IX, di->cfsi_used * di->sizeof_cfsi_m_ix);
+   w_put(w, di->cfsi_m_ix, di->cfsi_used * di->sizeof_cfsi_m_ix);
+   n_cfsi_ms = di->cfsi_m_pool ? VG_(sizeDedupPA)(di->cfsi_m_pool) : 0;
+   w_sect(w, &hdr, SECT_CFSI_MS, n_cfsi_ms);
+   for (i = 1; i <= n_cfsi_ms; i++)
+      w_put(w, VG_(indexEltNumber)(di->cfsi_m_pool, i), sizeof(DiCfSI_m));
+   n_exprs = di->cfsi_exprs ? VG_(sizeXA)(di->cfsi_exprs) : 0;
+   w_sect(w, &hdr, SECT_CFSI_EXPRS, n_exprs);
+   for (i = 0; i < n_exprs; i++)
+      w_put(w, VG_(indexXA)(di->cfsi_exprs, i), sizeof(CfiExpr));
+   w_flush(w);
+
+   /* Now that all the rest is there, the header, with the magic. */
+   VG_(memcpy)(hdr.magic, DICACHE_MAGIC, sizeof(hdr.magic));
+   if (w->ok && VG_(lseek)(w->fd, 0, VKI_SEEK_SET) != 0)
+      w->ok = False;
+   if (w->ok && VG_(write)(w->fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+      w->ok = False;
+   VG_(close)(w->fd);
+
+   if (w->ok && VG_(rename)(tmp_path, path) == 0) {
+      if (VG_(clo_verbosity) > 1)
+         VG_(message)(Vg_DebugMsg, "Saved debug info to %s\n", path);
+      trim_cache(path);
+   } else {
+      VG_(unlink)(tmp_path);
+      if (VG_(clo_verbosity) > 1)
+         VG_(message)(Vg_DebugMsg, "Can't write debuginfo cache entry %s\n",
+                                   path);
+   }
+   ML_(dinfo_free)(w);
+   VG_(deleteXA)(strs);
+
+  out:
+   ML_(dinfo_free)(path);
+   ML_(dinfo_free)(tmp_path);
+   ML_(dinfo_free)(di->cache_name);
+   di->cache_name = NULL;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Loading                                              ---*/
+/*------------------------------------------------------------*/
+
+/* Is section s of the entry of szB bytes at img an array of
+   records of eltSzB bytes within the entry? */
+static Bool sect_ok ( const UChar* img, SizeT szB, UInt s, SizeT eltSzB )
+{
+   const CHdr* hdr = (const CHdr*)img;
+   ULong off = hdr->sects[s].off;
+   ULong n   = hdr->sects[s].n;
+   return off % 8 == 0 && off >= sizeof(CHdr) && off <= szB
+          && n <= (szB - off) / eltSzB;
+}
+
+static Bool ix_ok ( const void* ixs, UInt sizeof_ix, UWord n, UInt max )
+{
+   UWord i;
+   for (i = 0; i < n; i++) {
+      UInt ix;
+      switch (sizeof_ix) {
+         case 1: ix = ((const UChar*) ixs)[i]; break;
+         case 2: ix = ((const UShort*)ixs)[i]; break;
+         case 4: ix = ((const UInt*)  ixs)[i]; break;
+         default: return False;
+      }
+      if (ix > max)
+         return False;
+   }
+   return True;
+}
+
+/* Is reg one of the registers evalCfiExpr knows on this
+   architecture? */
+static Bool cfireg_ok ( CfiReg reg )
+{
+   switch (reg) {
+#     if defined(VGA_x86) || defined(VGA_amd64)
+      case Creg_IA_IP: case Creg_IA_SP: case Creg_IA_BP:
+         return True;
+#     elif defined(VGA_arm)
+      case Creg_ARM_R15: case Creg_ARM_R14: case Creg_ARM_R13:
+      case Creg_ARM_R12: case Creg_ARM_R7:
+         return True;
+#     elif defined(VGA_s390x)
+      case Creg_S390_IA: case Creg_S390_SP: case Creg_S390_FP:
+      case Creg_S390_LR:
+         return True;
+#     elif defined(VGA_mips32) || defined(VGA_mips64) || defined(VGA_nanomips)
+      case Creg_IA_IP: case Creg_IA_SP: case Creg_IA_BP: case Creg_MIPS_RA:
+         return True;
+#     elif defined(VGA_arm64)
+      case Creg_ARM64_SP: case Creg_ARM64_X30: case Creg_ARM64_X29:
+         return True;
+#     endif
+      default:
+         return False;
+   }
+}
+
+/* Set ok[i] to True if the CFI expression exprs[i] can be evaluated:
+   it is made of known operations, of registers of this architecture,
+   and of expressions which can be evaluated, whose indices are lower
+   than i (expressions are built bottom up), so that evaluation
+   terminates. */
+static void check_cfi_exprs ( const CfiExpr* exprs, UWord n,
+                              /*OUT*/Bool* ok )
+{
+#  define SUB_OK(_ix)  ((_ix) >= 0 && (UWord)(_ix) < i && ok[_ix])
+   UWord i;
+   for (i = 0; i < n; i++) {
+      const CfiExpr* e = &exprs[i];
+      switch (e->tag) {
+         case Cex_Const:
+            ok[i] = True;
+            break;
+         case Cex_Deref:
+            ok[i] = SUB_OK(e->Cex.Deref.ixAddr);
+            break;
+         case Cex_Unop:
+            ok[i] = e->Cex.Unop.op >= Cunop_Abs
+                    && e->Cex.Unop.op <= Cunop_Not
+                    && SUB_OK(e->Cex.Unop.ix);
+            break;
+         case Cex_Binop:
+            ok[i] = e->Cex.Binop.op >= Cbinop_Add
+                    && e->Cex.Binop.op <= Cbinop_Ne
+                    && SUB_OK(e->Cex.Binop.ixL) && SUB_OK(e->Cex.Binop.ixR);
+            break;
+         case Cex_CfiReg:
+            ok[i] = cfireg_ok(e->Cex.CfiReg.reg);
+            break;
+         default:
+            /* Cex_Undef and Cex_DwReg cannot be evaluated. */
+            ok[i] = False;
+            break;
+      }
+   }
+#  undef SUB_OK
+}
+
+/* Do the CFIC_EXPR and CFIR_EXPR rules of m refer to CFI expressions
+   which can be evaluated, according to expr_ok? */
+static Bool cfsi_m_ok ( const DiCfSI_m* m, const Bool* expr_ok,
+                        UWord n_exprs )
+{
+#  define EXPR_OK(_off) ((_off) >= 0 && (UWord)(_off) < n_exprs \
+                         && expr_ok[_off])
+#  define RULE_OK(_reg) (m->_reg##_how != CFIR_EXPR || EXPR_OK(m->_reg##_off))
+   if (m->cfa_how == CFIC_EXPR && !EXPR_OK(m->cfa_off))
+      return False;
+#  if defined(VGA_x86) || defined(VGA_amd64)
+   return RULE_OK(ra) && RULE_OK(sp) && RULE_OK(bp);
+#  elif defined(VGA_arm)
+   return RULE_OK(ra) && RULE_OK(r14) && RULE_OK(r13) && RULE_OK(r12)
+          && RULE_OK(r11) && RULE_OK(r7);
+#  elif defined(VGA_arm64)
+   return RULE_OK(ra) && RULE_OK(sp) && RULE_OK(x30) && RULE_OK(x29);
+#  elif defined(VGA_ppc32) || defined(VGA_ppc64be) || defined(VGA_ppc64le)
+   return RULE_OK(ra);
+#  elif defined(VGA_s390x)
+   return RULE_OK(sp) && RULE_OK(ra) && RULE_OK(fp)
+          && RULE_OK(f0) && RULE_OK(f1) && RULE_OK(f2) && RULE_OK(f3)
+          && RULE_OK(f4) && RULE_OK(f5) && RULE_OK(f6) && RULE_OK(f7);
+#  elif defined(VGA_mips32) || defined(VGA_mips64) || defined(VGA_nanomips)
+   return RULE_OK(ra) && RULE_OK(sp) && RULE_OK(fp);
+#  else
+#    error "Unknown arch"
+#  endif
+#  undef RULE_OK
+#  undef EXPR_OK
+}
+
+/* Rebuild a frozen dedup pool from its n elements of eltSzB bytes, so
+   that they keep their numbers 1 .. n.  Returns NULL if they are not
+   all different. */
+static DedupPoolAlloc* rebuild_pool ( const HChar* cc,
+                                      SizeT poolSzB, SizeT eltAlign,
+                                      const void* elts, UInt n,
+                                      SizeT eltSzB )
+{
+   DedupPoolAlloc* pool = VG_(newDedupPA)(poolSzB, eltAlign,
+                                          ML_(dinfo_zalloc), cc,
+                                          ML_(dinfo_free));
+   UInt i;
+   for (i = 0; i < n; i++) {
+      if (VG_(allocFixedEltDedupPA)(pool, eltSzB,
+                                    (const UChar*)elts + i * eltSzB)
+          != i + 1) {
+         VG_(deleteDedupPA)(pool);
+         return NULL;
+      }
+   }
+   VG_(freezeDedupPA)(pool, ML_(dinfo_shrink_block));
+   return pool;
+}
+
+/* Free the tables that a failed load may have set up. */
+static void discard_tables ( struct _DebugInfo* di )
+{
+   UWord i;
+   if (di->symtab) {
+      for (i = 0; i < di->symtab_used; i++)
+         if (di->symtab[i].sec_names)
+            ML_(dinfo_free)(di->symtab[i].sec_names);
+      ML_(dinfo_free)(di->symtab);
+   }
+   if (di->fndnpool)       VG_(deleteDedupPA)(di->fndnpool);
+   if (di->loctab)         ML_(dinfo_free)(di->loctab);
+   if (di->loctab_fndn_ix) ML_(dinfo_free)(di->loctab_fndn_ix);
+   if (di->inltab)         ML_(dinfo_free)(di->inltab);
+   if (di->cfsi_base)      ML_(dinfo_free)(di->cfsi_base);
+   if (di->cfsi_m_ix)      ML_(dinfo_free)(di->cfsi_m_ix);
+   if (di->cfsi_m_pool)    VG_(deleteDedupPA)(di->cfsi_m_pool);
+   if (di->cfsi_exprs)     VG_(deleteXA)(di->cfsi_exprs);
+   di->symtab = NULL;      di->symtab_used = di->symtab_size = 0;
+   di->fndnpool = NULL;
+   di->loctab = NULL;      di->loctab_used = di->loctab_size = 0;
+   di->loctab_fndn_ix = NULL;
+   di->inltab = NULL;      di->inltab_used = di->inltab_size = 0;
+   di->cfsi_base = NULL;   di->cfsi_used = di->cfsi_size = 0;
+   di->cfsi_m_ix = NULL;
+   di->cfsi_m_pool = NULL;
+   di->cfsi_exprs = NULL;
+}
+
+/* Build di's tables from the entry of szB bytes at img, relocating
+   them by delta.  Returns False if the entry is inconsistent. */
+static Bool load_tables ( struct _DebugInfo* di,
+                          const UChar* img, SizeT szB, PtrdiffT delta )
+{
+   const CHdr*  hdr = (const CHdr*)img;
+   const HChar* strs;
+   UWord        n_strs, i;
+
+#  define SECT(_s, _type)  ((const _type*)(img + hdr->sects[_s].off))
+#  define N(_s)            ((UWord)hdr->sects[_s].n)
+#  define STR_OK(_off)     ((_off) < n_strs)
+#  define STR(_off)        ((_off) == DICACHE_NO_STR ? NULL : strs + (_off))
+
+   strs   = SECT(SECT_STRS, HChar);
+   n_strs = N(SECT_STRS);
+
+   if (N(SECT_SYMS) > 0) {
+      const CSym* csyms = SECT(SECT_SYMS, CSym);
+      const UInt* secs  = SECT(SECT_SEC_NAMES, UInt);
+      di->symtab = ML_(dinfo_zalloc)("di.dicache.lt.1",
+                                     N(SECT_SYMS) * sizeof(DiSym));
+      di->symtab_used = di->symtab_size = N(SECT_SYMS);
+      for (i = 0; i < N(SECT_SYMS); i++) {
+         const CSym* csym = &csyms[i];
+         DiSym*      sym  = &di->symtab[i];
+         if (!STR_OK(csym->pri_name))
+            return False;
+         sym->avmas = csym->avmas;
+         sym->avmas.main += delta;
+         /* Zero means no such address, on the platforms having one. */
+         SET_TOCPTR_AVMA(sym->avmas, GET_TOCPTR_AVMA(sym->avmas) == 0
+                            ? 0 : GET_TOCPTR_AVMA(sym->avmas) + delta);
+         SET_LOCAL_EP_AVMA(sym->avmas, GET_LOCAL_EP_AVMA(sym->avmas) == 0
+                              ? 0 : GET_LOCAL_EP_AVMA(sym->avmas) + delta);
+         sym->pri_name = STR(csym->pri_name);
+         if (csym->sec_names != DICACHE_NO_STR) {
+            UWord j, k;
+            if (csym->sec_names >= N(SECT_SEC_NAMES))
+               return False;
+            for (j = csym->sec_names; j < N(SECT_SEC_NAMES); j++)
+               if (secs[j] == DICACHE_NO_STR || !STR_OK(secs[j]))
+                  break;
+            if (j == N(SECT_SEC_NAMES) || secs[j] != DICACHE_NO_STR
+                || j == csym->sec_names)
+               return False;
+            sym->sec_names
+               = ML_(dinfo_zalloc)("di.dicache.lt.2",
+                                   (j - csym->sec_names + 1)
+                                   * sizeof(HChar*));
+            for (k = csym->sec_names; k < j; k++)
+               sym->sec_names[k - csym->sec_names] = STR(secs[k]);
+         }
+         sym->size     = csym->size;
+         sym->isText   = csym->isText;
+         sym->isIFunc  = csym->isIFunc;
+         sym->isGlobal = csym->isGlobal;
+      }
+   }
+
+   if (N(SECT_FNDNS) > 0) {
+      const CFnDn* cfndns = SECT(SECT_FNDNS, CFnDn);
+      FnDn* fndns = ML_(dinfo_zalloc)("di.dicache.lt.3",
+                                      N(SECT_FNDNS) * sizeof(FnDn));
+      for (i = 0; i < N(SECT_FNDNS); i++) {
+         if (!STR_OK(cfndns[i].filename)
+             || (cfndns[i].dirname != DICACHE_NO_STR
+                 && !STR_OK(cfndns[i].dirname))) {
+            ML_(dinfo_free)(fndns);
+            return False;
+         }
+         fndns[i].filename = STR(cfndns[i].filename);
+         fndns[i].dirname  = STR(cfndns[i].dirname);
+      }
+      di->fndnpool = rebuild_pool("di.dicache.lt.4", 500, vg_alignof(FnDn),
+                                  fndns, N(SECT_FNDNS), sizeof(FnDn));
+      ML_(dinfo_free)(fndns);
+      if (di->fndnpool == NULL)
+         return False;
+   }
+
+   if (N(SECT_LOCS) > 0) {
+      if (N(SECT_LOC_FNDN_IX) != N(SECT_LOCS) * hdr->sizeof_fndn_ix
+          || !ix_ok(SECT(SECT_LOC_FNDN_IX, void), hdr->sizeof_fndn_ix,
+                    N(SECT_LOCS), N(SECT_FNDNS)))
+         return False;
+      di->loctab = ML_(dinfo_zalloc)("di.dicache.lt.5",
+                                     N(SECT_LOCS) * sizeof(DiLoc));
+      VG_(memcpy)(di->loctab, SECT(SECT_LOCS, DiLoc),
+                  N(SECT_LOCS) * sizeof(DiLoc));
+      di->loctab_used = di->loctab_size = N(SECT_LOCS);
+      for (i = 0; i < di->loctab_used; i++)
+         di->loctab[i].addr += delta;
+      di->sizeof_fndn_ix = hdr->sizeof_fndn_ix;
+      di->loctab_fndn_ix = ML_(dinfo_zalloc)("di.dicache.lt.6",
+                                             N(SECT_LOC_FNDN_IX));
+      VG_(memcpy)(di->loctab_fndn_ix, SECT(SECT_LOC_FNDN_IX, UChar),
+                  N(SECT_LOC_FNDN_IX));
+   }
+
+   if (N(SECT_INLS) > 0) {
+      const CInlLoc* cinls = SECT(SECT_INLS, CInlLoc);
+      di->inltab = ML_(dinfo_zalloc)("di.dicache.lt.7",
+                                     N(SECT_INLS) * sizeof(DiInlLoc));
+      di->inltab_used = di->inltab_size = N(SECT_INLS);
+      for (i = 0; i < N(SECT_INLS); i++) {
+         const CInlLoc* cinl = &cinls[i];
+         DiInlLoc*      inl  = &di->inltab[i];
+         if (!STR_OK(cinl->inlinedfn) || cinl->fndn_ix > N(SECT_FNDNS))
+            return False;
+         inl->addr_lo   = cinl->addr_lo + delta;
+         inl->addr_hi   = cinl->addr_hi + delta;
+         inl->inlinedfn = STR(cinl->inlinedfn);
+         inl->fndn_ix   = cinl->fndn_ix;
+         inl->lineno    = cinl->lineno;
+         inl->level     = cinl->level;
+      }
+      di->maxinl_codesz = hdr->maxinl_codesz;
+   }
+
+   if (N(SECT_CFSI_BASE) > 0) {
+      const CfiExpr*  exprs = SECT(SECT_CFSI_EXPRS, CfiExpr);
+      const DiCfSI_m* ms    = SECT(SECT_CFSI_MS, DiCfSI_m);
+      Bool*           expr_ok;
+      if (N(SECT_CFSI_M_IX) != N(SECT_CFSI_BASE) * hdr->sizeof_cfsi_m_ix
+          || N(SECT_CFSI_MS) == 0
+          || !ix_ok(SECT(SECT_CFSI_M_IX, void), hdr->sizeof_cfsi_m_ix,
+                    N(SECT_CFSI_BASE), N(SECT_CFSI_MS)))
+         return False;
+      expr_ok = ML_(dinfo_zalloc)("di.dicache.lt.12",
+                                  N(SECT_CFSI_EXPRS) * sizeof(Bool) + 1);
+      check_cfi_exprs(exprs, N(SECT_CFSI_EXPRS), expr_ok);
+      for (i = 0; i < N(SECT_CFSI_MS); i++)
+         if (!cfsi_m_ok(&ms[i], expr_ok, N(SECT_CFSI_EXPRS)))
+            break;
+      ML_(dinfo_free)(expr_ok);
+      if (i < N(SECT_CFSI_MS))
+         return False;
+      di->cfsi_base = ML_(dinfo_zalloc)("di.dicache.lt.8",
+                                        N(SECT_CFSI_BASE) * sizeof(Addr));
+      di->cfsi_used = di->cfsi_size = N(SECT_CFSI_BASE);
+      for (i = 0; i < di->cfsi_used; i++)
+         di->cfsi_base[i] = SECT(SECT_CFSI_BASE, Addr)[i] + delta;
+      di->sizeof_cfsi_m_ix = hdr->sizeof_cfsi_m_ix;
+      di->cfsi_m_ix = ML_(dinfo_zalloc)("di.dicache.lt.9",
+                                        N(SECT_CFSI_M_IX));
+      VG_(memcpy)(di->cfsi_m_ix, SECT(SECT_CFSI_M_IX, UChar),
+                  N(SECT_CFSI_M_IX));
+      di->cfsi_m_pool = rebuild_pool("di.dicache.lt.10",
+                                     1000 * sizeof(DiCfSI_m),
+                                     vg_alignof(DiCfSI_m),
+                                     ms,
+                                     N(SECT_CFSI_MS), sizeof(DiCfSI_m));
+      if (di->cfsi_m_pool == NULL)
+         return False;
+      if (N(SECT_CFSI_EXPRS) > 0) {
+         di->cfsi_exprs = VG_(newXA)(ML_(dinfo_zalloc), "di.dicache.lt.11",
+                                     ML_(dinfo_free), sizeof(CfiExpr));
+         for (i = 0; i < N(SECT_CFSI_EXPRS); i++)
+            VG_(addToXA)(di->cfsi_exprs, &exprs[i]);
+      }
+      di->cfsi_minavma = hdr->cfsi_minavma + delta;
+      di->cfsi_maxavma = hdr->cfsi_maxavma + delta;
+      ML_(make_CFSI_dir)(di);
+   }
+
+#  undef SECT
+#  undef N
+#  undef STR_OK
+#  undef STR
+   return True;
+}
+
+Bool ML_(dicache_load) ( struct _DebugInfo* di )
+{
+   HChar*       path;
+   SysRes       sres;
+   Int          fd;
+   struct vg_stat stat_buf;
+   const UChar* img = NULL;
+   SizeT        szB = 0;
+   const CHdr*  hdr;
+   CSeg         segs[N_SEGS];
+   PtrdiffT     delta;
+   UInt         s;
+   Bool         ok = False;
+
+   vg_assert(di->cache_name != NULL);
+   vg_assert(di->symtab == NULL && di->loctab == NULL
+             && di->inltab == NULL && di->cfsi_rd == NULL);
+
+   path = entry_path(di->cache_name, 0);
+   sres = VG_(open)(path, VKI_O_RDONLY, 0);
+   if (sr_isError(sres))
+      goto out;
+   fd = sr_Res(sres);
+   if (VG_(fstat)(fd, &stat_buf) != 0 || stat_buf.size < sizeof(CHdr)) {
+      VG_(close)(fd);
+      goto out;
+   }
+   szB  = stat_buf.size;
+   sres = VG_(am_mmap_file_float_valgrind)(szB, VKI_PROT_READ, fd, 0);
+   VG_(close)(fd);
+   if (sr_isError(sres))
+      goto out;
+   img = (const UChar*)(Addr)sr_Res(sres);
+   hdr = (const CHdr*)img;
+
+   /* Is it a complete entry, for this build of Valgrind, and does
+      it hold sane sections? */
+   if (VG_(memcmp)(hdr->magic, DICACHE_MAGIC, sizeof(hdr->magic)) != 0
+       || hdr->version != DICACHE_VERSION
+       || hdr->szB_hdr != sizeof(CHdr)
+       || VG_(strncmp)(hdr->vg_version, VERSION,
+                       sizeof(hdr->vg_version)) != 0
+       || VG_(strncmp)(hdr->platform, VG_PLATFORM,
+                       sizeof(hdr->platform)) != 0)
+      goto out;
+   if (!sect_ok(img, szB, SECT_STRS,        sizeof(HChar))
+       || !sect_ok(img, szB, SECT_SYMS,        sizeof(CSym))
+       || !sect_ok(img, szB, SECT_SEC_NAMES,   sizeof(UInt))
+       || !sect_ok(img, szB, SECT_FNDNS,       sizeof(CFnDn))
+       || !sect_ok(img, szB, SECT_LOCS,        sizeof(DiLoc))
+       || !sect_ok(img, szB, SECT_LOC_FNDN_IX, sizeof(UChar))
+       || !sect_ok(img, szB, SECT_INLS,        sizeof(CInlLoc))
+       || !sect_ok(img, szB, SECT_CFSI_BASE,   sizeof(Addr))
+       || !sect_ok(img, szB, SECT_CFSI_M_IX,   sizeof(UChar))
+       || !sect_ok(img, szB, SECT_CFSI_MS,     sizeof(DiCfSI_m))
+       || !sect_ok(img, szB, SECT_CFSI_EXPRS,  sizeof(CfiExpr)))
+      goto out;
+   /* All strings must be terminated within their section, and this
+      must be the entry we are looking for. */
+   if (hdr->sects[SECT_STRS].n == 0
+       || img[hdr->sects[SECT_STRS].off + hdr->sects[SECT_STRS].n - 1] != 0
+       || hdr->name >= hdr->sects[SECT_STRS].n
+       || VG_(strcmp)((const HChar*)img + hdr->sects[SECT_STRS].off
+                      + hdr->name, di->cache_name) != 0)
+      goto out;
+
+   /* The object must have the same layout as when the entry was
+      saved, except that it may have been mapped elsewhere. */
+   get_segs(di, segs);
+   delta = segs[SEG_TEXT].avma - hdr->segs[SEG_TEXT].avma;
+   for (s = 0; s < N_SEGS; s++) {
+      if (segs[s].present != hdr->segs[s].present
+          || segs[s].svma != hdr->segs[s].svma
+          || segs[s].size != hdr->segs[s].size
+          || (segs[s].present
+              && segs[s].avma - hdr->segs[s].avma != delta))
+         goto out;
+   }
+
+   if (!load_tables(di, img, szB, delta)) {
+      discard_tables(di);
+      goto out;
+   }
+   ok = True;
+
+  out:
+   if (ok) {
+      if (VG_(clo_verbosity) > 1)
+         VG_(message)(Vg_DebugMsg, "Using cached debug info %s\n", path);
+      di->cache_avma = (Addr)img;
+      di->cache_szB  = szB;
+      ML_(dinfo_free)(di->cache_name);
+      di->cache_name = NULL;
+   } else if (img != NULL) {
+      if (VG_(clo_verbosity) > 1)
+         VG_(message)(Vg_DebugMsg, "Ignoring debuginfo cache entry %s\n",
+                                   path);
+      VG_(am_munmap_valgrind)((Addr)img, szB);
+   }
+   ML_(dinfo_free)(path);
+   return ok;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                dicache.c ---*/
+/*--------------------------------------------------------------------*/
@@ -39,6 +39,10 @@
 #include "pub_core_libcprint.h"
 #include "pub_core_libcproc.h"     /* VG_(read_millisecond_timer) */
 #include "pub_core_libcfile.h"
+#include "pub_core_aspacemgr.h"    /* VG_(am_mmap_file_float_valgrind) */
+#include "pub_core_options.h"      /* VG_(clo_image_cache_size) */
+#include "pub_core_syscall.h"      /* VG_(do_syscall3) */
+#include "pub_core_vkiscnums.h"    /* __NR_madvise */
 #include "priv_misc.h"             /* dinfo_zalloc/free/strdup */
 #include "priv_image.h"            /* self */
 
@@ -46,13 +50,42 @@
 #define TINFL_HEADER_FILE_ONLY
 #include "tinfl.c"
 
-/* These values (1024 entries of 8192 bytes each) gives a cache
-   size of 8MB. */
+/* The cache holds blocks of CACHE_ENTRY_SIZE (8192) bytes of the
+   file, for images that aren't mapped, and chunks of decompressed
+   data of CSLC_CHUNK_SIZE bytes.  Its size, including the restart
+   points of the compressed slices, is limited to
+   VG_(clo_image_cache_size) MB, of which at most half is used for
+   restart points.
+
+   A local file is only mapped if this process can't write it.  A
+   mapped file which is truncated gets us a SIGBUS when reading the
+   part of the mapping beyond its new end, which can't be recovered
+   from.  Files replaced by another one, by a rename, or unlinked, are
+   not a problem, as the mapping keeps the original file.  But files
+   that we can write may well be overwritten in place, for instance
+   by cp'ing a newly built object over them: these are read with
+   pread, which just returns less data in that case. */
 #define CACHE_ENTRY_SIZE_BITS (12+1)
-#define CACHE_N_ENTRIES       1024
 
 #define CACHE_ENTRY_SIZE      (1 << CACHE_ENTRY_SIZE_BITS)
 
+#define CACHE_ARRAY_GROW_SIZE 64
+
+/* Compressed slices are decompressed in chunks of this size, which
+   must be a multiple of TINFL_LZ_DICT_SIZE. */
+#define CSLC_CHUNK_SIZE       (8 * TINFL_LZ_DICT_SIZE)
+
+/* Compressed data is fed to the inflater in pieces of this size. */
+#define CSLC_INPUT_SIZE       (64 * 1024)
+
+/* On 32-bit hosts, larger files are not mapped, so as not to use up
+   the address space; they are read through the cache instead. */
+#define MAX_MAPPED_SIZE_32    (64 * 1024 * 1024)
+
+/* The maximum number of blocks fetched from a debuginfo server in a
+   single round trip, when a file is read sequentially. */
+#define SERVER_READAHEAD_BLOCKS 64
+
 #define COMPRESSED_SLICE_ARRAY_GROW_SIZE 64
 
 /* An entry in the cache. */
@@ -66,6 +99,18 @@ typedef
    }
    CEnt;
 
+/* A restart point of a compressed slice: the state of the inflater,
+   and its dictionary, once a whole number of chunks of the slice have
+   been decompressed.  Decompressing any chunk of the slice starts
+   from the nearest restart point at or before it. */
+typedef
+   struct {
+      DiOffT             offC;   // offset of the next compressed byte
+      tinfl_decompressor inflater;
+      UChar              dict[TINFL_LZ_DICT_SIZE];
+   }
+   CRst;
+
 /* Compressed slice */
 typedef
    struct {
@@ -73,6 +118,10 @@ typedef
       SizeT  szD;   // size of decompressed data
       DiOffT offC;  // offset of compressed data
       SizeT  szC;   // size of compressed data
+      // Restart points, one per chunk, allocated on first use.
+      // rsts[k] is for chunk k, and is non-NULL for k < rsts_used.
+      CRst** rsts;
+      UInt   rsts_used;
    }
    CSlc;
 
@@ -83,13 +132,23 @@ typedef
       Bool  is_local;
       // The fd for the local file, or sd for a remote server.
       Int   fd;
-      // The name.  In ML_(dinfo_zalloc)'d space.  Used only for printing
-      // error messages; hence it doesn't really matter what this contains.
+      // The name.  In ML_(dinfo_zalloc)'d space.  Used for printing
+      // error messages, and to reopen a suspended local file.
       HChar* name;
+      // For a suspended local file (fd == -1): identity of the file, to
+      // check that the file reopened by ML_(img_resume) is the same.
+      // Not known if fstat failed, in which case it can't be resumed.
+      Bool  id_known;
+      ULong dev;
+      ULong ino;
+      ULong mtime;
+      ULong mtime_nsec;
       // The rest of these fields are only valid when using remote files
       // (that is, using a debuginfo server; hence when is_local==False)
       // Session ID allocated to us by the server.  Cannot be zero.
       ULong session_id;
+      // Does the server understand SECT requests (version 2)?
+      Bool  sect_ok;
    }
    Source;
 
@@ -100,13 +159,33 @@ struct _DiImage {
    SizeT size;
    // Real size of image
    SizeT real_size;
-   // The number of entries used.  0 .. CACHE_N_ENTRIES
+   // A local file is mapped read-only in its entirety if possible, in
+   // which case map_size is real_size, and reading it doesn't go
+   // through the cache.  Else map is NULL and map_size is 0.
+   const UChar* map;
+   SizeT map_size;
+   // The number of entries used, and the size of the ces array.
    UInt  ces_used;
-   // Pointers to the entries.  ces[0 .. ces_used-1] are non-NULL.
-   // ces[ces_used .. CACHE_N_ENTRIES-1] are NULL.
-   // The non-NULL entries may be arranged arbitrarily.  We expect to use
-   // a pseudo-LRU scheme though.
-   CEnt* ces[CACHE_N_ENTRIES];
+   UInt  ces_size;
+   // The total size of the data of the entries in use.
+   SizeT ces_szB;
+   // Pointers to the entries.  ces[0 .. ces_used-1] are non-NULL, and
+   // ordered from the most to the least recently used.  Except when
+   // the image is suspended, there is at least one entry, so that the
+   // fast path in get() need not check for it.
+   CEnt** ces;
+
+   // For a remote image: the offset at which the next miss would be
+   // sequential, and the number of blocks fetched at the last miss.
+   DiOffT ra_next;
+   UInt   ra_blocks;
+
+   // The total size of the restart points of the compressed slices.
+   SizeT rsts_szB;
+
+   // Has a read of the (local) file returned less data than expected,
+   // because the file was truncated?
+   Bool  truncated;
 
    // Array of compressed slices
    CSlc* cslc;
@@ -118,19 +197,19 @@ struct _DiImage {
 
 
 /* Sanity check code for CEnts. */
-static void pp_CEnt(const HChar* msg, CEnt* ce)
+static void pp_CEnt(const HChar* msg, const CEnt* ce)
 {
    VG_(printf)("%s: fromC %s, used %llu, size %llu, offset %llu\n",
                msg, ce->fromC ? "True" : "False",
                (ULong)ce->used, (ULong)ce->size, (ULong)ce->off);
 }
 
-static Bool is_sane_CEnt ( const HChar* who, const DiImage* img, UInt i )
+static Bool is_sane_CEnt ( const HChar* who, const DiImage* img,
+                           const CEnt* ce )
 {
    vg_assert(img);
-   vg_assert(i <= CACHE_N_ENTRIES);
+   vg_assert(ce);
 
-   CEnt* ce = img->ces[i];
    if (!(ce->used <= ce->size)) goto fail;
    if (ce->fromC) {
       // ce->size can be anything, but ce->used must be either the
@@ -148,7 +227,7 @@ static Bool is_sane_CEnt ( const HChar* who, const DiImage* img, UInt i )
    return True;
 
  fail:
-   VG_(printf)("is_sane_CEnt[%u]: fail: %s\n", i, who);
+   VG_(printf)("is_sane_CEnt: fail: %s\n", who);
    pp_CEnt("failing CEnt", ce);
    return False;
 }
@@ -271,11 +350,9 @@ static void give_up__image_overrun(void)
    /*NOTREACHED*/
 }
 
-/* "Do" a transaction: that is, send the given frame to the server and
-   return the frame it sends back.  Caller owns the resulting frame
-   and must free it.  A NULL return means the transaction failed for
-   some reason. */
-static Frame* do_transaction ( Int sd, const Frame* req )
+/* Send the given frame to the server.  Returns False if that failed
+   for some reason. */
+static Bool send_Frame ( Int sd, const Frame* req )
 {
    if (0) VG_(printf)("CLIENT: send %c%c%c%c\n",
                       req->data[0], req->data[1], req->data[2], req->data[3]);
@@ -296,15 +373,19 @@ static Frame* do_transaction ( Int sd, const Frame* req )
    write_UInt_le(&wr_first8[0], adler);
 
    Int r = my_write(sd, &wr_first8[0], 8);
-   if (r != 8) return NULL;
+   if (r != 8) return False;
    vg_assert(req->n_data >= 4); // else ill formed -- no KIND field
    r = my_write(sd, req->data, req->n_data);
-   if (r != req->n_data) return NULL;
+   return r == req->n_data;
+}
 
-   /* So, the request is sent.  Now get a request of the same format
-      out of the channel. */
+/* Get the next frame out of the channel.  Caller owns the resulting
+   frame and must free it.  A NULL return means that failed for some
+   reason. */
+static Frame* recv_Frame ( Int sd )
+{
    UChar rd_first8[8];  // adler32; length32
-   r = my_read(sd, &rd_first8[0], 8);
+   Int r = my_read(sd, &rd_first8[0], 8);
    if (r != 8) return NULL;
    UInt rd_adler = read_UInt_le(&rd_first8[0]);
    UInt rd_len   = read_UInt_le(&rd_first8[4]);
@@ -321,7 +402,7 @@ static Frame* do_transaction ( Int sd, const Frame* req )
                       res->data[0], res->data[1], res->data[2], res->data[3]);
 
    /* Compute the checksum for the received data, and check it. */
-   adler = VG_(adler32)(0, NULL, 0); // initial value
+   UInt adler = VG_(adler32)(0, NULL, 0); // initial value
    adler = VG_(adler32)(adler, &rd_first8[4], 4);
    if (res->n_data > 0)
       adler = VG_(adler32)(adler, res->data, res->n_data);
@@ -330,6 +411,16 @@ static Frame* do_transaction ( Int sd, const Frame* req )
    return res;
 }
 
+/* "Do" a transaction: that is, send the given frame to the server and
+   return the frame it sends back.  Caller owns the resulting frame
+   and must free it.  A NULL return means the transaction failed for
+   some reason. */
+static Frame* do_transaction ( Int sd, const Frame* req )
+{
+   if (!send_Frame(sd, req)) return NULL;
+   return recv_Frame(sd);
+}
+
 static void free_Frame ( Frame* fr )
 {
    vg_assert(fr && fr->data);
@@ -361,6 +452,22 @@ static Frame* mk_Frame_le64_le64_le64 ( const HChar* tag,
    return f;
 }
 
+static Frame* mk_Frame_le64_le64_le64_le64 ( const HChar* tag,
+                                             ULong n1, ULong n2, ULong n3,
+                                             ULong n4 )
+{
+   vg_assert(VG_(strlen)(tag) == 4);
+   Frame* f = ML_(dinfo_zalloc)("di.mFllll.1", sizeof(Frame));
+   f->n_data = 4 + 4*8;
+   f->data = ML_(dinfo_zalloc)("di.mFllll.2", f->n_data);
+   VG_(memcpy)(&f->data[0], tag, 4);
+   write_ULong_le(&f->data[4 + 0*8], n1);
+   write_ULong_le(&f->data[4 + 1*8], n2);
+   write_ULong_le(&f->data[4 + 2*8], n3);
+   write_ULong_le(&f->data[4 + 3*8], n4);
+   return f;
+}
+
 static Frame* mk_Frame_asciiz ( const HChar* tag, const HChar* str )
 {
    vg_assert(VG_(strlen)(tag) == 4);
@@ -488,35 +595,70 @@ static inline CSlc* find_cslc ( DiImage* img, DiOffT off )
    return NULL;
 }
 
-/* Allocate a new CEnt, connect it to |img|, and return its index. */
-static UInt alloc_CEnt ( DiImage* img, SizeT szB, Bool fromC )
+/* Allocate a new CEnt, not yet connected to any image. */
+static CEnt* alloc_CEnt ( SizeT szB, Bool fromC )
 {
-   vg_assert(img != NULL);
-   vg_assert(img->ces_used < CACHE_N_ENTRIES);
    if (fromC) {
       // szB can be arbitrary
    } else {
       vg_assert(szB == CACHE_ENTRY_SIZE);
    }
-   UInt entNo = img->ces_used;
-   img->ces_used++;
-   vg_assert(img->ces[entNo] == NULL);
-   img->ces[entNo] = ML_(dinfo_zalloc)("di.alloc_CEnt.1",
-                                       offsetof(CEnt, data) + szB);
-   img->ces[entNo]->size = szB;
-   img->ces[entNo]->fromC = fromC;
-   vg_assert(is_sane_CEnt("alloc_CEnt", img, entNo));
-   return entNo;
+   CEnt* ce = ML_(dinfo_zalloc)("di.alloc_CEnt.1",
+                                offsetof(CEnt, data) + szB);
+   ce->size  = szB;
+   ce->fromC = fromC;
+   return ce;
 }
 
-static void realloc_CEnt ( DiImage* img, UInt entNo, SizeT szB, Bool fromC )
+/* Disconnect the given entry from |img|, and free it. */
+static void discard_CEnt ( DiImage* img, UInt entNo )
 {
-   vg_assert(img != NULL);
-   vg_assert(fromC || szB >= CACHE_ENTRY_SIZE);
-   vg_assert(is_sane_CEnt("realloc_CEnt-pre", img, entNo));
-   img->ces[entNo] = ML_(dinfo_realloc)("di.realloc_CEnt.1",
-                                        img->ces[entNo],
-                                        offsetof(CEnt, data) + szB);
+   UInt i;
+   vg_assert(entNo < img->ces_used);
+   CEnt* ce = img->ces[entNo];
+   vg_assert(img->ces_szB >= ce->size);
+   img->ces_szB -= ce->size;
+   ML_(dinfo_free)(ce);
+   img->ces_used--;
+   for (i = entNo; i < img->ces_used; i++)
+      img->ces[i] = img->ces[i+1];
+   img->ces[img->ces_used] = NULL;
+}
+
+/* Connect |ce| to |img|, at the top.  If the cache, with the restart
+   points, then gets bigger than VG_(clo_image_cache_size) MB, make
+   room first by discarding
+   the (ostensibly) LRU entries.  But try to discard non-fromC entries
+   first, since discarding and reloading fromC entries is much more
+   expensive. */
+static void insert_CEnt ( DiImage* img, CEnt* ce )
+{
+   SizeT maxB = (SizeT)VG_(clo_image_cache_size) * 1024 * 1024;
+   UInt  i;
+
+   vg_assert(is_sane_CEnt("insert_CEnt", img, ce));
+   while (img->ces_used > 0
+          && img->ces_szB + img->rsts_szB + ce->size > maxB) {
+      UInt entNo = img->ces_used - 1;
+      for (i = img->ces_used; i > 0; i--) {
+         if (!img->ces[i-1]->fromC) {
+            entNo = i-1;
+            break;
+         }
+      }
+      discard_CEnt(img, entNo);
+   }
+
+   if (img->ces_used == img->ces_size) {
+      img->ces_size += CACHE_ARRAY_GROW_SIZE;
+      img->ces = ML_(dinfo_realloc)("di.image.insert_CEnt.1",
+                                    img->ces, img->ces_size * sizeof(CEnt*));
+   }
+   for (i = img->ces_used; i > 0; i--)
+      img->ces[i] = img->ces[i-1];
+   img->ces[0] = ce;
+   img->ces_used++;
+   img->ces_szB += ce->size;
 }
 
 /* Move the given entry to the top and slide those above it down by 1,
@@ -543,19 +685,84 @@ static void move_CEnt_to_top ( DiImage* img, UInt entNo )
    }
 }
 
+/* Set the given entry to the block [off, +len) of a remote image,
+   from |res|, the server's response to a request for it, which is
+   freed.  If |res| is not a RDOK frame for that block, the server
+   screwed up somehow, and we give up. */
+static void set_CEnt_from_RDOK ( const DiImage* img, CEnt* ce, Frame* res,
+                                 DiOffT off, SizeT len )
+{
+   vg_assert(!img->source.is_local);
+   vg_assert(len > 0 && len <= ce->size);
+   if (!res) goto server_fail;
+   ULong  rx_session_id = 0, rx_off = 0, rx_len = 0, rx_zdata_len = 0;
+   UChar* rx_data = NULL;
+   /* Pretty confusing.  rx_sessionid, rx_off and rx_len are copies
+      of the values that we requested in the READ frame just above,
+      so we can be sure that the server is responding to the right
+      request.  It just copies them from the request into the
+      response.  rx_data is the actual data, and rx_zdata_len is
+      its compressed length.  Hence rx_len must equal len, but
+      rx_zdata_len can be different -- smaller, hopefully.. */
+   if (!parse_Frame_le64_le64_le64_bytes
+       (res, "RDOK", &rx_session_id, &rx_off,
+                     &rx_len, &rx_data, &rx_zdata_len))
+      goto server_fail;
+   if (rx_session_id != img->source.session_id
+       || rx_off != off || rx_len != len || rx_data == NULL)
+      goto server_fail;
+
+   //VG_(memcpy)(&ce->data[0], rx_data, len);
+   // Decompress into the destination buffer
+   // Tell the lib the max number of output bytes it can write.
+   // After the call, this holds the number of bytes actually written,
+   // and it's an error if it is different.
+   lzo_uint out_len = len;
+   Int lzo_rc = lzo1x_decompress_safe(rx_data, rx_zdata_len,
+                                      &ce->data[0], &out_len,
+                                      NULL);
+   Bool ok = lzo_rc == LZO_E_OK && out_len == len;
+   if (!ok) goto server_fail;
+
+   free_Frame(res); res = NULL;
+   ce->off  = off;
+   ce->used = len;
+   ce->fromC = False;
+   vg_assert(is_sane_CEnt("set_CEnt_from_RDOK", img, ce));
+   return;
+
+  server_fail:
+   /* The server screwed up somehow.  Now what? */
+   if (res) {
+      UChar* reason = NULL;
+      if (parse_Frame_asciiz(res, "FAIL", &reason)) {
+         VG_(umsg)("set_CEnt (reading data from DI server): fail: "
+                   "%s\n", reason);
+      } else {
+         VG_(umsg)("set_CEnt (reading data from DI server): fail: "
+                   "unknown reason\n");
+      }
+      free_Frame(res); res = NULL;
+   } else {
+      VG_(umsg)("set_CEnt (reading data from DI server): fail: "
+                "server unexpectedly closed the connection\n");
+   }
+   give_up__comms_lost();
+   /* NOTREACHED */
+   vg_assert(0);
+}
+
 /* Set the given entry so that it has a chunk of the file containing
    the given offset.  It is this function that brings data into the
    cache, either by reading the local file or pulling it from the
-   remote server. */
-static void set_CEnt ( const DiImage* img, UInt entNo, DiOffT off )
+   remote server.  Mapped files never need it. */
+static void set_CEnt ( DiImage* img, CEnt* ce, DiOffT off )
 {
    SizeT len;
    DiOffT off_orig = off;
    vg_assert(img != NULL);
-   vg_assert(img->ces_used <= CACHE_N_ENTRIES);
-   vg_assert(entNo >= 0 && entNo < img->ces_used);
+   vg_assert(img->map == NULL);
    vg_assert(off < img->real_size);
-   CEnt* ce = img->ces[entNo];
    vg_assert(ce != NULL);
    /* Compute [off, +len) as the slice we are going to read. */
    off = block_round_down(off);
@@ -582,9 +789,19 @@ static void set_CEnt ( const DiImage* img, UInt entNo, DiOffT off )
    }
 
    if (img->source.is_local) {
-      // Simple: just read it
+      // Simple: just read it.  If the file was truncated since we
+      // looked at its size, there is less data than expected: the
+      // rest reads as zeroes, which the debuginfo reader will not
+      // make much sense of, but at least won't crash on.
       SysRes sr = VG_(pread)(img->source.fd, &ce->data[0], (Int)len, off);
-      vg_assert(!sr_isError(sr));
+      SizeT  got = sr_isError(sr) ? 0 : sr_Res(sr);
+      if (got < len) {
+         VG_(memset)(&ce->data[got], 0, len - got);
+         if (!img->truncated)
+            VG_(umsg)("Warning: %s was truncated while its debug info "
+                      "was being read\n", img->source.name);
+         img->truncated = True;
+      }
    } else {
       // Not so simple: poke the server
       vg_assert(img->source.session_id > 0);
@@ -592,66 +809,201 @@ static void set_CEnt ( const DiImage* img, UInt entNo, DiOffT off )
          = mk_Frame_le64_le64_le64("READ", img->source.session_id, off, len);
       Frame* res = do_transaction(img->source.fd, req);
       free_Frame(req); req = NULL;
-      if (!res) goto server_fail;
-      ULong  rx_session_id = 0, rx_off = 0, rx_len = 0, rx_zdata_len = 0;
-      UChar* rx_data = NULL;
-      /* Pretty confusing.  rx_sessionid, rx_off and rx_len are copies
-         of the values that we requested in the READ frame just above,
-         so we can be sure that the server is responding to the right
-         request.  It just copies them from the request into the
-         response.  rx_data is the actual data, and rx_zdata_len is
-         its compressed length.  Hence rx_len must equal len, but
-         rx_zdata_len can be different -- smaller, hopefully.. */
-      if (!parse_Frame_le64_le64_le64_bytes
-          (res, "RDOK", &rx_session_id, &rx_off,
-                        &rx_len, &rx_data, &rx_zdata_len))
-         goto server_fail;
-      if (rx_session_id != img->source.session_id
-          || rx_off != off || rx_len != len || rx_data == NULL)
-         goto server_fail;
-
-      //VG_(memcpy)(&ce->data[0], rx_data, len);
-      // Decompress into the destination buffer
-      // Tell the lib the max number of output bytes it can write.
-      // After the call, this holds the number of bytes actually written,
-      // and it's an error if it is different.
-      lzo_uint out_len = len;
-      Int lzo_rc = lzo1x_decompress_safe(rx_data, rx_zdata_len,
-                                         &ce->data[0], &out_len,
-                                         NULL);
-      Bool ok = lzo_rc == LZO_E_OK && out_len == len;
-      if (!ok) goto server_fail;
-
-      free_Frame(res); res = NULL;
-      goto end_of_else_clause;
-     server_fail:
-      /* The server screwed up somehow.  Now what? */
-      if (res) {
-         UChar* reason = NULL;
-         if (parse_Frame_asciiz(res, "FAIL", &reason)) {
-            VG_(umsg)("set_CEnt (reading data from DI server): fail: "
-                      "%s\n", reason);
-         } else {
-            VG_(umsg)("set_CEnt (reading data from DI server): fail: "
-                      "unknown reason\n");
-         }
-         free_Frame(res); res = NULL;
-      } else {
-         VG_(umsg)("set_CEnt (reading data from DI server): fail: "
-                   "server unexpectedly closed the connection\n");
-      }
-      give_up__comms_lost();
-      /* NOTREACHED */
-      vg_assert(0);
-     end_of_else_clause:
-      {}
+      set_CEnt_from_RDOK(img, ce, res, off, len);
+      return;
    }
    
    ce->off  = off;
    ce->used = len;
    ce->fromC = False;
-   vg_assert(ce == img->ces[entNo]);
-   vg_assert(is_sane_CEnt("set_CEnt", img, entNo));
+   vg_assert(is_sane_CEnt("set_CEnt", img, ce));
+}
+
+/* Is the given offset in any entry? */
+static Bool is_cached ( const DiImage* img, DiOffT off )
+{
+   UInt i;
+   for (i = 0; i < img->ces_used; i++) {
+      if (is_in_CEnt(img->ces[i], off))
+         return True;
+   }
+   return False;
+}
+
+/* Bring the block containing |off| of a remote image into the cache,
+   at the top.  If the image is being read sequentially, that is, if
+   this miss is just after the blocks fetched at the previous one,
+   twice as many blocks as then are fetched, up to
+   SERVER_READAHEAD_BLOCKS.  They are all fetched in one round trip:
+   with a single SECT request if the server understands it, else with
+   one READ request per block, all sent before reading any response.
+   The requests are small enough to fit in the socket buffers, so
+   this can't deadlock. */
+static void fetch_from_server ( DiImage* img, DiOffT off )
+{
+   CEnt*  ces[SERVER_READAHEAD_BLOCKS];
+   DiOffT block = block_round_down(off);
+   Int    sd    = img->source.fd;
+   UInt   nBlocks, i;
+   Bool   sent;
+
+   vg_assert(!img->source.is_local);
+   vg_assert(img->source.session_id > 0);
+   vg_assert(off < img->real_size);
+
+   if (block != img->ra_next || img->ra_blocks == 0)
+      img->ra_blocks = 1;
+   else if (img->ra_blocks < SERVER_READAHEAD_BLOCKS)
+      img->ra_blocks *= 2;
+   /* Stop at the end of the file, or at a block that's cached. */
+   for (nBlocks = 1; nBlocks < img->ra_blocks; nBlocks++) {
+      DiOffT b = block + (DiOffT)nBlocks * CACHE_ENTRY_SIZE;
+      if (b >= img->real_size || is_cached(img, b))
+         break;
+   }
+   DiOffT end = block + (DiOffT)nBlocks * CACHE_ENTRY_SIZE;
+   if (end > img->real_size)
+      end = img->real_size;
+   img->ra_next = end;
+
+   if (img->source.sect_ok) {
+      Frame* req = mk_Frame_le64_le64_le64_le64("SECT",
+                                                img->source.session_id,
+                                                block, end - block,
+                                                CACHE_ENTRY_SIZE);
+      sent = send_Frame(sd, req);
+      free_Frame(req);
+   } else {
+      sent = True;
+      for (i = 0; i < nBlocks && sent; i++) {
+         DiOffT b   = block + (DiOffT)i * CACHE_ENTRY_SIZE;
+         SizeT  len = end - b < CACHE_ENTRY_SIZE ? end - b : CACHE_ENTRY_SIZE;
+         Frame* req = mk_Frame_le64_le64_le64("READ", img->source.session_id,
+                                              b, len);
+         sent = send_Frame(sd, req);
+         free_Frame(req);
+      }
+   }
+
+   for (i = 0; i < nBlocks; i++) {
+      DiOffT b   = block + (DiOffT)i * CACHE_ENTRY_SIZE;
+      SizeT  len = end - b < CACHE_ENTRY_SIZE ? end - b : CACHE_ENTRY_SIZE;
+      ces[i] = alloc_CEnt(CACHE_ENTRY_SIZE, False/*!fromC*/);
+      set_CEnt_from_RDOK(img, ces[i], sent ? recv_Frame(sd) : NULL, b, len);
+   }
+   /* Connect the block containing |off| last, so it ends up on top. */
+   for (i = nBlocks; i > 0; i--)
+      insert_CEnt(img, ces[i-1]);
+}
+
+/* Decompress chunk |chunkNo| of the compressed slice |cslcNo| into a
+   new CEnt, which is not connected to |img|.  The compressed data is
+   fetched with ML_(img_get_some), which may well change the cache,
+   hence the need for the caller to connect the new CEnt only once it
+   is complete.  Since the compressed data is in the real part of the
+   image, the recursion stops there.
+
+   Decompression starts at the nearest restart point at or before the
+   chunk, and saves a restart point for each chunk boundary it goes
+   past, so that any chunk discarded from the cache can be
+   decompressed again without going through all the chunks before
+   it.  This works because the chunks are a whole number of
+   dictionaries long: the inflater state and its (wrapping)
+   dictionary are all that is needed to carry on from a chunk
+   boundary.  Restart points are only saved while they use less than
+   half of VG_(clo_image_cache_size) MB, for all the slices: beyond
+   that, chunks are decompressed from the last saved one. */
+static CEnt* decompress_chunk ( DiImage* img, UInt cslcNo, UInt chunkNo )
+{
+   vg_assert(cslcNo < img->cslc_used);
+   CSlc* cslc    = &img->cslc[cslcNo];
+   UInt  nChunks = (cslc->szD + CSLC_CHUNK_SIZE - 1) / CSLC_CHUNK_SIZE;
+   vg_assert(chunkNo < nChunks);
+
+   if (cslc->rsts == NULL) {
+      cslc->rsts = ML_(dinfo_zalloc)("di.image.decompress_chunk.1",
+                                     nChunks * sizeof(CRst*));
+      cslc->rsts[0] = ML_(dinfo_zalloc)("di.image.decompress_chunk.2",
+                                        sizeof(CRst));
+      cslc->rsts[0]->offC = cslc->offC;
+      tinfl_init(&cslc->rsts[0]->inflater);
+      cslc->rsts_used = 1;
+      img->rsts_szB += sizeof(CRst);
+   }
+
+   UInt   c      = chunkNo < cslc->rsts_used ? chunkNo : cslc->rsts_used - 1;
+   CRst*  st     = ML_(dinfo_zalloc)("di.image.decompress_chunk.3",
+                                     sizeof(CRst));
+   UChar* in     = ML_(dinfo_zalloc)("di.image.decompress_chunk.4",
+                                     CSLC_INPUT_SIZE);
+   SizeT  inUsed = 0, inAvail = 0;
+   DiOffT offCEnd = cslc->offC + cslc->szC;
+   CEnt*  ce     = NULL;
+
+   VG_(memcpy)(st, cslc->rsts[c], sizeof(CRst));
+   DiOffT offCNext = st->offC; // next compressed byte to read into |in|
+
+   for (; c <= chunkNo; c++) {
+      SizeT szChunk = c < nChunks-1 ? CSLC_CHUNK_SIZE
+                                    : cslc->szD - (SizeT)c * CSLC_CHUNK_SIZE;
+      SizeT done    = 0;
+      if (c == chunkNo)
+         ce = alloc_CEnt(szChunk, True/*fromC*/);
+
+      while (done < szChunk) {
+         if (inUsed == inAvail && offCNext < offCEnd) {
+            SizeT len = offCEnd - offCNext;
+            if (len > CSLC_INPUT_SIZE)
+               len = CSLC_INPUT_SIZE;
+            inUsed  = 0;
+            inAvail = 0;
+            while (inAvail < len)
+               inAvail += ML_(img_get_some)(in + inAvail, img,
+                                            offCNext + inAvail,
+                                            len - inAvail);
+            offCNext += len;
+         }
+         Bool  moreIn  = offCNext < offCEnd;
+         SizeT dictPos = done % TINFL_LZ_DICT_SIZE;
+         SizeT inSz    = inAvail - inUsed;
+         SizeT outSz   = TINFL_LZ_DICT_SIZE - dictPos;
+         tinfl_status status
+            = tinfl_decompress(&st->inflater, in + inUsed, &inSz,
+                               st->dict, st->dict + dictPos, &outSz,
+                               TINFL_FLAG_PARSE_ZLIB_HEADER
+                               | (moreIn ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+         inUsed   += inSz;
+         st->offC += inSz;
+         // sanity checks on data, FIXME
+         vg_assert(status >= TINFL_STATUS_DONE);
+         vg_assert(outSz <= szChunk - done);
+         if (ce)
+            VG_(memcpy)(&ce->data[done], st->dict + dictPos, outSz);
+         done += outSz;
+         vg_assert(done == szChunk
+                   || status == TINFL_STATUS_HAS_MORE_OUTPUT
+                   || (status == TINFL_STATUS_NEEDS_MORE_INPUT
+                       && (inUsed < inAvail || moreIn)));
+      }
+
+      if (c+1 < nChunks && c+1 == cslc->rsts_used
+          && img->rsts_szB + sizeof(CRst)
+             <= (SizeT)VG_(clo_image_cache_size) * 1024 * 1024 / 2) {
+         CRst* rst = ML_(dinfo_zalloc)("di.image.decompress_chunk.5",
+                                       sizeof(CRst));
+         VG_(memcpy)(rst, st, sizeof(CRst));
+         cslc->rsts[c+1] = rst;
+         cslc->rsts_used++;
+         img->rsts_szB += sizeof(CRst);
+      }
+   }
+
+   ML_(dinfo_free)(in);
+   ML_(dinfo_free)(st);
+   vg_assert(ce != NULL);
+   ce->off  = cslc->offD + (DiOffT)chunkNo * CSLC_CHUNK_SIZE;
+   ce->used = ce->size;
+   return ce;
 }
 
 __attribute__((noinline))
@@ -659,7 +1011,7 @@ static UChar get_slowcase ( DiImage* img, DiOffT off )
 {
    /* Stay sane .. */
    vg_assert(off < img->size);
-   vg_assert(img->ces_used <= CACHE_N_ENTRIES);
+   vg_assert(off >= img->map_size);
    UInt i;
    /* Start the search at entry 1, since the fast-case function
       checked slot zero already. */
@@ -677,145 +1029,38 @@ static UChar get_slowcase ( DiImage* img, DiOffT off )
       return img->ces[0]->data[ off - img->ces[0]->off ];
    }
 
-   vg_assert(i <= img->ces_used);
-
-   // It's not in any entry.  Either allocate a new one or recycle the LRU
-   // one.  This is where the presence of compressed sections makes things
-   // tricky.  There are 4 cases to consider:
-   //
-   // (1) not from a compressed slice, we can allocate a new entry
-   // (2) not from a compressed slice, we have to recycle the LRU entry
-   // (3) from a compressed slice, we can allocate a new entry
-   // (4) from a compressed slice, we have to recycle the LRU entry
-   //
-   // Cases (3) and (4) are complex because we will have to call
-   // ML_(img_get_some) to get the compressed data.  But this function is
-   // reachable from ML_(img_get_some), so we may re-enter get_slowcase a
-   // second time as a result.  Given that the compressed data will be cause
-   // only cases (1) and (2) to happen, this guarantees no infinite recursion.
-   // It does however mean that we can't carry (in this function invokation)
-   // any local copies of the overall cache state across the ML_(img_get_some)
-   // call, since it may become invalidated by the recursive call to
-   // get_slowcase.
-
-   // First of all, see if it is in a compressed slice, and if so, pull the
-   // compressed data into an intermediate buffer.  Given the preceding
-   // comment, this is a safe place to do it, since we are not carrying any
-   // cache state here apart from the knowledge that the requested offset is
-   // not in the cache at all, and the recursive call won't change that fact.
-
+   // It's not in any entry.  For a remote image, fetch it from the
+   // server, maybe with some of the blocks after it.  Else make a new
+   // one: either a block of the file, or a chunk of a compressed
+   // slice.  Either way, connect them at the top, possibly discarding
+   // the LRU ones.
    CSlc* cslc = find_cslc(img, off);
-   UChar* cbuf = NULL;
-   if (cslc != NULL) {
-      SizeT len = 0;
-      cbuf = ML_(dinfo_zalloc)("di.image.get_slowcase.cbuf-1", cslc->szC);
-      // get compressed data
-      while (len < cslc->szC)
-         len += ML_(img_get_some)(cbuf + len, img, cslc->offC + len,
-                                  cslc->szC - len);
-   }
-
-   // Now we can do what we like.
-   vg_assert((cslc == NULL && cbuf == NULL) || (cslc != NULL && cbuf != NULL));
-
-   // Note, we can't capture this earlier, for exactly the reasons detailed
-   // above.
-   UInt ces_used_at_entry = img->ces_used;
-
-   // This is the size of the CEnt that we want to have after allocation or
-   // recycling.
-   SizeT size = (cslc == NULL) ? CACHE_ENTRY_SIZE : cslc->szD;
-
-   // Cases (1) and (3)
-   if (img->ces_used < CACHE_N_ENTRIES) {
-      /* Allocate a new cache entry, and fill it in. */
-      i = alloc_CEnt(img, size, /*fromC?*/cslc != NULL);
+   if (cslc == NULL && !img->source.is_local) {
+      fetch_from_server(img, off);
+   } else {
+      CEnt* ce;
       if (cslc == NULL) {
-         set_CEnt(img, i, off);
-         img->ces[i]->fromC = False;
-         vg_assert(is_sane_CEnt("get_slowcase-case-1", img, i));
-         vg_assert(img->ces_used == ces_used_at_entry + 1);
+         ce = alloc_CEnt(CACHE_ENTRY_SIZE, False/*!fromC*/);
+         set_CEnt(img, ce, off);
       } else {
-         SizeT len = tinfl_decompress_mem_to_mem(
-                        img->ces[i]->data, cslc->szD,
-                        cbuf, cslc->szC,
-                        TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF
-                        | TINFL_FLAG_PARSE_ZLIB_HEADER);
-         vg_assert(len == cslc->szD); // sanity check on data, FIXME
-         vg_assert(cslc->szD == size);
-         img->ces[i]->used = cslc->szD;
-         img->ces[i]->off = cslc->offD;
-         img->ces[i]->fromC = True;
-         vg_assert(is_sane_CEnt("get_slowcase-case-3", img, i));
-         vg_assert(img->ces_used == ces_used_at_entry + 1);
-      }
-      vg_assert(img->ces_used == ces_used_at_entry + 1);
-      if (i > 0) {
-         move_CEnt_to_top(img, i);
-         i = 0;
+         ce = decompress_chunk(img, cslc - img->cslc,
+                               (off - cslc->offD) / CSLC_CHUNK_SIZE);
       }
-      vg_assert(is_in_CEnt(img->ces[i], off));
-      if (cbuf != NULL) {
-         ML_(dinfo_free)(cbuf);
-      }
-      return img->ces[i]->data[ off - img->ces[i]->off ];
-   }
-
-   // Cases (2) and (4)
-   /* All entries in use.  Recycle the (ostensibly) LRU one.  But try to find
-      a non-fromC entry to recycle, though, since discarding and reloading
-      fromC entries is very expensive.  The result is that -- unless all
-      CACHE_N_ENTRIES wind up being used by decompressed slices, which is
-      highly unlikely -- we'll wind up keeping all the decompressed data in
-      the cache for its entire remaining life.  We could probably do better
-      but it would make the cache management even more complex. */
-   vg_assert(img->ces_used == CACHE_N_ENTRIES);
-
-   // Select entry to recycle.
-   for (i = CACHE_N_ENTRIES-1; i > 0; i--) {
-      if (!img->ces[i]->fromC)
-         break;
-   }
-   vg_assert(i >= 0 && i < CACHE_N_ENTRIES);
-
-   realloc_CEnt(img, i, size, /*fromC?*/cslc != NULL);
-   img->ces[i]->size = size;
-   img->ces[i]->used = 0;
-   if (cslc == NULL) {
-      set_CEnt(img, i, off);
-      img->ces[i]->fromC = False;
-      vg_assert(is_sane_CEnt("get_slowcase-case-2", img, i));
-   } else {
-      SizeT len = tinfl_decompress_mem_to_mem(
-                     img->ces[i]->data, cslc->szD,
-                     cbuf, cslc->szC,
-                     TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF
-                     | TINFL_FLAG_PARSE_ZLIB_HEADER);
-      vg_assert(len == size);
-      img->ces[i]->used = size;
-      img->ces[i]->off = cslc->offD;
-      img->ces[i]->fromC = True;
-      vg_assert(is_sane_CEnt("get_slowcase-case-4", img, i));
-   }
-   vg_assert(img->ces_used == ces_used_at_entry);
-   if (i > 0) {
-      move_CEnt_to_top(img, i);
-      i = 0;
-   }
-   vg_assert(is_in_CEnt(img->ces[i], off));
-   if (cbuf != NULL) {
-      ML_(dinfo_free)(cbuf);
+      insert_CEnt(img, ce);
    }
-   return img->ces[i]->data[ off - img->ces[i]->off ];
+   vg_assert(is_in_CEnt(img->ces[0], off));
+   return img->ces[0]->data[ off - img->ces[0]->off ];
 }
 
 // This is called a lot, so do the usual fast/slow split stuff on it. */
 static inline UChar get ( DiImage* img, DiOffT off )
 {
-   /* Most likely case is, it's in the ces[0] position. */
-   /* ML_(img_from_local_file) requests a read for ces[0] when
-      creating the image.  Hence slot zero is always non-NULL, so we
-      can skip this test. */
+   /* Most likely case is, it's in the mapped file, if there is one. */
+   if (LIKELY(off < img->map_size))
+      return img->map[off];
+   /* Else, it's most likely in the ces[0] position. */
+   /* open_cache guarantees that there is at least one entry.  Hence
+      slot zero is always non-NULL, so we can skip this test. */
    if (LIKELY(/* img->ces[0] != NULL && */
               is_in_CEnt(img->ces[0], off))) {
       return img->ces[0]->data[ off - img->ces[0]->off ];
@@ -824,6 +1069,64 @@ static inline UChar get ( DiImage* img, DiOffT off )
    return get_slowcase(img, off);
 }
 
+/* Get ready to read |img|, whose file or session has just been
+   opened.  A local file which we can't write is mapped if possible.  Else, force the
+   zeroth entry to be the first chunk of the file.  That's likely to
+   be the first part that's requested anyway, and loading it at this
+   point forcing img->ces[0] to always be non-empty, thereby saving us
+   an is-it-empty check on the fast path in get().  For a mapped file,
+   the zeroth entry is left empty, for the same reason. */
+static void open_cache ( DiImage* img )
+{
+   vg_assert(img->ces_used == 0);
+   vg_assert(img->map == NULL);
+   vg_assert(img->source.fd >= 0);
+
+   if (img->source.is_local
+       && (VG_WORDSIZE == 8 || img->real_size <= MAX_MAPPED_SIZE_32)
+       && VG_(access)(img->source.name, False, True, False) != 0) {
+      SysRes sres = VG_(am_mmap_file_float_valgrind)(
+                       img->real_size, VKI_PROT_READ, img->source.fd, 0);
+      if (!sr_isError(sres)) {
+         img->map      = (const UChar*)(Addr)sr_Res(sres);
+         img->map_size = img->real_size;
+      }
+   }
+
+   CEnt* ce = alloc_CEnt(CACHE_ENTRY_SIZE, False/*!fromC*/);
+   if (img->map == NULL)
+      set_CEnt(img, ce, 0);
+   insert_CEnt(img, ce);
+}
+
+/* Free the cache of |img|, including the restart points of its
+   compressed slices, and unmap its file. */
+static void close_cache ( DiImage* img )
+{
+   UInt i, j;
+
+   while (img->ces_used > 0)
+      discard_CEnt(img, img->ces_used - 1);
+   vg_assert(img->ces_szB == 0);
+
+   for (i = 0; i < img->cslc_used; i++) {
+      CSlc* cslc = &img->cslc[i];
+      for (j = 0; j < cslc->rsts_used; j++)
+         ML_(dinfo_free)(cslc->rsts[j]);
+      ML_(dinfo_free)(cslc->rsts);
+      cslc->rsts      = NULL;
+      cslc->rsts_used = 0;
+   }
+   img->rsts_szB = 0;
+
+   if (img->map != NULL) {
+      SysRes sres = VG_(am_munmap_valgrind)((Addr)img->map, img->map_size);
+      vg_assert(!sr_isError(sres));
+      img->map      = NULL;
+      img->map_size = 0;
+   }
+}
+
 /* Create an image from a file in the local filesystem.  This is
    relatively straightforward. */
 DiImage* ML_(img_from_local_file)(const HChar* fullpath)
@@ -859,17 +1162,10 @@ DiImage* ML_(img_from_local_file)(const HChar* fullpath)
    img->cslc            = NULL;
    img->cslc_size       = 0;
    img->cslc_used       = 0;
-   /* img->ces is already zeroed out */
+   /* img->map and img->ces are already zeroed out */
    vg_assert(img->source.fd >= 0);
 
-   /* Force the zeroth entry to be the first chunk of the file.
-      That's likely to be the first part that's requested anyway, and
-      loading it at this point forcing img->cent[0] to always be
-      non-empty, thereby saving us an is-it-empty check on the fast
-      path in get(). */
-   UInt entNo = alloc_CEnt(img, CACHE_ENTRY_SIZE, False/*!fromC*/);
-   vg_assert(entNo == 0);
-   set_CEnt(img, 0, 0);
+   open_cache(img);
 
    return img;
 }
@@ -901,17 +1197,10 @@ DiImage* ML_(img_from_fd)(Int fd, const HChar* fullpath)
    img->cslc            = NULL;
    img->cslc_size       = 0;
    img->cslc_used       = 0;
-   /* img->ces is already zeroed out */
+   /* img->map and img->ces are already zeroed out */
    vg_assert(img->source.fd >= 0);
 
-   /* Force the zeroth entry to be the first chunk of the file.
-      That's likely to be the first part that's requested anyway, and
-      loading it at this point forcing img->cent[0] to always be
-      non-empty, thereby saving us an is-it-empty check on the fast
-      path in get(). */
-   UInt entNo = alloc_CEnt(img, CACHE_ENTRY_SIZE, False/*!fromC*/);
-   vg_assert(entNo == 0);
-   set_CEnt(img, 0, 0);
+   open_cache(img);
 
    return img;
 }
@@ -949,16 +1238,29 @@ DiImage* ML_(img_from_di_server)(const HChar* filename,
    /* Ok, we got a connection.  Ask it for version string, so as to be
       reasonably sure we're talking to an instance of
       auxprogs/valgrind-di-server and not to some other random program
-      that happens to be listening on that port. */
-   Frame* req = mk_Frame_noargs("VERS");
+      that happens to be listening on that port.  Ask for version 2
+      first, which has the SECT request.  Version 1 servers reply to
+      that with a FAIL frame, in which case ask for version 1. */
+   Bool   sect_ok = True;
+   Frame* req = mk_Frame_noargs("VER2");
    Frame* res = do_transaction(sd, req);
    if (res == NULL)
       goto fail; // do_transaction failed?!
    UChar* vstr = NULL;
+   if (parse_Frame_asciiz(res, "FAIL", &vstr)) {
+      free_Frame(req);
+      free_Frame(res);
+      sect_ok = False;
+      req = mk_Frame_noargs("VERS");
+      res = do_transaction(sd, req);
+      if (res == NULL)
+         goto fail;
+   }
    if (!parse_Frame_asciiz(res, "VEOK", &vstr))
       goto fail; // unexpected response kind, or invalid ID string
    vg_assert(vstr);
-   if (VG_(strcmp)("Valgrind Debuginfo Server, Version 1",
+   if (VG_(strcmp)(sect_ok ? "Valgrind Debuginfo Server, Version 2"
+                           : "Valgrind Debuginfo Server, Version 1",
                    (const HChar*)vstr) != 0)
       goto fail; // wrong version string
    free_Frame(req);
@@ -985,6 +1287,7 @@ DiImage* ML_(img_from_di_server)(const HChar* filename,
    img->source.is_local   = False;
    img->source.fd         = sd;
    img->source.session_id = session_id;
+   img->source.sect_ok    = sect_ok;
    img->size              = size;
    img->real_size         = size;
    img->ces_used          = 0;
@@ -996,14 +1299,10 @@ DiImage* ML_(img_from_di_server)(const HChar* filename,
    img->cslc_size       = 0;
    img->cslc_used       = 0;
 
-   /* img->ces is already zeroed out */
+   /* img->map and img->ces are already zeroed out */
    vg_assert(img->source.fd >= 0);
 
-   /* See comment on equivalent bit in ML_(img_from_local_file) for
-      rationale. */
-   UInt entNo = alloc_CEnt(img, CACHE_ENTRY_SIZE, False/*!fromC*/);
-   vg_assert(entNo == 0);
-   set_CEnt(img, 0, 0);
+   open_cache(img);
 
    return img;
 
@@ -1045,6 +1344,8 @@ DiOffT ML_(img_mark_compressed_part)(DiImage* img, DiOffT offset, SizeT szC,
    img->cslc[img->cslc_used].szC = szC;
    img->cslc[img->cslc_used].offD = img->size;
    img->cslc[img->cslc_used].szD = szD;
+   img->cslc[img->cslc_used].rsts = NULL;
+   img->cslc[img->cslc_used].rsts_used = 0;
    img->size += szD;
    img->cslc_used++;
    return ret;
@@ -1055,15 +1356,8 @@ void ML_(img_free)(DiImage* img)
    vg_assert(img != NULL);
 
    /* Free up the cache entries, ultimately |img| itself. */
-   UInt i;
-   vg_assert(img->ces_used <= CACHE_N_ENTRIES);
-   for (i = 0; i < img->ces_used; i++) {
-      ML_(dinfo_free)(img->ces[i]);
-   }
-   /* Take the opportunity to sanity check the rest. */
-   for (i = i; i < img->ces_used; i++) {
-      vg_assert(img->ces[i] == NULL);
-   }
+   close_cache(img);
+   ML_(dinfo_free)(img->ces);
    ML_(dinfo_free)(img->source.name);
    ML_(dinfo_free)(img->cslc);
    ML_(dinfo_free)(img);
@@ -1073,9 +1367,10 @@ void ML_(img_done)(DiImage* img)
 {
    vg_assert(img != NULL);
    if (img->source.is_local) {
-      /* Close the file; nothing else to do. */
+      /* Close the file, unless suspended; nothing else to do. */
       vg_assert(img->source.session_id == 0);
-      VG_(close)(img->source.fd);
+      if (img->source.fd >= 0)
+         VG_(close)(img->source.fd);
    } else {
       /* Close the socket.  The server can detect this and will scrub
          the connection when it happens, so there's no need to tell it
@@ -1089,6 +1384,86 @@ void ML_(img_done)(DiImage* img)
 
 
 
+Bool ML_(img_is_local)(const DiImage* img)
+{
+   vg_assert(img != NULL);
+   return img->source.is_local;
+}
+
+void ML_(img_suspend)(DiImage* img)
+{
+   struct vg_stat stat_buf;
+
+   vg_assert(img != NULL);
+   vg_assert(img->source.is_local);
+   vg_assert(img->source.fd >= 0);
+
+   img->source.id_known = VG_(fstat)(img->source.fd, &stat_buf) == 0;
+   if (img->source.id_known) {
+      img->source.dev        = stat_buf.dev;
+      img->source.ino        = stat_buf.ino;
+      img->source.mtime      = stat_buf.mtime;
+      img->source.mtime_nsec = stat_buf.mtime_nsec;
+   }
+   close_cache(img);
+   VG_(close)(img->source.fd);
+   img->source.fd = -1;
+}
+
+Bool ML_(img_resume)(DiImage* img)
+{
+   SysRes         fd;
+   struct vg_stat stat_buf;
+
+   vg_assert(img != NULL);
+   vg_assert(img->source.is_local);
+   vg_assert(img->source.fd == -1);
+   vg_assert(img->ces_used == 0);
+
+   if (!img->source.id_known)
+      return False;
+   fd = VG_(open)(img->source.name, VKI_O_RDONLY, 0);
+   if (sr_isError(fd))
+      return False;
+   if (VG_(fstat)(sr_Res(fd), &stat_buf) != 0
+       || stat_buf.dev != img->source.dev
+       || stat_buf.ino != img->source.ino
+       || stat_buf.mtime != img->source.mtime
+       || stat_buf.mtime_nsec != img->source.mtime_nsec
+       || (SizeT)stat_buf.size != img->real_size) {
+      VG_(close)(sr_Res(fd));
+      return False;
+   }
+   img->source.fd = sr_Res(fd);
+
+   open_cache(img);
+   return True;
+}
+
+void ML_(img_will_need)(DiImage* img, DiOffT offset, SizeT size)
+{
+   vg_assert(img != NULL);
+   vg_assert(offset != DiOffT_INVALID);
+   if (offset >= img->real_size) {
+      /* A compressed slice: it is its compressed data that is read. */
+      const CSlc* cslc = find_cslc(img, offset);
+      if (cslc == NULL)
+         return;
+      offset = cslc->offC;
+      size   = cslc->szC;
+   }
+   if (offset >= img->map_size || size == 0)
+      return;
+   if (size > img->map_size - offset)
+      size = img->map_size - offset;
+#  if defined(VGO_linux)
+   Addr start = VG_PGROUNDDN((Addr)&img->map[offset]);
+   Addr end   = VG_PGROUNDUP((Addr)&img->map[offset] + size);
+   (void)VG_(do_syscall3)(__NR_madvise, start, end - start,
+                          VKI_MADV_WILLNEED);
+#  endif
+}
+
 DiOffT ML_(img_size)(const DiImage* img)
 {
    vg_assert(img != NULL);
@@ -1143,6 +1518,10 @@ void ML_(img_get)(/*OUT*/void* dst,
    vg_assert(img != NULL);
    vg_assert(size > 0);
    ensure_valid(img, offset, size, "ML_(img_get)");
+   if (offset + size <= img->map_size) {
+      VG_(memcpy)(dst, &img->map[offset], size);
+      return;
+   }
    SizeT i;
    for (i = 0; i < size; i++) {
       ((UChar*)dst)[i] = get(img, offset + i);
@@ -1155,6 +1534,12 @@ SizeT ML_(img_get_some)(/*OUT*/void* dst,
    vg_assert(img != NULL);
    vg_assert(size > 0);
    ensure_valid(img, offset, size, "ML_(img_get_some)");
+   if (offset < img->map_size) {
+      SizeT nToCopy = img->map_size - offset;
+      if (nToCopy > size) nToCopy = size;
+      VG_(memcpy)(dst, &img->map[offset], nToCopy);
+      return nToCopy;
+   }
    UChar* dstU = (UChar*)dst;
    /* Use |get| in the normal way to get the first byte of the range.
       This guarantees to put the cache entry containing |offset| in
@@ -0,0 +1,68 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Persistent cache of canonicalised debug info.                ---*/
+/*---                                               priv_dicache.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __PRIV_DICACHE_H
+#define __PRIV_DICACHE_H
+
+#include "pub_core_basics.h"    // Bool
+
+struct _DebugInfo;
+
+/* With --debuginfo-cache=<dir>, the symbol, line number, inline and
+   CFI tables of an object having a build-id are saved, once
+   canonicalised, in a file of <dir> named after the build-id.  Later
+   runs map that file read-only and rebuild the tables from it,
+   without reading the object's symbol tables and DWARF at all.
+
+   Can the tables of di be loaded from, or saved to, the cache?  Not
+   if the cache is disabled, nor if the user wants to see the info
+   being read, nor if variable info is read, as it is not cached. */
+extern Bool ML_(dicache_enabled) ( const struct _DebugInfo* di );
+
+/* Set di->cache_name to the name of di's entry in the cache, for an
+   object with the given build-id, and whose debug info is read from
+   a separate debug file and/or an alternate debug file. */
+extern void ML_(dicache_set_name) ( struct _DebugInfo* di,
+                                    const HChar* buildid,
+                                    Bool with_debug_file,
+                                    Bool with_alt_file );
+
+/* Try to load di's tables from its cache entry, di->cache_name.  On
+   success, the tables are ready for use (canonicalised), the entry
+   stays mapped until di is freed, di->cache_name is freed and set to
+   NULL, and True is returned.  Otherwise, di is unchanged. */
+extern Bool ML_(dicache_load) ( struct _DebugInfo* di );
+
+/* Save di's canonicalised tables to its cache entry, di->cache_name,
+   which is then freed and set to NULL.  Failures are silently
+   ignored, except for a message at -v. */
+extern void ML_(dicache_save) ( struct _DebugInfo* di );
+
+#endif /* ndef __PRIV_DICACHE_H */
+
+/*--------------------------------------------------------------------*/
+/*--- end                                           priv_dicache.h ---*/
+/*--------------------------------------------------------------------*/
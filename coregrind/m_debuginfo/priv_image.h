@@ -77,6 +77,24 @@ void ML_(img_free)(DiImage*);
 /* Destroy an existing image. */
 void ML_(img_done)(DiImage*);
 
+/* Is the image made from a local file? */
+Bool ML_(img_is_local)(const DiImage* img);
+
+/* Close the file of an image made from a local file, and free its
+   cache, so that the image costs little until it is needed again.
+   Its size and compressed parts are kept, so that slices of it remain
+   valid once it is reopened by ML_(img_resume). */
+void ML_(img_suspend)(DiImage* img);
+
+/* Reopen a suspended image.  Returns False, leaving it suspended, if
+   the file can't be reopened or is not the same file anymore. */
+Bool ML_(img_resume)(DiImage* img);
+
+/* Hint that [offset, +size) is about to be read, so that a mapped
+   file can be read ahead, asynchronously.  For a compressed slice, the
+   whole of its compressed data is read ahead. */
+void ML_(img_will_need)(DiImage* img, DiOffT offset, SizeT size);
+
 /* Virtual size of the image. */
 DiOffT ML_(img_size)(const DiImage* img);
 
@@ -52,6 +52,14 @@ extern Bool ML_(is_elf_object_file)( const void* image, SizeT n_image,
 */
 extern Bool ML_(read_elf_debug_info) ( DebugInfo* di );
 
+/* With --lazy-debuginfo=yes, ML_(read_elf_debug_info) only reads the
+   symbols and the unwind info.  The reading of the line number, inline
+   and variable info is deferred (di->deferred != NULL) until
+   ML_(read_elf_deferred_debug_info) is called, when it is first
+   needed.  ML_(free_elf_deferred_debug_info) releases it unread. */
+extern void ML_(read_elf_deferred_debug_info) ( DebugInfo* di );
+extern void ML_(free_elf_deferred_debug_info) ( DebugInfo* di );
+
 extern Bool ML_(check_elf_and_get_rw_loads) ( Int fd, const HChar* filename, Int * rw_load_count );
 
 
@@ -603,6 +603,9 @@ struct _DebugInfoFSM
 
 /* So, the main structure for holding debug info for one object. */
 
+/* Opaque, defined in readelf.c. */
+typedef  struct _DiDeferred  DiDeferred;
+
 struct _DebugInfo {
 
    /* Admin stuff */
@@ -678,6 +681,21 @@ struct _DebugInfo {
       invalid and should not be consulted. */
    Bool  have_dinfo; /* initially False */
 
+   /* The line number, inline and variable info whose reading has been
+      deferred until it is first needed (--lazy-debuginfo=yes), or NULL
+      if there is none, or once it has been read.  See
+      ML_(read_elf_deferred_debug_info). */
+   DiDeferred* deferred;
+
+   /* With --debuginfo-cache=<dir>: the name of di's entry in the
+      cache, if the info read is to be saved in it once canonicalised,
+      or NULL.  If instead the info was loaded from the cache, the
+      entry stays mapped at [cache_avma, +cache_szB) while di exists,
+      as the strings of the info are in it.  See priv_dicache.h. */
+   HChar* cache_name;
+   Addr   cache_avma;
+   SizeT  cache_szB;
+
    /* All the rest of the fields in this structure are filled in once
       we have committed to reading the symbols and debug info (that
       is, at the point where .have_dinfo is set to True). */
@@ -975,7 +993,15 @@ struct _DebugInfo {
       Also includes summary address bounds, showing the min and max address
       covered by any of the records, as an aid to fast searching.  And, if the
       records require any expression nodes, they are stored in
-      cfsi_exprs. */
+      cfsi_exprs.
+
+      Finally, cfsi_dir is a directory of cfsi_base, splitting
+      [cfsi_minavma,cfsi_maxavma] into cfsi_dir_n chunks ("pages") of
+      1 << cfsi_dir_shift bytes, with the page size chosen so that a
+      page holds a few entries.  cfsi_dir[p] is the index of the entry
+      containing the first byte of page p (or 0), so the entry for an
+      address in page p is in cfsi_dir[p] .. cfsi_dir[p+1].  cfsi_dir
+      has cfsi_dir_n+1 elements, and is NULL if it would be too big. */
    Addr* cfsi_base;
    UInt  sizeof_cfsi_m_ix; /* size in byte of indexes stored in cfsi_m_ix. */
    void* cfsi_m_ix; /* Each index occupies sizeof_cfsi_m_ix bytes.
@@ -990,6 +1016,9 @@ struct _DebugInfo {
    DedupPoolAlloc *cfsi_m_pool;
    Addr    cfsi_minavma;
    Addr    cfsi_maxavma;
+   UInt*   cfsi_dir;
+   UWord   cfsi_dir_n;
+   UInt    cfsi_dir_shift;
    XArray* cfsi_exprs; /* XArray of CfiExpr */
 
    /* Optimized code under Wine x86: MSVC++ PDB FramePointerOmitted
@@ -1142,6 +1171,10 @@ extern void ML_(addVar)( struct _DebugInfo* di,
    this after finishing adding entries to these tables. */
 extern void ML_(canonicaliseTables) ( struct _DebugInfo* di );
 
+/* Canonicalise the tables filled in by the reading of deferred debug
+   info, in preparation for use. */
+extern void ML_(canonicaliseDeferredTables) ( struct _DebugInfo* di );
+
 /* Canonicalise the call-frame-info table held by 'di', in preparation
    for use. This is called by ML_(canonicaliseTables) but can also be
    called on it's own to sort just this table. */
@@ -1151,6 +1184,11 @@ extern void ML_(canonicaliseCFI) ( struct _DebugInfo* di );
    from cfsi_rd array. cfsi_rd is then freed. */
 extern void ML_(finish_CFSI_arrays) ( struct _DebugInfo* di );
 
+/* ML_(make_CFSI_dir) builds the directory of the cfsi_base array.
+   Called by ML_(finish_CFSI_arrays), or once the cfsi_base array is
+   loaded from the debuginfo cache. */
+extern void ML_(make_CFSI_dir) ( struct _DebugInfo* di );
+
 /* ------ Searching ------ */
 
 /* Find a symbol-table index containing the specified pointer, or -1
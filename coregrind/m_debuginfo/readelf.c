@@ -55,6 +55,7 @@
 #include "priv_readdwarf.h"        /* 'cos ELF contains DWARF */
 #include "priv_readdwarf3.h"
 #include "priv_readexidx.h"
+#include "priv_dicache.h"
 #include "config.h"
 
 /* --- !!! --- EXTERNAL HEADERS start --- !!! --- */
@@ -1871,6 +1872,128 @@ static HChar* readlink_path (const HChar *path)
    supplied DebugInfo.
 */
 
+/* The DWARF sections holding line number, inline and variable info,
+   and the images they are in.  With --lazy-debuginfo=yes, these are
+   kept in di->deferred, with the images suspended, until the info is
+   first needed. */
+struct _DiDeferred {
+   DiImage* mimg;
+   DiImage* dimg;
+   DiImage* aimg;
+   DiSlice  debug_info;
+   DiSlice  debug_types;
+   DiSlice  debug_abbv;
+   DiSlice  debug_line;
+   DiSlice  debug_str;
+   DiSlice  debug_ranges;
+   DiSlice  debug_rnglists;
+   DiSlice  debug_loclists;
+   DiSlice  debug_loc;
+   DiSlice  debug_info_alt;
+   DiSlice  debug_abbv_alt;
+   DiSlice  debug_line_alt;
+   DiSlice  debug_str_alt;
+   DiSlice  debug_line_str;
+   DiSlice  debug_addr;
+   DiSlice  debug_str_offsets;
+};
+
+/* Hint that a section is about to be read, so that its image reads it
+   ahead while the sections before it are being parsed. */
+static void will_need ( DiSlice sli )
+{
+   if (ML_(sli_is_valid)(sli) && sli.szB > 0)
+      ML_(img_will_need)(sli.img, sli.ioff, sli.szB);
+}
+
+static void read_elf_dwarf3 ( struct _DebugInfo* di, const DiDeferred* dd )
+{
+   /* Both readers go through these sequentially. */
+   will_need(dd->debug_info);
+   will_need(dd->debug_abbv);
+   will_need(dd->debug_line);
+   will_need(dd->debug_str);
+   /* The old reader: line numbers and unwind info only */
+   ML_(read_debuginfo_dwarf3) ( di,
+                                dd->debug_info,
+                                dd->debug_types,
+                                dd->debug_abbv,
+                                dd->debug_line,
+                                dd->debug_str,
+                                dd->debug_str_alt,
+                                dd->debug_line_str );
+   /* The new reader: read the DIEs in .debug_info to acquire
+      information on variable types and locations or inline info.
+      But only if the tool asks for it, or the user requests it on
+      the command line. */
+   if (VG_(clo_read_var_info) /* the user or tool asked for it */
+       || VG_(clo_read_inline_info)) {
+      ML_(new_dwarf3_reader)(
+         di, dd->debug_info,     dd->debug_types,
+             dd->debug_abbv,     dd->debug_line,
+             dd->debug_str,      dd->debug_ranges,
+             dd->debug_rnglists, dd->debug_loclists,
+             dd->debug_loc,      dd->debug_info_alt,
+             dd->debug_abbv_alt, dd->debug_line_alt,
+             dd->debug_str_alt,  dd->debug_line_str,
+             dd->debug_addr,     dd->debug_str_offsets
+      );
+   }
+}
+
+/* Should the reading of di's DWARF info from these images be
+   deferred?  Not if the images can't be suspended, nor if the info is
+   to be saved in the debuginfo cache, nor if the user wants to see
+   the info being read. */
+static Bool defer_elf_dwarf3 ( const struct _DebugInfo* di,
+                               const DiDeferred* dd )
+{
+   return VG_(clo_lazy_debuginfo)
+          && di->cache_name == NULL
+          && !di->trace_symtab && !di->ddump_line
+          && (dd->mimg == NULL || ML_(img_is_local)(dd->mimg))
+          && (dd->dimg == NULL || ML_(img_is_local)(dd->dimg))
+          && (dd->aimg == NULL || ML_(img_is_local)(dd->aimg));
+}
+
+static void free_DiDeferred ( DiDeferred* dd )
+{
+   if (dd->mimg) ML_(img_done)(dd->mimg);
+   if (dd->dimg) ML_(img_done)(dd->dimg);
+   if (dd->aimg) ML_(img_done)(dd->aimg);
+   ML_(dinfo_free)(dd);
+}
+
+void ML_(read_elf_deferred_debug_info) ( struct _DebugInfo* di )
+{
+   DiDeferred* dd = di->deferred;
+   Bool        ok = True;
+
+   vg_assert(dd != NULL);
+   vg_assert(di->have_dinfo);
+   /* Nothing below must find it still deferred. */
+   di->deferred = NULL;
+
+   if (dd->mimg && !ML_(img_resume)(dd->mimg)) ok = False;
+   if (dd->dimg && !ML_(img_resume)(dd->dimg)) ok = False;
+   if (dd->aimg && !ML_(img_resume)(dd->aimg)) ok = False;
+   if (ok)
+      read_elf_dwarf3(di, dd);
+   else
+      ML_(symerr)(di, True, "File changed since it was mapped: "
+                            "no line number, inline or variable info.");
+   free_DiDeferred(dd);
+
+   ML_(canonicaliseDeferredTables)(di);
+}
+
+void ML_(free_elf_deferred_debug_info) ( struct _DebugInfo* di )
+{
+   vg_assert(di->deferred != NULL);
+   free_DiDeferred(di->deferred);
+   di->deferred = NULL;
+}
+
 Bool ML_(read_elf_debug_info) ( struct _DebugInfo* di )
 {
    /* This function is long and complex.  That, and the presence of
@@ -1947,6 +2070,10 @@ Bool ML_(read_elf_debug_info) ( struct _DebugInfo* di )
 
    XArray* /* of RangeAndBias */ svma_ranges = NULL;
 
+   /* The build-id of the object, if its tables can be loaded from or
+      saved to the debuginfo cache. */
+   HChar* cache_buildid = NULL;
+
 #  if defined(SOLARIS_PT_SUNDWTRACE_THRP)
    Addr dtrace_data_vaddr = 0;
 #  endif
@@ -3073,7 +3200,10 @@ Bool ML_(read_elf_debug_info) ( struct _DebugInfo* di )
       }
 
       if (buildid) {
-         ML_(dinfo_free)(buildid);
+         if (ML_(dicache_enabled)(di))
+            cache_buildid = buildid;
+         else
+            ML_(dinfo_free)(buildid);
          buildid = NULL; /* paranoia */
       }
 
@@ -3494,6 +3624,18 @@ Bool ML_(read_elf_debug_info) ( struct _DebugInfo* di )
       } /* do we have a debug image? */
 
 
+      /* TOPLEVEL */
+      /* Now that we know where the info comes from: if the tables
+         read from it are in the debuginfo cache, we are done. */
+      if (cache_buildid) {
+         ML_(dicache_set_name)(di, cache_buildid,
+                               dimg != NULL, aimg != NULL);
+         if (ML_(dicache_load)(di)) {
+            res = True;
+            goto out;
+         }
+      }
+
       /* TOPLEVEL */
       /* Check some sizes */
       vg_assert((dynsym_escn.szB % sizeof(ElfXX_Sym)) == 0);
@@ -3557,31 +3699,33 @@ Bool ML_(read_elf_debug_info) ( struct _DebugInfo* di )
       if (ML_(sli_is_valid)(debug_info_escn) 
           && ML_(sli_is_valid)(debug_abbv_escn)
           && ML_(sli_is_valid)(debug_line_escn)) {
-         /* The old reader: line numbers and unwind info only */
-         ML_(read_debuginfo_dwarf3) ( di,
-                                      debug_info_escn,
-                                      debug_types_escn,
-                                      debug_abbv_escn,
-                                      debug_line_escn,
-                                      debug_str_escn,
-                                      debug_str_alt_escn,
-                                      debug_line_str_escn);
-         /* The new reader: read the DIEs in .debug_info to acquire
-            information on variable types and locations or inline info.
-            But only if the tool asks for it, or the user requests it on
-            the command line. */
-         if (VG_(clo_read_var_info) /* the user or tool asked for it */
-             || VG_(clo_read_inline_info)) {
-            ML_(new_dwarf3_reader)(
-               di, debug_info_escn,     debug_types_escn,
-                   debug_abbv_escn,     debug_line_escn,
-                   debug_str_escn,      debug_ranges_escn,
-                   debug_rnglists_escn, debug_loclists_escn,
-                   debug_loc_escn,      debug_info_alt_escn,
-                   debug_abbv_alt_escn, debug_line_alt_escn,
-                   debug_str_alt_escn,  debug_line_str_escn,
-                   debug_addr_escn,     debug_str_offsets_escn
-            );
+         DiDeferred dd;
+         dd.mimg              = mimg;
+         dd.dimg              = dimg;
+         dd.aimg              = aimg;
+         dd.debug_info        = debug_info_escn;
+         dd.debug_types       = debug_types_escn;
+         dd.debug_abbv        = debug_abbv_escn;
+         dd.debug_line        = debug_line_escn;
+         dd.debug_str         = debug_str_escn;
+         dd.debug_ranges      = debug_ranges_escn;
+         dd.debug_rnglists    = debug_rnglists_escn;
+         dd.debug_loclists    = debug_loclists_escn;
+         dd.debug_loc         = debug_loc_escn;
+         dd.debug_info_alt    = debug_info_alt_escn;
+         dd.debug_abbv_alt    = debug_abbv_alt_escn;
+         dd.debug_line_alt    = debug_line_alt_escn;
+         dd.debug_str_alt     = debug_str_alt_escn;
+         dd.debug_line_str    = debug_line_str_escn;
+         dd.debug_addr        = debug_addr_escn;
+         dd.debug_str_offsets = debug_str_offsets_escn;
+         if (defer_elf_dwarf3(di, &dd)) {
+            /* The images are suspended and handed over below. */
+            di->deferred = ML_(dinfo_zalloc)("di.redi.defer.1",
+                                             sizeof(DiDeferred));
+            *di->deferred = dd;
+         } else {
+            read_elf_dwarf3(di, &dd);
          }
       }
 
@@ -3666,12 +3810,27 @@ Bool ML_(read_elf_debug_info) ( struct _DebugInfo* di )
 
   out: 
    {
-      /* Last, but not least, detach from the image(s). */
+      /* Last, but not least, detach from the image(s), unless the
+         DWARF info they hold is to be read later. */
+      if (di->deferred != NULL && res) {
+         if (mimg) ML_(img_suspend)(mimg);
+         if (dimg) ML_(img_suspend)(dimg);
+         if (aimg) ML_(img_suspend)(aimg);
+         mimg = dimg = aimg = NULL;
+      } else if (di->deferred != NULL) {
+         ML_(dinfo_free)(di->deferred);
+         di->deferred = NULL;
+      }
       if (mimg) ML_(img_done)(mimg);
       if (dimg) ML_(img_done)(dimg);
       if (aimg) ML_(img_done)(aimg);
 
       if (svma_ranges) VG_(deleteXA)(svma_ranges);
+      if (cache_buildid) ML_(dinfo_free)(cache_buildid);
+      if (!res && di->cache_name) {
+         ML_(dinfo_free)(di->cache_name);
+         di->cache_name = NULL;
+      }
 
       return res;
    } /* out: */ 
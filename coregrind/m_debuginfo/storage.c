@@ -2302,6 +2302,50 @@ void ML_(canonicaliseCFI) ( struct _DebugInfo* di )
    }
 }
 
+/* Build di->cfsi_dir, so that ML_(search_one_cfitab) only has to
+   binary search the few entries of one page.  The page size is the
+   smallest power of 2 giving no more than one page for every
+   CFSI_DIR_DENSITY entries, but at least 1 << CFSI_DIR_MIN_SHIFT
+   bytes: the directory is then much smaller than cfsi_base. */
+#define CFSI_DIR_DENSITY   4
+#define CFSI_DIR_MIN_SHIFT 6
+
+void ML_(make_CFSI_dir) ( struct _DebugInfo* di )
+{
+   UInt  shift;
+   UWord n, p, i;
+   Addr  first_page;
+
+   vg_assert (di->cfsi_dir == NULL);
+   if (di->cfsi_used < 2 * CFSI_DIR_DENSITY)
+      return;
+
+   for (shift = CFSI_DIR_MIN_SHIFT; shift < 8 * sizeof(Addr); shift++) {
+      n = (di->cfsi_maxavma >> shift) - (di->cfsi_minavma >> shift) + 1;
+      if (n <= di->cfsi_used / CFSI_DIR_DENSITY)
+         break;
+   }
+   /* The ranges covered can be sparse: don't use more than one UInt
+      of directory for each entry. */
+   if (shift == 8 * sizeof(Addr) || (UInt)di->cfsi_used != di->cfsi_used)
+      return;
+
+   di->cfsi_dir_shift = shift;
+   di->cfsi_dir_n     = n;
+   di->cfsi_dir       = ML_(dinfo_zalloc)( "di.storage.mcd.1",
+                                           (n + 1) * sizeof(UInt) );
+   first_page = di->cfsi_minavma >> shift;
+   i = 0;
+   for (p = 0; p < n; p++) {
+      Addr page_start = (first_page + p) << shift;
+      while (i + 1 < di->cfsi_used && di->cfsi_base[i + 1] <= page_start)
+         i++;
+      di->cfsi_dir[p] = i;
+   }
+   /* All entries start before the page following cfsi_maxavma. */
+   di->cfsi_dir[n] = di->cfsi_used - 1;
+}
+
 void ML_(finish_CFSI_arrays) ( struct _DebugInfo* di )
 {
    UWord n_mergeables, n_holes;
@@ -2387,6 +2431,8 @@ void ML_(finish_CFSI_arrays) ( struct _DebugInfo* di )
    di->cfsi_size = new_used;
    ML_(dinfo_free) (di->cfsi_rd);
    di->cfsi_rd = NULL;
+
+   ML_(make_CFSI_dir) (di);
 }
 
 
@@ -2401,6 +2447,21 @@ void ML_(canonicaliseTables) ( struct _DebugInfo* di )
    if (di->cfsi_m_pool)
       VG_(freezeDedupPA) (di->cfsi_m_pool, ML_(dinfo_shrink_block));
    canonicaliseVarInfo ( di );
+   /* Deferred reading will add to the string and file name pools. */
+   if (di->deferred)
+      return;
+   if (di->strpool)
+      VG_(freezeDedupPA) (di->strpool, ML_(dinfo_shrink_block));
+   if (di->fndnpool)
+      VG_(freezeDedupPA) (di->fndnpool, ML_(dinfo_shrink_block));
+}
+
+void ML_(canonicaliseDeferredTables) ( struct _DebugInfo* di )
+{
+   vg_assert (di->deferred == NULL);
+   canonicaliseLoctab ( di );
+   canonicaliseInltab ( di );
+   canonicaliseVarInfo ( di );
    if (di->strpool)
       VG_(freezeDedupPA) (di->strpool, ML_(dinfo_shrink_block));
    if (di->fndnpool)
@@ -2474,6 +2535,16 @@ Word ML_(search_one_cfitab) ( const DebugInfo* di, Addr ptr )
         lo = 0, 
         hi = di->cfsi_used-1;
 
+   if (di->cfsi_dir != NULL && ptr >= di->cfsi_minavma) {
+      /* Only search the entries of ptr's page. */
+      UWord p = (ptr >> di->cfsi_dir_shift)
+                - (di->cfsi_minavma >> di->cfsi_dir_shift);
+      if (p < di->cfsi_dir_n) {
+         lo = di->cfsi_dir[p];
+         hi = di->cfsi_dir[p + 1];
+      }
+   }
+
    while (lo <= hi) {
       /* Invariants : hi == cfsi_used-1 || ptr < cfsi_base[hi+1]
                       lo == 0           || ptr > cfsi_base[lo-1]
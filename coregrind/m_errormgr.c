@@ -39,6 +39,7 @@
 #include "pub_core_libcfile.h"
 #include "pub_core_libcprint.h"
 #include "pub_core_libcproc.h"         // For VG_(getpid)()
+#include "pub_core_machine.h"          // For VG_(get_IP)()
 #include "pub_core_seqmatch.h"
 #include "pub_core_mallocfree.h"
 #include "pub_core_options.h"
@@ -76,6 +77,26 @@ static Error* errors = NULL;
 static Supp* suppressions = NULL;
 static Bool load_suppressions_called = False;
 
+/* Index of the suppressions, on the name in their first (innermost)
+   frame.  A suppression whose first frame is a plain "fun:" or "obj:"
+   name (no wildcards) can only match an error whose innermost function
+   or object has that name, so is placed in the supp_index chain for
+   that name.  All other suppressions are in supp_unindexed.
+   is_suppressible_error() then only has to look at the two chains for
+   the error's innermost function and object names, and at
+   supp_unindexed. */
+#define N_SUPP_INDEX_CHAINS 1021
+static Supp* supp_index[N_SUPP_INDEX_CHAINS];
+static Supp* supp_unindexed = NULL;
+
+/* Number of suppressions in supp_index with a "fun:" and an "obj:"
+   first frame. */
+static UInt n_supp_index_fun = 0;
+static UInt n_supp_index_obj = 0;
+
+/* Stamp of the suppression at the head of the list. */
+static UWord supp_stamp = 0;
+
 /* Running count of unsuppressed errors detected. */
 static UInt n_errs_found = 0;
 
@@ -111,6 +132,9 @@ static UWord em_supplist_searches = 0;
    searching. */
 static UWord em_supplist_cmps = 0;
 
+/* Stats: number of errors found suppressed by supp_ip_cache. */
+static UWord em_supp_ip_cache_hits = 0;
+
 /*------------------------------------------------------------*/
 /*--- Error type                                           ---*/
 /*------------------------------------------------------------*/
@@ -225,6 +249,14 @@ typedef
    (0..)) for 'skind'. */
 struct _Supp {
    struct _Supp* next;
+   struct _Supp* prev;
+   // Links in the chain of supp_index (or supp_unindexed) holding this
+   // suppression.  Like the main list, chains are in decreasing stamp
+   // order.
+   struct _Supp* chain_next;
+   struct _Supp* chain_prev;
+   // Higher stamps are nearer the head of the suppressions list.
+   UWord stamp;
    Int count;     // The number of times this error has been suppressed.
    HChar* sname;  // The name by which the suppression is referred to.
 
@@ -412,10 +444,11 @@ static void gen_suppression(const Error* err)
    UInt n_ips = VG_(get_ExeContext_n_ips)(ec);
    vg_assert(n_ips > 0);
    vg_assert(n_ips <= VG_DEEPEST_BACKTRACE);
+   Addr ips[n_ips];
+   VG_(get_ExeContext_ips)(ec, 0, n_ips, ips);
    VG_(apply_StackTrace)(printSuppForIp_nonXML,
                          text, VG_(get_ExeContext_epoch)(ec),
-                         VG_(get_ExeContext_StackTrace)(ec),
-                         n_ips);
+                         ips, n_ips);
 
    VG_(xaprintf)(text, "}\n");
    // zero terminate
@@ -443,8 +476,7 @@ static void gen_suppression(const Error* err)
       // Print stack trace elements
       VG_(apply_StackTrace)(printSuppForIp_XML,
                             NULL, VG_(get_ExeContext_epoch)(ec),
-                            VG_(get_ExeContext_StackTrace)(ec),
-                            VG_(get_ExeContext_n_ips)(ec));
+                            ips, n_ips);
 
       // And now the cdata bit
       // XXX FIXME!  properly handle the case where the raw text
@@ -677,6 +709,93 @@ void construct_error ( Error* err, ThreadId tid, ErrorKind ekind, Addr a,
 
 
 
+/* A small direct-mapped cache of the instructions at which errors of a
+   given kind are known to be suppressed, whatever the rest of the stack
+   looks like.  This is the case when the matching suppression only
+   constrains the innermost frame (see supp_depends_only_on_ip).  A hit
+   lets VG_(maybe_record_error) skip both the stack unwind and the
+   suppression matching, which dominate the cost of an error that is
+   reported (and suppressed) millions of times.  The occurrence is
+   counted against the first error context recorded at the instruction.
+
+   Entries are tagged with the debuginfo epoch, so that they become
+   stale when code is unmapped or mapped. */
+#define N_SUPP_IP_CACHE 1024
+
+typedef
+   struct {
+      Addr      ip;
+      ErrorKind ekind;
+      UInt      epoch;
+      Error*    err;  // NULL if the entry is unused
+   }
+   SuppIPCacheEnt;
+
+static SuppIPCacheEnt supp_ip_cache[N_SUPP_IP_CACHE];
+
+static Bool supp_depends_only_on_ip ( const Supp* su );
+
+static inline UWord supp_ip_cache_ix ( Addr ip, ErrorKind ekind )
+{
+   return ((ip >> 1) ^ (ip >> 11) ^ (UWord)ekind) % N_SUPP_IP_CACHE;
+}
+
+/* Return the suppressed error record matching an error of kind EKIND
+   at the current instruction of TID, or NULL if there is none. */
+static Error* lookup_supp_ip_cache ( ThreadId tid, VgRes exe_res,
+                                     ErrorKind ekind, Addr a,
+                                     const HChar* s, void* extra )
+{
+   Addr            ip  = VG_(get_IP)(tid);
+   SuppIPCacheEnt* ent = &supp_ip_cache[supp_ip_cache_ix(ip, ekind)];
+   Error           err;
+
+   if (ent->err == NULL || ent->ip != ip || ent->ekind != ekind
+       || ent->epoch != VG_(current_DiEpoch)().n)
+      return NULL;
+
+   /* The suppression does not depend on the stack beyond IP, so the
+      error is suppressed if the tool considers it the same as the
+      cached one apart from its stack. */
+   err.next   = NULL;
+   err.unique = 0;
+   err.supp   = NULL;
+   err.count  = 1;
+   err.tid    = tid;
+   err.where  = ent->err->where;
+   err.ekind  = ekind;
+   err.addr   = a;
+   err.string = s;
+   err.extra  = extra;
+   if (!eq_Error(exe_res, ent->err, &err))
+      return NULL;
+
+   em_supp_ip_cache_hits++;
+   return ent->err;
+}
+
+/* Note that the suppressed error P, whose stack trace is WHERE, was
+   just seen in thread TID. */
+static void update_supp_ip_cache ( ThreadId tid, Error* p, ExeContext* where )
+{
+   Addr            ip, where_ip;
+   SuppIPCacheEnt* ent;
+
+   vg_assert(p->supp != NULL);
+   if (!supp_depends_only_on_ip(p->supp))
+      return;
+   ip = VG_(get_IP)(tid);
+   VG_(get_ExeContext_ips)(where, 0, 1, &where_ip);
+   if (where_ip != ip)
+      return;
+
+   ent = &supp_ip_cache[supp_ip_cache_ix(ip, p->ekind)];
+   ent->ip    = ip;
+   ent->ekind = p->ekind;
+   ent->epoch = VG_(current_DiEpoch)().n;
+   ent->err   = p;
+}
+
 /* Top-level entry point to the error management subsystem.
    All detected errors are notified here; this routine decides if/when the
    user should see the error. */
@@ -753,6 +872,16 @@ void VG_(maybe_record_error) ( ThreadId tid,
       }
    }
 
+   /* Errors of this kind at this instruction may be known to be
+      suppressed; if so there is no need to even build the error. */
+   p = lookup_supp_ip_cache ( tid, exe_res, ekind, a, s, extra );
+   if (p != NULL) {
+      p->count++;
+      p->supp->count++;
+      n_errs_suppressed++;
+      return;
+   }
+
    /* Build ourselves the error */
    construct_error ( &err, tid, ekind, a, s, extra, NULL );
 
@@ -769,6 +898,7 @@ void VG_(maybe_record_error) ( ThreadId tid,
             /* Deal correctly with suppressed errors. */
             p->supp->count++;
             n_errs_suppressed++;	 
+            update_supp_ip_cache(tid, p, err.where);
          } else {
             n_errs_found++;
          }
@@ -852,6 +982,7 @@ void VG_(maybe_record_error) ( ThreadId tid,
       n_supp_contexts++;
       n_errs_suppressed++;
       p->supp->count++;
+      update_supp_ip_cache(tid, p, err.where);
    }
 }
 
@@ -1029,9 +1160,10 @@ void VG_(show_all_errors) (  Int verbosity, Bool xml )
       vg_assert(! xml);
 
       if ((i+1 == VG_(clo_dump_error))) {
-         StackTrace ips = VG_(get_ExeContext_StackTrace)(p_min->where);
+         Addr ip;
+         VG_(get_ExeContext_ips)(p_min->where, 0, 1, &ip);
          VG_(translate) ( 0 /* dummy ThreadId; irrelevant due to debugging*/,
-                          ips[0], /*debugging*/True, 0xFE/*verbosity*/,
+                          ip, /*debugging*/True, 0xFE/*verbosity*/,
                           /*bbs_done*/0,
                           /*allow redir?*/True);
       }
@@ -1270,6 +1402,86 @@ static Bool tool_name_present(const HChar *name, const HChar *names)
    return found;
 }
 
+/* Returns the supp_index chain number for a first frame of type TY
+   named NAME. */
+static UInt supp_index_chain ( SuppLocTy ty, const HChar* name )
+{
+   UInt h = ty;
+   while (*name)
+      h = (h << 5) + h + (UChar)*name++;
+   return h % N_SUPP_INDEX_CHAINS;
+}
+
+static Bool supp_is_indexed ( const Supp* su )
+{
+   return (su->callers[0].ty == FunName || su->callers[0].ty == ObjName)
+          && su->callers[0].name_is_simple_str;
+}
+
+static Supp** supp_chain_for ( const Supp* su )
+{
+   if (supp_is_indexed(su))
+      return &supp_index[supp_index_chain(su->callers[0].ty,
+                                          su->callers[0].name)];
+   else
+      return &supp_unindexed;
+}
+
+/* Put SU at the head of the suppressions list and of its chain. */
+static void push_suppression ( Supp* su )
+{
+   Supp** chain = supp_chain_for(su);
+
+   su->stamp = ++supp_stamp;
+
+   su->prev = NULL;
+   su->next = suppressions;
+   if (suppressions)
+      suppressions->prev = su;
+   suppressions = su;
+
+   su->chain_prev = NULL;
+   su->chain_next = *chain;
+   if (*chain)
+      (*chain)->chain_prev = su;
+   *chain = su;
+}
+
+static void add_suppression ( Supp* su )
+{
+   if (supp_is_indexed(su)) {
+      if (su->callers[0].ty == FunName)
+         n_supp_index_fun++;
+      else
+         n_supp_index_obj++;
+   }
+   push_suppression(su);
+}
+
+/* Move SU to the head of the suppressions list, in the hope of making
+   future searches cheaper. */
+static void move_suppression_to_front ( Supp* su )
+{
+   Supp** chain;
+
+   if (su == suppressions)
+      return;
+
+   chain = supp_chain_for(su);
+   vg_assert(su->prev != NULL);
+   su->prev->next = su->next;
+   if (su->next)
+      su->next->prev = su->prev;
+   if (su->chain_prev)
+      su->chain_prev->chain_next = su->chain_next;
+   else
+      *chain = su->chain_next;
+   if (su->chain_next)
+      su->chain_next->chain_prev = su->chain_prev;
+
+   push_suppression(su);
+}
+
 /* Read suppressions from the file specified in 
    VG_(clo_suppressions)[clo_suppressions_i]
    and place them in the suppressions list.  If there's any difficulty
@@ -1458,8 +1670,7 @@ static void load_one_suppressions_file ( Int clo_suppressions_i )
          supp->callers[i] = tmp_callers[i];
       }
 
-      supp->next = suppressions;
-      suppressions = supp;
+      add_suppression(supp);
    }
    VG_(free)(buf);
    VG_(close)(fd);
@@ -1491,6 +1702,10 @@ void VG_(load_suppressions) ( void )
 {
    Int i;
    suppressions = NULL;
+   supp_unindexed = NULL;
+   for (i = 0; i < N_SUPP_INDEX_CHAINS; i++)
+      supp_index[i] = NULL;
+   n_supp_index_fun = n_supp_index_obj = 0;
    load_suppressions_called = True;
    for (i = 0; i < VG_(sizeXA)(VG_(clo_suppressions)); i++) {
       if (VG_(clo_verbosity) > 1) {
@@ -1960,7 +2175,9 @@ Bool supp_matches_error(const Supp* su, const Error* err)
 static Supp* is_suppressible_error ( const Error* err )
 {
    Supp* su;
-   Supp* su_prev;
+   Supp* cands[3];
+   UInt  fun_chain = N_SUPP_INDEX_CHAINS;
+   Int   i, best;
 
    IPtoFunOrObjCompleter ip2fo;
    /* Conceptually, ip2fo contains an array of function names and an array of
@@ -1982,8 +2199,10 @@ static Supp* is_suppressible_error ( const Error* err )
 
    /* Prepare the lazy input completer. */
    ip2fo.epoch = VG_(get_ExeContext_epoch)(err->where);
-   ip2fo.ips = VG_(get_ExeContext_StackTrace)(err->where);
    ip2fo.n_ips = VG_(get_ExeContext_n_ips)(err->where);
+   Addr ips[ip2fo.n_ips];
+   VG_(get_ExeContext_ips)(err->where, 0, ip2fo.n_ips, ips);
+   ip2fo.ips = ips;
    ip2fo.n_ips_expanded = 0;
    ip2fo.n_expanded = 0;
    ip2fo.sz_offsets = 0;
@@ -1994,34 +2213,74 @@ static Supp* is_suppressible_error ( const Error* err )
    ip2fo.names_szB = 0;
    ip2fo.names_free = 0;
 
-   /* See if the error context matches any suppression. */
+   /* Find the chains of suppressions which can match: those indexed on
+      the innermost function and object names, and the unindexed ones.
+      The names are completed in ip2fo, so are not looked up again when
+      matching. */
+   cands[0] = supp_unindexed;
+   cands[1] = cands[2] = NULL;
+   if (n_supp_index_fun + n_supp_index_obj > 0
+       && haveInputInpC(&ip2fo, 0)) {
+      if (n_supp_index_fun > 0) {
+         fun_chain = supp_index_chain(FunName, foComplete(&ip2fo, 0, True));
+         cands[1] = supp_index[fun_chain];
+      }
+      if (n_supp_index_obj > 0) {
+         UInt obj_chain = supp_index_chain(ObjName,
+                                           foComplete(&ip2fo, 0, False));
+         if (obj_chain != fun_chain)
+            cands[2] = supp_index[obj_chain];
+      }
+   }
+
+   /* See if the error context matches any suppression.  The chains are
+      merged in stamp order, so that the suppressions are tried in the
+      same order as in the full list. */
    if (DEBUG_ERRORMGR || VG_(debugLog_getLevel)() >= 4)
      VG_(dmsg)("errormgr matching begin\n");
-   su_prev = NULL;
-   for (su = suppressions; su != NULL; su = su->next) {
+   while (True) {
+      best = -1;
+      for (i = 0; i < 3; i++) {
+         if (cands[i] != NULL
+             && (best == -1 || cands[i]->stamp > cands[best]->stamp))
+            best = i;
+      }
+      if (best == -1)
+         break;
+      su = cands[best];
+      cands[best] = su->chain_next;
+
       em_supplist_cmps++;
       if (supp_matches_error(su, err) 
           && supp_matches_callers(&ip2fo, su)) {
          /* got a match.  */
          /* Inform the tool that err is suppressed by su. */
          (void)VG_TDICT_CALL(tool_update_extra_suppression_use, err, su);
-         /* Move this entry to the head of the list
-            in the hope of making future searches cheaper. */
-         if (su_prev) {
-            vg_assert(su_prev->next == su);
-            su_prev->next = su->next;
-            su->next = suppressions;
-            suppressions = su;
-         }
+         move_suppression_to_front(su);
          clearIPtoFunOrObjCompleter(su, &ip2fo);
          return su;
       }
-      su_prev = su;
    }
    clearIPtoFunOrObjCompleter(NULL, &ip2fo);
    return NULL;      /* no matches */
 }
 
+/* Does the matching of SU against an error depend only on the error's
+   innermost frame (as opposed to the whole stack)?  The tool-specific
+   part of the matching does not look at the stack at all. */
+static Bool supp_depends_only_on_ip ( const Supp* su )
+{
+   Int i;
+
+   if (su->callers[0].ty == DotDotDot)
+      return False;
+   for (i = 1; i < su->n_callers; i++) {
+      if (su->callers[i].ty != DotDotDot)
+         return False;
+   }
+   return True;
+}
+
 /* Show accumulated error-list and suppression-list search stats. 
 */
 void VG_(print_errormgr_stats) ( void )
@@ -2030,6 +2289,10 @@ void VG_(print_errormgr_stats) ( void )
       " errormgr: %'lu supplist searches, %'lu comparisons during search\n",
       em_supplist_searches, em_supplist_cmps
    );
+   VG_(dmsg)(
+      " errormgr: %'lu suppressed errors found by instruction address\n",
+      em_supp_ip_cache_hits
+   );
    VG_(dmsg)(
       " errormgr: %'lu errlist searches, %'lu comparisons during search\n",
       em_errlist_searches, em_errlist_cmps
@@ -46,13 +46,28 @@
    suppression specifications.  If not used in comparison, the rest
    are purely informational (but often important).
 
+   The IPs themselves are stored in a table of frames.  A frame is an
+   IP together with the frame of its caller (its parent), and each
+   (IP, parent) pair is stored only once.  So the frames form a tree
+   rooted at the outermost callers, and stack traces which share their
+   outer frames (which is most of them: they typically all go through
+   main and a few levels below it) share their storage.  As each frame
+   is unique, the frame of the innermost IP identifies a stack trace.
+
    The contexts are stored in a traditional chained hash table, so as
    to allow quick determination of whether a new context already
-   exists.  The hash table starts small and expands dynamically, so as
+   exists.  Only when it does not are the frames of the new context
+   looked up (and added if needed) in a second hash table, over the
+   frames.  The hash tables start small and expand dynamically, so as
    to keep the load factor below 1.0.
 
    The idea is only to ever store any one context once, so as to save
-   space and make exact comparisons faster. */
+   space and make exact comparisons faster.
+
+   The IPs of a context are only copied into an array when asked for
+   by VG_(get_ExeContext_StackTrace) and friends, which for most
+   contexts (e.g. the allocation stacks of heap blocks) never
+   happens. */
 
 
 /* Primes for the hash table */
@@ -68,8 +83,20 @@ static SizeT ec_primes[N_EC_PRIMES] = {
 };
 
 
-/* Each element is present in a hash chain, and also contains a
-   variable length array of guest code addresses (the useful part). */
+/* A frame: an IP, and the number of the frame of its caller, or zero
+   if it is the outermost frame.  Frame number zero itself is not used.
+   Each frame is also present in a hash chain. */
+
+typedef
+   struct {
+      Addr ip;
+      UInt parent;
+      UInt chain;
+   }
+   EcFrame;
+
+/* Each element is present in a hash chain, and refers to its innermost
+   frame. */
 
 struct _ExeContext {
    struct _ExeContext* chain;
@@ -94,11 +121,14 @@ struct _ExeContext {
       epoch is changed to the last epoch identifying the set containing the
       archived debug info. */
    DiEpoch epoch;
-   /* Variable-length array.  The size is 'n_ips'; at
-      least 1, at most VG_DEEPEST_BACKTRACE.  [0] is the current IP,
-      [1] is its caller, [2] is the caller of [1], etc. */
+   /* Number of IPs: at least 1, at most VG_DEEPEST_BACKTRACE. */
    UInt n_ips;
-   Addr ips[0];
+   /* Number of the frame of the current IP.  Following the
+      parent links gives its caller, the caller of the caller, etc. */
+   UInt frame;
+   /* Array of the 'n_ips' IPs, or NULL if not yet needed.  [0] is the
+      current IP, [1] is its caller, [2] is the caller of [1], etc. */
+   Addr* ips;
 };
 
 
@@ -107,6 +137,16 @@ static ExeContext** ec_htab; /* array [ec_htab_size] of ExeContext* */
 static SizeT        ec_htab_size;     /* one of the values in ec_primes */
 static SizeT        ec_htab_size_idx; /* 0 .. N_EC_PRIMES-1 */
 
+/* The frames, allocated in chunks of EC_FRAMES_PER_CHUNK frames, and
+   the dynamically expanding hash table over them. */
+#define EC_FRAMES_PER_CHUNK 4096
+static EcFrame** ec_frame_chunks;      /* array [ec_frame_chunks_size] */
+static UInt      ec_frame_chunks_size;
+static UInt      ec_frames_used;       /* including unused frame 0 */
+static UInt*    ec_frame_htab;        /* array [ec_frame_htab_size] */
+static SizeT    ec_frame_htab_size;   /* one of the values in ec_primes */
+static SizeT    ec_frame_htab_size_idx; /* 0 .. N_EC_PRIMES-1 */
+
 /* ECU serial number */
 static UInt ec_next_ecu = 4; /* We must never issue zero */
 
@@ -127,6 +167,11 @@ static ULong ec_cmp2s;
 static ULong ec_cmp4s;
 static ULong ec_cmpAlls;
 
+/* Stats only: the total number of IPs in the stored contexts, and the
+   number of IPs copied to arrays on request. */
+static ULong ec_totips;
+static ULong ec_totips_copied;
+
 
 /*------------------------------------------------------------*/
 /*--- ExeContext functions.                                ---*/
@@ -147,6 +192,8 @@ static void init_ExeContext_storage ( void )
    ec_cmp2s = 0;
    ec_cmp4s = 0;
    ec_cmpAlls = 0;
+   ec_totips = 0;
+   ec_totips_copied = 0;
 
    ec_htab_size_idx = 0;
    ec_htab_size = ec_primes[ec_htab_size_idx];
@@ -155,6 +202,17 @@ static void init_ExeContext_storage ( void )
    for (i = 0; i < ec_htab_size; i++)
       ec_htab[i] = NULL;
 
+   ec_frame_chunks_size = 16;
+   ec_frame_chunks = VG_(malloc)("execontext.iEs2",
+                                 sizeof(EcFrame*) * ec_frame_chunks_size);
+   ec_frames_used = 1; /* frame 0 is not used */
+   ec_frame_htab_size_idx = 0;
+   ec_frame_htab_size = ec_primes[ec_frame_htab_size_idx];
+   ec_frame_htab = VG_(malloc)("execontext.iEs3",
+                               sizeof(UInt) * ec_frame_htab_size);
+   for (i = 0; i < ec_frame_htab_size; i++)
+      ec_frame_htab[i] = 0;
+
    {
       Addr ips[1];
       ips[0] = 0;
@@ -166,6 +224,37 @@ static void init_ExeContext_storage ( void )
    init_done = True;
 }
 
+static inline EcFrame* ec_frame ( UInt f )
+{
+   return &ec_frame_chunks[f / EC_FRAMES_PER_CHUNK][f % EC_FRAMES_PER_CHUNK];
+}
+
+/* Copy the IPs of EC into IPS, which must have room for EC->n_ips
+   elements. */
+static void get_ips ( const ExeContext* ec, Addr* ips )
+{
+   UInt i;
+   UInt f = ec->frame;
+   for (i = 0; i < ec->n_ips; i++) {
+      vg_assert(f != 0);
+      ips[i] = ec_frame(f)->ip;
+      f = ec_frame(f)->parent;
+   }
+   vg_assert(f == 0);
+}
+
+/* Return the array of the IPs of EC, creating it if needed. */
+static Addr* ec_ips ( ExeContext* ec )
+{
+   if (UNLIKELY(ec->ips == NULL)) {
+      ec->ips = VG_(perm_malloc)( ec->n_ips * sizeof(Addr),
+                                  vg_alignof(Addr) );
+      get_ips(ec, ec->ips);
+      ec_totips_copied += ec->n_ips;
+   }
+   return ec->ips;
+}
+
 DiEpoch VG_(get_ExeContext_epoch)( const ExeContext* e )
 {
    if (is_DiEpoch_INVALID (e->epoch))
@@ -179,7 +268,9 @@ void VG_(print_ExeContext_stats) ( Bool with_stacktraces )
 {
    Int i;
    ULong total_n_ips;
+   ULong flat_szB, frames_szB;
    ExeContext* ec;
+   Addr ips[VG_DEEPEST_BACKTRACE];
 
    init_ExeContext_storage();
 
@@ -190,8 +281,9 @@ void VG_(print_ExeContext_stats) ( Bool with_stacktraces )
             VG_(message)(Vg_DebugMsg,
                          "   exectx: stacktrace ecu %u epoch %u n_ips %u\n",
                          ec->ecu, ec->epoch.n, ec->n_ips);
+            get_ips(ec, ips);
             VG_(pp_StackTrace)( VG_(get_ExeContext_epoch)(ec),
-                                ec->ips, ec->n_ips );
+                                ips, ec->n_ips );
          }
       }
       VG_(message)(Vg_DebugMsg, 
@@ -221,20 +313,38 @@ void VG_(print_ExeContext_stats) ( Bool with_stacktraces )
       "   exectx: %'llu cmp2, %'llu cmp4, %'llu cmpAll\n",
       ec_cmp2s, ec_cmp4s, ec_cmpAlls 
    );
+   /* Compare the space used for the IPs with what storing each context
+      as a flat array would need. */
+   flat_szB   = ec_totips * sizeof(Addr);
+   frames_szB = (ULong)(ec_frames_used + EC_FRAMES_PER_CHUNK - 1)
+                   / EC_FRAMES_PER_CHUNK * EC_FRAMES_PER_CHUNK
+                   * sizeof(EcFrame)
+                + (ULong)ec_frame_htab_size * sizeof(UInt)
+                + ec_totips_copied * sizeof(Addr);
+   VG_(message)(Vg_DebugMsg, 
+      "   exectx: %'u frames for %'llu IPs (%'llu copied):"
+      " %'llu bytes, %'lld bytes saved\n",
+      ec_frames_used - 1, ec_totips, ec_totips_copied,
+      frames_szB, (Long)flat_szB - (Long)frames_szB
+   );
 }
 
 /* Print an ExeContext. */
 void VG_(pp_ExeContext) ( ExeContext* ec )
 {
-   VG_(pp_StackTrace)( VG_(get_ExeContext_epoch)(ec), ec->ips, ec->n_ips );
+   Addr ips[VG_DEEPEST_BACKTRACE];
+   get_ips(ec, ips);
+   VG_(pp_StackTrace)( VG_(get_ExeContext_epoch)(ec), ips, ec->n_ips );
 }
 
 void VG_(apply_ExeContext)(
    void(*action)(UInt n, DiEpoch ep, Addr ip, void* opaque),
    void* opaque, ExeContext* ec)
 {
+   Addr ips[VG_DEEPEST_BACKTRACE];
+   get_ips(ec, ips);
    VG_(apply_StackTrace)(action, opaque, VG_(get_ExeContext_epoch)(ec),
-                         ec->ips, ec->n_ips);
+                         ips, ec->n_ips);
 }
 
 void VG_(archive_ExeContext_in_range) (DiEpoch last_epoch,
@@ -250,9 +360,9 @@ void VG_(archive_ExeContext_in_range) (DiEpoch last_epoch,
    for (i = 0; i < ec_htab_size; i++) {
       for (ec = ec_htab[i]; ec; ec = ec->chain) {
          if (is_DiEpoch_INVALID (ec->epoch))
-            for (UInt j = 0; j < ec->n_ips; j++) {
-               if (UNLIKELY(ec->ips[j] >= text_avma
-                            && ec->ips[j] <= text_avma_end)) {
+            for (UInt f = ec->frame; f != 0; f = ec_frame(f)->parent) {
+               if (UNLIKELY(ec_frame(f)->ip >= text_avma
+                            && ec_frame(f)->ip <= text_avma_end)) {
                   ec->epoch = last_epoch;
                   n_archived++;
                   break;
@@ -270,7 +380,8 @@ void VG_(archive_ExeContext_in_range) (DiEpoch last_epoch,
 Bool VG_(eq_ExeContext) ( VgRes res, const ExeContext* e1,
                           const ExeContext* e2 )
 {
-   Int i;
+   Int  i;
+   UInt f1, f2;
 
    if (e1 == NULL || e2 == NULL) 
       return False;
@@ -285,22 +396,32 @@ Bool VG_(eq_ExeContext) ( VgRes res, const ExeContext* e1,
    case Vg_LowRes:
       /* Just compare the top two callers. */
       ec_cmp2s++;
+      f1 = e1->frame;
+      f2 = e2->frame;
       for (i = 0; i < 2; i++) {
-         if ( (e1->n_ips <= i) &&  (e2->n_ips <= i)) return True;
-         if ( (e1->n_ips <= i) && !(e2->n_ips <= i)) return False;
-         if (!(e1->n_ips <= i) &&  (e2->n_ips <= i)) return False;
-         if (e1->ips[i] != e2->ips[i])               return False;
+         /* Same frame: the rest of the traces is the same too. */
+         if (f1 == f2)
+            return e1->n_ips < 2 || e1->epoch.n == e2->epoch.n;
+         if (f1 == 0 || f2 == 0)                     return False;
+         if (ec_frame(f1)->ip != ec_frame(f2)->ip)   return False;
+         f1 = ec_frame(f1)->parent;
+         f2 = ec_frame(f2)->parent;
       }
       return e1->epoch.n == e2->epoch.n;
 
    case Vg_MedRes:
       /* Just compare the top four callers. */
       ec_cmp4s++;
+      f1 = e1->frame;
+      f2 = e2->frame;
       for (i = 0; i < 4; i++) {
-         if ( (e1->n_ips <= i) &&  (e2->n_ips <= i)) return True;
-         if ( (e1->n_ips <= i) && !(e2->n_ips <= i)) return False;
-         if (!(e1->n_ips <= i) &&  (e2->n_ips <= i)) return False;
-         if (e1->ips[i] != e2->ips[i])               return False;
+         /* Same frame: the rest of the traces is the same too. */
+         if (f1 == f2)
+            return e1->n_ips < 4 || e1->epoch.n == e2->epoch.n;
+         if (f1 == 0 || f2 == 0)                     return False;
+         if (ec_frame(f1)->ip != ec_frame(f2)->ip)   return False;
+         f1 = ec_frame(f1)->parent;
+         f2 = ec_frame(f2)->parent;
       }
       return e1->epoch.n == e2->epoch.n;
 
@@ -334,6 +455,12 @@ static inline UWord ROLW ( UWord w, Int n )
    return w;
 }
 
+static inline UWord calc_frame_hash ( Addr ip, UInt parent, UWord htab_sz )
+{
+   UWord hash = ROLW(ip, 19) ^ (UWord)parent;
+   return hash % htab_sz;
+}
+
 static UWord calc_hash ( const Addr* ips, UInt n_ips, UWord htab_sz )
 {
    UInt  i;
@@ -346,6 +473,88 @@ static UWord calc_hash ( const Addr* ips, UInt n_ips, UWord htab_sz )
    return hash % htab_sz;
 }
 
+/* Are the IPs of EC the N_IPS ones in IPS? */
+static inline Bool ips_eq ( const ExeContext* ec, const Addr* ips, UInt n_ips )
+{
+   UInt i;
+   UInt f = ec->frame;
+   if (ec->n_ips != n_ips)
+      return False;
+   for (i = 0; i < n_ips; i++) {
+      if (ec_frame(f)->ip != ips[i])
+         return False;
+      f = ec_frame(f)->parent;
+   }
+   return True;
+}
+
+static void resize_ec_frame_htab ( void )
+{
+   SizeT i;
+   SizeT new_size;
+   UInt  f;
+
+   vg_assert(ec_frame_htab_size_idx >= 0
+             && ec_frame_htab_size_idx < N_EC_PRIMES);
+   if (ec_frame_htab_size_idx == N_EC_PRIMES-1)
+      return; /* out of primes - can't resize further */
+
+   new_size = ec_primes[ec_frame_htab_size_idx + 1];
+   VG_(free)(ec_frame_htab);
+   ec_frame_htab = VG_(malloc)("execontext.refh1", sizeof(UInt) * new_size);
+   for (i = 0; i < new_size; i++)
+      ec_frame_htab[i] = 0;
+
+   for (f = 1; f < ec_frames_used; f++) {
+      UWord hash = calc_frame_hash(ec_frame(f)->ip, ec_frame(f)->parent,
+                                   new_size);
+      ec_frame(f)->chain  = ec_frame_htab[hash];
+      ec_frame_htab[hash] = f;
+   }
+
+   ec_frame_htab_size = new_size;
+   ec_frame_htab_size_idx++;
+}
+
+/* Find the frame for IP called from the frame PARENT (0 for an
+   outermost frame), adding it if it does not exist yet. */
+static UInt find_or_add_frame ( Addr ip, UInt parent )
+{
+   UWord hash = calc_frame_hash(ip, parent, ec_frame_htab_size);
+   UInt  f;
+
+   for (f = ec_frame_htab[hash]; f != 0; f = ec_frame(f)->chain) {
+      if (ec_frame(f)->ip == ip && ec_frame(f)->parent == parent)
+         return f;
+   }
+
+   if (ec_frames_used % EC_FRAMES_PER_CHUNK == 0 || ec_frames_used == 1) {
+      /* Need a new chunk. */
+      UInt chunk = ec_frames_used / EC_FRAMES_PER_CHUNK;
+      if (ec_frames_used > 0xFFFFFFFF - EC_FRAMES_PER_CHUNK)
+         VG_(core_panic)("m_execontext: more than 2^32 frames created");
+      if (chunk == ec_frame_chunks_size) {
+         ec_frame_chunks_size *= 2;
+         ec_frame_chunks = VG_(realloc)("execontext.faf1", ec_frame_chunks,
+                                        sizeof(EcFrame*)
+                                        * ec_frame_chunks_size);
+      }
+      ec_frame_chunks[chunk] = VG_(malloc)("execontext.faf2",
+                                           sizeof(EcFrame)
+                                           * EC_FRAMES_PER_CHUNK);
+   }
+   f = ec_frames_used++;
+   ec_frame(f)->ip     = ip;
+   ec_frame(f)->parent = parent;
+   ec_frame(f)->chain  = ec_frame_htab[hash];
+   ec_frame_htab[hash] = f;
+
+   if (ec_frames_used > ec_frame_htab_size)
+      resize_ec_frame_htab();
+
+   return f;
+}
+
 static void resize_ec_htab ( void )
 {
    SizeT        i;
@@ -372,7 +581,10 @@ static void resize_ec_htab ( void )
       ExeContext* cur = ec_htab[i];
       while (cur) {
          ExeContext* next = cur->chain;
-         UWord hash = calc_hash(cur->ips, cur->n_ips, new_size);
+         Addr ips[VG_DEEPEST_BACKTRACE];
+         UWord hash;
+         get_ips(cur, ips);
+         hash = calc_hash(ips, cur->n_ips, new_size);
          vg_assert(hash < new_size);
          cur->chain = new_ec_htab[hash];
          new_ec_htab[hash] = cur;
@@ -460,7 +672,7 @@ static ExeContext* record_ExeContext_wrk ( ThreadId tid, Word first_ip_delta,
 static ExeContext* record_ExeContext_wrk2 ( const Addr* ips, UInt n_ips )
 {
    Int         i;
-   Bool        same;
+   UInt        frame;
    UWord       hash;
    ExeContext* new_ec;
    ExeContext* list;
@@ -485,11 +697,8 @@ static ExeContext* record_ExeContext_wrk2 ( const Addr* ips, UInt n_ips )
    while (True) {
       if (list == NULL) break;
       ec_searchcmps++;
-      same = list->n_ips == n_ips && is_DiEpoch_INVALID (list->epoch);
-      for (i = 0; i < n_ips && same ; i++) {
-         same = list->ips[i] == ips[i];
-      }
-      if (same) break;
+      if (is_DiEpoch_INVALID (list->epoch) && ips_eq(list, ips, n_ips))
+         break;
       prev2 = prev;
       prev  = list;
       list  = list->chain;
@@ -522,13 +731,16 @@ static ExeContext* record_ExeContext_wrk2 ( const Addr* ips, UInt n_ips )
 
    /* Bummer.  We have to allocate a new context record. */
    ec_totstored++;
+   ec_totips += n_ips;
 
-   new_ec = VG_(perm_malloc)( sizeof(struct _ExeContext) 
-                              + n_ips * sizeof(Addr),
-                              vg_alignof(struct _ExeContext));
+   /* Find the frame of the innermost IP, working inwards from the
+      outermost one and adding the frames not seen yet. */
+   frame = 0;
+   for (i = n_ips - 1; i >= 0; i--)
+      frame = find_or_add_frame( ips[i], frame );
 
-   for (i = 0; i < n_ips; i++)
-      new_ec->ips[i] = ips[i];
+   new_ec = VG_(perm_malloc)( sizeof(struct _ExeContext),
+                              vg_alignof(struct _ExeContext));
 
    vg_assert(VG_(is_plausible_ECU)(ec_next_ecu));
    new_ec->ecu = ec_next_ecu;
@@ -540,6 +752,8 @@ static ExeContext* record_ExeContext_wrk2 ( const Addr* ips, UInt n_ips )
    }
 
    new_ec->n_ips = n_ips;
+   new_ec->frame = frame;
+   new_ec->ips   = NULL;
    new_ec->chain = ec_htab[hash];
    new_ec->epoch = DiEpoch_INVALID();
    ec_htab[hash] = new_ec;
@@ -571,8 +785,82 @@ ExeContext* VG_(make_depth_1_ExeContext_from_Addr)( Addr a ) {
 }
 
 StackTrace VG_(get_ExeContext_StackTrace) ( ExeContext* e ) {
-   return e->ips;
-}  
+   return ec_ips(e);
+}
+
+void VG_(init_ExeContext_iter) ( /*OUT*/ExeContextIter* it,
+                                 const ExeContext* e )
+{
+   it->frame = e->frame;
+}
+
+Bool VG_(next_ExeContext_ip) ( ExeContextIter* it, /*OUT*/Addr* ip )
+{
+   if (it->frame == 0)
+      return False;
+   *ip = ec_frame(it->frame)->ip;
+   it->frame = ec_frame(it->frame)->parent;
+   return True;
+}
+
+/* The frame of IP number N of E. */
+static UInt nth_frame ( const ExeContext* e, UInt n )
+{
+   UInt f = e->frame;
+   vg_assert(n <= e->n_ips);
+   while (n-- > 0)
+      f = ec_frame(f)->parent;
+   return f;
+}
+
+void VG_(get_ExeContext_ips) ( const ExeContext* e, UInt from, UInt n,
+                               /*OUT*/Addr* ips )
+{
+   UInt i;
+   UInt f;
+   vg_assert(from + n <= e->n_ips);
+   f = nth_frame(e, from);
+   for (i = 0; i < n; i++) {
+      ips[i] = ec_frame(f)->ip;
+      f = ec_frame(f)->parent;
+   }
+}
+
+Bool VG_(eq_ExeContext_from) ( const ExeContext* e1, const ExeContext* e2,
+                               UInt from )
+{
+   if (e1->n_ips != e2->n_ips)
+      return False;
+   if (from >= e1->n_ips)
+      return True;
+   /* Frames are unique: the same (IP, parent) pair has the same frame. */
+   return nth_frame(e1, from) == nth_frame(e2, from);
+}
+
+Int VG_(cmp_ExeContext_ips) ( const ExeContext* e1, UInt from1, UInt n1,
+                              const ExeContext* e2, UInt from2, UInt n2 )
+{
+   UInt i;
+   UInt f1, f2;
+   const UInt n = n1 < n2 ? n1 : n2;
+
+   vg_assert(from1 + n1 <= e1->n_ips);
+   vg_assert(from2 + n2 <= e2->n_ips);
+   f1 = nth_frame(e1, from1);
+   f2 = nth_frame(e2, from2);
+   for (i = 0; i < n; i++) {
+      /* Same frame: the common part is the same. */
+      if (f1 == f2)
+         break;
+      if (ec_frame(f1)->ip != ec_frame(f2)->ip)
+         return ec_frame(f1)->ip < ec_frame(f2)->ip ? -1 : 1;
+      f1 = ec_frame(f1)->parent;
+      f2 = ec_frame(f2)->parent;
+   }
+   if (n1 < n2) return -1;
+   if (n1 > n2) return  1;
+   return 0;
+}
 
 UInt VG_(get_ECU_from_ExeContext)( const ExeContext* e ) {
    vg_assert(VG_(is_plausible_ECU)(e->ecu));
@@ -611,7 +899,8 @@ const Addr* VG_(make_StackTrace_from_ExeContext)(const ExeContext *e,
     vg_assert(e != NULL);
 
     *n_ips = e->n_ips;
-    return e->ips;
+    /* The array is created on demand, but does not change e otherwise. */
+    return ec_ips((ExeContext*)(HWord)e);
 }
 
 ExeContext* VG_(null_ExeContext) (void)
@@ -172,6 +172,7 @@ void VG_(print_all_stats) (Bool memory_stats, Bool tool_stats)
    VG_(print_scheduler_stats)();
    VG_(print_ExeContext_stats)( False /* with_stacktraces */ );
    VG_(print_errormgr_stats)();
+   VG_(print_debuginfo_stats)();
    if (tool_stats && VG_(needs).print_stats) {
       VG_TDICT_CALL(tool_print_stats);
    }
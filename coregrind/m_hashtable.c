@@ -39,6 +39,22 @@
 /*--------------------------------------------------------------------*/
 
 #define CHAIN_NO(key,tbl) (((UWord)(key)) % tbl->n_chains)
+#define OLD_CHAIN_NO(key,tbl) (((UWord)(key)) % tbl->n_old_chains)
+
+/* Resizing is done incrementally, so that a table holding millions of
+   elements does not stall its user for a full rehash when it grows.
+   When the table grows, the old chains array is kept in old_chains, and
+   each subsequent modification moves the nodes of a few old chains to
+   the new chains array.  Old chains below migrated are empty.  While
+   old_chains is non NULL, a node can be in either array: lookups and
+   removals check the new chain first, then the old one.
+   Migration is finished before iterating, so HT_Next and
+   HT_remove_at_Iter only ever see the new chains array. */
+
+/* Number of old chains migrated at each modification.  It must be
+   big enough for the migration to be finished before the next resize,
+   which happens at the earliest after n_old_chains more additions. */
+#define N_CHAINS_MIGRATED_PER_OP 4
 
 struct _VgHashTable {
    UInt         n_chains;   // should be prime
@@ -46,6 +62,9 @@ struct _VgHashTable {
    VgHashNode*  iterNode;   // current iterator node
    UInt         iterChain;  // next chain to be traversed by the iterator
    VgHashNode** chains;     // expanding array of hash chains
+   UInt         n_old_chains; // size of old_chains
+   UInt         migrated;   // old_chains[0 .. migrated-1] are empty
+   VgHashNode** old_chains; // chains being migrated, or NULL
    Bool         iterOK;     // table safe to iterate over?
    const HChar* name;       // name of table (for debugging only)
 };
@@ -74,6 +93,9 @@ VgHashTable *VG_(HT_construct) ( const HChar* name )
    table->chains        = VG_(calloc)("hashtable.Hc.2", 1, sz);
    table->n_chains      = n_chains;
    table->n_elements    = 0;
+   table->n_old_chains  = 0;
+   table->migrated      = 0;
+   table->old_chains    = NULL;
    table->iterOK        = True;
    table->name          = name;
    vg_assert(name);
@@ -85,6 +107,39 @@ UInt VG_(HT_count_nodes) ( const VgHashTable *table )
    return table->n_elements;
 }
 
+/* Move the nodes of at most n_migrate old chains to the new chains. */
+static void migrate ( VgHashTable *table, UInt n_migrate )
+{
+   VgHashNode * node;
+
+   while (table->old_chains != NULL && n_migrate > 0) {
+      node = table->old_chains[table->migrated];
+      while (node != NULL) {
+         VgHashNode* next = node->next;
+         UWord chain = CHAIN_NO(node->key, table);
+         node->next = table->chains[chain];
+         table->chains[chain] = node;
+         node = next;
+      }
+      table->old_chains[table->migrated] = NULL;
+      table->migrated++;
+      n_migrate--;
+      if (table->migrated == table->n_old_chains) {
+         VG_(free)(table->old_chains);
+         table->old_chains   = NULL;
+         table->n_old_chains = 0;
+         table->migrated     = 0;
+      }
+   }
+}
+
+static void finish_migration ( VgHashTable *table )
+{
+   if (table->old_chains != NULL)
+      migrate(table, table->n_old_chains - table->migrated);
+   vg_assert(table->old_chains == NULL);
+}
+
 static void resize ( VgHashTable *table )
 {
    Int          i;
@@ -92,12 +147,14 @@ static void resize ( VgHashTable *table )
    SizeT        old_chains = table->n_chains;
    SizeT        new_chains = old_chains + 1;
    VgHashNode** chains;
-   VgHashNode * node;
 
    /* If we've run out of primes, do nothing. */
    if (old_chains == primes[N_HASH_PRIMES-1])
       return;
 
+   /* Should not happen (see N_CHAINS_MIGRATED_PER_OP), but be safe. */
+   finish_migration(table);
+
    vg_assert(old_chains >= primes[0] 
              && old_chains < primes[N_HASH_PRIMES-1]);
 
@@ -118,23 +175,14 @@ static void resize ( VgHashTable *table )
          table->name, (UWord)old_chains, (UWord)new_chains,
          (UWord)table->n_elements );
 
-   table->n_chains = new_chains;
    sz = new_chains * sizeof(VgHashNode*);
    chains = VG_(calloc)("hashtable.resize.1", 1, sz);
 
-   for (i = 0; i < old_chains; i++) {
-      node = table->chains[i];
-      while (node != NULL) {
-         VgHashNode* next = node->next;
-         UWord chain = CHAIN_NO(node->key, table);
-         node->next = chains[chain];
-         chains[chain] = node;
-         node = next;
-      }
-   }
-
-   VG_(free)(table->chains);
-   table->chains = chains;
+   table->old_chains   = table->chains;
+   table->n_old_chains = old_chains;
+   table->migrated     = 0;
+   table->chains       = chains;
+   table->n_chains     = new_chains;
 }
 
 /* Puts a new, heap allocated VgHashNode, into the VgHashTable.  Prepends
@@ -146,6 +194,8 @@ void VG_(HT_add_node) ( VgHashTable *table, void* vnode )
    node->next           = table->chains[chain];
    table->chains[chain] = node;
    table->n_elements++;
+   if (UNLIKELY(table->old_chains != NULL))
+      migrate(table, N_CHAINS_MIGRATED_PER_OP);
    if ( (1 * (ULong)table->n_elements) > (1 * (ULong)table->n_chains) ) {
       resize(table);
    }
@@ -165,6 +215,15 @@ void* VG_(HT_lookup) ( const VgHashTable *table, UWord key )
       }
       curr = curr->next;
    }
+   if (UNLIKELY(table->old_chains != NULL)) {
+      curr = table->old_chains[ OLD_CHAIN_NO(key, table) ];
+      while (curr) {
+         if (key == curr->key) {
+            return curr;
+         }
+         curr = curr->next;
+      }
+   }
    return NULL;
 }
 
@@ -182,23 +241,30 @@ void* VG_(HT_gen_lookup) ( const VgHashTable *table, const void* node,
       }
       curr = curr->next;
    }
+   if (UNLIKELY(table->old_chains != NULL)) {
+      curr = table->old_chains[ OLD_CHAIN_NO(hnode->key, table) ]; // GEN!!!
+      while (curr) {
+         if (hnode->key == curr->key && cmp (hnode, curr) == 0) { // GEN!!!
+            return curr;
+         }
+         curr = curr->next;
+      }
+   }
    return NULL;
 }
 
-/* Removes a VgHashNode from the table.  Returns NULL if not found. */
-void* VG_(HT_remove) ( VgHashTable *table, UWord key )
+/* Removes the node with the given key (and for which cmp returns 0, if
+   cmp is not NULL) from the chain starting at *chain_start.  Returns
+   NULL if not found. */
+static VgHashNode* remove_from_chain ( VgHashNode** chain_start, UWord key,
+                                       const VgHashNode* hnode, HT_Cmp_t cmp )
 {
-   UWord        chain         = CHAIN_NO(key, table);
-   VgHashNode*  curr          =   table->chains[chain];
-   VgHashNode** prev_next_ptr = &(table->chains[chain]);
-
-   /* Table has been modified; hence HT_Next should assert. */
-   table->iterOK = False;
+   VgHashNode*  curr          = *chain_start;
+   VgHashNode** prev_next_ptr = chain_start;
 
    while (curr) {
-      if (key == curr->key) {
+      if (key == curr->key && (cmp == NULL || cmp(hnode, curr) == 0)) {
          *prev_next_ptr = curr->next;
-         table->n_elements--;
          return curr;
       }
       prev_next_ptr = &(curr->next);
@@ -207,28 +273,38 @@ void* VG_(HT_remove) ( VgHashTable *table, UWord key )
    return NULL;
 }
 
-/* Removes a VgHashNode by node from the table.  Returns NULL if not found.
-   GEN!!! marks the lines that differs from VG_(HT_remove). */
-void* VG_(HT_gen_remove) ( VgHashTable *table, const void* node, HT_Cmp_t cmp  )
+static VgHashNode* remove_node ( VgHashTable *table, UWord key,
+                                 const VgHashNode* hnode, HT_Cmp_t cmp )
 {
-   const VgHashNode* hnode    = node; // GEN!!!
-   UWord        chain         = CHAIN_NO(hnode->key, table); // GEN!!!
-   VgHashNode*  curr          =   table->chains[chain];
-   VgHashNode** prev_next_ptr = &(table->chains[chain]);
+   VgHashNode* res;
 
    /* Table has been modified; hence HT_Next should assert. */
    table->iterOK = False;
 
-   while (curr) {
-      if (hnode->key == curr->key && cmp(hnode, curr) == 0) { // GEN!!!
-         *prev_next_ptr = curr->next;
-         table->n_elements--;
-         return curr;
-      }
-      prev_next_ptr = &(curr->next);
-      curr = curr->next;
-   }
-   return NULL;
+   res = remove_from_chain(&table->chains[CHAIN_NO(key, table)],
+                           key, hnode, cmp);
+   if (res == NULL && UNLIKELY(table->old_chains != NULL))
+      res = remove_from_chain(&table->old_chains[OLD_CHAIN_NO(key, table)],
+                              key, hnode, cmp);
+   if (res != NULL)
+      table->n_elements--;
+   if (UNLIKELY(table->old_chains != NULL))
+      migrate(table, N_CHAINS_MIGRATED_PER_OP);
+   return res;
+}
+
+/* Removes a VgHashNode from the table.  Returns NULL if not found. */
+void* VG_(HT_remove) ( VgHashTable *table, UWord key )
+{
+   return remove_node(table, key, NULL, NULL);
+}
+
+/* Removes a VgHashNode by node from the table.  Returns NULL if not found.
+   GEN!!! marks the lines that differs from VG_(HT_remove). */
+void* VG_(HT_gen_remove) ( VgHashTable *table, const void* node, HT_Cmp_t cmp  )
+{
+   const VgHashNode* hnode    = node; // GEN!!!
+   return remove_node(table, hnode->key, hnode, cmp); // GEN!!!
 }
 
 void VG_(HT_print_stats) ( const VgHashTable *table, HT_Cmp_t cmp )
@@ -244,7 +320,7 @@ void VG_(HT_print_stats) ( const VgHashTable *table, HT_Cmp_t cmp )
    #define INCOCCUR(occur,n) (n >= MAXOCCUR ? occur[MAXOCCUR]++ : occur[n]++)
    UInt i;
    UInt nkey, nelt, ncno;
-   VgHashNode *cnode, *node;
+   VgHashNode *chain, *cnode, *node;
 
    VG_(memset)(key_occurences, 0, sizeof(key_occurences));
    VG_(memset)(elt_occurences, 0, sizeof(elt_occurences));
@@ -253,14 +329,21 @@ void VG_(HT_print_stats) ( const VgHashTable *table, HT_Cmp_t cmp )
    // Note that the below algorithm is quadractic in nr of elements in a chain
    // but if that happens, the hash table/function is really bad and that
    // should be fixed.
-   for (i = 0; i < table->n_chains; i++) {
+   // Chains still to be migrated are reported after the new chains.
+   for (i = 0; i < table->n_chains + table->n_old_chains; i++) {
+      if (i < table->n_chains)
+         chain = table->chains[i];
+      else if (i - table->n_chains >= table->migrated)
+         chain = table->old_chains[i - table->n_chains];
+      else
+         continue;
       ncno = 0;
-      for (cnode = table->chains[i]; cnode != NULL; cnode = cnode->next) {
+      for (cnode = chain; cnode != NULL; cnode = cnode->next) {
          ncno++;
 
          nkey = 0;
          // Is the same cnode->key existing before cnode ?
-         for (node = table->chains[i]; node != cnode; node = node->next) {
+         for (node = chain; node != cnode; node = node->next) {
             if (node->key == cnode->key)
                nkey++;
          }
@@ -275,7 +358,7 @@ void VG_(HT_print_stats) ( const VgHashTable *table, HT_Cmp_t cmp )
 
          nelt = 0;
          // Is the same cnode element existing before cnode ?
-         for (node = table->chains[i]; node != cnode; node = node->next) {
+         for (node = chain; node != cnode; node = node->next) {
             if (node->key == cnode->key
                 && (cmp == NULL || cmp (node, cnode) == 0)) {
                nelt++;
@@ -344,6 +427,13 @@ VgHashNode** VG_(HT_to_array) (const VgHashTable *table, /*OUT*/ UInt* n_elems)
          arr[j++] = node;
       }
    }
+   if (table->old_chains != NULL) {
+      for (i = table->migrated; i < table->n_old_chains; i++) {
+         for (node = table->old_chains[i]; node != NULL; node = node->next) {
+            arr[j++] = node;
+         }
+      }
+   }
    vg_assert(j == *n_elems);
 
    return arr;
@@ -352,6 +442,7 @@ VgHashNode** VG_(HT_to_array) (const VgHashTable *table, /*OUT*/ UInt* n_elems)
 void VG_(HT_ResetIter)(VgHashTable *table)
 {
    vg_assert(table);
+   finish_migration(table);
    table->iterNode  = NULL;
    table->iterChain = 0;
    table->iterOK    = True;
@@ -419,6 +510,7 @@ void VG_(HT_destruct)(VgHashTable *table, void(*freenode_fn)(void*))
    UInt       i;
    VgHashNode *node, *node_next;
 
+   finish_migration(table);
    for (i = 0; i < table->n_chains; i++) {
       for (node = table->chains[i]; node != NULL; node = node_next) {
          node_next = node->next;
@@ -179,6 +179,12 @@ static void usage_NORETURN ( int need_help )
 "    --allow-mismatched-debuginfo=no|yes  [no]\n"
 "                              for the above two flags only, accept debuginfo\n"
 "                              objects that don't \"match\" the main object\n"
+"    --debuginfo-cache=<dir>   save the debug info read from objects having\n"
+"                              a build-id in <dir>, and reuse it in later runs\n"
+"    --debuginfo-cache-size=<number>  size in MB above which the oldest\n"
+"                              entries of the above cache are removed [512]\n"
+"    --image-cache-size=<number>  size in MB of the cache used to read the\n"
+"                              debug info of each object [64]\n"
 "    --smc-check=none|stack|all|all-non-file [all-non-file]\n"
 "                              checks for self-modifying code: none, only for\n"
 "                              code found in stacks, for all code, or for all\n"
@@ -192,6 +198,8 @@ static void usage_NORETURN ( int need_help )
 "                              and use it to print better error messages in\n"
 "                              tools that make use of it (Memcheck, Helgrind,\n"
 "                              DRD) [no]\n"
+"    --lazy-debuginfo=yes|no   read line number, inline and variable info\n"
+"                              only when first needed [no]\n"
 "    --vgdb-poll=<number>      gdbserver poll max every <number> basic blocks [%d] \n"
 "    --vgdb-shadow-registers=no|yes   let gdb see the shadow registers [no]\n"
 "    --vgdb-prefix=<prefix>    prefix for vgdb FIFOs [%s]\n"
@@ -210,6 +218,10 @@ static void usage_NORETURN ( int need_help )
 "           android-gpu-sgx5xx android-gpu-adreno3xx none\n"
 "    --merge-recursive-frames=<number>  merge frames between identical\n"
 "           program counters in max <number> frames) [0]\n"
+"    --shadow-call-stack=no|yes  record stack traces from a shadow stack\n"
+"           of calls instead of unwinding (x86/amd64 only) [no]\n"
+"    --cfi-cache-size=<number>  number of entries in each thread's cache\n"
+"           of stack unwinding information [2048]\n"
 "    --num-transtab-sectors=<number> size of translated code cache [%d]\n"
 "           more sectors may increase performance, but use more memory.\n"
 "    --avg-transtab-entry-size=<number> avg size in bytes of a translated\n"
@@ -669,6 +681,7 @@ static void process_option (Clo_Mode mode,
                         VG_(clo_progress_interval), 0, 3600) {}
    else if VG_BOOL_CLO(arg, "--read-inline-info", VG_(clo_read_inline_info)) {}
    else if VG_BOOL_CLO(arg, "--read-var-info",    VG_(clo_read_var_info)) {}
+   else if VG_BOOL_CLO(arg, "--lazy-debuginfo",   VG_(clo_lazy_debuginfo)) {}
 
    else if VG_INT_CLO (arg, "--dump-error",       VG_(clo_dump_error))   {}
    else if VG_INT_CLO (arg, "--input-fd",         VG_(clo_input_fd))     {}
@@ -684,6 +697,10 @@ static void process_option (Clo_Mode mode,
    else if VG_BINT_CLOM(cloPD, arg, "--merge-recursive-frames",
                         VG_(clo_merge_recursive_frames), 0,
                         VG_DEEPEST_BACKTRACE) {}
+   else if VG_BOOL_CLO(arg, "--shadow-call-stack",
+                       VG_(clo_shadow_call_stack)) {}
+   else if VG_BINT_CLO(arg, "--cfi-cache-size",
+                       VG_(clo_cfi_cache_size), 16, 1024*1024) {}
 
    else if VG_XACT_CLO(arg, "--smc-check=none",
                        VG_(clo_smc_check), Vg_SmcNone) {}
@@ -789,6 +806,13 @@ static void process_option (Clo_Mode mode,
    else if VG_STR_CLO (arg, "--extra-debuginfo-path",
                        VG_(clo_extra_debuginfo_path)) {}
 
+   else if VG_STR_CLO (arg, "--debuginfo-cache",
+                       VG_(clo_debuginfo_cache)) {}
+   else if VG_BINT_CLO(arg, "--debuginfo-cache-size",
+                       VG_(clo_debuginfo_cache_size), 1, 1024*1024) {}
+   else if VG_BINT_CLO(arg, "--image-cache-size",
+                       VG_(clo_image_cache_size), 1, 4096) {}
+
    else if VG_STR_CLO(arg, "--require-text-symbol", tmp_str) {
       /* String needs to be of the form C?*C?*, where C is any
          character, but is the same both times.  Having it in this
@@ -1034,6 +1058,19 @@ void main_process_cmd_line_options( void )
          "You must define a non nul exit error code, with --error-exitcode=...\n");
    }
 
+#  if !defined(VGA_x86) && !defined(VGA_amd64)
+   if (VG_(clo_shadow_call_stack)) {
+      VG_(fmsg_bad_option)("--shadow-call-stack=yes",
+                           "--shadow-call-stack= is only available on "
+                           "x86 and amd64.\n");
+      /*NOTREACHED*/
+   }
+#  endif
+   /* The shadow call stack is pushed at the end of each block that
+      ends in a call, so calls must not be chased into. */
+   if (VG_(clo_shadow_call_stack))
+      VG_(clo_vex_control).guest_chase = False;
+
 #  if !defined(VGO_darwin)
    if (VG_(clo_resync_filter) != 0) {
       VG_(fmsg_bad_option)("--resync-filter=yes or =verbose",
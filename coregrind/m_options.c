@@ -133,6 +133,9 @@ XArray *VG_(clo_fullpath_after); // array of strings
 const HChar* VG_(clo_extra_debuginfo_path) = NULL;
 const HChar* VG_(clo_debuginfo_server) = NULL;
 Bool   VG_(clo_allow_mismatched_debuginfo) = False;
+const HChar* VG_(clo_debuginfo_cache) = NULL;
+UInt   VG_(clo_debuginfo_cache_size) = 512;
+UInt   VG_(clo_image_cache_size) = 64;
 UChar  VG_(clo_trace_flags)    = 0; // 00000000b
 Bool   VG_(clo_profyle_sbs)    = False;
 UChar  VG_(clo_profyle_flags)  = 0; // 00000000b
@@ -168,10 +171,13 @@ Bool VG_(clo_enable_debuginfod) = True;
 Int    VG_(clo_dump_error)     = 0;
 Int    VG_(clo_backtrace_size) = 12;
 Int    VG_(clo_merge_recursive_frames) = 0; // default value: no merge
+Bool   VG_(clo_shadow_call_stack) = False;
+UInt   VG_(clo_cfi_cache_size) = 2048;
 UInt   VG_(clo_sim_hints)      = 0;
 Bool   VG_(clo_sym_offsets)    = False;
 Bool   VG_(clo_read_inline_info) = False; // Or should be put it to True by default ???
 Bool   VG_(clo_read_var_info)  = False;
+Bool   VG_(clo_lazy_debuginfo) = False;
 XArray *VG_(clo_req_tsyms);  // array of strings
 Bool   VG_(clo_run_libc_freeres) = True;
 Bool   VG_(clo_run_cxx_freeres) = True;
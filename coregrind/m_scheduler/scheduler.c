@@ -83,6 +83,7 @@
 #include "pub_core_signals.h"
 #include "pub_core_stacks.h"
 #include "pub_core_stacktrace.h"    // For VG_(get_and_pp_StackTrace)()
+                                    // and VG_(reset_shadow_call_stack)()
 #include "pub_core_syscall.h"
 #include "pub_core_syswrap.h"
 #include "pub_core_tooliface.h"
@@ -613,6 +614,8 @@ void mostly_clear_thread_record ( ThreadId tid )
 
    os_state_clear(&VG_(threads)[tid]);
 
+   VG_(reset_shadow_call_stack)(tid);
+
    /* start with no altstack */
    VG_(threads)[tid].altstack.ss_sp = (void *)0xdeadbeef;
    VG_(threads)[tid].altstack.ss_size = 0;
@@ -959,9 +962,29 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    /* Clear return area. */
    two_words[0] = two_words[1] = 0;
 
+   // Tell the tool this thread is about to run client code.  This is
+   // done before looking up the translation to run, so that the tool
+   // may discard translations.
+   VG_(ok_to_discard_translations) = True;
+   VG_TRACK( start_client_code, tid, bbs_done );
+   VG_(ok_to_discard_translations) = False;
+
    /* Figure out where we're starting from. */
    if (use_alt_host_addr) {
-      /* unusual case -- no-redir translation */
+      /* unusual case -- no-redir translation.  Make it again if the
+         tool just discarded it. */
+      Addr ip = VG_(get_IP)(tid);
+      if (!VG_(search_unredir_transtab)( &alt_host_addr, ip )) {
+         if (!VG_(translate)( tid, ip, /*debug*/False, 0/*not verbose*/,
+                              bbs_done, False/*NO REDIRECTION*/ )) {
+            /* See handle_noredir_jump. */
+            two_words[0] = VG_TRC_BORING;
+            VG_TRACK( stop_client_code, tid, bbs_done );
+            return;
+         }
+         Bool found = VG_(search_unredir_transtab)( &alt_host_addr, ip );
+         vg_assert2(found, "unredir translation missing after creation?!");
+      }
       host_code_addr = alt_host_addr;
    } else {
       /* normal case -- redir translation */
@@ -988,6 +1011,7 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
                which case we can return now claiming it's not
                findable. */
             two_words[0] = VG_TRC_INNER_FASTMISS; /* hmm, is that right? */
+            VG_TRACK( stop_client_code, tid, bbs_done );
             return;
          }
       }
@@ -1025,9 +1049,6 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
 
    /* Set up return-value area. */
 
-   // Tell the tool this thread is about to run client code
-   VG_TRACK( start_client_code, tid, bbs_done );
-
    vg_assert(VG_(in_generated_code) == False);
    VG_(in_generated_code) = True;
 
@@ -1548,6 +1548,11 @@ void push_signal_frame ( ThreadId tid, const vki_siginfo_t *siginfo,
                          scss.scss_per_sig[sigNo].scss_flags,
                          &tst->sig_mask,
                          scss.scss_per_sig[sigNo].scss_restorer);
+
+   /* The handler is entered without a call; stop stack traces taken
+      from the shadow call stack from running past it. */
+   if (VG_(clo_shadow_call_stack))
+      VG_(shadow_call_stack_push_signal_frame)(tid, VG_(get_SP)(tid));
 }
 
 
@@ -35,6 +35,7 @@
 #include "pub_core_libcassert.h"
 #include "pub_core_libcprint.h"
 #include "pub_core_machine.h"
+#include "pub_core_mallocfree.h"
 #include "pub_core_options.h"
 #include "pub_core_stacks.h"        // VG_(stack_limits)
 #include "pub_core_stacktrace.h"
@@ -1508,6 +1509,180 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
 /*---                                                      ---*/
 /*------------------------------------------------------------*/
 
+/*------------------------------------------------------------*/
+/*--- Shadow call stacks (--shadow-call-stack=yes)         ---*/
+/*------------------------------------------------------------*/
+
+/* With --shadow-call-stack=yes, the JIT appends a call to
+   VG_(shadow_call_stack_push) to each block ending in a call,
+   recording the SP just after the return address was pushed, and the
+   return address itself, and a call to VG_(shadow_call_stack_pop) to
+   each block ending in a return, which pops the frames below the SP
+   after the return.  A frame at that SP is still live: it is the one
+   of a function which returns to its caller just after making a call,
+   without having pushed anything.  A frame is also dead as soon as SP
+   goes above it without a return, which happens with longjmp and
+   exceptions: such frames are popped by the next push or pop, and
+   skipped when taking a stack trace.
+
+   Frames are therefore kept in strictly decreasing SP order.  Taking
+   a stack trace is just a copy of the live frames, which is much
+   cheaper than unwinding with CFI.  We fall back to unwinding
+   whenever the shadow stack can't be trusted: inside a signal
+   handler (a barrier frame with ret == 0 is pushed for each signal
+   frame), and for good after an SP change bigger than
+   VG_(clo_max_stackframe), which indicates a stack switch. */
+
+typedef
+   struct {
+      Addr sp;   /* SP after the call pushed the return address */
+      Addr ret;  /* return address, or 0 for a signal frame */
+   }
+   ShadowFrame;
+
+typedef
+   struct {
+      ShadowFrame* frames;
+      UInt         used;
+      UInt         size;
+      Bool         broken;  /* can't be trusted until the thread exits */
+   }
+   ShadowCallStack;
+
+#define SCS_MIN_FRAMES 64
+#define SCS_MAX_FRAMES (1 << 20)
+
+/* Indexed by ThreadId, allocated at the first push. */
+static ShadowCallStack* shadow_call_stacks = NULL;
+
+static ShadowCallStack* get_shadow_call_stack ( ThreadId tid )
+{
+   if (UNLIKELY(shadow_call_stacks == NULL))
+      shadow_call_stacks = VG_(calloc)("stacktrace.gscs.1", VG_N_THREADS,
+                                       sizeof(ShadowCallStack));
+   vg_assert(tid < VG_N_THREADS);
+   return &shadow_call_stacks[tid];
+}
+
+/* Pop the frames of scs below sp, and the one at sp if AT_SP.  Returns
+   False, and marks scs as broken, if SP moved by more than
+   --max-stackframe, which indicates a stack switch. */
+static Bool pop_dead_shadow_frames ( ShadowCallStack* scs, Addr sp,
+                                     Bool at_sp )
+{
+   Addr max_delta = (Addr)VG_(clo_max_stackframe);
+
+   while (scs->used > 0
+          && (scs->frames[scs->used-1].sp < sp
+              || (at_sp && scs->frames[scs->used-1].sp == sp))) {
+      if (sp - scs->frames[scs->used-1].sp > max_delta) {
+         scs->broken = True;
+         return False;
+      }
+      scs->used--;
+   }
+   if (scs->used > 0 && scs->frames[scs->used-1].sp - sp > max_delta) {
+      scs->broken = True;
+      return False;
+   }
+   return True;
+}
+
+static void push_shadow_frame ( ThreadId tid, Addr sp, Addr ret )
+{
+   ShadowCallStack* scs = get_shadow_call_stack(tid);
+
+   if (UNLIKELY(scs->broken))
+      return;
+
+   /* Frames at or below the new one have returned, or have been
+      unwound by longjmp or an exception. */
+   if (!pop_dead_shadow_frames(scs, sp, True/*at_sp*/))
+      return;
+
+   if (UNLIKELY(scs->used == scs->size)) {
+      if (scs->size == SCS_MAX_FRAMES) {
+         scs->broken = True;
+         return;
+      }
+      scs->size = scs->size == 0 ? SCS_MIN_FRAMES : 2 * scs->size;
+      scs->frames = VG_(realloc)("stacktrace.psf.2", scs->frames,
+                                 scs->size * sizeof(ShadowFrame));
+   }
+   scs->frames[scs->used].sp  = sp;
+   scs->frames[scs->used].ret = ret;
+   scs->used++;
+}
+
+VG_REGPARM(2)
+void VG_(shadow_call_stack_push) ( Addr sp, Addr ret )
+{
+   push_shadow_frame(VG_(running_tid), sp, ret);
+}
+
+VG_REGPARM(1)
+void VG_(shadow_call_stack_pop) ( Addr sp )
+{
+   ShadowCallStack* scs = get_shadow_call_stack(VG_(running_tid));
+
+   if (LIKELY(!scs->broken))
+      pop_dead_shadow_frames(scs, sp, False/*at_sp*/);
+}
+
+void VG_(shadow_call_stack_push_signal_frame) ( ThreadId tid, Addr sp )
+{
+   push_shadow_frame(tid, sp, 0);
+}
+
+void VG_(reset_shadow_call_stack) ( ThreadId tid )
+{
+   if (shadow_call_stacks == NULL)
+      return;
+   vg_assert(tid < VG_N_THREADS);
+   shadow_call_stacks[tid].used   = 0;
+   shadow_call_stacks[tid].broken = False;
+}
+
+/* Build a stack trace for tid from its shadow call stack, given the
+   IP and SP of the innermost frame.  Returns 0 if the caller must
+   unwind the stack instead. */
+static UInt get_StackTrace_from_shadow ( ThreadId tid,
+                                         /*OUT*/Addr* ips, UInt n_ips,
+                                         Addr ip, Addr sp )
+{
+   const ShadowCallStack* scs;
+   Int  cmrf = VG_(clo_merge_recursive_frames);
+   Addr max_delta = (Addr)VG_(clo_max_stackframe);
+   Addr prev_sp = sp;
+   UInt i, j;
+
+   if (shadow_call_stacks == NULL)
+      return 0;
+   scs = &shadow_call_stacks[tid];
+   if (scs->broken)
+      return 0;
+
+   /* Skip the frames of calls which have returned. */
+   j = scs->used;
+   while (j > 0 && scs->frames[j-1].sp < sp)
+      j--;
+
+   vg_assert(n_ips > 0);
+   ips[0] = ip;
+   i = 1;
+   while (i < n_ips && j > 0) {
+      const ShadowFrame* fr = &scs->frames[--j];
+      if (fr->ret == 0 || fr->sp - prev_sp > max_delta)
+         return 0;
+      /* As for the unwinders, ips[i] is the address of the call
+         rather than the return address. */
+      ips[i++] = fr->ret - 1;
+      prev_sp = fr->sp;
+      RECURSIVE_MERGE(cmrf,ips,i);
+   }
+   return i;
+}
+
 /*------------------------------------------------------------*/
 /*--- Exported functions.                                  ---*/
 /*------------------------------------------------------------*/
@@ -1565,6 +1740,14 @@ UInt VG_(get_StackTrace_with_deltas)(
    startRegs.r_pc += (Long)first_ip_delta;
    startRegs.r_sp += (Long)first_sp_delta;
 
+   if (VG_(clo_shadow_call_stack) && sps == NULL && fps == NULL) {
+      UInt n_found = get_StackTrace_from_shadow(tid, ips, n_ips,
+                                                (Addr)startRegs.r_pc,
+                                                (Addr)startRegs.r_sp);
+      if (n_found > 0)
+         return n_found;
+   }
+
    if (0)
       VG_(printf)("tid %u: stack_highest=0x%08lx ip=0x%010llx "
                   "sp=0x%010llx\n",
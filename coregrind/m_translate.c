@@ -37,6 +37,7 @@
 #include "pub_core_libcbase.h"
 #include "pub_core_libcassert.h"
 #include "pub_core_libcprint.h"
+#include "pub_core_mallocfree.h"
 #include "pub_core_options.h"
 
 #include "pub_core_debuginfo.h"  // VG_(get_fnname_w_offset)
@@ -44,6 +45,7 @@
 
 #include "pub_core_signals.h"    // VG_(synth_fault_{perms,mapping}
 #include "pub_core_stacks.h"     // VG_(unknown_SP_update*)()
+#include "pub_core_stacktrace.h" // VG_(shadow_call_stack_push)
 #include "pub_core_tooliface.h"  // VG_(tdict)
 
 #include "pub_core_translate.h"
@@ -225,31 +227,137 @@ static IRExpr* mk_ecu_Expr ( Addr guest_IP )
    return mkIRExpr_HWord( (HWord)ecu );
 }
 
-/* When gdbserver is activated, the translation of a block must
-   first be done by the tool function, then followed by a pass
-   which (if needed) instruments the code for gdbserver.
+/* With --shadow-call-stack=yes, a block ending in a call pushes the
+   call on the thread's shadow call stack, and a block ending in a
+   return pops the frames the return has left.  Calls are not chased
+   (see m_main.c), so the call is the last instruction of the block,
+   and the return address is the end of its IMark.  The SP read here
+   is the SP after the return address has been pushed, or after it has
+   been popped.
+
+   SP can also go up without a return, by longjmp or when an exception
+   is thrown.  So a block not ending in a return also pops the frames
+   below the new SP after each change of SP which is not by a known
+   constant, as those unwind the stack by loading SP from memory or
+   from another register.  Changes by a constant (push, pop, add and
+   sub) stay within the current function's frame. */
+static
+IRSB* shadow_call_stack_pass ( IRSB*                 sb,
+                               const VexGuestLayout* layout,
+                               IRType                gWordTy )
+{
+   Int      i;
+   IRTemp   sp;
+   IRDirty* di;
+   Addr     ret;
+   IROp     add_op = gWordTy == Ity_I32 ? Iop_Add32 : Iop_Add64;
+   IROp     sub_op = gWordTy == Ity_I32 ? Iop_Sub32 : Iop_Sub64;
+
+   if (sb->jumpkind != Ijk_Ret) {
+      /* Which temps hold SP plus or minus a constant? */
+      Bool* is_SP_tmp = VG_(calloc)("m_translate.scsp.1",
+                                    sb->tyenv->types_used, sizeof(Bool));
+      IRSB* bb = deepCopyIRSBExceptStmts(sb);
+
+      for (i = 0; i < sb->stmts_used; i++) {
+         IRStmt* st = sb->stmts[i];
+         IRExpr* e;
+
+         addStmtToIRSB(bb, st);
+         if (st->tag == Ist_WrTmp) {
+            e = st->Ist.WrTmp.data;
+            if ((e->tag == Iex_Get
+                 && e->Iex.Get.offset == layout->offset_SP
+                 && e->Iex.Get.ty == gWordTy)
+                || (e->tag == Iex_RdTmp && is_SP_tmp[e->Iex.RdTmp.tmp])
+                || (e->tag == Iex_Binop
+                    && (e->Iex.Binop.op == add_op
+                        || e->Iex.Binop.op == sub_op)
+                    && e->Iex.Binop.arg1->tag == Iex_RdTmp
+                    && is_SP_tmp[e->Iex.Binop.arg1->Iex.RdTmp.tmp]
+                    && e->Iex.Binop.arg2->tag == Iex_Const))
+               is_SP_tmp[st->Ist.WrTmp.tmp] = True;
+         } else if (st->tag == Ist_Put
+                    && st->Ist.Put.offset == layout->offset_SP
+                    && typeOfIRExpr(sb->tyenv, st->Ist.Put.data) == gWordTy) {
+            e = st->Ist.Put.data;
+            if (e->tag == Iex_RdTmp && is_SP_tmp[e->Iex.RdTmp.tmp])
+               continue;
+            di = unsafeIRDirty_0_N(
+                    1/*regparms*/,
+                    "VG_(shadow_call_stack_pop)",
+                    VG_(fnptr_to_fnentry)( &VG_(shadow_call_stack_pop) ),
+                    mkIRExprVec_1( e )
+                 );
+            addStmtToIRSB(bb, IRStmt_Dirty(di));
+         }
+      }
+      VG_(free)(is_SP_tmp);
+      sb = bb;
+   }
+
+   if (sb->jumpkind != Ijk_Call && sb->jumpkind != Ijk_NoRedir
+       && sb->jumpkind != Ijk_Ret)
+      return sb;
+
+   sp = newIRTemp(sb->tyenv, gWordTy);
+   addStmtToIRSB(sb, IRStmt_WrTmp(sp, IRExpr_Get(layout->offset_SP,
+                                                 gWordTy)));
+   if (sb->jumpkind == Ijk_Ret) {
+      di = unsafeIRDirty_0_N(
+              1/*regparms*/,
+              "VG_(shadow_call_stack_pop)",
+              VG_(fnptr_to_fnentry)( &VG_(shadow_call_stack_pop) ),
+              mkIRExprVec_1( IRExpr_RdTmp(sp) )
+           );
+   } else {
+      for (i = sb->stmts_used - 1; i >= 0; i--)
+         if (sb->stmts[i]->tag == Ist_IMark)
+            break;
+      vg_assert(i >= 0);
+      ret = (Addr)sb->stmts[i]->Ist.IMark.addr
+            + sb->stmts[i]->Ist.IMark.len;
+      di = unsafeIRDirty_0_N(
+              2/*regparms*/,
+              "VG_(shadow_call_stack_push)",
+              VG_(fnptr_to_fnentry)( &VG_(shadow_call_stack_push) ),
+              mkIRExprVec_2( IRExpr_RdTmp(sp), mkIRExpr_HWord(ret) )
+           );
+   }
+   addStmtToIRSB(sb, IRStmt_Dirty(di));
+   return sb;
+}
+
+/* When gdbserver is activated, or with --shadow-call-stack=yes, the
+   translation of a block must first be done by the tool function,
+   then followed by the core passes which (if needed) instrument the
+   code for gdbserver and for the shadow call stack.
 */
 static
-IRSB* tool_instrument_then_gdbserver_if_needed ( VgCallbackClosure* closureV,
-                                                 IRSB*              sb_in,
-                                                 const VexGuestLayout*  layout,
-                                                 const VexGuestExtents* vge,
-                                                 const VexArchInfo*     vai,
-                                                 IRType             gWordTy, 
-                                                 IRType             hWordTy )
+IRSB* tool_instrument_then_core_passes ( VgCallbackClosure* closureV,
+                                         IRSB*              sb_in,
+                                         const VexGuestLayout*  layout,
+                                         const VexGuestExtents* vge,
+                                         const VexArchInfo*     vai,
+                                         IRType             gWordTy, 
+                                         IRType             hWordTy )
 {
-   return VG_(instrument_for_gdbserver_if_needed)
-      (VG_(tdict).tool_instrument (closureV,
-                                   sb_in,
-                                   layout,
-                                   vge,
-                                   vai,
-                                   gWordTy,
-                                   hWordTy),
-       layout,
-       vge,
-       gWordTy,
-       hWordTy);                                   
+   IRSB* sb = VG_(tdict).tool_instrument (closureV,
+                                          sb_in,
+                                          layout,
+                                          vge,
+                                          vai,
+                                          gWordTy,
+                                          hWordTy);
+   if (VG_(clo_vgdb) != Vg_VgdbNo)
+      sb = VG_(instrument_for_gdbserver_if_needed)(sb,
+                                                   layout,
+                                                   vge,
+                                                   gWordTy,
+                                                   hWordTy);
+   if (VG_(clo_shadow_call_stack))
+      sb = shadow_call_stack_pass(sb, layout, gWordTy);
+   return sb;
 }
 
 /* For tools that want to know about SP changes, this pass adds
@@ -1778,8 +1886,8 @@ Bool VG_(translate) ( ThreadId tid,
      IRSB*(*f)(VgCallbackClosure*,
                IRSB*,const VexGuestLayout*,const VexGuestExtents*,
                const VexArchInfo*,IRType,IRType)
-        = VG_(clo_vgdb) != Vg_VgdbNo
-             ? tool_instrument_then_gdbserver_if_needed
+        = VG_(clo_vgdb) != Vg_VgdbNo || VG_(clo_shadow_call_stack)
+             ? tool_instrument_then_core_passes
              : VG_(tdict).tool_instrument;
      IRSB*(*g)(void*,
                IRSB*,const VexGuestLayout*,const VexGuestExtents*,
@@ -143,25 +143,9 @@ static Int ips_order_cmp(const void* vleft, const void* vright)
    const Xecu right_xecu = *(const Xecu*)vright;
    const xec* left  = VG_(indexXA)(xec_data_for_sort, left_xecu);
    const xec* right = VG_(indexXA)(xec_data_for_sort, right_xecu);
-   const StackTrace left_ips  = VG_(get_ExeContext_StackTrace)(left->ec)
-      + left->top;
-   const StackTrace right_ips = VG_(get_ExeContext_StackTrace)(right->ec)
-      + right->top;
-   UInt i;
-
-   const UInt c_n_ips_sel = left->n_ips_sel < right->n_ips_sel 
-      ? left->n_ips_sel : right->n_ips_sel;
 
-   // First see if we have a difference on the common nr of ips selected
-   for (i = 0; i < c_n_ips_sel; i++) {
-      if (left_ips[i] == right_ips[i]) continue;
-      if (left_ips[i] < right_ips[i]) return -1;
-      return  1;
-   }
-   // Common part is equal => compare lengths.
-   if (left->n_ips_sel < right->n_ips_sel) return -1;
-   if (left->n_ips_sel > right->n_ips_sel) return  1;
-   return 0;
+   return VG_(cmp_ExeContext_ips)(left->ec, left->top, left->n_ips_sel,
+                                  right->ec, right->top, right->n_ips_sel);
 }
 
 // If needed, build or refresh shared->ips_order_xecu
@@ -315,8 +299,9 @@ static Xecu find_or_insert (XTree* xt, ExeContext* ec)
       } else {
          UInt top;
          UInt n_ips_sel = VG_(get_ExeContext_n_ips)(xe.ec);
-         xt->filter_IPs_fn(VG_(get_ExeContext_StackTrace)(xe.ec), n_ips_sel,
-                           &top, &n_ips_sel);
+         Addr ips[n_ips_sel];
+         VG_(get_ExeContext_ips)(xe.ec, 0, n_ips_sel, ips);
+         xt->filter_IPs_fn(ips, n_ips_sel, &top, &n_ips_sel);
          xe.top = (UShort)top;
          xe.n_ips_sel = (UShort)n_ips_sel;
       }
@@ -547,11 +532,13 @@ void VG_(XT_callgrind_print)
          UInt called_linenum;
          UInt prev_linenum;
 
-         const Addr* ips = VG_(get_ExeContext_StackTrace)(xe->ec) + xe->top;
+         Addr ips[xe->n_ips_sel];
          const DiEpoch ep = VG_(get_ExeContext_epoch)(xe->ec);
 
          Int ips_idx = xe->n_ips_sel - 1;
 
+         VG_(get_ExeContext_ips)(xe->ec, xe->top, xe->n_ips_sel, ips);
+
          if (0) {
             VG_(printf)("entry img %s\n", img);
             VG_(pp_ExeContext)(xe->ec);
@@ -813,7 +800,8 @@ static void ms_output_group (VgFile* fp, UInt depth, UInt indent,
 }
 
 /* Allocate and build an array of Ms_Ec sorted by addresses in the
-   Ms_Ec StackTrace. */
+   Ms_Ec StackTrace.  The IPs of the Ms_Ec are copied after the array,
+   in the same block. */
 static void prepare_ms_ec (XTree* xt,
                            ULong (*report_value)(const void* value),
                            ULong* top_total, Ms_Ec** vms_ec, UInt* vn_ec)
@@ -821,11 +809,19 @@ static void prepare_ms_ec (XTree* xt,
    XT_shared* shared = xt->shared;
    const UInt n_xecu = VG_(sizeXA)(shared->xec);
    const UInt n_data_xecu = VG_(sizeXA)(xt->data);
-   Ms_Ec* ms_ec = VG_(malloc)("XT_massif_print.ms_ec", n_xecu * sizeof(Ms_Ec));
+   SizeT n_ips_total = 0;
+   Ms_Ec* ms_ec;
+   Addr* ips;
    UInt n_xecu_sel = 0; // Nr of xecu that are selected for output.
 
    vg_assert(n_data_xecu <= n_xecu);
 
+   for (Xecu xecu = 0; xecu < n_data_xecu; xecu++)
+      n_ips_total += ((xec*)VG_(indexXA)(shared->xec, xecu))->n_ips_sel;
+   ms_ec = VG_(malloc)("XT_massif_print.ms_ec",
+                       n_xecu * sizeof(Ms_Ec) + n_ips_total * sizeof(Addr));
+   ips = (Addr*)&ms_ec[n_xecu];
+
    // Ensure we have in shared->ips_order_xecu our xecu sorted by StackTrace.
    ensure_ips_order_xecu_valid(shared);
 
@@ -841,7 +837,9 @@ static void prepare_ms_ec (XTree* xt,
       if (ms_ec[n_xecu_sel].n_ips == 0)
          continue;
             
-      ms_ec[n_xecu_sel].ips = VG_(get_ExeContext_StackTrace)(xe->ec) + xe->top;
+      VG_(get_ExeContext_ips)(xe->ec, xe->top, xe->n_ips_sel, ips);
+      ms_ec[n_xecu_sel].ips = ips;
+      ips += xe->n_ips_sel;
       ms_ec[n_xecu_sel].report_value
          = (*report_value)(VG_(indexXA)(xt->data, xecu));
       *top_total += ms_ec[n_xecu_sel].report_value;
@@ -167,6 +167,9 @@ extern Bool VG_(use_FPO_info) ( /*MOD*/Addr* ipP,
    range [from,to]. */
 extern void VG_(ppUnwindInfo) (Addr from, Addr to);
 
+/* Print stats (informational only). */
+extern void VG_(print_debuginfo_stats) ( void );
+
 /* AVMAs for a symbol. Usually only the lowest address of the entity.
    On ppc64 platforms, also contains tocptr and local_ep.
    These fields should only be accessed using the macros
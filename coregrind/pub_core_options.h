@@ -168,6 +168,17 @@ extern const HChar* VG_(clo_debuginfo_server);
    _debuginfo_server. */
 extern Bool VG_(clo_allow_mismatched_debuginfo);
 
+/* Directory in which the debug info read from objects having a
+   build-id is saved, to be reused by later runs.  NULL if none. */
+extern const HChar* VG_(clo_debuginfo_cache);
+/* Size in MB above which the oldest entries of the debug info cache
+   are removed.  Default: 512. */
+extern UInt VG_(clo_debuginfo_cache_size);
+
+/* Size in MB of the cache of file blocks and decompressed section
+   chunks used when reading the debug info of an object.  Default: 64. */
+extern UInt VG_(clo_image_cache_size);
+
 /* DEBUG: print generated code?  default: 00000000 ( == NO ) */
 extern UChar VG_(clo_trace_flags);
 
@@ -255,6 +266,9 @@ extern Bool VG_(clo_sym_offsets);
 extern Bool VG_(clo_read_inline_info);
 /* Read DWARF3 variable info even if tool doesn't ask for it? */
 extern Bool VG_(clo_read_var_info);
+/* Defer reading of line number, inline and variable info until it is
+   first queried?  Default: NO */
+extern Bool VG_(clo_lazy_debuginfo);
 /* Which prefix to strip from full source file paths, if any. */
 extern const HChar* VG_(clo_prefix_to_strip);
 
@@ -330,6 +344,15 @@ extern UInt VG_(clo_max_threads);
    Note that the value is changeable by a gdbsrv command. */
 extern Int VG_(clo_merge_recursive_frames);
 
+/* Should stack traces be taken from a per-thread shadow stack of
+   calls, maintained by the JIT, rather than by unwinding the stack?
+   Default: NO.  Only supported on x86 and amd64. */
+extern Bool VG_(clo_shadow_call_stack);
+
+/* Number of entries of each thread's cache of CFI unwind info
+   lookups.  Default: 2048. */
+extern UInt VG_(clo_cfi_cache_size);
+
 /* Max number of sectors that will be used by the translation code cache. */
 extern UInt VG_(clo_num_transtab_sectors);
 
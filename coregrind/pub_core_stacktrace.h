@@ -55,6 +55,21 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
                                const UnwindStartRegs* startRegs,
                                Addr fp_max_orig );
 
+// Shadow call stacks, for --shadow-call-stack=yes.  The push function
+// is called from generated code at the end of each block which ends
+// in a call, with the SP after the call and the return address, and
+// the pop function at the end of each block which ends in a return,
+// with the SP after the return.  A signal frame is pushed when a
+// signal handler is invoked, and the thread's shadow stack is reset
+// when its ThreadState is cleared.
+extern VG_REGPARM(2)
+       void VG_(shadow_call_stack_push) ( Addr sp, Addr ret );
+extern VG_REGPARM(1)
+       void VG_(shadow_call_stack_pop) ( Addr sp );
+extern void VG_(shadow_call_stack_push_signal_frame) ( ThreadId tid,
+                                                       Addr sp );
+extern void VG_(reset_shadow_call_stack) ( ThreadId tid );
+
 #endif   // __PUB_CORE_STACKTRACE_H
 
 /*--------------------------------------------------------------------*/
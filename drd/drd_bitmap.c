@@ -30,6 +30,7 @@
 #include "pub_tool_libcbase.h"    /* VG_(memset) */
 #include "pub_tool_libcprint.h"   /* VG_(printf) */
 #include "pub_tool_mallocfree.h"  /* VG_(malloc), VG_(free) */
+#include "pub_tool_poolalloc.h"   /* VG_(newPA)() */
 
 
 /* Local function declarations. */
@@ -42,11 +43,23 @@ static void bm2_print(const struct bitmap2* const bm2);
 /* Local variables. */
 
 static OSet* s_bm2_set_template;
+static UInt  s_bm_cache_size = DRD_BITMAP_N_CACHE_ELEM;
+static PoolAlloc* s_bm_cache_pool;
 static ULong s_bitmap_creation_count;
 static ULong s_bitmap_merge_count;
 static ULong s_bitmap2_merge_count;
 
 
+/* Global variables. */
+
+/*
+ * a1 is initialized with a value that never can match any valid address:
+ * the upper (ADDR_LSB_BITS + ADDR_IGNORED_BITS) bits of a1 are always zero
+ * for a valid cache entry.
+ */
+struct bm_cache_elem DRD_(bm_no_cache) = { ~(UWord)1, 0 };
+
+
 /* Function definitions. */
 
 void DRD_(bm_module_init)(void)
@@ -62,6 +75,48 @@ void DRD_(bm_module_cleanup)(void)
    tl_assert(s_bm2_set_template);
    VG_(OSetGen_Destroy)(s_bm2_set_template);
    s_bm2_set_template = NULL;
+   if (s_bm_cache_pool)
+   {
+      VG_(deletePA)(s_bm_cache_pool);
+      s_bm_cache_pool = NULL;
+   }
+}
+
+/**
+ * Set the number of elements of the lookup cache of each bitmap. Must be a
+ * power of two, and be called before any lookup cache has been allocated.
+ */
+void DRD_(bm_set_cache_size)(const UInt n)
+{
+   tl_assert(n > 0 && (n & (n - 1)) == 0);
+   tl_assert(!s_bm_cache_pool);
+   s_bm_cache_size = n;
+}
+
+UInt DRD_(bm_get_cache_size)(void)
+{
+   return s_bm_cache_size;
+}
+
+/**
+ * Allocate the lookup cache of bm. The caches are allocated in large
+ * chunks from a pool, since all caches have the same size.
+ */
+void DRD_(bm_cache_alloc)(struct bitmap* const bm)
+{
+   unsigned i;
+
+   tl_assert(bm->cache == &DRD_(bm_no_cache));
+
+   if (!s_bm_cache_pool)
+      s_bm_cache_pool
+         = VG_(newPA)(s_bm_cache_size * sizeof(struct bm_cache_elem),
+                      128,
+                      VG_(malloc), "drd.bitmap.bca.1", VG_(free));
+   bm->cache = VG_(allocEltPA)(s_bm_cache_pool);
+   bm->cache_mask = s_bm_cache_size - 1;
+   for (i = 0; i < s_bm_cache_size; i++)
+      bm->cache[i] = DRD_(bm_no_cache);
 }
 
 struct bitmap* DRD_(bm_new)()
@@ -89,19 +144,10 @@ void DRD_(bm_delete)(struct bitmap* const bm)
 /** Initialize *bm. */
 void DRD_(bm_init)(struct bitmap* const bm)
 {
-   unsigned i;
-
    tl_assert(bm);
-   /*
-    * Cache initialization. a1 is initialized with a value that never can
-    * match any valid address: the upper (ADDR_LSB_BITS + ADDR_IGNORED_BITS)
-    * bits of a1 are always zero for a valid cache entry.
-    */
-   for (i = 0; i < DRD_BITMAP_N_CACHE_ELEM; i++)
-   {
-      bm->cache[i].a1  = ~(UWord)1;
-      bm->cache[i].bm2 = 0;
-   }
+   /* The lookup cache is only allocated when it is used. */
+   bm->cache = &DRD_(bm_no_cache);
+   bm->cache_mask = 0;
    bm->oset = VG_(OSetGen_EmptyClone)(s_bm2_set_template);
 
    s_bitmap_creation_count++;
@@ -110,6 +156,8 @@ void DRD_(bm_init)(struct bitmap* const bm)
 /** Free the memory allocated by DRD_(bm_init)(). */
 void DRD_(bm_cleanup)(struct bitmap* const bm)
 {
+   if (bm->cache != &DRD_(bm_no_cache))
+      VG_(freeEltPA)(s_bm_cache_pool, bm->cache);
    VG_(OSetGen_Destroy)(bm->oset);
 }
 
@@ -1007,9 +1055,10 @@ Bool DRD_(bm_equal)(struct bitmap* const lhs, struct bitmap* const rhs)
 
 void DRD_(bm_swap)(struct bitmap* const bm1, struct bitmap* const bm2)
 {
-   OSet* const tmp = bm1->oset;
-   bm1->oset = bm2->oset;
-   bm2->oset = tmp;
+   /* The lookup caches point into the OSets, so swap them too. */
+   const struct bitmap tmp = *bm1;
+   *bm1 = *bm2;
+   *bm2 = tmp;
 }
 
 /** Merge bitmaps *lhs and *rhs into *lhs. */
@@ -1185,16 +1234,17 @@ int DRD_(bm_has_races)(struct bitmap* const lhs, struct bitmap* const rhs)
 
       for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
       {
+         /*
+          * Compute HAS_RACE() for all the bits of a word at once, and only
+          * look at the individual bits if there is a race.
+          */
+         UWord races = (bm1l->bm0_w[k] & (bm1r->bm0_r[k] | bm1r->bm0_w[k]))
+                       | (bm1l->bm0_r[k] & bm1r->bm0_w[k]);
          unsigned b;
-         for (b = 0; b < BITS_PER_UWORD; b++)
+         for (b = 0; races; b++, races >>= 1)
          {
-            UWord const access_mask
-               = ((bm1l->bm0_r[k] & bm0_mask(b)) ? LHS_R : 0)
-               | ((bm1l->bm0_w[k] & bm0_mask(b)) ? LHS_W : 0)
-               | ((bm1r->bm0_r[k] & bm0_mask(b)) ? RHS_R : 0)
-               | ((bm1r->bm0_w[k] & bm0_mask(b)) ? RHS_W : 0);
             Addr const a = make_address(bm2l->addr, k * BITS_PER_UWORD | b);
-            if (HAS_RACE(access_mask) && ! DRD_(is_suppressed)(a, a + 1))
+            if ((races & 1) && ! DRD_(is_suppressed)(a, a + 1))
             {
                return 1;
             }
@@ -344,111 +344,32 @@ struct bitmap2* bm2_insert(struct bitmap* const bm, const UWord a1);
 
 
 
+/** Cache of the bitmaps for which no lookup has been cached yet. */
+extern struct bm_cache_elem DRD_(bm_no_cache);
+
+void DRD_(bm_cache_alloc)(struct bitmap* const bm);
+
 /**
- * Rotate elements cache[0..n-1] such that the element at position n-1 is
- * moved to position 0. This allows to speed up future cache lookups.
+ * Look up a1 in the lookup cache of bm. Since the cache is direct-mapped,
+ * this takes a constant time.
  */
-static __inline__
-void bm_cache_rotate(struct bm_cache_elem cache[], const int n)
-{
-#if 0
-   struct bm_cache_elem t;
-
-   tl_assert(2 <= n && n <= 8);
-
-   t = cache[0];
-   if (n > 1)
-      cache[0] = cache[1];
-   if (n > 2)
-      cache[1] = cache[2];
-   if (n > 3)
-      cache[2] = cache[3];
-   if (n > 4)
-      cache[3] = cache[4];
-   if (n > 5)
-      cache[4] = cache[5];
-   if (n > 6)
-      cache[5] = cache[6];
-   if (n > 7)
-      cache[6] = cache[7];
-   cache[n - 1] = t;
-#endif
-}
-
 static __inline__
 Bool bm_cache_lookup(struct bitmap* const bm, const UWord a1,
                      struct bitmap2** bm2)
 {
+   const struct bm_cache_elem* elem;
+
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
    tl_assert(bm);
    tl_assert(bm2);
 #endif
 
-#if DRD_BITMAP_N_CACHE_ELEM > 8
-#error Please update the code below.
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 1
-   if (a1 == bm->cache[0].a1)
-   {
-      *bm2 = bm->cache[0].bm2;
-      return True;
-   }
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 2
-   if (a1 == bm->cache[1].a1)
-   {
-      *bm2 = bm->cache[1].bm2;
-      return True;
-   }
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 3
-   if (a1 == bm->cache[2].a1)
-   {
-      *bm2 = bm->cache[2].bm2;
-      bm_cache_rotate(bm->cache, 3);
-      return True;
-   }
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 4
-   if (a1 == bm->cache[3].a1)
+   elem = &bm->cache[a1 & bm->cache_mask];
+   if (a1 == elem->a1)
    {
-      *bm2 = bm->cache[3].bm2;
-      bm_cache_rotate(bm->cache, 4);
+      *bm2 = elem->bm2;
       return True;
    }
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 5
-   if (a1 == bm->cache[4].a1)
-   {
-      *bm2 = bm->cache[4].bm2;
-      bm_cache_rotate(bm->cache, 5);
-      return True;
-   }
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 6
-   if (a1 == bm->cache[5].a1)
-   {
-      *bm2 = bm->cache[5].bm2;
-      bm_cache_rotate(bm->cache, 6);
-      return True;
-   }
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 7
-   if (a1 == bm->cache[6].a1)
-   {
-      *bm2 = bm->cache[6].bm2;
-      bm_cache_rotate(bm->cache, 7);
-      return True;
-   }
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 8
-   if (a1 == bm->cache[7].a1)
-   {
-      *bm2 = bm->cache[7].bm2;
-      bm_cache_rotate(bm->cache, 8);
-      return True;
-   }
-#endif
    *bm2 = 0;
    return False;
 }
@@ -458,36 +379,17 @@ void bm_update_cache(struct bitmap* const bm,
                      const UWord a1,
                      struct bitmap2* const bm2)
 {
+   struct bm_cache_elem* elem;
+
 #ifdef ENABLE_DRD_CONSISTENCY_CHECKS
    tl_assert(bm);
 #endif
 
-#if DRD_BITMAP_N_CACHE_ELEM > 8
-#error Please update the code below.
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 8
-   bm->cache[7] = bm->cache[6];
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 7
-   bm->cache[6] = bm->cache[5];
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 6
-   bm->cache[5] = bm->cache[4];
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 5
-   bm->cache[4] = bm->cache[3];
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 4
-   bm->cache[3] = bm->cache[2];
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 3
-   bm->cache[2] = bm->cache[1];
-#endif
-#if DRD_BITMAP_N_CACHE_ELEM >= 2
-   bm->cache[1] = bm->cache[0];
-#endif
-   bm->cache[0].a1  = a1;
-   bm->cache[0].bm2 = bm2;
+   if (UNLIKELY(bm->cache == &DRD_(bm_no_cache)))
+      DRD_(bm_cache_alloc)(bm);
+   elem = &bm->cache[a1 & bm->cache_mask];
+   elem->a1  = a1;
+   elem->bm2 = bm2;
 }
 
 /**
@@ -65,6 +65,7 @@ static Bool trace_sectsuppr;
  */
 static Bool DRD_(process_cmd_line_option)(const HChar* arg)
 {
+   int bitmap_cache_size      = -1;
    int check_stack_accesses   = -1;
    int join_list_vol          = -1;
    int exclusive_threshold_ms = -1;
@@ -90,7 +91,9 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
    const HChar* trace_address = 0;
    const HChar* ptrace_address= 0;
 
-   if      VG_BOOL_CLO(arg, "--check-stack-var",     check_stack_accesses) {}
+   if      VG_BINT_CLO(arg, "--bitmap-cache-size",   bitmap_cache_size,
+                       1, 4096) {}
+   else if VG_BOOL_CLO(arg, "--check-stack-var",     check_stack_accesses) {}
    else if VG_INT_CLO (arg, "--join-list-vol",       join_list_vol) {}
    else if VG_BOOL_CLO(arg, "--drd-stats",           s_print_stats) {}
    else if VG_BOOL_CLO(arg, "--first-race-only",     first_race_only) {}
@@ -129,6 +132,12 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
+   if (bitmap_cache_size != -1)
+   {
+      if (bitmap_cache_size & (bitmap_cache_size - 1))
+         VG_(fmsg_bad_option)(arg, "must be a power of two\n");
+      DRD_(bm_set_cache_size)(bitmap_cache_size);
+   }
    if (check_stack_accesses != -1)
       DRD_(set_check_stack_accesses)(check_stack_accesses);
    if (exclusive_threshold_ms != -1)
@@ -202,6 +211,8 @@ static Bool DRD_(process_cmd_line_option)(const HChar* arg)
 static void DRD_(print_usage)(void)
 {
    VG_(printf)(
+"    --bitmap-cache-size=<n>   Number of entries of the per-bitmap lookup\n"
+"                              cache, a power of two [%u].\n"
 "    --check-stack-var=yes|no  Whether or not to report data races on\n"
 "                              stack variables [no].\n"
 "    --exclusive-threshold=<n> Print an error message if any mutex or\n"
@@ -247,6 +258,7 @@ static void DRD_(print_usage)(void)
 "    --trace-mutex=yes|no      Trace all mutex activity [no].\n"
 "    --trace-rwlock=yes|no     Trace all reader-writer lock activity[no].\n"
 "    --trace-semaphore=yes|no  Trace all semaphore activity [no].\n",
+DRD_(bm_get_cache_size)(),
 DRD_(thread_get_segment_merge_interval)(),
 DRD_(ignore_thread_creation) ? "yes" : "no"
 );
@@ -71,8 +71,13 @@ static Bool     s_trace_conflict_set = False;
 static Bool     s_trace_conflict_set_bm = False;
 static Bool     s_trace_fork_join = False;
 static Bool     s_segment_merging = True;
-static Bool     s_new_segments_since_last_merge;
+static int      s_new_segments_since_last_merge;
 static int      s_segment_merge_interval = 10;
+static ULong    s_segment_merge_threshold;
+static Segment** s_cs;
+static unsigned s_cs_capacity;
+static unsigned* s_cs_begin;
+static unsigned s_cs_nthreads;
 static unsigned s_join_list_vol = 10;
 static unsigned s_deletion_head;
 static unsigned s_deletion_tail;
@@ -151,6 +156,8 @@ void DRD_(thread_init)(void)
       static ThreadInfo initval;
       DRD_(g_threadinfo)[i] = initval;
    }
+   s_cs_begin = VG_(malloc)("drd.main.ti.2",
+                            (DRD_N_THREADS + 1) * sizeof s_cs_begin[0]);
 }
 
 /**
@@ -1021,7 +1028,9 @@ static void thread_discard_ordered_segments(void)
  * precede future segments via inter-thread synchronization operations. In
  * DRD the set CS consists of the latest segment of each thread combined with
  * all segments for which the reference count is strictly greater than one.
- * The code below is an optimized version of the following:
+ * The segments of CS are collected by thread_collect_cs() before a merge
+ * pass, since merging does not modify CS. The code below is an optimized
+ * version of the following:
  *
  * for (i = 0; i < DRD_N_THREADS; i++)
  * {
@@ -1053,28 +1062,58 @@ static Bool thread_consistent_segment_ordering(const DrdThreadId tid,
    tl_assert(sg1->thr_next == sg2);
    tl_assert(DRD_(vc_lte)(&sg1->vc, &sg2->vc));
 
+   for (i = 0; i < s_cs_nthreads; i++)
+   {
+      unsigned j;
+
+      for (j = s_cs_begin[i]; j < s_cs_begin[i + 1]; j++) {
+         const Segment* const sg = s_cs[j];
+         if (DRD_(vc_lte)(&sg2->vc, &sg->vc))
+            break;
+         if (DRD_(vc_lte)(&sg1->vc, &sg->vc))
+            return False;
+      }
+      for (j = s_cs_begin[i + 1]; j > s_cs_begin[i]; j--) {
+         const Segment* const sg = s_cs[j - 1];
+         if (DRD_(vc_lte)(&sg->vc, &sg1->vc))
+            break;
+         if (DRD_(vc_lte)(&sg->vc, &sg2->vc))
+            return False;
+      }
+   }
+   return True;
+}
+
+/**
+ * Collect the segments of the set CS (see also
+ * thread_consistent_segment_ordering()) in s_cs, per thread and in thread
+ * order: the segments of the i-th thread having such segments are
+ * s_cs[s_cs_begin[i] .. s_cs_begin[i + 1] - 1].
+ */
+static void thread_collect_cs(void)
+{
+   unsigned i, n = 0;
+
+   s_cs_nthreads = 0;
    for (i = 0; i < DRD_N_THREADS; i++)
    {
+      const unsigned begin = n;
       Segment* sg;
 
       for (sg = DRD_(g_threadinfo)[i].sg_first; sg; sg = sg->thr_next) {
          if (!sg->thr_next || DRD_(sg_get_refcnt)(sg) > 1) {
-            if (DRD_(vc_lte)(&sg2->vc, &sg->vc))
-               break;
-            if (DRD_(vc_lte)(&sg1->vc, &sg->vc))
-               return False;
-         }
-      }
-      for (sg = DRD_(g_threadinfo)[i].sg_last; sg; sg = sg->thr_prev) {
-         if (!sg->thr_next || DRD_(sg_get_refcnt)(sg) > 1) {
-            if (DRD_(vc_lte)(&sg->vc, &sg1->vc))
-               break;
-            if (DRD_(vc_lte)(&sg->vc, &sg2->vc))
-               return False;
+            if (n == s_cs_capacity) {
+               s_cs_capacity = s_cs_capacity ? 2 * s_cs_capacity : 64;
+               s_cs = VG_(realloc)("drd.thread.cs.1", s_cs,
+                                   s_cs_capacity * sizeof s_cs[0]);
+            }
+            s_cs[n++] = sg;
          }
       }
+      if (n > begin)
+         s_cs_begin[s_cs_nthreads++] = begin;
    }
-   return True;
+   s_cs_begin[s_cs_nthreads] = n;
 }
 
 /**
@@ -1102,6 +1141,8 @@ static void thread_merge_segments(void)
 
    s_new_segments_since_last_merge = 0;
 
+   thread_collect_cs();
+
    for (i = 0; i < DRD_N_THREADS; i++)
    {
       Segment* sg;
@@ -1111,7 +1152,11 @@ static void thread_merge_segments(void)
 #endif
 
       for (sg = DRD_(g_threadinfo)[i].sg_first; sg; sg = sg->thr_next) {
-         if (DRD_(sg_get_refcnt)(sg) == 1 && sg->thr_next) {
+         /*
+          * Merge sg with its successors as long as possible, such that a
+          * single pass merges runs of segments and not only pairs.
+          */
+         while (DRD_(sg_get_refcnt)(sg) == 1 && sg->thr_next) {
             Segment* const sg_next = sg->thr_next;
             if (DRD_(sg_get_refcnt)(sg_next) == 1
                 && sg_next->thr_next
@@ -1121,6 +1166,8 @@ static void thread_merge_segments(void)
                DRD_(sg_merge)(sg, sg_next);
                thread_discard_segment(i, sg_next);
             }
+            else
+               break;
          }
       }
 
@@ -1130,6 +1177,27 @@ static void thread_merge_segments(void)
    }
 }
 
+/**
+ * Called each time a segment has been created. Segment merging is deferred
+ * until at least s_segment_merge_interval segments have been created since
+ * the previous merge and the number of segments has reached
+ * s_segment_merge_threshold, which is set to twice the number of segments
+ * that survive a merge. Since the cost of a merge pass grows with the
+ * number of segments, this keeps the cost per created segment bounded when
+ * few segments can be merged, e.g. when there are many threads.
+ */
+static void thread_maybe_merge_segments(void)
+{
+   if (s_segment_merging
+       && ++s_new_segments_since_last_merge >= s_segment_merge_interval
+       && DRD_(sg_get_segments_alive_count)() >= s_segment_merge_threshold)
+   {
+      thread_discard_ordered_segments();
+      thread_merge_segments();
+      s_segment_merge_threshold = 2 * DRD_(sg_get_segments_alive_count)();
+   }
+}
+
 /**
  * Create a new segment for the specified thread, and discard any segments
  * that cannot cause races anymore.
@@ -1154,12 +1222,7 @@ void DRD_(thread_new_segment)(const DrdThreadId tid)
 
    tl_assert(thread_conflict_set_up_to_date(DRD_(g_drd_running_tid)));
 
-   if (s_segment_merging
-       && ++s_new_segments_since_last_merge >= s_segment_merge_interval)
-   {
-      thread_discard_ordered_segments();
-      thread_merge_segments();
-   }
+   thread_maybe_merge_segments();
 }
 
 /** Call this function after thread 'joiner' joined thread 'joinee'. */
@@ -1267,12 +1330,7 @@ void DRD_(thread_new_segment_and_combine_vc)(DrdThreadId tid, const Segment* sg)
 
    thread_combine_vc_sync(tid, sg);
 
-   if (s_segment_merging
-       && ++s_new_segments_since_last_merge >= s_segment_merge_interval)
-   {
-      thread_discard_ordered_segments();
-      thread_merge_segments();
-   }
+   thread_maybe_merge_segments();
 }
 
 /**
@@ -61,13 +61,20 @@ struct bm_cache_elem
    struct bitmap2* bm2;
 };
 
-#define DRD_BITMAP_N_CACHE_ELEM 4
+/* Default number of elements of the lookup cache of a bitmap. */
+#define DRD_BITMAP_N_CACHE_ELEM 256
 
 /* Complete bitmap. */
 struct bitmap
 {
-   struct bm_cache_elem cache[DRD_BITMAP_N_CACHE_ELEM];
-   OSet*                oset;
+   /*
+    * Direct-mapped cache of second level bitmap lookups, indexed by
+    * a1 & cache_mask. Points to a single dummy element until a lookup
+    * result is cached for the first time.
+    */
+   struct bm_cache_elem* cache;
+   UWord                 cache_mask;
+   OSet*                 oset;
 };
 
 
@@ -75,6 +82,8 @@ struct bitmap
 
 void DRD_(bm_module_init)(void);
 void DRD_(bm_module_cleanup)(void);
+void DRD_(bm_set_cache_size)(const UInt n);
+UInt DRD_(bm_get_cache_size)(void);
 struct bitmap* DRD_(bm_new)(void);
 void DRD_(bm_delete)(struct bitmap* const bm);
 void DRD_(bm_init)(struct bitmap* const bm);
@@ -82,6 +82,10 @@ Bool  HG_(clo_delta_stacktrace) = False;
 
 UWord HG_(clo_conflict_cache_size) = 2000000;
 
+const HChar* HG_(clo_conflict_cache_spill) = NULL;
+
+UWord HG_(clo_conflict_cache_spill_size) = 256;
+
 UWord HG_(clo_sanity_flags) = 0;
 
 Bool  HG_(clo_free_is_write) = False;
@@ -90,6 +94,12 @@ UWord HG_(clo_vts_pruning) = 1;
 
 Bool  HG_(clo_check_stack_refs) = True;
 
+Bool  HG_(clo_sample_accesses) = False;
+
+UWord HG_(clo_sample_burst) = 10;
+
+UWord HG_(clo_sample_max_skip) = 10000;
+
 /*--------------------------------------------------------------------*/
 /*--- end                                              hg_basics.c ---*/
 /*--------------------------------------------------------------------*/
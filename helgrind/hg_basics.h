@@ -107,6 +107,14 @@ extern Bool  HG_(clo_delta_stacktrace);
    amd 10 million.  Default is 1 million. */
 extern UWord HG_(clo_conflict_cache_size);
 
+/* When doing "full" history collection, the conflicting-access cache
+   entries that are recycled are written to this file, if not NULL.
+   They are read back only when no conflicting access is found in the
+   cache for a race.  The file is used as a ring buffer of
+   HG_(clo_conflict_cache_spill_size) megabytes. */
+extern const HChar* HG_(clo_conflict_cache_spill);
+extern UWord HG_(clo_conflict_cache_spill_size);
+
 /* Sanity check level.  This is an or-ing of
    SCE_{THREADS,LOCKS,BIGRANGE,ACCESS,LAOG}. */
 extern UWord HG_(clo_sanity_flags);
@@ -134,6 +142,19 @@ extern UWord HG_(clo_vts_pruning);
    the stack, which speeds things up a bit.  Default: True. */
 extern Bool HG_(clo_check_stack_refs); 
 
+/* When True, memory accesses are only race-checked during sampled
+   bursts of executions of each superblock.  A burst checks the next
+   HG_(clo_sample_burst) executions of the superblock.  The number of
+   executions skipped after each burst starts at the burst length and
+   doubles after each burst, up to HG_(clo_sample_max_skip).  So
+   rarely executed code is checked nearly always, and hot code about
+   once every HG_(clo_sample_max_skip) / HG_(clo_sample_burst)
+   executions.  Synchronisation events are always tracked.  Default:
+   False. */
+extern Bool  HG_(clo_sample_accesses);
+extern UWord HG_(clo_sample_burst);
+extern UWord HG_(clo_sample_max_skip);
+
 #endif /* ! __HG_BASICS_H */
 
 /*--------------------------------------------------------------------*/
@@ -4700,6 +4700,152 @@ static void instrument_mem_access ( IRSB*   sbOut,
 }
 
 
+/* Access sampling (--sample-accesses=yes), after LiteRace.  Each
+   instrumented superblock has an SBSample, which alternates between a
+   burst of executions in which its memory accesses are checked, and a
+   run of executions in which they are not.  The code added at the
+   start of the superblock counts executions down, and calls
+   evh__sample_phase_end to switch phases; the helpers of the memory
+   accesses are then guarded by the current phase.  The skipped runs
+   get longer after each burst, so that hot code is rarely checked
+   while cold code, where races tend to hide from testing, is checked
+   nearly every time it runs.
+
+   SBSamples are keyed by the guest address of their superblock, and
+   are never freed: a retranslated superblock continues where it left
+   off. */
+typedef
+   struct _SBSample {
+      struct _SBSample* next;
+      UWord             key;      // guest address of the superblock
+      UInt              left;     // executions left in this phase
+      UInt              checking; // 1 during a burst, 0 when skipping
+      UInt              skip;     // length of the next skipped run
+   }
+   SBSample;
+
+static VgHashTable* hg_samples = NULL;
+
+static ULong stats__sample_bursts = 0;
+
+static VG_REGPARM(1) void evh__sample_phase_end ( SBSample* sbs )
+{
+   if (sbs->checking) {
+      sbs->checking = 0;
+      sbs->left     = sbs->skip;
+      if (sbs->skip < HG_(clo_sample_max_skip) / 2)
+         sbs->skip *= 2;
+      else
+         sbs->skip = HG_(clo_sample_max_skip);
+   } else {
+      sbs->checking = 1;
+      sbs->left     = HG_(clo_sample_burst);
+      stats__sample_bursts++;
+   }
+}
+
+static SBSample* get_SBSample ( Addr ga )
+{
+   SBSample* sbs;
+
+   if (hg_samples == NULL)
+      hg_samples = VG_(HT_construct)( "hg_samples" );
+   sbs = VG_(HT_lookup)( hg_samples, ga );
+   if (sbs == NULL) {
+      sbs = HG_(zalloc)( "hg.get_SBSample.1", sizeof(SBSample) );
+      sbs->key      = ga;
+      sbs->checking = 1;
+      sbs->left     = HG_(clo_sample_burst);
+      sbs->skip     = HG_(clo_sample_burst);
+      VG_(HT_add_node)( hg_samples, sbs );
+      stats__sample_bursts++;
+   }
+   return sbs;
+}
+
+/* Does bbIn contain anything instrument_mem_access would be called
+   for?  Conservative: may say yes for accesses in the dynamic
+   linker, which are not instrumented. */
+static Bool has_mem_accesses ( const IRSB* bbIn )
+{
+   Int i;
+   for (i = 0; i < bbIn->stmts_used; i++) {
+      const IRStmt* st = bbIn->stmts[i];
+      switch (st->tag) {
+         case Ist_CAS: case Ist_Store: case Ist_StoreG: case Ist_LoadG:
+            return True;
+         case Ist_LLSC:
+            if (st->Ist.LLSC.storedata == NULL)
+               return True;
+            break;
+         case Ist_WrTmp:
+            if (st->Ist.WrTmp.data->tag == Iex_Load)
+               return True;
+            break;
+         case Ist_Dirty:
+            if (st->Ist.Dirty.details->mFx != Ifx_None)
+               return True;
+            break;
+         default:
+            break;
+      }
+   }
+   return False;
+}
+
+/* Add to bbOut the code counting the executions of the superblock at
+   guest address ga, and return an Ity_I1 atom which is True if the
+   accesses of this execution are to be checked. */
+static IRExpr* add_sample_check ( IRSB* bbOut, Addr ga, IREndness endness )
+{
+   SBSample* sbs    = get_SBSample( ga );
+   IRExpr*   a_left = mkIRExpr_HWord( (HWord)&sbs->left );
+   IRExpr*   a_chk  = mkIRExpr_HWord( (HWord)&sbs->checking );
+   IRTemp    left0  = newIRTemp(bbOut->tyenv, Ity_I32);
+   IRTemp    end    = newIRTemp(bbOut->tyenv, Ity_I1);
+   IRTemp    left1  = newIRTemp(bbOut->tyenv, Ity_I32);
+   IRTemp    left2  = newIRTemp(bbOut->tyenv, Ity_I32);
+   IRTemp    chk    = newIRTemp(bbOut->tyenv, Ity_I32);
+   IRTemp    res    = newIRTemp(bbOut->tyenv, Ity_I1);
+   IRDirty*  di;
+
+   /* if (sbs->left == 0) evh__sample_phase_end(sbs); */
+   addStmtToIRSB(bbOut, assign(left0, IRExpr_Load(endness, Ity_I32, a_left)));
+   addStmtToIRSB(bbOut, assign(end, binop(Iop_CmpEQ32, mkexpr(left0),
+                                                        mkU32(0))));
+   di = unsafeIRDirty_0_N( 1, "evh__sample_phase_end",
+                           VG_(fnptr_to_fnentry)( &evh__sample_phase_end ),
+                           mkIRExprVec_1( mkIRExpr_HWord( (HWord)sbs ) ) );
+   di->guard = mkexpr(end);
+   /* Make sure the loads below are not moved above the call. */
+   di->mFx   = Ifx_Modify;
+   di->mAddr = mkIRExpr_HWord( (HWord)sbs );
+   di->mSize = sizeof(SBSample);
+   addStmtToIRSB(bbOut, IRStmt_Dirty(di));
+
+   /* sbs->left--; check this execution if sbs->checking */
+   addStmtToIRSB(bbOut, assign(left1, IRExpr_Load(endness, Ity_I32, a_left)));
+   addStmtToIRSB(bbOut, assign(left2, binop(Iop_Sub32, mkexpr(left1),
+                                                        mkU32(1))));
+   addStmtToIRSB(bbOut, IRStmt_Store(endness, a_left, mkexpr(left2)));
+   addStmtToIRSB(bbOut, assign(chk, IRExpr_Load(endness, Ity_I32, a_chk)));
+   addStmtToIRSB(bbOut, assign(res, binop(Iop_CmpNE32, mkexpr(chk),
+                                                        mkU32(0))));
+   return mkexpr(res);
+}
+
+/* The guard of an access: its own guard if any, and the sampling
+   guard if any.  Both are atoms or NULL (meaning True). */
+static IRExpr* mk_access_guard ( IRSB* bbOut, IRExpr* guard, IRExpr* sampled )
+{
+   if (sampled == NULL)
+      return guard;
+   if (guard == NULL)
+      return sampled;
+   return mk_And1(bbOut, guard, sampled);
+}
+
+
 /* Figure out if GA is a guest code address in the dynamic linker, and
    if so return True.  Otherwise (and in case of any doubt) return
    False.  (sidedly safe w/ False as the safe value) */
@@ -4745,6 +4891,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
    IRStmt* st;
    Bool    inLDSO = False;
    Addr    inLDSOmask4K = 1; /* mismatches on first check */
+   IRExpr* sampled = NULL; /* sampling guard, NULL => always check */
 
    // Set to True when SP must be fixed up when taking a stack trace for the
    // mem accesses in the rest of the instruction
@@ -4779,6 +4926,11 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
       i++;
    }
 
+   if (HG_(clo_sample_accesses) && has_mem_accesses(bbIn))
+      sampled = add_sample_check(bbOut, vge->base[0],
+                                 archinfo_host->endness == VexEndnessBE
+                                    ? Iend_BE : Iend_LE);
+
    // Get the first statement, and initial cia from it
    tl_assert(bbIn->stmts_used > 0);
    tl_assert(i < bbIn->stmts_used);
@@ -4881,7 +5033,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      * sizeofIRType(typeOfIRExpr(bbIn->tyenv, cas->dataLo)),
                   False/*!isStore*/, fixupSP_needed,
                   hWordTy_szB, goff_SP, goff_SP_s1,
-                  NULL/*no-guard*/
+                  sampled
                );
             }
             break;
@@ -4902,7 +5054,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(dataTy),
                      False/*!isStore*/, fixupSP_needed,
                      hWordTy_szB, goff_SP, goff_SP_s1,
-                     NULL/*no-guard*/
+                     sampled
                   );
                }
             } else {
@@ -4920,7 +5072,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   sizeofIRType(typeOfIRExpr(bbIn->tyenv, st->Ist.Store.data)),
                   True/*isStore*/, fixupSP_needed,
                   hWordTy_szB, goff_SP, goff_SP_s1,
-                  NULL/*no-guard*/
+                  sampled
                );
             }
             break;
@@ -4934,7 +5086,9 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    True/*isStore*/, fixupSP_needed,
                                    hWordTy_szB,
-                                   goff_SP, goff_SP_s1, sg->guard );
+                                   goff_SP, goff_SP_s1,
+                                   mk_access_guard(bbOut, sg->guard,
+                                                   sampled) );
             break;
          }
 
@@ -4948,7 +5102,9 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    False/*!isStore*/, fixupSP_needed,
                                    hWordTy_szB,
-                                   goff_SP, goff_SP_s1, lg->guard );
+                                   goff_SP, goff_SP_s1,
+                                   mk_access_guard(bbOut, lg->guard,
+                                                   sampled) );
             break;
          }
 
@@ -4962,7 +5118,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(data->Iex.Load.ty),
                      False/*!isStore*/, fixupSP_needed,
                      hWordTy_szB, goff_SP, goff_SP_s1,
-                     NULL/*no-guard*/
+                     sampled
                   );
                }
             }
@@ -4984,7 +5140,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                         bbOut, d->mAddr, dataSize,
                         False/*!isStore*/, fixupSP_needed,
                         hWordTy_szB, goff_SP, goff_SP_s1,
-                        NULL/*no-guard*/
+                        sampled
                      );
                   }
                }
@@ -4994,7 +5150,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                         bbOut, d->mAddr, dataSize,
                         True/*isStore*/, fixupSP_needed,
                         hWordTy_szB, goff_SP, goff_SP_s1,
-                        NULL/*no-guard*/
+                        sampled
                      );
                   }
                }
@@ -5764,6 +5920,10 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
 
    else if VG_BINT_CLO(arg, "--conflict-cache-size",
                        HG_(clo_conflict_cache_size), 10*1000, 150*1000*1000) {}
+   else if VG_STR_CLO(arg, "--conflict-cache-spill",
+                      HG_(clo_conflict_cache_spill)) {}
+   else if VG_BINT_CLO(arg, "--conflict-cache-spill-size",
+                       HG_(clo_conflict_cache_spill_size), 1, 64*1024) {}
 
    /* "stuvwx" --> stuvwx (binary) */
    else if VG_STR_CLO(arg, "--hg-sanity-flags", tmp_str) {
@@ -5801,6 +5961,13 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
    else if VG_BOOL_CLO(arg, "--ignore-thread-creation",
                             HG_(clo_ignore_thread_creation)) {}
 
+   else if VG_BOOL_CLO(arg, "--sample-accesses",
+                            HG_(clo_sample_accesses)) {}
+   else if VG_BINT_CLO(arg, "--sample-burst",
+                       HG_(clo_sample_burst), 1, 1000*1000) {}
+   else if VG_BINT_CLO(arg, "--sample-max-skip",
+                       HG_(clo_sample_max_skip), 1, 1000*1000*1000) {}
+
    else 
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
@@ -5821,10 +5988,18 @@ static void hg_print_usage ( void )
 "        yes : derive a stacktrace from the previous stacktrace\n"
 "          if there was no call/return or similar instruction\n"
 "    --conflict-cache-size=N   size of 'full' history cache [2000000]\n"
+"    --conflict-cache-spill=<file> write the entries evicted from the\n"
+"                              'full' history cache to <file> [none]\n"
+"    --conflict-cache-spill-size=<MB> size of the spill file [256]\n"
 "    --check-stack-refs=no|yes race-check reads and writes on the\n"
 "                              main stack and thread stacks? [yes]\n"
 "    --ignore-thread-creation=yes|no Ignore activities during thread\n"
-"                              creation [%s]\n",
+"                              creation [%s]\n"
+"    --sample-accesses=no|yes  only race-check memory accesses in sampled\n"
+"                              bursts of executions of each block [no]\n"
+"    --sample-burst=<number>   block executions checked per burst [10]\n"
+"    --sample-max-skip=<number> maximum block executions skipped\n"
+"                              between two bursts [10000]\n",
 HG_(clo_ignore_thread_creation) ? "yes" : "no"
    );
 }
@@ -5910,6 +6085,10 @@ static void hg_print_stats (void)
                stats__lockN_releases
               );
    VG_(printf)("   sanity checks: %'8lu\n", stats__sanity_checks);
+   if (HG_(clo_sample_accesses))
+      VG_(printf)("        sampling: %'8u blocks, %'llu bursts\n",
+                  hg_samples ? VG_(HT_count_nodes)(hg_samples) : 0,
+                  stats__sample_bursts);
 
    VG_(printf)("\n");
    libhb_shutdown(True); // This in fact only print stats.
@@ -47,6 +47,9 @@
 #include "pub_tool_debuginfo.h"
 #include "pub_tool_gdbserver.h"
 #include "pub_tool_options.h"        // VG_(clo_stats)
+#include "pub_tool_libcfile.h"
+#include "pub_tool_libcproc.h"        // VG_(atfork)
+#include "pub_tool_vki.h"
 #include "hg_basics.h"
 #include "hg_wordset.h"
 #include "hg_lock_n_thread.h"
@@ -326,6 +329,12 @@ struct _Thr {
       comments on the definition of ScalarTS for details. */
    ThrID thrid : SCALARTS_N_THRBITS;
 
+   /* This thread's own entry in viR and viW (it is the same in both),
+      that is, its scalar clock.  Cached here so that the epoch
+      (thrid, tym) of its current segment is known without looking
+      into its VTSs. */
+   ULong tym;
+
    /* A filter that removes references for which we believe that
       msmcread/msmcwrite will not change the state, nor report a
       race. */
@@ -394,6 +403,10 @@ static void VtsID__rcinc ( VtsID ii );
 static void VtsID__rcdec ( VtsID ii );
 
 static inline Bool SVal__isC ( SVal s );
+static inline Bool SVal__isE ( SVal s );
+static inline Bool SVal__isCE ( SVal s );
+static inline SVal SVal__mkE ( ThrID thrid, ULong rtym, ULong wtym );
+static inline ThrID SVal__unE_ThrID ( SVal s );
 static inline VtsID SVal__unC_Rmin ( SVal s );
 static inline VtsID SVal__unC_Wmin ( SVal s );
 static inline SVal SVal__mkC ( VtsID rmini, VtsID wmini );
@@ -667,6 +680,11 @@ static UWord stats__vts_pruning          = 0; // # nr of vts pruning
 // # calls to VTS__cmp_structural w/ slow case
 static UWord stats__vts__cmp_structural_slow = 0;
 
+// # calls to VTS__join/VTS__cmpLEQ done by a single sweep over
+// two VTSs having the same ThrIDs
+static UWord stats__vts__join_sweep   = 0;
+static UWord stats__vts__cmpLEQ_sweep = 0;
+
 // # calls to VTS__indexAt_SLOW
 static UWord stats__vts__indexat_slow = 0;
 
@@ -876,9 +894,9 @@ static UWord shmem__SecMap_do_GC(Bool really)
          LineZ* lineZ = &sm->linesZ[i];
          if (lineZ->dict[0] != SVal_INVALID) {
             ok_to_GC = lineZ->dict[0] == SVal_NOACCESS
-               && !SVal__isC (lineZ->dict[1])
-               && !SVal__isC (lineZ->dict[2])
-               && !SVal__isC (lineZ->dict[3]);
+               && !SVal__isCE (lineZ->dict[1])
+               && !SVal__isCE (lineZ->dict[2])
+               && !SVal__isCE (lineZ->dict[3]);
          } else {
             LineF *lineF = LineF_Ptr(lineZ);
             n_linesF++;
@@ -2183,6 +2201,9 @@ static void VTS__show ( const VTS* vts );
 /* Debugging only.  Return vts[index], so to speak. */
 static ULong VTS__indexAt_SLOW ( VTS* vts, Thr* idx );
 
+/* Return vts[thrid], so to speak, using a binary search. */
+static ULong VTS__indexAt_ThrID ( VTS* vts, ThrID thrid );
+
 /* Notify the VTS machinery that a thread has been declared
    comprehensively dead: that is, it has done an async exit AND it has
    been joined with.  This should ensure that its local clocks (.viR
@@ -2334,14 +2355,13 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts )
    tl_assert(is_sane_VTS(vts));
    n = vts->usedTS;
 
-   /* Copy all entries which precede 'me'. */
+   /* Copy all entries which precede 'me', in one go. */
    for (i = 0; i < n; i++) {
-      ScalarTS* here = &vts->ts[i];
-      if (UNLIKELY(here->thrid >= me_thrid))
+      if (UNLIKELY(vts->ts[i].thrid >= me_thrid))
          break;
-      UInt hi = out->usedTS++;
-      out->ts[hi] = *here;
    }
+   VG_(memcpy)(&out->ts[0], &vts->ts[0], i * sizeof(ScalarTS));
+   out->usedTS = i;
 
    /* 'i' now indicates the next entry to copy, if any.
        There are 3 possibilities:
@@ -2377,11 +2397,9 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts )
          out->ts[hi].tym   = 1;
       }
       /* And copy any remaining entries. */
-      for (/*keepgoing*/; i < n; i++) {
-         ScalarTS* here2 = &vts->ts[i];
-         UInt hi = out->usedTS++;
-         out->ts[hi] = *here2;
-      }
+      VG_(memcpy)(&out->ts[out->usedTS], &vts->ts[i],
+                  (n - i) * sizeof(ScalarTS));
+      out->usedTS += n - i;
    }
 
    tl_assert(is_sane_VTS(out));
@@ -2390,6 +2408,82 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts )
 }
 
 
+/* Helpers for VTS__join and VTS__cmpLEQ, for 2 VTSs of the same
+   length.  They work on the ScalarTSs as ULongs: when two ScalarTSs
+   have the same thrid, comparing them as ULongs compares their tym.
+   The loops have no early exit and no data dependent branch, so that
+   the compiler can vectorise them.  The ThrIDs are checked as we go,
+   by or-ing their differences, and the result is only used if they
+   are all equal.  scalarts_thrid_mask has the thrid bits of a
+   ScalarTS set. */
+static ULong scalarts_thrid_mask = 0;
+
+static void init_scalarts_thrid_mask ( void )
+{
+   ScalarTS st;
+   STATIC_ASSERT(sizeof(ScalarTS) == sizeof(ULong));
+   *(ULong*)&st = 0;
+   st.thrid = ThrID_MAX_VALID;
+   scalarts_thrid_mask = *(ULong*)&st;
+}
+
+/* Set out to the join of a and b, and return True, if a and b have
+   the same ThrIDs.  Otherwise return False, with out->usedTS == 0. */
+static Bool VTS__join_sweep ( /*OUT*/VTS* out, VTS* a, VTS* b )
+{
+   const ULong* wa = (const ULong*)&a->ts[0];
+   const ULong* wb = (const ULong*)&b->ts[0];
+   ULong*       wo = (ULong*)&out->ts[0];
+   const ULong  mask = scalarts_thrid_mask;
+   const UInt   n = a->usedTS;
+   ULong        diff = 0;
+   UInt         i;
+   tl_assert(b->usedTS == n);
+   tl_assert(out->sizeTS >= n);
+   for (i = 0; i < n; i++) {
+      ULong x = wa[i];
+      ULong y = wb[i];
+      wo[i] = x > y ? x : y;
+      diff |= (x ^ y) & mask;
+   }
+   if (UNLIKELY(diff != 0))
+      return False;
+   out->usedTS = n;
+   return True;
+}
+
+/* If a and b have the same ThrIDs, set *res as VTS__cmpLEQ(a,b)
+   would, and return True.  Otherwise return False. */
+static Bool VTS__cmpLEQ_sweep ( /*OUT*/UInt* res, VTS* a, VTS* b )
+{
+   const ULong* wa = (const ULong*)&a->ts[0];
+   const ULong* wb = (const ULong*)&b->ts[0];
+   const ULong  mask = scalarts_thrid_mask;
+   const UInt   n = a->usedTS;
+   ULong        diff = 0;
+   UInt         gt = 0;
+   UInt         i;
+   tl_assert(b->usedTS == n);
+   for (i = 0; i < n; i++) {
+      ULong x = wa[i];
+      ULong y = wb[i];
+      diff |= (x ^ y) & mask;
+      gt   |= x > y;
+   }
+   if (UNLIKELY(diff != 0))
+      return False;
+   *res = 0;
+   if (gt) {
+      /* Not LEQ.  Find the first index at which they are not. */
+      for (i = 0; wa[i] <= wb[i]; i++)
+         ;
+      *res = a->ts[i].thrid;
+      tl_assert(*res >= 1024);
+   }
+   return True;
+}
+
+
 /* Return a new VTS constructed as the join (max) of the 2 args.
    Neither arg is modified.
 */
@@ -2415,6 +2509,20 @@ static void VTS__join ( /*OUT*/VTS* out, VTS* a, VTS* b )
       scalarts_limitations_fail_NORETURN( True/*due_to_nThrs*/ );
    tl_assert(out->sizeTS >= useda + usedb);
 
+   /* With many threads, most VTSs mention the same ThrIDs, so first
+      try a single sweep computing the max of the entries pairwise.
+      This gives up (and falls back to the merge below) if some ThrID
+      differs. */
+   if (useda == usedb && useda > 0
+       && a->ts[0].thrid == b->ts[0].thrid
+       && a->ts[useda-1].thrid == b->ts[useda-1].thrid) {
+      if (VTS__join_sweep(out, a, b)) {
+         stats__vts__join_sweep++;
+         tl_assert(is_sane_VTS(out));
+         return;
+      }
+   }
+
    ia = ib = 0;
 
    while (1) {
@@ -2508,6 +2616,17 @@ static UInt/*ThrID*/ VTS__cmpLEQ ( VTS* a, VTS* b )
    useda = a->usedTS;
    usedb = b->usedTS;
 
+   /* As in VTS__join, try a single sweep first. */
+   if (useda == usedb && useda > 0
+       && a->ts[0].thrid == b->ts[0].thrid
+       && a->ts[useda-1].thrid == b->ts[useda-1].thrid) {
+      UInt res;
+      if (VTS__cmpLEQ_sweep(&res, a, b)) {
+         stats__vts__cmpLEQ_sweep++;
+         return res;
+      }
+   }
+
    ia = ib = 0;
 
    while (1) {
@@ -2677,6 +2796,25 @@ ULong VTS__indexAt_SLOW ( VTS* vts, Thr* idx )
 }
 
 
+/* See comment on prototype above.
+*/
+static ULong VTS__indexAt_ThrID ( VTS* vts, ThrID thrid )
+{
+   UWord lo = 0, hi = vts->usedTS;
+   while (lo < hi) {
+      UWord mid = (lo + hi) / 2;
+      ThrID here = vts->ts[mid].thrid;
+      if (here == thrid)
+         return vts->ts[mid].tym;
+      if (here < thrid)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return 0;
+}
+
+
 /* See comment on prototype above.
 */
 static void VTS__declare_thread_very_dead ( Thr* thr )
@@ -2728,14 +2866,77 @@ static void VTS__declare_thread_very_dead ( Thr* thr )
 //                                                     //
 /////////////////////////////////////////////////////////
 
-static WordFM* /* WordFM VTS* void */ vts_set = NULL;
+/* The set of interned VTSs.  This is a hash table keyed by a hash of
+   the VTS's ScalarTSs, so that finding a VTS usually takes a single
+   structural comparison, rather than one per level of a tree. */
+typedef
+   struct _VtsSetNode {
+      struct _VtsSetNode* next;
+      UWord               key;  /* vts_hash(vts) */
+      VTS*                vts;
+   }
+   VtsSetNode;
+
+static VgHashTable* /* of VtsSetNode */ vts_set = NULL;
+
+static UWord vts_hash ( const VTS* vts )
+{
+   const ULong* w = (const ULong*)&vts->ts[0];
+   UInt  n = vts->usedTS;
+   UInt  i;
+   ULong h = 0xcbf29ce484222325ULL ^ n;
+   for (i = 0; i < n; i++) {
+      h ^= w[i];
+      h *= 0x100000001b3ULL;
+      h ^= h >> 29;
+   }
+   return (UWord)(h ^ (h >> 32));
+}
+
+static Word cmp_VtsSetNode ( const void* node1, const void* node2 )
+{
+   const VtsSetNode* n1 = node1;
+   const VtsSetNode* n2 = node2;
+   return VTS__cmp_structural(n1->vts, n2->vts);
+}
+
+static VgHashTable* vts_set__new ( const HChar* who )
+{
+   return VG_(HT_construct)( who );
+}
+
+/* Find the VTS in set structurally identical to vts, if any. */
+static VTS* vts_set__lookup ( VgHashTable* set, VTS* vts )
+{
+   VtsSetNode  cand = { NULL, vts_hash(vts), vts };
+   VtsSetNode* node = VG_(HT_gen_lookup)( set, &cand, cmp_VtsSetNode );
+   return node ? node->vts : NULL;
+}
+
+/* Add vts to set, which must not contain an identical VTS. */
+static void vts_set__add ( VgHashTable* set, VTS* vts )
+{
+   VtsSetNode* node = HG_(zalloc)( "libhb.vts_set__add.1",
+                                   sizeof(VtsSetNode) );
+   node->key = vts_hash(vts);
+   node->vts = vts;
+   VG_(HT_add_node)( set, node );
+}
+
+/* Remove vts (by ref) from set.  Asserts that it is there. */
+static void vts_set__del ( VgHashTable* set, VTS* vts )
+{
+   VtsSetNode  cand = { NULL, vts_hash(vts), vts };
+   VtsSetNode* node = VG_(HT_gen_remove)( set, &cand, cmp_VtsSetNode );
+   tl_assert(node); /* else it isn't in vts_set ?! */
+   tl_assert(node->vts == vts); /* else what did we find?! */
+   HG_(free)(node);
+}
 
 static void vts_set_init ( void )
 {
    tl_assert(!vts_set);
-   vts_set = VG_(newFM)( HG_(zalloc), "libhb.vts_set_init.1",
-                         HG_(free),
-                         (Word(*)(UWord,UWord))VTS__cmp_structural );
+   vts_set = vts_set__new( "libhb.vts_set_init.1" );
 }
 
 /* Given a VTS, look in vts_set to see if we already have a
@@ -2744,23 +2945,22 @@ static void vts_set_init ( void )
    set, and return (False, pointer to the clone). */
 static Bool vts_set__find__or__clone_and_add ( /*OUT*/VTS** res, VTS* cand )
 {
-   UWord keyW, valW;
+   VTS* found;
    stats__vts_set__focaa++;
    tl_assert(cand->id == VtsID_INVALID);
    /* lookup cand (by value) */
-   if (VG_(lookupFM)( vts_set, &keyW, &valW, (UWord)cand )) {
-      /* found it */
-      tl_assert(valW == 0);
+   found = vts_set__lookup( vts_set, cand );
+   if (found) {
       /* if this fails, cand (by ref) was already present (!) */
-      tl_assert(keyW != (UWord)cand);
-      *res = (VTS*)keyW;
+      tl_assert(found != cand);
+      *res = found;
       return True;
    } else {
       /* not present.  Clone, add and return address of clone. */
       stats__vts_set__focaa_a++;
       VTS* clone = VTS__clone( "libhb.vts_set_focaa.1", cand );
       tl_assert(clone != cand);
-      VG_(addToFM)( vts_set, (UWord)clone, 0/*val is unused*/ );
+      vts_set__add( vts_set, clone );
       *res = clone;
       return False;
    }
@@ -2922,7 +3122,7 @@ static void show_vts_stats ( const HChar* caller )
    UWord nSet, nTab, nLive;
    ULong totrc;
    UWord n, i;
-   nSet = VG_(sizeFM)( vts_set );
+   nSet = VG_(HT_count_nodes)( vts_set );
    nTab = VG_(sizeXA)( vts_tab );
    totrc = 0;
    nLive = 0;
@@ -2979,7 +3179,13 @@ void remap_VtsIDs_in_SVal ( /*MOD*/XArray* /* of VtsTE */ old_tab,
       remap_VtsID( old_tab, new_tab, &wMin );
       new_sv = SVal__mkC( rMin, wMin );
       *s = new_sv;
-  }
+   } else if (SVal__isE(old_sv)) {
+      /* The constraints of a pruned thread vanish, as they do from
+         the VTSs. */
+      ThrID thrid = SVal__unE_ThrID(old_sv);
+      if (VG_(lookupXA)( verydead_thread_table, &thrid, NULL, NULL ))
+         *s = SVal__mkE( thrid, 0, 0 );
+   }
 }
 
 
@@ -3013,8 +3219,6 @@ static void vts_tab__do_GC ( Bool show_stats )
       free list, removed from vts_set, and deleted. */
    nFreed = 0;
    for (i = 0; i < nTab; i++) {
-      Bool present;
-      UWord oldK = 0, oldV = 12345;
       VtsTE* te = VG_(indexXA)( vts_tab, i );
       if (te->vts == NULL) {
          tl_assert(te->rc == 0);
@@ -3025,11 +3229,7 @@ static void vts_tab__do_GC ( Bool show_stats )
       /* Ok, we got one we can free. */
       tl_assert(te->vts->id == i);
       /* first, remove it from vts_set. */
-      present = VG_(delFromFM)( vts_set,
-                                &oldK, &oldV, (UWord)te->vts );
-      tl_assert(present); /* else it isn't in vts_set ?! */
-      tl_assert(oldV == 0); /* no info stored in vts_set val fields */
-      tl_assert(oldK == (UWord)te->vts); /* else what did delFromFM find?! */
+      vts_set__del( vts_set, te->vts );
       /* now free the VTS itself */
       VTS__delete(te->vts);
       te->vts = NULL;
@@ -3109,11 +3309,8 @@ static void vts_tab__do_GC ( Bool show_stats )
       = VG_(newXA)( HG_(zalloc), "libhb.vts_tab__do_GC.new_tab",
                     HG_(free), sizeof(VtsTE) );
 
-   /* WordFM VTS* void */
-   WordFM* new_set
-      = VG_(newFM)( HG_(zalloc), "libhb.vts_tab__do_GC.new_set",
-                    HG_(free),
-                    (Word(*)(UWord,UWord))VTS__cmp_structural );
+   VgHashTable* /* of VtsSetNode */ new_set
+      = vts_set__new( "libhb.vts_tab__do_GC.new_set" );
 
    /* Visit each old VTS.  For each one:
 
@@ -3123,11 +3320,11 @@ static void vts_tab__do_GC ( Bool show_stats )
         Nothing (not present) or the new VtsID for it.
 
       * if not present, allocate a new VtsID for it, insert (pruned
-        VTS, new VtsID) in the tree, and set
+        VTS, new VtsID) in the set, and set
         remap_table[old VtsID] = new VtsID.
 
       * if present, set remap_table[old VtsID] = new VtsID, where
-        new VtsID was determined by the tree lookup.  Then free up
+        new VtsID was determined by the set lookup.  Then free up
         the clone.
    */
 
@@ -3160,17 +3357,12 @@ static void vts_tab__do_GC ( Bool show_stats )
       tl_assert(*(ULong*)(&new_vts->ts[new_vts->usedTS])
                 == 0x0ddC0ffeeBadF00dULL);
 
-      /* Get rid of the old VTS and the tree entry.  It's a bit more
+      /* Get rid of the old VTS and the set entry.  It's a bit more
          complex to incrementally delete the VTSs now than to nuke
          them all after we're done, but the upside is that we don't
          wind up temporarily storing potentially two complete copies
          of each VTS and hence spiking memory use. */
-      UWord oldK = 0, oldV = 12345;
-      Bool  present = VG_(delFromFM)( vts_set,
-                                      &oldK, &oldV, (UWord)old_vts );
-      tl_assert(present); /* else it isn't in vts_set ?! */
-      tl_assert(oldV == 0); /* no info stored in vts_set val fields */
-      tl_assert(oldK == (UWord)old_vts); /* else what did delFromFM find?! */
+      vts_set__del( vts_set, old_vts );
       /* now free the VTS itself */
       VTS__delete(old_vts);
       old_te->vts = NULL;
@@ -3182,23 +3374,16 @@ static void vts_tab__do_GC ( Bool show_stats )
          structurally identical version is already present in new_set.
          If so, delete the one we just made and move on; if not, add
          it. */
-      VTS*  identical_version = NULL;
-      UWord valW = 12345;
-      if (VG_(lookupFM)(new_set, (UWord*)&identical_version, &valW,
-                        (UWord)new_vts)) {
+      VTS* identical_version = vts_set__lookup( new_set, new_vts );
+      if (identical_version) {
          // already have it
-         tl_assert(valW == 0);
-         tl_assert(identical_version != NULL);
          tl_assert(identical_version != new_vts);
          VTS__delete(new_vts);
          new_vts = identical_version;
          tl_assert(new_vts->id != VtsID_INVALID);
       } else {
-         tl_assert(valW == 12345);
-         tl_assert(identical_version == NULL);
          new_vts->id = new_VtsID_ctr++;
-         Bool b = VG_(addToFM)(new_set, (UWord)new_vts, 0);
-         tl_assert(!b);
+         vts_set__add( new_set, new_vts );
          VtsTE new_te;
          new_te.vts      = new_vts;
          new_te.rc       = 0;
@@ -3232,14 +3417,14 @@ static void vts_tab__do_GC ( Bool show_stats )
    /* At this point, we have:
       * the old VTS table, with its u.remap entries set,
         and with all .vts == NULL.
-      * the old VTS tree should be empty, since it and the old VTSs
+      * the old VTS set should be empty, since it and the old VTSs
         it contained have been incrementally deleted was we worked
         through the old table.
       * the new VTS table, with all .rc == 0, all u.freelink and u.remap
         == VtsID_INVALID. 
-      * the new VTS tree.
+      * the new VTS set.
    */
-   tl_assert( VG_(sizeFM)(vts_set) == 0 );
+   tl_assert( VG_(HT_count_nodes)(vts_set) == 0 );
 
    /* Now actually apply the mapping. */
    /* Visit all the VtsIDs in the entire system.  Where do we expect
@@ -3322,7 +3507,7 @@ static void vts_tab__do_GC ( Bool show_stats )
    }
 
    /* Install the new table and set. */
-   VG_(deleteFM)(vts_set, NULL/*kFin*/, NULL/*vFin*/);
+   VG_(HT_destruct)(vts_set, HG_(free));
    vts_set = new_set;
    VG_(deleteXA)( vts_tab );
    vts_tab = new_tab;
@@ -3335,21 +3520,20 @@ static void vts_tab__do_GC ( Bool show_stats )
    /* Sanity check vts_set and vts_tab. */
 
    /* Because all the live entries got slid down to the bottom of vts_tab: */
-   tl_assert( VG_(sizeXA)( vts_tab ) == VG_(sizeFM)( vts_set ));
+   tl_assert( VG_(sizeXA)( vts_tab ) == VG_(HT_count_nodes)( vts_set ));
 
    /* Assert that the vts_tab and vts_set entries point at each other
       in the required way */
-   UWord wordK = 0, wordV = 0;
-   VG_(initIterFM)( vts_set );
-   while (VG_(nextIterFM)( vts_set, &wordK, &wordV )) {
-      tl_assert(wordK != 0);
-      tl_assert(wordV == 0);
-      VTS* vts = (VTS*)wordK;
+   VtsSetNode* node;
+   VG_(HT_ResetIter)( vts_set );
+   while ((node = VG_(HT_Next)( vts_set ))) {
+      VTS* vts = node->vts;
+      tl_assert(vts != NULL);
+      tl_assert(node->key == vts_hash(vts));
       tl_assert(vts->id != VtsID_INVALID);
       VtsTE* te = VG_(indexXA)( vts_tab, vts->id );
       tl_assert(te->vts == vts);
    }
-   VG_(doneIterFM)( vts_set );
 
    /* Also iterate over the table, and check each entry is
       plausible. */
@@ -3536,6 +3720,21 @@ static ULong VtsID__indexAt ( VtsID vi, Thr* idx ) {
    return VTS__indexAt_SLOW( vts, idx );
 }
 
+/* index into a VTS, quickly */
+static inline ULong VtsID__indexAt_ThrID ( VtsID vi, ThrID thrid ) {
+   VTS* vts = VtsID__to_VTS(vi);
+   return VTS__indexAt_ThrID( vts, thrid );
+}
+
+/* Create the VTS of an epoch, that is [thr:tym], or [] if tym is
+   zero.  See the comments on SVal__isE below. */
+static VtsID VtsID__mk_Epoch ( Thr* thr, ULong tym ) {
+   temp_max_sized_VTS->usedTS = 0;
+   if (tym > 0)
+      VTS__singleton(temp_max_sized_VTS, thr, tym);
+   return vts_tab__find__or__clone_and_add(temp_max_sized_VTS);
+}
+
 /* Assuming that !cmpLEQ(vi1, vi2), find the index of the first (or
    any, really) element in vi1 which is pointwise greater-than the
    corresponding element in vi2.  If no such element exists, return
@@ -4166,12 +4365,32 @@ static Int cmp__ULong_n_EC__by_ULong ( const ULong_n_EC* pair1,
 
       <---------30--------->    <---------30--------->
    00 X-----Rmin-VtsID-----X 00 X-----Wmin-VtsID-----X   C(Rmin,Wmin)
+   01 X--ThrID--X X-------Wtym-------X X--Wtym-Rtym--X   E(ThrID,Rtym,Wtym)
    10 X--------------------X XX X--------------------X   A: SVal_NOACCESS
    11 0--------------------0 00 0--------------------0   A: SVal_INVALID
 
-*/
+   E is an epoch-based (as in FastTrack) encoding of the common case
+   where both constraints come from a single thread T: E(T,Rtym,Wtym)
+   stands for C(Rmin,Wmin), with Rmin and Wmin the VTSs T had when
+   its scalar clock was Rtym and Wtym respectively.  A tym of zero
+   stands for no constraint at all (an empty VTS), so Rtym <= Wtym.
+
+   As a thread's scalar clock only becomes known to other threads
+   via an SO (or thread creation), which carries the thread's VTS,
+   and is then ticked, another thread's clock K is >= T's VTS at
+   T's scalar clock tym exactly when K[T] >= tym.  So, comparing an E
+   with a thread's clock needs no VTS comparison, and E SVals need no
+   reference counting.  An access by T itself always leaves an E,
+   and a write by any thread turns the location back into an E.  An
+   E is promoted to the equivalent C, built from VTSs [T:Rtym] and
+   [T:Wtym], when a read by another thread joins constraints from
+   several threads, or when there is a race.  Locations whose tyms
+   do not fit use a C. */
 #define SVAL_TAGMASK (3ULL << 62)
 
+#define SVAL_E_WTYM_BITS 30
+#define SVAL_E_DTYM_BITS (62 - SCALARTS_N_THRBITS - SVAL_E_WTYM_BITS)
+
 static inline Bool SVal__isC ( SVal s ) {
    return (0ULL << 62) == (s & SVAL_TAGMASK);
 }
@@ -4189,6 +4408,60 @@ static inline VtsID SVal__unC_Wmin ( SVal s ) {
    return (VtsID)(s & 0xFFFFFFFFULL);
 }
 
+static inline Bool SVal__isE ( SVal s ) {
+   return (1ULL << 62) == (s & SVAL_TAGMASK);
+}
+/* Can E(_,rtym,wtym) be represented? */
+static inline Bool SVal__canE ( ULong rtym, ULong wtym ) {
+   return wtym < (1ULL << SVAL_E_WTYM_BITS)
+          && wtym - rtym < (1ULL << SVAL_E_DTYM_BITS);
+}
+static inline SVal SVal__mkE ( ThrID thrid, ULong rtym, ULong wtym ) {
+   STATIC_ASSERT(SVAL_E_DTYM_BITS >= 8);
+   tl_assert(rtym <= wtym);
+   tl_assert(SVal__canE(rtym, wtym));
+   return (1ULL << 62)
+          | (((ULong)thrid) << (SVAL_E_WTYM_BITS + SVAL_E_DTYM_BITS))
+          | (wtym << SVAL_E_DTYM_BITS)
+          | (wtym - rtym);
+}
+static inline ThrID SVal__unE_ThrID ( SVal s ) {
+   tl_assert(SVal__isE(s));
+   return (ThrID)((s >> (SVAL_E_WTYM_BITS + SVAL_E_DTYM_BITS))
+                  & ThrID_MAX_VALID);
+}
+static inline ULong SVal__unE_Wtym ( SVal s ) {
+   tl_assert(SVal__isE(s));
+   return (s >> SVAL_E_DTYM_BITS) & ((1ULL << SVAL_E_WTYM_BITS) - 1);
+}
+static inline ULong SVal__unE_Rtym ( SVal s ) {
+   return SVal__unE_Wtym(s) - (s & ((1ULL << SVAL_E_DTYM_BITS) - 1));
+}
+
+/* Is s a constraint, either C or E ? */
+static inline Bool SVal__isCE ( SVal s ) {
+   return 0ULL == (s & (2ULL << 62));
+}
+
+/* Return the C equivalent to E s.  This creates the VTSs [T:Rtym]
+   and [T:Wtym], without taking references on them. */
+static SVal SVal__EtoC ( SVal s ) {
+   ULong rtym = SVal__unE_Rtym(s);
+   ULong wtym = SVal__unE_Wtym(s);
+   /* A thread whose tyms are zero may have been pruned, so don't
+      look it up then. */
+   Thr*  thr  = wtym == 0 ? NULL : Thr__from_ThrID(SVal__unE_ThrID(s));
+   return SVal__mkC( VtsID__mk_Epoch(thr, rtym), VtsID__mk_Epoch(thr, wtym) );
+}
+
+/* The state of a location just written by thr, without a race:
+   C(viW,viW), preferably as an E. */
+static inline SVal SVal__mkWritten ( Thr* thr ) {
+   if (LIKELY(SVal__canE(thr->tym, thr->tym)))
+      return SVal__mkE(thr->thrid, thr->tym, thr->tym);
+   return SVal__mkC(thr->viW, thr->viW);
+}
+
 static inline Bool SVal__isA ( SVal s ) {
    return (2ULL << 62) == (s & SVAL_TAGMASK);
 }
@@ -4242,22 +4515,30 @@ static inline SVal Ptr2SVal (void* ptr)
 
    2. A Hash table of OldRefs.  These store information about each old
       ref that we need to record.  Hash table key is the address of the
-      location for which the information is recorded.  For LRU
-      purposes, each OldRef in the hash table is also on a doubly
-      linked list maintaining the order in which the OldRef were most
-      recently accessed.
+      location for which the information is recorded.
       Each OldRef also maintains the stamp at which it was last accessed.
       With these stamps, we can quickly check which of 2 OldRef is the
-      'newest', without having to scan the full list of LRU OldRef.
+      'newest'.
 
       The important part of an OldRef is, however, its acc component.
       This binds a TSW triple (thread, size, R/W) to an RCEC.
 
-      We allocate a maximum of VG_(clo_conflict_cache_size) OldRef.
-      Then we do exact LRU discarding.  For each discarded OldRef we must
-      of course decrement the reference count on the RCEC it
-      refers to, in order that entries from (1) eventually get
-      discarded too.
+      We allocate a maximum of VG_(clo_conflict_cache_size) OldRef,
+      in chunks that are never freed.  Once they are all in use, an
+      OldRef is recycled using an approximation of LRU: the stamps are
+      grouped in N_AGE_BUCKETS buckets of consecutive stamps, and a
+      clock hand sweeping the chunks recycles the first OldRef it finds
+      that belongs to the oldest non-empty bucket.  This avoids the 2
+      list pointers per OldRef that exact LRU needs.  For each
+      discarded OldRef we must of course decrement the reference count
+      on the RCEC it refers to, in order that entries from (1)
+      eventually get discarded too.
+
+   3. Optionally (--conflict-cache-spill), the discarded OldRefs are
+      not lost but written, with their stack trace delta-encoded, to a
+      file used as a ring buffer of blocks.  The spill file is only
+      read back when a race is reported and no conflicting access is
+      found in (2).
 */
 
 static UWord stats__evm__lookup_found = 0;
@@ -4767,8 +5048,6 @@ typedef
    struct OldRef {
       struct OldRef *ht_next; // to link hash table nodes together.
       UWord  ga; // hash_table key, == address for which we record an access.
-      struct OldRef *prev; // to refs older than this one
-      struct OldRef *next; // to refs newer that this one
       UWord stamp; // allows to order (by time of access) 2 OldRef
       Thr_n_RCEC acc;
    }
@@ -4794,76 +5073,28 @@ static Word cmp_oldref_tsw (const void* node1, const void* node2 )
 }
 
 
-//////////// BEGIN OldRef pool allocator
-static PoolAlloc* oldref_pool_allocator;
-// Note: We only allocate elements in this pool allocator, we never free them.
+//////////// BEGIN OldRef chunks
+// OldRefs are allocated in chunks of OLDREF_CHUNK_N elements.
+// Note: We only allocate chunks, we never free them.
 // We stop allocating elements at VG_(clo_conflict_cache_size).
-//////////// END OldRef pool allocator
+// The OldRef number i is oldref_chunks[i / OLDREF_CHUNK_N][i % OLDREF_CHUNK_N].
+#define OLDREF_CHUNK_N 4096
+static OldRef** oldref_chunks = NULL;
 
-static OldRef mru; 
-static OldRef lru; 
-// A double linked list, chaining all OldREf in a mru/lru order.
-// mru/lru are sentinel nodes.
-// Whenever an oldref is re-used, its position is changed as the most recently
-// used (i.e. pointed to by mru.prev).
-// When a new oldref is needed, it is allocated from the pool
-//  if we have not yet reached --conflict-cache-size.
-// Otherwise, if all oldref have already been allocated,
-// the least recently used (i.e. pointed to by lru.next) is re-used.
-// When an OldRef is used, it is moved as the most recently used entry
-// (i.e. pointed to by mru.prev).
-
-// Removes r from the double linked list
-// Note: we do not need to test for special cases such as
-// NULL next or prev pointers, because we have sentinel nodes
-// at both sides of the list. So, a node is always forward and
-// backward linked.
-static inline void OldRef_unchain(OldRef *r)
+static inline OldRef* OldRef_at ( UWord i )
 {
-   r->next->prev = r->prev;
-   r->prev->next = r->next;
-}
-
-// Insert new as the newest OldRef
-// Similarly to OldRef_unchain, no need to test for NULL
-// pointers, as e.g. mru.prev is always guaranteed to point
-// to a non NULL node (lru when the list is empty).
-static inline void OldRef_newest(OldRef *new)
-{
-   new->next = &mru;
-   new->prev = mru.prev;
-   mru.prev = new;
-   new->prev->next = new;
+   return &oldref_chunks[i / OLDREF_CHUNK_N][i % OLDREF_CHUNK_N];
 }
+//////////// END OldRef chunks
 
 
 static VgHashTable* oldrefHT    = NULL; /* Hash table* OldRef* */
 static UWord     oldrefHTN    = 0;    /* # elems in oldrefHT */
 /* Note: the nr of ref in the oldrefHT will always be equal to
-   the nr of elements that were allocated from the OldRef pool allocator
+   the nr of elements that were allocated in the OldRef chunks
    as we never free an OldRef : we just re-use them. */
 
 
-/* allocates a new OldRef or re-use the lru one if all allowed OldRef
-   have already been allocated. */
-static OldRef* alloc_or_reuse_OldRef ( void )
-{
-   if (oldrefHTN < HG_(clo_conflict_cache_size)) {
-      oldrefHTN++;
-      return VG_(allocEltPA) ( oldref_pool_allocator );
-   } else {
-      OldRef *oldref_ht;
-      OldRef *oldref = lru.next;
-
-      OldRef_unchain(oldref);
-      oldref_ht = VG_(HT_gen_remove) (oldrefHT, oldref, cmp_oldref_tsw);
-      tl_assert (oldref == oldref_ht);
-      ctxt__rcdec( oldref->acc.rcec );
-      return oldref;
-   }
-}
-
-
 inline static UInt min_UInt ( UInt a, UInt b ) {
    return a < b ? a : b;
 }
@@ -4889,6 +5120,478 @@ static inline Word cmp_nonempty_intervals ( Addr a1, SizeT n1,
 
 static UWord event_map_stamp = 0; // Used to stamp each OldRef when touched.
 
+
+//////////// BEGIN OldRef age buckets
+// The stamps are grouped in buckets of 2^age_bucket_shift consecutive
+// stamps.  The age of an OldRef is the nr of buckets between its stamp
+// and event_map_stamp.  We count the OldRefs of each of the
+// N_AGE_BUCKETS most recent buckets, and the OldRefs that are older
+// ("ancient").  The bucket sizes are powers of 2 so that the ages stay
+// right when event_map_stamp cycles.
+// When all OldRefs are in use, oldref_hand sweeps the OldRefs, and the
+// first one found having the oldest age that has OldRefs is recycled.
+#define N_AGE_BUCKETS 16
+static UInt  age_bucket_shift = 0;
+static UWord age_bucket_n[N_AGE_BUCKETS];
+static UWord age_bucket_n_ancient = 0;
+static UWord oldref_hand = 0;
+
+static UWord stats__oldref_recycled = 0;
+static UWord stats__oldref_hand_steps = 0;
+
+static inline UWord OldRef_age ( const OldRef* ref )
+{
+   return ((event_map_stamp >> age_bucket_shift)
+           - (ref->stamp >> age_bucket_shift))
+          & (~(UWord)0 >> age_bucket_shift);
+}
+
+/* Returns the counter of ref's age bucket. */
+static inline UWord* OldRef_age_n ( const OldRef* ref )
+{
+   if (OldRef_age(ref) >= N_AGE_BUCKETS)
+      return &age_bucket_n_ancient;
+   return &age_bucket_n[(ref->stamp >> age_bucket_shift) % N_AGE_BUCKETS];
+}
+
+/* Sets the stamp of ref to event_map_stamp, counting it in the
+   current age bucket. */
+static inline void OldRef_set_stamp ( OldRef* ref )
+{
+   ref->stamp = event_map_stamp;
+   age_bucket_n[(event_map_stamp >> age_bucket_shift) % N_AGE_BUCKETS]++;
+}
+
+/* To call after event_map_stamp has been incremented: when a new bucket
+   starts, the oldest recent bucket becomes ancient. */
+static inline void age_buckets_advance ( void )
+{
+   if (UNLIKELY((event_map_stamp & ((1UL << age_bucket_shift) - 1)) == 0)) {
+      UWord* n = &age_bucket_n[(event_map_stamp >> age_bucket_shift)
+                               % N_AGE_BUCKETS];
+      age_bucket_n_ancient += *n;
+      *n = 0;
+   }
+}
+
+/* Returns the OldRef to recycle: the next one found by oldref_hand
+   in the oldest non-empty age bucket. */
+static OldRef* OldRef_to_recycle ( void )
+{
+   const UWord cur = event_map_stamp >> age_bucket_shift;
+   UWord min_age;
+   OldRef* ref;
+
+   if (age_bucket_n_ancient > 0)
+      min_age = N_AGE_BUCKETS;
+   else {
+      min_age = N_AGE_BUCKETS - 1;
+      while (age_bucket_n[(cur - min_age) % N_AGE_BUCKETS] == 0) {
+         tl_assert(min_age > 0);
+         min_age--;
+      }
+   }
+
+   do {
+      ref = OldRef_at(oldref_hand);
+      oldref_hand++;
+      if (oldref_hand == oldrefHTN)
+         oldref_hand = 0;
+      stats__oldref_hand_steps++;
+   } while (OldRef_age(ref) < min_age);
+   return ref;
+}
+//////////// END OldRef age buckets
+
+
+//////////// BEGIN OldRef spill file
+// With --conflict-cache-spill, the recycled OldRefs are written in
+// SPILL_BLOCK_SZB blocks to a file used as a ring buffer.  The file
+// is unlinked once opened, so it disappears when helgrind exits.
+//
+// A block starts with its nr of records (an UInt), followed by the
+// records.  A record is the ga, the stamp, the tsw, the locksHeldW and
+// the stack trace of an OldRef, as ULEB128 numbers.  The ga, the stamp
+// and each frame are encoded as the (zigzag encoded) difference with the
+// corresponding value in the previous record of the block, so that
+// records with close addresses or similar stack traces take a few bytes.
+//
+// For each block, the lowest and highest address of its records and a
+// bloom filter of the pages of its records are kept in memory, so that
+// a lookup only reads the blocks that might contain an access to the
+// page(s) of the racy access.  Records take about 20 bytes, so a block
+// holds about 3000 of them: the filter has 10 bits per record, and
+// SPILL_BLOOM_NHASH bits set per page, for about 1% of false positives.
+// The filters take 1/16 of the size of the spill file.  In any case, a
+// lookup reads at most SPILL_MAX_READS blocks.
+#define SPILL_BLOCK_SZB     65536
+#define SPILL_REC_MAX_SZB   (4 * 10 + 1 + N_FRAMES * 10)
+#define SPILL_PAGE_SHIFT    12
+#define SPILL_BLOOM_NBITS   (SPILL_BLOCK_SZB / 2)
+#define SPILL_BLOOM_NWORDS  (SPILL_BLOOM_NBITS / (8 * sizeof(UWord)))
+#define SPILL_BLOOM_NHASH   7
+#define SPILL_MAX_READS     32
+
+typedef
+   struct {
+      UWord seq;    /* 1 + nr of the block in the written blocks, 0 = none */
+      Addr  lo;     /* lowest and highest address of the records */
+      Addr  hi;
+      UWord bloom[SPILL_BLOOM_NWORDS];
+   }
+   SpillBlock;
+
+typedef
+   struct {
+      UWord ga;
+      UWord stamp;
+      UInt  tsw;
+      UWord locksHeldW;
+      UInt  nframes;
+      UWord frames[N_FRAMES];
+   }
+   SpillRec;
+
+static Int         spill_fd = -1;
+static UWord       spill_nblocks = 0;
+static SpillBlock* spill_blocks = NULL; /* spill_nblocks elements */
+static UWord       spill_seq = 0;       /* nr of blocks written so far */
+/* The block being filled, not yet written. */
+static SpillBlock  spill_cur;
+static UChar*      spill_buf = NULL;
+static UInt        spill_used = 0;
+static UInt        spill_nrec = 0;
+static SpillRec    spill_prev;
+/* Buffer to read back a block. */
+static UChar*      spill_rbuf = NULL;
+
+static UWord stats__spill_records = 0;
+static UWord stats__spill_blocks_written = 0;
+static UWord stats__spill_blocks_read = 0;
+static UWord stats__spill_lookup_found = 0;
+static UWord stats__spill_lookup_capped = 0;
+
+static inline UChar* spill_put_uleb ( UChar* p, ULong v )
+{
+   do {
+      UChar b = v & 0x7F;
+      v >>= 7;
+      if (v) b |= 0x80;
+      *p++ = b;
+   } while (v);
+   return p;
+}
+
+static inline const UChar* spill_get_uleb ( const UChar* p, ULong* v )
+{
+   UInt shift = 0;
+   *v = 0;
+   do {
+      *v |= ((ULong)(*p & 0x7F)) << shift;
+      shift += 7;
+   } while (*p++ & 0x80);
+   return p;
+}
+
+/* Zigzag encoding of the (word size) difference new - old. */
+static inline ULong spill_zz ( UWord new, UWord old )
+{
+   Long d = (Long)(Word)(new - old);
+   return ((ULong)d << 1) ^ (ULong)(d >> 63);
+}
+
+static inline UWord spill_unzz ( ULong z, UWord old )
+{
+   Long d = (Long)(z >> 1) ^ -(Long)(z & 1);
+   return old + (UWord)d;
+}
+
+/* The SPILL_BLOOM_NHASH bits of page are h1, h1 + h2, h1 + 2*h2, ...
+   (modulo SPILL_BLOOM_NBITS), with h1 and h2 taken from one hash. */
+static inline void spill_bloom_hash ( UWord page, UInt* h1, UInt* h2 )
+{
+   ULong h = (ULong)page * 0x9E3779B97F4A7C15ULL;
+   *h1 = (UInt)(h >> 32);
+   *h2 = (UInt)(h >> 13) | 1;
+}
+
+static inline void spill_bloom_add ( SpillBlock* blk, UWord page )
+{
+   const UInt bpw = 8 * sizeof(UWord);
+   UInt h1, h2, i, b;
+   spill_bloom_hash(page, &h1, &h2);
+   for (i = 0; i < SPILL_BLOOM_NHASH; i++) {
+      b = (h1 + i * h2) % SPILL_BLOOM_NBITS;
+      blk->bloom[b / bpw] |= 1UL << (b % bpw);
+   }
+}
+
+static inline Bool spill_bloom_test ( const SpillBlock* blk, UWord page )
+{
+   const UInt bpw = 8 * sizeof(UWord);
+   UInt h1, h2, i, b;
+   spill_bloom_hash(page, &h1, &h2);
+   for (i = 0; i < SPILL_BLOOM_NHASH; i++) {
+      b = (h1 + i * h2) % SPILL_BLOOM_NBITS;
+      if (!(blk->bloom[b / bpw] & (1UL << (b % bpw))))
+         return False;
+   }
+   return True;
+}
+
+static void spill_start_block ( void )
+{
+   VG_(memset)(&spill_cur, 0, sizeof(spill_cur));
+   spill_cur.lo = ~(Addr)0;
+   VG_(memset)(&spill_prev, 0, sizeof(spill_prev));
+   spill_used = sizeof(UInt);
+   spill_nrec = 0;
+}
+
+static void spill_write_block ( void )
+{
+   const UWord k = spill_seq % spill_nblocks;
+   Int res;
+
+   VG_(memcpy)(spill_buf, &spill_nrec, sizeof(UInt));
+   if (VG_(lseek)(spill_fd, (Off64T)k * SPILL_BLOCK_SZB, VKI_SEEK_SET) < 0
+       || (res = VG_(write)(spill_fd, spill_buf, SPILL_BLOCK_SZB))
+          != SPILL_BLOCK_SZB) {
+      VG_(umsg)("WARNING: helgrind: write to the conflict cache spill file"
+                " failed, no more spilling.\n");
+      VG_(close)(spill_fd);
+      spill_fd = -1;
+      return;
+   }
+   spill_seq++;
+   spill_cur.seq = spill_seq;
+   spill_blocks[k] = spill_cur;
+   stats__spill_blocks_written++;
+   spill_start_block();
+}
+
+/* Appends ref to the spill file. */
+static void spill_OldRef ( const OldRef* ref )
+{
+   const RCEC* rcec = ref->acc.rcec;
+   UChar* p;
+   UInt n, i;
+
+   if (spill_used + SPILL_REC_MAX_SZB > SPILL_BLOCK_SZB) {
+      spill_write_block();
+      if (spill_fd < 0)
+         return;
+   }
+
+   for (n = 0; n < N_FRAMES; n++)
+      if (0 == rcec->frames[n]) break;
+
+   p = &spill_buf[spill_used];
+   p = spill_put_uleb(p, spill_zz(ref->ga, spill_prev.ga));
+   p = spill_put_uleb(p, spill_zz(ref->stamp, spill_prev.stamp));
+   p = spill_put_uleb(p, oldref_tsw(ref));
+   p = spill_put_uleb(p, ref->acc.locksHeldW);
+   *p++ = (UChar)n;
+   for (i = 0; i < n; i++)
+      p = spill_put_uleb(p, spill_zz(rcec->frames[i], spill_prev.frames[i]));
+   spill_used = p - spill_buf;
+   tl_assert(spill_used <= SPILL_BLOCK_SZB);
+   spill_nrec++;
+
+   spill_prev.ga = ref->ga;
+   spill_prev.stamp = ref->stamp;
+   for (i = 0; i < N_FRAMES; i++)
+      spill_prev.frames[i] = i < n ? rcec->frames[i] : 0;
+
+   if (ref->ga < spill_cur.lo)
+      spill_cur.lo = ref->ga;
+   if (ref->ga + ref->acc.tsw.szB - 1 > spill_cur.hi)
+      spill_cur.hi = ref->ga + ref->acc.tsw.szB - 1;
+   spill_bloom_add(&spill_cur, ref->ga >> SPILL_PAGE_SHIFT);
+   spill_bloom_add(&spill_cur,
+                   (ref->ga + ref->acc.tsw.szB - 1) >> SPILL_PAGE_SHIFT);
+   stats__spill_records++;
+}
+
+/* Search in the block blk the newest access conflicting with
+   thrid/[a, a+szB[/isW.  If found, return it in *res and True. */
+static Bool spill_search_block ( const UChar* blk, ThrID thrid,
+                                 Addr a, SizeT szB, Bool isW,
+                                 /*OUT*/SpillRec* res )
+{
+   SpillRec rec;
+   UInt nrec, r, i;
+   ULong v;
+   const UChar* p = blk + sizeof(UInt);
+   Bool found = False;
+
+   VG_(memset)(&rec, 0, sizeof(rec));
+   VG_(memcpy)(&nrec, blk, sizeof(UInt));
+   for (r = 0; r < nrec; r++) {
+      TSW tsw;
+
+      p = spill_get_uleb(p, &v); rec.ga = spill_unzz(v, rec.ga);
+      p = spill_get_uleb(p, &v); rec.stamp = spill_unzz(v, rec.stamp);
+      p = spill_get_uleb(p, &v); rec.tsw = (UInt)v;
+      p = spill_get_uleb(p, &v); rec.locksHeldW = (UWord)v;
+      tl_assert(*p <= N_FRAMES);
+      rec.nframes = *p++;
+      for (i = 0; i < rec.nframes; i++) {
+         p = spill_get_uleb(p, &v);
+         rec.frames[i] = spill_unzz(v, rec.frames[i]);
+      }
+      for (; i < N_FRAMES; i++)
+         rec.frames[i] = 0;
+
+      /* Same criteria as libhb_event_map_lookup. */
+      *(UInt*)&tsw = rec.tsw;
+      if (tsw.thrid == thrid)
+         continue;
+      if (!tsw.isW && !isW)
+         continue;
+      if (cmp_nonempty_intervals(a, szB, rec.ga, tsw.szB) != 0)
+         continue;
+      if (!found
+          || (res->stamp - event_map_stamp) < (rec.stamp - event_map_stamp)) {
+         *res = rec;
+         found = True;
+      }
+   }
+   return found;
+}
+
+/* Search the spill file for the newest access conflicting with
+   thr/[a, a+szB[/isW.  The block being filled is searched first,
+   then the written blocks, from the newest to the oldest, stopping
+   at the first block having a match, or after reading SPILL_MAX_READS
+   blocks. */
+static Bool spill_lookup ( /*OUT*/SpillRec* res,
+                           Thr* thr, Addr a, SizeT szB, Bool isW )
+{
+   const UWord pg1 = a >> SPILL_PAGE_SHIFT;
+   const UWord pg2 = (a + szB - 1) >> SPILL_PAGE_SHIFT;
+   UWord s;
+   UInt nreads = 0;
+
+   if (spill_nrec > 0) {
+      VG_(memcpy)(spill_buf, &spill_nrec, sizeof(UInt));
+      if (spill_search_block(spill_buf, thr->thrid, a, szB, isW, res))
+         return True;
+   }
+
+   for (s = spill_seq; s > 0 && s + spill_nblocks > spill_seq; s--) {
+      const UWord k = (s - 1) % spill_nblocks;
+      tl_assert(spill_blocks[k].seq == s);
+      if (a + szB - 1 < spill_blocks[k].lo || a > spill_blocks[k].hi)
+         continue;
+      if (!spill_bloom_test(&spill_blocks[k], pg1)
+          && !spill_bloom_test(&spill_blocks[k], pg2))
+         continue;
+      if (nreads == SPILL_MAX_READS) {
+         stats__spill_lookup_capped++;
+         return False;
+      }
+      nreads++;
+      if (VG_(lseek)(spill_fd, (Off64T)k * SPILL_BLOCK_SZB, VKI_SEEK_SET) < 0
+          || VG_(read)(spill_fd, spill_rbuf, SPILL_BLOCK_SZB)
+             != SPILL_BLOCK_SZB)
+         return False;
+      stats__spill_blocks_read++;
+      if (spill_search_block(spill_rbuf, thr->thrid, a, szB, isW, res))
+         return True;
+   }
+   return False;
+}
+
+/* Creates the spill file and moves it out of the client's fd range.
+   An existing path is refused: the file is unlinked as soon as it is
+   open, and must not be a file (or the target of a symlink) that
+   someone else uses. */
+static Bool spill_open ( void )
+{
+   HChar* name;
+   SysRes sres;
+
+   name = VG_(expand_file_name)("--conflict-cache-spill",
+                                HG_(clo_conflict_cache_spill));
+   sres = VG_(open)(name, VKI_O_CREAT|VKI_O_EXCL|VKI_O_RDWR,
+                    VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres)) {
+      VG_(umsg)("WARNING: helgrind: cannot create the conflict cache spill"
+                " file %s (%s), continuing without it.\n", name,
+                sr_Err(sres) == VKI_EEXIST ? "file exists" : "open failed");
+      VG_(free)(name);
+      return False;
+   }
+   VG_(unlink)(name);
+   VG_(free)(name);
+   spill_fd = VG_(safe_fd)(sr_Res(sres));
+   return True;
+}
+
+/* After fork, the child would share the spill file and its offset with
+   the parent: it gets a spill file of its own, and forgets the blocks
+   written before the fork, which are only in the parent's file. */
+static void spill_atfork_child ( ThreadId tid )
+{
+   if (spill_fd < 0)
+      return;
+   VG_(close)(spill_fd);
+   spill_fd = -1;
+   spill_seq = 0;
+   VG_(memset)(spill_blocks, 0, spill_nblocks * sizeof(SpillBlock));
+   spill_open();
+}
+
+static void spill_init ( void )
+{
+   if (HG_(clo_conflict_cache_spill) == NULL || HG_(clo_history_level) != 2)
+      return;
+
+   if (!spill_open())
+      return;
+
+   spill_nblocks = HG_(clo_conflict_cache_spill_size)
+                   * (1024 * 1024 / SPILL_BLOCK_SZB);
+   spill_blocks = HG_(zalloc)("libhb.spill_init.1 (spill blocks)",
+                              spill_nblocks * sizeof(SpillBlock));
+   spill_buf = HG_(zalloc)("libhb.spill_init.2 (spill buf)", SPILL_BLOCK_SZB);
+   spill_rbuf = HG_(zalloc)("libhb.spill_init.3 (spill rbuf)",
+                            SPILL_BLOCK_SZB);
+   spill_start_block();
+   VG_(atfork)(NULL/*pre*/, NULL/*parent*/, spill_atfork_child/*child*/);
+}
+//////////// END OldRef spill file
+
+
+/* allocates a new OldRef or re-use an old one if all allowed OldRef
+   have already been allocated. */
+static OldRef* alloc_or_reuse_OldRef ( void )
+{
+   if (oldrefHTN < HG_(clo_conflict_cache_size)) {
+      if (oldrefHTN % OLDREF_CHUNK_N == 0) {
+         const UWord n = HG_(clo_conflict_cache_size) - oldrefHTN;
+         oldref_chunks[oldrefHTN / OLDREF_CHUNK_N]
+            = HG_(zalloc)("libhb.alloc_or_reuse_OldRef.1 (OldRef chunk)",
+                          (n < OLDREF_CHUNK_N ? n : OLDREF_CHUNK_N)
+                          * sizeof(OldRef));
+      }
+      return OldRef_at(oldrefHTN++);
+   } else {
+      OldRef *oldref_ht;
+      OldRef *oldref = OldRef_to_recycle();
+
+      (*OldRef_age_n(oldref))--;
+      oldref_ht = VG_(HT_gen_remove) (oldrefHT, oldref, cmp_oldref_tsw);
+      tl_assert (oldref == oldref_ht);
+      if (spill_fd >= 0)
+         spill_OldRef(oldref);
+      ctxt__rcdec( oldref->acc.rcec );
+      stats__oldref_recycled++;
+      return oldref;
+   }
+}
+
 static void event_map_bind ( Addr a, SizeT szB, Bool isW, Thr* thr )
 {
    OldRef  example;
@@ -4927,12 +5630,10 @@ static void event_map_bind ( Addr a, SizeT szB, Bool isW, Thr* thr )
       }
       tl_assert(ref->acc.tsw.thrid == thrid);
       /* Update the stamp, RCEC and the W-held lockset. */
-      ref->stamp = event_map_stamp;
+      (*OldRef_age_n(ref))--;
+      OldRef_set_stamp(ref);
       ref->acc.locksHeldW = locksHeldW;
 
-      OldRef_unchain(ref);
-      OldRef_newest(ref);
-
    } else {
       tl_assert (szB == 4 || szB == 8 ||szB == 1 || szB == 2);
       // We only need to check the size the first time we insert a ref.
@@ -4946,15 +5647,15 @@ static void event_map_bind ( Addr a, SizeT szB, Bool isW, Thr* thr )
       ref->acc.tsw = (TSW) {.thrid  = thrid,
                             .szB    = szB,
                             .isW    = (UInt)(isW & 1)};
-      ref->stamp = event_map_stamp;
+      OldRef_set_stamp(ref);
       ref->acc.locksHeldW = locksHeldW;
       ref->acc.rcec       = rcec;
       ctxt__rcinc(rcec);
 
       VG_(HT_add_node) ( oldrefHT, ref );
-      OldRef_newest (ref);
    }
    event_map_stamp++;
+   age_buckets_advance();
 }
 
 
@@ -5061,39 +5762,79 @@ Bool libhb_event_map_lookup ( /*OUT*/ExeContext** resEC,
       /* consider next address in toCheck[] */
    } /* for (j = 0; j < nToCheck; j++) */
 
+   /* Not in the cache: maybe the access was spilled. */
+   if (spill_fd >= 0) {
+      SpillRec rec;
+      if (spill_lookup(&rec, thr, a, szB, isW)) {
+         TSW tsw;
+         *(UInt*)&tsw = rec.tsw;
+         *resEC      = VG_(make_ExeContext_from_StackTrace)
+                          (rec.frames,
+                           min_UInt(rec.nframes, VG_(clo_backtrace_size)));
+         *resThr     = Thr__from_ThrID(tsw.thrid);
+         *resSzB     = tsw.szB;
+         *resIsW     = tsw.isW;
+         *locksHeldW = rec.locksHeldW;
+         stats__spill_lookup_found++;
+         return True;
+      }
+   }
+
    /* really didn't find anything. */
    stats__evm__lookup_notfound++;
    return False;
 }
 
 
+/* Orders 2 OldRef* by stamp, taking into account that event_map_stamp
+   might have cycled. */
+static Int cmp_OldRef_by_stamp ( const void* v1, const void* v2 )
+{
+   const OldRef* r1 = *(const OldRef* const*)v1;
+   const OldRef* r2 = *(const OldRef* const*)v2;
+   const UWord s1 = r1->stamp - event_map_stamp;
+   const UWord s2 = r2->stamp - event_map_stamp;
+   if (s1 < s2) return -1;
+   if (s1 > s2) return 1;
+   return 0;
+}
+
 void libhb_event_map_access_history ( Addr a, SizeT szB, Access_t fn )
 {
-   OldRef *ref = lru.next;
+   XArray* refs = VG_(newXA)( HG_(zalloc),
+                              "libhb.event_map_access_history.1",
+                              HG_(free), sizeof(OldRef*) );
+   OldRef *ref;
    SizeT ref_szB;
+   UWord i;
+   Word k;
    Int n;
-      
-   while (ref != &mru) {
+
+   for (i = 0; i < oldrefHTN; i++) {
+      ref = OldRef_at(i);
+      if (cmp_nonempty_intervals(a, szB, ref->ga, ref->acc.tsw.szB) == 0)
+         VG_(addToXA)( refs, &ref );
+   }
+   VG_(setCmpFnXA)( refs, cmp_OldRef_by_stamp );
+   VG_(sortXA)( refs );
+
+   for (k = 0; k < VG_(sizeXA)( refs ); k++) {
+      ref = *(OldRef**)VG_(indexXA)( refs, k );
       ref_szB = ref->acc.tsw.szB;
-      if (cmp_nonempty_intervals(a, szB, ref->ga, ref_szB) == 0) {
-         RCEC* ref_rcec = ref->acc.rcec;
-         for (n = 0; n < N_FRAMES; n++) {
-            if (0 == ref_rcec->frames[n]) {
-               break;
-            }
+      RCEC* ref_rcec = ref->acc.rcec;
+      for (n = 0; n < N_FRAMES; n++) {
+         if (0 == ref_rcec->frames[n]) {
+            break;
          }
-         (*fn)(ref_rcec->frames, n,
-               Thr__from_ThrID(ref->acc.tsw.thrid),
-               ref->ga,
-               ref_szB,
-               ref->acc.tsw.isW,
-               ref->acc.locksHeldW);
       }
-      tl_assert (ref->next == &mru
-                 || ((ref->stamp - event_map_stamp)
-                        < ref->next->stamp - event_map_stamp));
-      ref = ref->next;
+      (*fn)(ref_rcec->frames, n,
+            Thr__from_ThrID(ref->acc.tsw.thrid),
+            ref->ga,
+            ref_szB,
+            ref->acc.tsw.isW,
+            ref->acc.locksHeldW);
    }
+   VG_(deleteXA)( refs );
 }
 
 static void event_map_init ( void )
@@ -5116,30 +5857,28 @@ static void event_map_init ( void )
    for (i = 0; i < N_RCEC_TAB; i++)
       contextTab[i] = NULL;
 
-   /* Oldref pool allocator */
-   oldref_pool_allocator = VG_(newPA)(
-                               sizeof(OldRef),
-                               1000 /* OldRefs per pool */,
-                               HG_(zalloc),
-                               "libhb.event_map_init.3 (OldRef pools)",
-                               HG_(free)
-                            );
+   /* Oldref chunks */
+   oldref_chunks = HG_(zalloc)( "libhb.event_map_init.3 (OldRef chunks)",
+                                (HG_(clo_conflict_cache_size)
+                                 + OLDREF_CHUNK_N - 1) / OLDREF_CHUNK_N
+                                * sizeof(OldRef*) );
 
    /* Oldref hashtable */
    tl_assert(!oldrefHT);
    oldrefHT = VG_(HT_construct) ("libhb.event_map_init.4 (oldref hashtable)");
 
    oldrefHTN = 0;
-   mru.prev = &lru;
-   mru.next = NULL;
-   lru.prev = NULL;
-   lru.next = &mru;
-   mru.acc = (Thr_n_RCEC) {.tsw = {.thrid = 0, 
-                                   .szB = 0, 
-                                   .isW = 0},
-                           .locksHeldW = 0, 
-                           .rcec = NULL};
-   lru.acc = mru.acc;
+
+   /* Age buckets: N_AGE_BUCKETS buckets cover at least the cache size. */
+   age_bucket_shift = 0;
+   while ((N_AGE_BUCKETS << age_bucket_shift) < HG_(clo_conflict_cache_size))
+      age_bucket_shift++;
+   for (i = 0; i < N_AGE_BUCKETS; i++)
+      age_bucket_n[i] = 0;
+   age_bucket_n_ancient = 0;
+   oldref_hand = 0;
+
+   spill_init();
 }
 
 static void event_map__check_reference_counts ( void )
@@ -5240,6 +5979,8 @@ static ULong stats__msmcread         = 0;
 static ULong stats__msmcread_change  = 0;
 static ULong stats__msmcwrite        = 0;
 static ULong stats__msmcwrite_change = 0;
+static ULong stats__msmc_E           = 0; // # accesses to an E, as an E
+static ULong stats__msmc_EtoC        = 0; // # E promoted to C
 
 /* Some notes on the H1 history mechanism:
 
@@ -5425,6 +6166,33 @@ static inline SVal msmcread ( SVal svOld,
       tl_assert(is_sane_SVal_C(svOld));
    }
 
+   if (LIKELY(SVal__isE(svOld))) {
+      ThrID thrid = SVal__unE_ThrID(svOld);
+      ULong rtym  = SVal__unE_Rtym(svOld);
+      ULong wtym  = SVal__unE_Wtym(svOld);
+      ULong tym   = acc_thr->tym;
+      if (thrid == acc_thr->thrid) {
+         /* no race, and join(Wmin, tviW) is tviW, as Wmin is an
+            earlier VTS of this thread. */
+         if (LIKELY(SVal__canE(rtym, tym))) {
+            stats__msmc_E++;
+            svNew = SVal__mkE( thrid, rtym, tym );
+            goto out;
+         }
+      } else if (wtym == 0) {
+         /* no constraint at all, hence no race */
+         if (LIKELY(SVal__canE(0, tym))) {
+            stats__msmc_E++;
+            svNew = SVal__mkE( acc_thr->thrid, 0, tym );
+            goto out;
+         }
+      }
+      /* Read by another thread, which may race, and which joins
+         constraints from both threads: promote svOld and go on. */
+      stats__msmc_EtoC++;
+      svOld = SVal__EtoC(svOld);
+   }
+
    if (LIKELY(SVal__isC(svOld))) {
       VtsID tviR  = acc_thr->viR;
       VtsID tviW  = acc_thr->viW;
@@ -5466,7 +6234,7 @@ static inline SVal msmcread ( SVal svOld,
    if (UNLIKELY(svNew != svOld)) {
       tl_assert(svNew != SVal_INVALID);
       if (HG_(clo_history_level) >= 2
-          && SVal__isC(svOld) && SVal__isC(svNew)) {
+          && SVal__isCE(svOld) && SVal__isCE(svNew)) {
          event_map_bind( acc_addr, szB, False/*!isWrite*/, acc_thr );
          stats__msmcread_change++;
       }
@@ -5490,13 +6258,28 @@ static inline SVal msmcwrite ( SVal svOld,
       tl_assert(is_sane_SVal_C(svOld));
    }
 
+   if (LIKELY(SVal__isE(svOld))) {
+      ThrID thrid = SVal__unE_ThrID(svOld);
+      ULong wtym  = SVal__unE_Wtym(svOld);
+      if (thrid == acc_thr->thrid || wtym == 0
+          || VtsID__indexAt_ThrID(acc_thr->viW, thrid) >= wtym) {
+         /* no race */
+         stats__msmc_E++;
+         svNew = SVal__mkWritten( acc_thr );
+         goto out;
+      }
+      /* A race: promote svOld and go on, to report it. */
+      stats__msmc_EtoC++;
+      svOld = SVal__EtoC(svOld);
+   }
+
    if (LIKELY(SVal__isC(svOld))) {
       VtsID tviW  = acc_thr->viW;
       VtsID wmini = SVal__unC_Wmin(svOld);
       Bool  leq   = VtsID__cmpLEQ(wmini,tviW);
       if (LIKELY(leq)) {
          /* no race */
-         svNew = SVal__mkC( tviW, tviW );
+         svNew = SVal__mkWritten( acc_thr );
          goto out;
       } else {
          VtsID rmini = SVal__unC_Rmin(svOld);
@@ -5539,7 +6322,7 @@ static inline SVal msmcwrite ( SVal svOld,
    if (UNLIKELY(svNew != svOld)) {
       tl_assert(svNew != SVal_INVALID);
       if (HG_(clo_history_level) >= 2
-          && SVal__isC(svOld) && SVal__isC(svNew)) {
+          && SVal__isCE(svOld) && SVal__isCE(svNew)) {
          event_map_bind( acc_addr, szB, True/*isWrite*/, acc_thr );
          stats__msmcwrite_change++;
       }
@@ -6570,6 +7353,7 @@ Thr* libhb_init (
    temp_max_sized_VTS->id = VtsID_INVALID;
    verydead_thread_tables_init();
    vts_set_init();
+   init_scalarts_thrid_mask();
    vts_tab_init();
    event_map_init();
    VtsID__invalidate_caches();
@@ -6581,6 +7365,7 @@ Thr* libhb_init (
    vi  = VtsID__mk_Singleton( thr, 1 );
    thr->viR = vi;
    thr->viW = vi;
+   thr->tym = 1;
    VtsID__rcinc(thr->viR);
    VtsID__rcinc(thr->viW);
 
@@ -6599,6 +7384,7 @@ Thr* libhb_create ( Thr* parent )
 
    child->viR = VtsID__tick( parent->viR, child );
    child->viW = VtsID__tick( parent->viW, child );
+   child->tym = 1;
    Filter__clear(child->filter, "libhb_create(child)");
    VtsID__rcinc(child->viR);
    VtsID__rcinc(child->viW);
@@ -6606,14 +7392,15 @@ Thr* libhb_create ( Thr* parent )
       early for that - it may not have a valid TId yet.  So, let
       libhb_Thr_resumes pick it up the first time the thread runs. */
 
-   tl_assert(VtsID__indexAt( child->viR, child ) == 1);
-   tl_assert(VtsID__indexAt( child->viW, child ) == 1);
+   tl_assert(VtsID__indexAt( child->viR, child ) == child->tym);
+   tl_assert(VtsID__indexAt( child->viW, child ) == child->tym);
 
    /* and the parent has to move along too */
    VtsID__rcdec(parent->viR);
    VtsID__rcdec(parent->viW);
    parent->viR = VtsID__tick( parent->viR, parent );
    parent->viW = VtsID__tick( parent->viW, parent );
+   parent->tym++;
    Filter__clear(parent->filter, "libhb_create(parent)");
    VtsID__rcinc(parent->viR);
    VtsID__rcinc(parent->viW);
@@ -6709,6 +7496,8 @@ void libhb_shutdown ( Bool show_stats )
                   stats__msmcread, stats__msmcread_change);
       VG_(printf)("   libhb: %'13llu msmcwrite (%'llu dragovers)\n",
                   stats__msmcwrite, stats__msmcwrite_change);
+      VG_(printf)("   libhb: %'13llu msmc on an E (%'llu promoted to C)\n",
+                  stats__msmc_E, stats__msmc_EtoC);
       VG_(printf)("   libhb: %'13llu cmpLEQ queries (%'llu misses)\n",
                   stats__cmpLEQ_queries, stats__cmpLEQ_misses);
       VG_(printf)("   libhb: %'13llu join2  queries (%'llu misses)\n",
@@ -6717,6 +7506,8 @@ void libhb_shutdown ( Bool show_stats )
       VG_(printf)("%s","\n");
       VG_(printf)("   libhb: VTSops: tick %'lu,  join %'lu,  cmpLEQ %'lu\n",
                   stats__vts__tick, stats__vts__join,  stats__vts__cmpLEQ );
+      VG_(printf)("   libhb: VTSops: join %'lu,  cmpLEQ %'lu by a single sweep\n",
+                  stats__vts__join_sweep, stats__vts__cmpLEQ_sweep );
       VG_(printf)("   libhb: VTSops: cmp_structural %'lu (%'lu slow)\n",
                   stats__vts__cmp_structural, stats__vts__cmp_structural_slow);
       VG_(printf)("   libhb: VTSset: find__or__clone_and_add %'lu"
@@ -6732,8 +7523,8 @@ void libhb_shutdown ( Bool show_stats )
       );
       VG_(printf)("   libhb: #%lu vts_tab GC    #%lu vts pruning\n",
                   stats__vts_tab_GC, stats__vts_pruning);
-      VG_(printf)( "   libhb: %lu entries in vts_set\n",
-                   VG_(sizeFM)( vts_set ) );
+      VG_(printf)( "   libhb: %u entries in vts_set\n",
+                   VG_(HT_count_nodes)( vts_set ) );
 
       VG_(printf)("%s","\n");
       {
@@ -6774,8 +7565,23 @@ void libhb_shutdown ( Bool show_stats )
       VG_(printf)( "   libhb: oldrefHTN %lu (%'d bytes)\n",
                    oldrefHTN, (int)(oldrefHTN * sizeof(OldRef)));
       tl_assert (oldrefHTN == VG_(HT_count_nodes) (oldrefHT));
+      {
+         UWord b, nb = age_bucket_n_ancient;
+         for (b = 0; b < N_AGE_BUCKETS; b++)
+            nb += age_bucket_n[b];
+         tl_assert (nb == oldrefHTN);
+      }
+      VG_(printf)( "   libhb: oldref recycled %'lu (%'lu hand steps)\n",
+                   stats__oldref_recycled, stats__oldref_hand_steps);
       VG_(printf)( "   libhb: oldref lookup found=%lu notfound=%lu\n",
                    stats__evm__lookup_found, stats__evm__lookup_notfound);
+      if (spill_fd >= 0)
+         VG_(printf)( "   libhb: spill: %'lu records in %'lu blocks"
+                      " (%'lu blocks in file), lookup found=%lu"
+                      " (%'lu blocks read, %lu lookups capped)\n",
+                      stats__spill_records, stats__spill_blocks_written,
+                      spill_nblocks, stats__spill_lookup_found,
+                      stats__spill_blocks_read, stats__spill_lookup_capped);
       if (VG_(clo_verbosity) > 1)
          VG_(HT_print_stats) (oldrefHT, cmp_oldref_tsw);
       VG_(printf)( "   libhb: oldref bind tsw/rcec "
@@ -6979,6 +7785,7 @@ void libhb_so_send ( Thr* thr, SO* so, Bool strong_send )
    VtsID__rcdec(thr->viW);
    thr->viR = VtsID__tick( thr->viR, thr );
    thr->viW = VtsID__tick( thr->viW, thr );
+   thr->tym++;
    if (!thr->llexit_done) {
       Filter__clear(thr->filter, "libhb_so_send");
       note_local_Kw_n_stack_for(thr);
@@ -7076,7 +7883,7 @@ static void trace ( Thr* thr, Addr a, SizeT szB, const HChar* s )
 
 void libhb_srange_new ( Thr* thr, Addr a, SizeT szB )
 {
-   SVal sv = SVal__mkC(thr->viW, thr->viW);
+   SVal sv = SVal__mkWritten(thr);
    tl_assert(is_sane_SVal_C(sv));
    if (0 && TRACEME(a,szB)) trace(thr,a,szB,"nw-before");
    zsm_sset_range( a, szB, sv );
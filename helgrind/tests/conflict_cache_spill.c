@@ -0,0 +1,45 @@
+/* With --conflict-cache-spill, both stacks of a race are shown even if
+   the first access was evicted from the conflict cache long ago. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define N 100000
+
+static int shared;
+static long *big;
+
+static void *th1(void *v)
+{
+	int i;
+
+	shared = 1;
+	for (i = 0; i < N; i++)	/* evicts the access to shared */
+		big[i] = i;
+
+	return 0;
+}
+
+static void *th2(void *v)
+{
+	shared = 2;
+
+	return 0;
+}
+
+int main()
+{
+	pthread_t a, b;
+
+	big = malloc(N * sizeof(long));
+	pthread_create(&a, NULL, th1, NULL);
+	sleep(1);		/* force ordering */
+	pthread_create(&b, NULL, th2, NULL);
+
+	pthread_join(a, NULL);
+	pthread_join(b, NULL);
+	free(big);
+
+	return 0;
+}
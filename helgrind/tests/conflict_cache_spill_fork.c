@@ -0,0 +1,74 @@
+/* As conflict_cache_spill, in a child process that closed all its file
+   descriptors and opened a file, as a daemon does.  The spill file must
+   not be one of the client's descriptors, and the child must have a
+   spill file of its own. */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define N 100000
+
+static int shared;
+static long *big;
+
+static void *th1(void *v)
+{
+	int i;
+
+	shared = 1;
+	for (i = 0; i < N; i++)	/* evicts the access to shared */
+		big[i] = i;
+
+	return 0;
+}
+
+static void *th2(void *v)
+{
+	shared = 2;
+
+	return 0;
+}
+
+static void child(void)
+{
+	pthread_t a, b;
+	struct stat st;
+	int fd;
+
+	for (fd = 3; fd < 1024; fd++)
+		close(fd);
+	fd = open("conflict_cache_spill_fork.tmp",
+		  O_CREAT | O_TRUNC | O_RDWR, 0600);
+	if (fd < 0)
+		exit(1);
+	unlink("conflict_cache_spill_fork.tmp");
+
+	big = malloc(N * sizeof(long));
+	pthread_create(&a, NULL, th1, NULL);
+	sleep(1);		/* force ordering */
+	pthread_create(&b, NULL, th2, NULL);
+
+	pthread_join(a, NULL);
+	pthread_join(b, NULL);
+	free(big);
+
+	fstat(fd, &st);
+	printf("child file size %ld\n", (long)st.st_size);
+	exit(0);
+}
+
+int main()
+{
+	int status;
+
+	if (fork() == 0)
+		child();
+	wait(&status);
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+/* With --sample-accesses=yes, a race in code run once is still found
+   after hot code has made the sampling rate drop. */
+
+#include <pthread.h>
+#include <unistd.h>
+
+static int shared;
+
+static int work(void)
+{
+	int a[100] = { 0 };
+	int r, i;
+
+	for (r = 0; r < 1000; r++)
+		for (i = 0; i < 100; i++)
+			a[i] += i;
+	return a[r % 100];
+}
+
+static void *th(void *v)
+{
+	work();
+	shared++;
+
+	return 0;
+}
+
+int main()
+{
+	pthread_t a, b;
+
+	pthread_create(&a, NULL, th, NULL);
+	sleep(1);		/* force ordering */
+	pthread_create(&b, NULL, th, NULL);
+
+	pthread_join(a, NULL);
+	pthread_join(b, NULL);
+
+	return 0;
+}
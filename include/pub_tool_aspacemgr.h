@@ -155,6 +155,11 @@ extern Bool VG_(am_is_valid_for_client) ( Addr start, SizeT len,
 /* Really just a wrapper around VG_(am_mmap_anon_float_valgrind). */
 extern void* VG_(am_shadow_alloc)(SizeT size);
 
+/* As VG_(am_shadow_alloc), but aligned to 'align' bytes and (on Linux)
+   advised to be backed by transparent huge pages.  Intended for tools
+   which carve their shadow memory out of large arenas. */
+extern void* VG_(am_shadow_alloc_aligned)(SizeT size, SizeT align);
+
 /* Unmap the given address range and update the segment array
    accordingly.  This fails if the range isn't valid for valgrind. */
 extern SysRes VG_(am_munmap_valgrind)( Addr start, SizeT length );
@@ -104,9 +104,45 @@ extern DiEpoch VG_(get_ExeContext_epoch)( const ExeContext* e );
 // How many entries (frames) in this ExeContext?
 extern Int VG_(get_ExeContext_n_ips)( const ExeContext* e );
 
-// Extract the StackTrace from an ExeContext.
+// Extract the StackTrace from an ExeContext.  The IPs of a context
+// are stored as a chain of frames shared with other contexts: this
+// copies them into an array which is kept, with the context, until
+// the end of the run.  To only look at the IPs, use the iterator or
+// the comparison functions below, which do not copy anything.
 extern Addr* VG_(get_ExeContext_StackTrace) ( ExeContext* e );
 
+// Iterate over the IPs of an ExeContext, from the current IP outwards:
+//    ExeContextIter it;
+//    Addr ip;
+//    VG_(init_ExeContext_iter)(&it, ec);
+//    while (VG_(next_ExeContext_ip)(&it, &ip))
+//       ...
+// The fields of ExeContextIter are private to m_execontext.c.
+typedef
+   struct { UInt frame; }
+   ExeContextIter;
+extern void VG_(init_ExeContext_iter) ( /*OUT*/ExeContextIter* it,
+                                        const ExeContext* e );
+extern Bool VG_(next_ExeContext_ip) ( ExeContextIter* it, /*OUT*/Addr* ip );
+
+// Copy the 'n' IPs of e starting at IP number 'from' into ips.
+extern void VG_(get_ExeContext_ips) ( const ExeContext* e, UInt from, UInt n,
+                                      /*OUT*/Addr* ips );
+
+// Are the IPs of e1 and e2 the same from IP number 'from' onwards?
+// This does not look at the IPs before 'from', and, as contexts share
+// their outer frames, is cheap.
+extern Bool VG_(eq_ExeContext_from) ( const ExeContext* e1,
+                                      const ExeContext* e2, UInt from );
+
+// Compare the n1 IPs of e1 starting at IP number from1 with the n2 IPs
+// of e2 starting at from2, address by address.  If one is a prefix of
+// the other, the shorter one is the smaller.  Returns -1, 0 or 1.
+extern Int VG_(cmp_ExeContext_ips) ( const ExeContext* e1, UInt from1,
+                                     UInt n1,
+                                     const ExeContext* e2, UInt from2,
+                                     UInt n2 );
+
 // Find the ExeContext that has the given ECU, if any.
 // NOTE: very slow.  Do not call often.
 extern ExeContext* VG_(get_ExeContext_from_ECU)( UInt uniq );
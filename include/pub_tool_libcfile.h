@@ -75,6 +75,9 @@ extern SysRes VG_(open)   ( const HChar* pathname, Int flags, Int mode );
    returns fd if success, -1 otherwise */
 extern Int VG_(fd_open)  (const HChar* pathname, Int flags, Int mode);
 extern void   VG_(close)  ( Int fd );
+/* Move an fd into the Valgrind-safe range, where the client can neither
+   see nor close it.  The fd is also marked close-on-exec. */
+extern Int    VG_(safe_fd) ( Int oldfd );
 extern Int    VG_(read)   ( Int fd, void* buf, Int count);
 extern Int    VG_(write)  ( Int fd, const void* buf, Int count);
 extern Int    VG_(pipe)   ( Int fd[2] );
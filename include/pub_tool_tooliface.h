@@ -661,6 +661,15 @@ void VG_(track_copy_reg_to_mem)(void(*f)(CorePart part, ThreadId tid,
    order to run client code blocks, so the times bracketed by
    'start_client_code'..'stop_client_code' are a subset of the times
    when thread 'tid' holds the cpu lock.
+
+   'start_client_code' is called at the start of each time slice of
+   'tid', before the core looks up the translation it will run first
+   (before 3.21, it was called after the lookup, just before running
+   it).  It may thus discard translations, with
+   VG_(discard_translations_safely): the core then makes the
+   translation again.  A time slice lasts at most 100000 blocks, so a
+   tool acting in 'start_client_code' on 'blocks_dispatched' gets that
+   granularity.
 */
 void VG_(track_start_client_code)(
         void(*f)(ThreadId tid, ULong blocks_dispatched)
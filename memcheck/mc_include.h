@@ -509,6 +509,11 @@ extern HChar * MC_(snprintf_delta) (HChar * buf, Int size,
 Bool MC_(is_valid_aligned_word)     ( Addr a );
 Bool MC_(is_within_valid_secondary) ( Addr a );
 
+// For --leak-check-incremental: has the 64k chunk containing a been
+// written since the last call to MC_(clear_dirty_secondaries)?
+Bool MC_(is_dirty_secondary)        ( Addr a );
+void MC_(clear_dirty_secondaries)   ( void );
+
 // Prints as user msg a description of the given loss record.
 void MC_(pp_LossRecord)(UInt n_this_record, UInt n_total_records,
                         LossRecord* l);
@@ -728,6 +733,14 @@ extern Int MC_(clo_mc_level);
 /* Should we show mismatched frees?  Default: YES */
 extern Bool MC_(clo_show_mismatched_frees);
 
+/* Should a leak search reuse the previous scan of the memory not
+   written since then?  Default: NO */
+extern Bool MC_(clo_leak_check_incremental);
+
+/* Should secondary shadow maps be carved out of 2MB arenas backed by
+   transparent huge pages?  Default: NO */
+extern Bool MC_(clo_shadow_hugepages);
+
 /* Indicates the level of detail for Vbit tracking through integer add,
    subtract, and some integer comparison operations. */
 typedef
@@ -331,15 +331,18 @@ Int find_chunk_for ( Addr       ptr,
 }
 
 
+// Returns the active chunks.  *psorted is set to True if the returned
+// array is already sorted on the 'data' field, which is the case when
+// no mempool chunks are involved.
 static MC_Chunk**
-find_active_chunks(Int* pn_chunks)
+find_active_chunks(Int* pn_chunks, Bool* psorted)
 {
    // Our goal is to construct a set of chunks that includes every
    // mempool chunk, and every malloc region that *doesn't* contain a
    // mempool chunk.
    MC_Mempool *mp;
    MC_Chunk **mallocs, **chunks, *mc;
-   UInt n_mallocs, n_chunks, m, s;
+   UInt n_mallocs, n_chunks, n_pool_chunks, m, s;
    Bool *malloc_chunk_holds_a_pool_chunk;
 
    // First we collect all the malloc chunks into an array and sort it.
@@ -349,6 +352,7 @@ find_active_chunks(Int* pn_chunks)
    if (n_mallocs == 0) {
       tl_assert(mallocs == NULL);
       *pn_chunks = 0;
+      *psorted = True;
       return NULL;
    }
    VG_(ssort)(mallocs, n_mallocs, sizeof(VgHashNode*), compare_MC_Chunks);
@@ -358,6 +362,7 @@ find_active_chunks(Int* pn_chunks)
    malloc_chunk_holds_a_pool_chunk = VG_(calloc)( "mc.fas.1",
                                                   n_mallocs, sizeof(Bool) );
    n_chunks = n_mallocs;
+   n_pool_chunks = 0;
 
    // Then we loop over the mempool tables. For each chunk in each
    // pool, we set the entry in the Bool array corresponding to the
@@ -369,6 +374,7 @@ find_active_chunks(Int* pn_chunks)
 
          // We'll need to record this chunk.
          n_chunks++;
+         n_pool_chunks++;
 
          // Possibly invalidate the malloc holding the beginning of this chunk.
          m = find_chunk_for(mc->data, mallocs, n_mallocs);
@@ -417,7 +423,9 @@ find_active_chunks(Int* pn_chunks)
    VG_(free)(mallocs);
    VG_(free)(malloc_chunk_holds_a_pool_chunk);
 
+   // Without mempool chunks, chunks[] is mallocs[] in the same order.
    *pn_chunks = n_chunks;
+   *psorted = n_pool_chunks == 0;
 
    return chunks;
 }
@@ -462,6 +470,23 @@ static SizeT lc_chunks_n_frees_marker;
 // lc_extras[i] describe the same block).
 static LC_Extra* lc_extras;
 
+// The extent [lo .. hi) of each chunk in lc_chunks, zero-sized chunks
+// being given a size of 1 (see find_chunk_for).  Looking up a scanned
+// word is the innermost operation of the leak search: keeping the
+// extents in a flat array means the binary search does not have to
+// dereference a (cold) MC_Chunk at every step.  lc_extents_lo and
+// lc_extents_hi bound all chunks, so that the many scanned words which
+// are not pointers into the heap at all are rejected without a search.
+typedef
+   struct {
+      Addr lo;
+      Addr hi;
+   }
+   LC_Extent;
+static LC_Extent* lc_extents;
+static Addr       lc_extents_lo;
+static Addr       lc_extents_hi;
+
 // chunks will be converted and merged in loss record, maintained in lr_table
 // lr_table elements are kept from one leak_search to another to implement
 // the "print new/changed leaks" client request
@@ -495,10 +520,55 @@ static Int  lc_markstack_top;
 // Keeps track of how many bytes of memory we've scanned, for printing.
 // (Nb: We don't keep track of how many register bytes we've scanned.)
 static SizeT lc_scanned_szB;
+// With --leak-check-incremental, how many of them were not scanned again,
+// but reused from the previous leak search.
+static SizeT lc_reused_szB;
 // Keeps track of how many bytes we have not scanned due to read errors that
 // caused a signal such as SIGSEGV.
 static SizeT lc_sig_skipped_szB;
 
+// With --leak-check-incremental=yes, the words found by scanning memory
+// are remembered, so that the next leak search does not have to scan
+// the memory again if it was not written in between.  Memory is
+// remembered by pieces: the part of a scanned range (root segment or
+// block) that is within one 64k chunk, of at least LC_PIECE_MIN_SZB
+// bytes.  For each piece, the words which may point to a block are
+// recorded: those within [lc_pieces_lo, lc_pieces_hi), which covers all
+// the blocks.  mc_main.c marks the chunks that are written (including
+// V/A bit changes) as dirty.
+//
+// A piece can be reused during the search which scanned it, or during
+// the next one if its chunk is not dirty.  Its recorded words are then
+// handled in the same order as a scan would, so that the results are
+// exactly those of a full search.  A full search is done again when the
+// blocks go beyond [lc_pieces_lo, lc_pieces_hi), as a word not recorded
+// could then point to a block.
+#define LC_PIECE_MIN_SZB 1024
+
+typedef
+   struct _LC_Piece {
+      struct _LC_Piece* next;
+      Addr  start;          // key
+      Addr  end;
+      UInt  gen;            // leak search that last scanned or reused it
+      UInt  n_ptrs;
+      SizeT scanned_szB;    // lc_scanned_szB increment of the scan
+      Addr  ptrs[0];        // words within [lc_pieces_lo, lc_pieces_hi)
+   }
+   LC_Piece;
+
+static VgHashTable* lc_pieces;
+// The leak search after which the dirty chunks were last cleared.
+static UInt         lc_pieces_gen;
+static Addr         lc_pieces_lo;
+static Addr         lc_pieces_hi;
+
+// The piece being scanned, if recording.
+static Bool  lc_recording;
+static Bool  lc_rec_failed;
+static UInt  lc_rec_n_ptrs;
+static Addr  lc_rec_ptrs[SM_SIZE / sizeof(Addr)];
+
 
 SizeT MC_(bytes_leaked)     = 0;
 SizeT MC_(bytes_indirect)   = 0;
@@ -519,6 +589,49 @@ static SizeT MC_(bytes_heuristically_reachable)[N_LEAK_CHECK_HEURISTICS]
 static SizeT MC_(blocks_heuristically_reachable)[N_LEAK_CHECK_HEURISTICS]
                                                 = {0,0,0,0};
 
+// Same as find_chunk_for(ptr, lc_chunks, lc_n_chunks), but using
+// lc_extents.  The search must probe in the same order as find_chunk_for,
+// so that the same block is found when (metapool) blocks overlap.
+static Int find_lc_extent_for ( Addr ptr )
+{
+   Int lo, mid, hi;
+   lo = 0;
+   hi = lc_n_chunks-1;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (ptr < lc_extents[mid].lo)
+         hi = mid-1;
+      else if (ptr >= lc_extents[mid].hi)
+         lo = mid+1;
+      else
+         return mid;
+   }
+   return -1;
+}
+
+static void build_lc_extents ( void )
+{
+   Int i;
+   if (lc_extents) {
+      VG_(free)(lc_extents);
+      lc_extents = NULL;
+   }
+   lc_extents_lo = 0;
+   lc_extents_hi = 0;
+   if (lc_n_chunks == 0)
+      return;
+   lc_extents = VG_(malloc)( "mc.ble.1", lc_n_chunks * sizeof(LC_Extent) );
+   lc_extents_lo = lc_chunks[0]->data;
+   for (i = 0; i < lc_n_chunks; i++) {
+      lc_extents[i].lo = lc_chunks[i]->data;
+      lc_extents[i].hi = lc_chunks[i]->data + lc_chunks[i]->szB;
+      if (lc_chunks[i]->szB == 0)
+         lc_extents[i].hi++;
+      if (lc_extents[i].hi > lc_extents_hi)
+         lc_extents_hi = lc_extents[i].hi;
+   }
+}
+
 // Determines if a pointer is to a chunk.  Returns the chunk number et al
 // via call-by-reference.
 static Bool
@@ -528,36 +641,37 @@ lc_is_a_chunk_ptr(Addr ptr, Int* pch_no, MC_Chunk** pch, LC_Extra** pex)
    MC_Chunk* ch;
    LC_Extra* ex;
 
-   // Quick filter. Note: implemented with am, not with get_vabits2
+   // Quickest filter: outside the range covered by any chunk.
+   if (ptr < lc_extents_lo || ptr >= lc_extents_hi)
+      return False;
+
+   ch_no = find_lc_extent_for(ptr);
+   tl_assert(ch_no >= -1 && ch_no < lc_n_chunks);
+
+   // Note: implemented with am, not with get_vabits2
    // as ptr might be random data pointing anywhere. On 64 bit
    // platforms, getting va bits for random data can be quite costly
    // due to the secondary map.
-   if (!VG_(am_is_valid_for_client)(ptr, 1, VKI_PROT_READ)) {
+   if (ch_no == -1 || !VG_(am_is_valid_for_client)(ptr, 1, VKI_PROT_READ)) {
       return False;
    } else {
-      ch_no = find_chunk_for(ptr, lc_chunks, lc_n_chunks);
-      tl_assert(ch_no >= -1 && ch_no < lc_n_chunks);
 
-      if (ch_no == -1) {
-         return False;
-      } else {
-         // Ok, we've found a pointer to a chunk.  Get the MC_Chunk and its
-         // LC_Extra.
-         ch = lc_chunks[ch_no];
-         ex = &(lc_extras[ch_no]);
+      // Ok, we've found a pointer to a chunk.  Get the MC_Chunk and its
+      // LC_Extra.
+      ch = lc_chunks[ch_no];
+      ex = &(lc_extras[ch_no]);
 
-         tl_assert(ptr >= ch->data);
-         tl_assert(ptr < ch->data + ch->szB + (ch->szB==0  ? 1  : 0));
+      tl_assert(ptr >= ch->data);
+      tl_assert(ptr < ch->data + ch->szB + (ch->szB==0  ? 1  : 0));
 
-         if (VG_DEBUG_LEAKCHECK)
-            VG_(printf)("ptr=%#lx -> block %d\n", ptr, ch_no);
+      if (VG_DEBUG_LEAKCHECK)
+         VG_(printf)("ptr=%#lx -> block %d\n", ptr, ch_no);
 
-         *pch_no = ch_no;
-         *pch    = ch;
-         *pex    = ex;
+      *pch_no = ch_no;
+      *pch    = ch;
+      *pex    = ex;
 
-         return True;
-      }
+      return True;
    }
 }
 
@@ -1001,6 +1115,120 @@ lc_push_if_a_chunk_ptr(Addr ptr,
 }
 
 
+static void
+lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
+               Int clique, Int cur_clique,
+               Addr searched, SizeT szB);
+
+// Scan [start, start+len) for --leak-check-incremental, see LC_Piece.
+static void
+lc_scan_memory_incremental(Addr start, SizeT len, Bool is_prior_definite,
+                           Int clique, Int cur_clique)
+{
+   const Addr end = start + len;
+   Addr a = start;
+
+   while (a < end) {
+      Addr      next = VG_ROUNDDN(a, SM_SIZE) + SM_SIZE;
+      Addr      pend = (next == 0 || next > end) ? end : next;
+      LC_Piece* p;
+      UInt      i;
+
+      if (pend - a < LC_PIECE_MIN_SZB) {
+         // Not worth remembering.  lc_recording stops the recursion.
+         lc_recording  = True;
+         lc_rec_n_ptrs = 0;
+         lc_scan_memory(a, pend - a, is_prior_definite, clique, cur_clique,
+                        /*searched*/ 0, 0);
+         lc_recording  = False;
+         a = pend;
+         continue;
+      }
+
+      p = VG_(HT_lookup)(lc_pieces, a);
+      if (p != NULL && p->end == pend
+          && (p->gen == MC_(leak_search_gen)
+              || (p->gen == lc_pieces_gen && !MC_(is_dirty_secondary)(a)))) {
+         p->gen = MC_(leak_search_gen);
+         lc_scanned_szB += p->scanned_szB;
+         lc_reused_szB  += p->scanned_szB;
+         for (i = 0; i < p->n_ptrs; i++)
+            lc_push_if_a_chunk_ptr(p->ptrs[i], clique, cur_clique,
+                                   is_prior_definite);
+      } else {
+         SizeT scanned_szB = lc_scanned_szB;
+
+         if (p != NULL) {
+            VG_(HT_remove)(lc_pieces, a);
+            VG_(free)(p);
+         }
+         lc_recording  = True;
+         lc_rec_failed = False;
+         lc_rec_n_ptrs = 0;
+         lc_scan_memory(a, pend - a, is_prior_definite, clique, cur_clique,
+                        /*searched*/ 0, 0);
+         lc_recording  = False;
+         if (!lc_rec_failed) {
+            p = VG_(malloc)("mc.lsmi.1",
+                            sizeof(LC_Piece) + lc_rec_n_ptrs * sizeof(Addr));
+            p->start       = a;
+            p->end         = pend;
+            p->gen         = MC_(leak_search_gen);
+            p->n_ptrs      = lc_rec_n_ptrs;
+            p->scanned_szB = lc_scanned_szB - scanned_szB;
+            for (i = 0; i < lc_rec_n_ptrs; i++)
+               p->ptrs[i] = lc_rec_ptrs[i];
+            VG_(HT_add_node)(lc_pieces, p);
+         }
+      }
+      a = pend;
+   }
+}
+
+// Prepare the pieces for a leak search: if some block is outside the
+// range of the recorded words, forget all the previous scans.
+static void lc_pieces_start_search ( void )
+{
+   NSegment const* seg;
+
+   if (lc_pieces == NULL)
+      lc_pieces = VG_(HT_construct)("mc.lpss.1");
+
+   if (lc_extents_lo >= lc_pieces_lo && lc_extents_hi <= lc_pieces_hi)
+      return;
+
+   // Widen the range to the segments holding the first and last block,
+   // so that a heap growing within them does not need a full search.
+   lc_pieces_lo = lc_extents_lo;
+   lc_pieces_hi = lc_extents_hi;
+   seg = VG_(am_find_nsegment)(lc_pieces_lo);
+   if (seg != NULL && seg->kind != SkFree)
+      lc_pieces_lo = seg->start;
+   seg = VG_(am_find_nsegment)(lc_pieces_hi - 1);
+   if (seg != NULL && seg->kind != SkFree && seg->end + 1 != 0)
+      lc_pieces_hi = seg->end + 1;
+   lc_pieces_gen = 0;
+}
+
+// Forget the pieces not used by this leak search, and start recording
+// the chunks written until the next one.
+static void lc_pieces_end_search ( void )
+{
+   LC_Piece** pieces;
+   UInt       n_pieces, i;
+
+   pieces = (LC_Piece**)VG_(HT_to_array)(lc_pieces, &n_pieces);
+   for (i = 0; i < n_pieces; i++) {
+      if (pieces[i]->gen != MC_(leak_search_gen)) {
+         VG_(HT_remove)(lc_pieces, pieces[i]->start);
+         VG_(free)(pieces[i]);
+      }
+   }
+   VG_(free)(pieces);
+   lc_pieces_gen = MC_(leak_search_gen);
+   MC_(clear_dirty_secondaries)();
+}
+
 static VG_MINIMAL_JMP_BUF(lc_scan_memory_jmpbuf);
 static
 void lc_scan_memory_fault_catcher ( Int sigNo, Addr addr )
@@ -1058,6 +1286,12 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
    const Addr end = VG_ROUNDDN(start+len, sizeof(Addr));
    fault_catcher_t prev_catcher;
 
+   if (MC_(clo_leak_check_incremental) && searched == 0 && !lc_recording) {
+      lc_scan_memory_incremental(start, len, is_prior_definite,
+                                 clique, cur_clique);
+      return;
+   }
+
    if (VG_DEBUG_LEAKCHECK)
       VG_(printf)("scan %#lx-%#lx (%lu)\n", start, end, len);
 
@@ -1099,10 +1333,12 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
       // The below implies to mark ptr as volatile, as we read the value
       // after a longjmp to here.
       lc_sig_skipped_szB += VKI_PAGE_SIZE;
+      lc_rec_failed = True;
       ptr = ptr + VKI_PAGE_SIZE; // Unaddressable, - skip it.
 #     else
       // On other platforms, just skip one Addr.
       lc_sig_skipped_szB += sizeof(Addr);
+      lc_rec_failed = True;
       tl_assert(bad_scanned_addr >= VG_ROUNDUP(start, sizeof(Addr)));
       tl_assert(bad_scanned_addr < VG_ROUNDDN(start+len, sizeof(Addr)));
       ptr = bad_scanned_addr + sizeof(Addr); // Unaddressable, - skip it.
@@ -1165,6 +1401,9 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
                }
             }
          } else {
+            if (UNLIKELY(lc_recording)
+                && addr >= lc_pieces_lo && addr < lc_pieces_hi)
+               lc_rec_ptrs[lc_rec_n_ptrs++] = addr;
             lc_push_if_a_chunk_ptr(addr, clique, cur_clique, is_prior_definite);
          }
       } else if (0 && VG_DEBUG_LEAKCHECK) {
@@ -1924,6 +2163,7 @@ static void scan_memory_root_set(Addr searched, SizeT szB)
    tl_assert(seg_starts && n_seg_starts > 0);
 
    lc_scanned_szB = 0;
+   lc_reused_szB = 0;
    lc_sig_skipped_szB = 0;
 
    // VG_(am_show_nsegments)( 0, "leakcheck");
@@ -1995,6 +2235,7 @@ static MC_Mempool *find_mp_of_chunk (MC_Chunk* mc_search)
 void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
 {
    Int i, j;
+   Bool sorted;
    
    tl_assert(lcp->mode != LC_Off);
 
@@ -2016,9 +2257,10 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       VG_(free)(lc_chunks);
       lc_chunks = NULL;
    }
-   lc_chunks = find_active_chunks(&lc_n_chunks);
+   lc_chunks = find_active_chunks(&lc_n_chunks, &sorted);
    lc_chunks_n_frees_marker = MC_(get_cmalloc_n_frees)();
    if (lc_n_chunks == 0) {
+      build_lc_extents();
       tl_assert(lc_chunks == NULL);
       if (lr_table != NULL) {
          // forget the previous recorded LossRecords as next leak search
@@ -2036,8 +2278,13 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       return;
    }
 
-   // Sort the array so blocks are in ascending order in memory.
-   VG_(ssort)(lc_chunks, lc_n_chunks, sizeof(VgHashNode*), compare_MC_Chunks);
+   // Sort the array so blocks are in ascending order in memory, unless
+   // find_active_chunks has already done so.  For a big heap checked
+   // repeatedly from gdbserver this sort is a noticeable part of the
+   // cost of each leak search.
+   if (!sorted)
+      VG_(ssort)(lc_chunks, lc_n_chunks, sizeof(VgHashNode*),
+                 compare_MC_Chunks);
 
    // Sanity check -- make sure they're in order.
    for (i = 0; i < lc_n_chunks-1; i++) {
@@ -2143,6 +2390,10 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       }
    }
 
+   build_lc_extents();
+   if (MC_(clo_leak_check_incremental))
+      lc_pieces_start_search();
+
    // Initialise lc_extras.
    if (lc_extras) {
       VG_(free)(lc_extras);
@@ -2182,6 +2433,9 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
 
    if (VG_(clo_verbosity) > 1 && !VG_(clo_xml)) {
       VG_(umsg)("Checked %'lu bytes\n", lc_scanned_szB);
+      if (MC_(clo_leak_check_incremental))
+         VG_(umsg)("Reused the previous scan of %'lu bytes\n",
+                   lc_reused_szB);
       if (lc_sig_skipped_szB > 0)
          VG_(umsg)("Skipped %'lu bytes due to read errors\n",
                    lc_sig_skipped_szB);
@@ -2218,6 +2472,9 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       }
    }
 
+   if (MC_(clo_leak_check_incremental))
+      lc_pieces_end_search();
+
    print_results( tid, lcp);
 
    VG_(free) ( lc_markstack );
@@ -2251,6 +2508,7 @@ void MC_(who_points_at) ( Addr address, SizeT szB)
    MC_Chunk** chunks;
    Int        n_chunks;
    Int        i;
+   Bool       sorted;
 
    if (szB == 1)
       VG_(umsg) ("Searching for pointers to %#lx\n", address);
@@ -2258,7 +2516,7 @@ void MC_(who_points_at) ( Addr address, SizeT szB)
       VG_(umsg) ("Searching for pointers pointing in %lu bytes from %#lx\n",
                  szB, address);
 
-   chunks = find_active_chunks(&n_chunks);
+   chunks = find_active_chunks(&n_chunks, &sorted);
 
    // Scan memory root-set, searching for ptr pointing in address[szB]
    scan_memory_root_set(address, szB);
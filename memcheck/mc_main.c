@@ -295,6 +295,81 @@ static INLINE Bool is_distinguished_sm ( SecMap* sm ) {
 // Forward declaration
 static void update_SM_counts(SecMap* oldSM, SecMap* newSM);
 
+/* --------------- SecMap arenas --------------- */
+
+// By default every non-distinguished SecMap is a separate mmap obtained
+// from VG_(am_shadow_alloc).  For processes with a very large footprint
+// that means millions of small mappings, a bloated aspacemgr segment
+// array, and a TLB miss on almost every shadow lookup.  With
+// --shadow-hugepages=yes, SecMaps are instead carved out of 2MB aligned
+// arenas which the kernel is asked to back with transparent huge pages.
+// Arenas are never returned to the system: SecMaps which are replaced by
+// a distinguished secondary go on a free list and are reused.  NUMA
+// placement is per arena, not per SecMap: with the kernel's default
+// first-touch policy, the whole 2MB huge page backing an arena (about
+// 128 SecMaps) goes to the node of the thread that first touches it,
+// and SecMaps later carved out of it for threads of other nodes stay
+// there.
+
+#define SM_ARENA_SIZE      (2 * 1024 * 1024)
+#define SMS_PER_SM_ARENA   (SM_ARENA_SIZE / sizeof(SecMap))
+
+STATIC_ASSERT(SM_ARENA_SIZE % sizeof(SecMap) == 0);
+
+static SecMap* sm_arena_next  = NULL;  // next unused SecMap in arena
+static UWord   sm_arena_avail = 0;     // # unused SecMaps left in arena
+static SecMap* sm_freelist    = NULL;  // linked through first word
+
+static Int   n_sm_arenas        = 0;
+static ULong n_sm_arena_carved  = 0;
+static ULong n_sm_arena_reused  = 0;
+
+static SecMap* alloc_SecMap ( void )
+{
+   SecMap* sm;
+
+   if (!MC_(clo_shadow_hugepages)) {
+      sm = VG_(am_shadow_alloc)(sizeof(SecMap));
+      if (sm == NULL)
+         VG_(out_of_memory_NORETURN)( "memcheck:allocate new SecMap",
+                                      sizeof(SecMap) );
+      return sm;
+   }
+
+   if (sm_freelist != NULL) {
+      sm = sm_freelist;
+      sm_freelist = *(SecMap**)sm;
+      n_sm_arena_reused++;
+      return sm;
+   }
+
+   if (sm_arena_avail == 0) {
+      sm_arena_next = VG_(am_shadow_alloc_aligned)(SM_ARENA_SIZE,
+                                                   SM_ARENA_SIZE);
+      if (sm_arena_next == NULL)
+         VG_(out_of_memory_NORETURN)( "memcheck:allocate new SecMap arena",
+                                      SM_ARENA_SIZE );
+      sm_arena_avail = SMS_PER_SM_ARENA;
+      n_sm_arenas++;
+   }
+   sm = sm_arena_next;
+   sm_arena_next++;
+   sm_arena_avail--;
+   n_sm_arena_carved++;
+   return sm;
+}
+
+static void free_SecMap ( SecMap* sm )
+{
+   if (!MC_(clo_shadow_hugepages)) {
+      SysRes sres = VG_(am_munmap_valgrind)((Addr)sm, sizeof(SecMap));
+      tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+      return;
+   }
+   *(SecMap**)sm = sm_freelist;
+   sm_freelist = sm;
+}
+
 /* dist_sm points to one of our three distinguished secondaries.  Make
    a copy of it so that we can write to it.
 */
@@ -305,10 +380,7 @@ static SecMap* copy_for_writing ( SecMap* dist_sm )
           || dist_sm == &sm_distinguished[1]
           || dist_sm == &sm_distinguished[2]);
 
-   new_sm = VG_(am_shadow_alloc)(sizeof(SecMap));
-   if (new_sm == NULL)
-      VG_(out_of_memory_NORETURN)( "memcheck:allocate new SecMap", 
-                                   sizeof(SecMap) );
+   new_sm = alloc_SecMap();
    VG_(memcpy)(new_sm, dist_sm, sizeof(SecMap));
    update_SM_counts(dist_sm, new_sm);
    return new_sm;
@@ -341,6 +413,15 @@ static Int   n_sanity_expensive = 0;
 static Int   n_secVBit_nodes   = 0;
 static Int   max_secVBit_nodes = 0;
 
+/* See "SecMap compaction" below. */
+#define SM_COMPACT_MIN_LIMIT  1024
+
+static Int   sm_compact_limit   = SM_COMPACT_MIN_LIMIT;
+static Bool  sm_compact_pending = False;
+
+static ULong n_sm_compactions   = 0;
+static Int   n_sm_compacted     = 0;
+
 static void update_SM_counts(SecMap* oldSM, SecMap* newSM)
 {
    if      (oldSM == &sm_distinguished[SM_DIST_NOACCESS ]) n_noaccess_SMs --;
@@ -359,6 +440,8 @@ static void update_SM_counts(SecMap* oldSM, SecMap* newSM)
    if (n_undefined_SMs > max_undefined_SMs) max_undefined_SMs = n_undefined_SMs;
    if (n_defined_SMs   > max_defined_SMs  ) max_defined_SMs   = n_defined_SMs;
    if (n_non_DSM_SMs   > max_non_DSM_SMs  ) max_non_DSM_SMs   = n_non_DSM_SMs;   
+
+   if (n_non_DSM_SMs >= sm_compact_limit) sm_compact_pending = True;
 }
 
 /* --------------- Primary maps --------------- */
@@ -702,6 +785,72 @@ static SecMap* maybe_get_secmap_for ( Addr a )
    }
 }
 
+/* --------------- Dirty SecMaps --------------- */
+
+// With --leak-check-incremental=yes, the leak search only rescans the
+// 64k chunks of memory whose contents or V/A bits may have changed
+// since the previous search.  Every path that writes client memory or
+// its V/A bits marks the chunk it touches as dirty: a bit per chunk for
+// the range covered by the primary map, a set of chunk numbers above it.
+// The leak search clears them all when it is done.
+
+static UChar sm_dirty_bits[N_PRIMARY_MAP / 8];
+static OSet* sm_dirty_high = NULL;   /* of chunk numbers (UWord) */
+
+static void mark_SM_dirty_high ( Addr a )
+{
+   UWord n = a >> 16;
+   if (sm_dirty_high == NULL)
+      sm_dirty_high = VG_(OSetWord_Create)( VG_(malloc), "mc.msdh.1",
+                                            VG_(free) );
+   if (!VG_(OSetWord_Contains)(sm_dirty_high, n))
+      VG_(OSetWord_Insert)(sm_dirty_high, n);
+}
+
+static INLINE void mark_SM_dirty ( Addr a )
+{
+   if (LIKELY(!MC_(clo_leak_check_incremental)))
+      return;
+   if (LIKELY(a <= MAX_PRIMARY_ADDRESS)) {
+      UWord n = a >> 16;
+      sm_dirty_bits[n >> 3] |= (UChar)(1 << (n & 7));
+   } else {
+      mark_SM_dirty_high(a);
+   }
+}
+
+static void mark_SM_dirty_range ( Addr a, SizeT len )
+{
+   Addr last;
+   if (LIKELY(!MC_(clo_leak_check_incremental)) || len == 0)
+      return;
+   last = a + len - 1;
+   if (last < a)
+      last = ~(Addr)0;
+   for (a = VG_ROUNDDN(a, SM_SIZE); ; a += SM_SIZE) {
+      mark_SM_dirty(a);
+      if (last - a < SM_SIZE)
+         break;
+   }
+}
+
+Bool MC_(is_dirty_secondary) ( Addr a )
+{
+   UWord n = a >> 16;
+   if (a <= MAX_PRIMARY_ADDRESS)
+      return (sm_dirty_bits[n >> 3] >> (n & 7)) & 1;
+   return sm_dirty_high != NULL && VG_(OSetWord_Contains)(sm_dirty_high, n);
+}
+
+void MC_(clear_dirty_secondaries) ( void )
+{
+   VG_(memset)(sm_dirty_bits, 0, sizeof(sm_dirty_bits));
+   if (sm_dirty_high != NULL) {
+      VG_(OSetWord_Destroy)(sm_dirty_high);
+      sm_dirty_high = NULL;
+   }
+}
+
 /* --------------- Fundamental functions --------------- */
 
 static INLINE
@@ -753,6 +902,7 @@ void set_vabits2 ( Addr a, UChar vabits2 )
 {
    SecMap* sm       = get_secmap_for_writing(a);
    UWord   sm_off   = SM_OFF(a);
+   mark_SM_dirty(a);
    insert_vabits2_into_vabits8( a, vabits2, &(sm->vabits8[sm_off]) );
 }
 
@@ -783,6 +933,7 @@ void set_vabits8_for_aligned_word32 ( Addr a, UChar vabits8 )
 {
    SecMap* sm       = get_secmap_for_writing(a);
    UWord   sm_off   = SM_OFF(a);
+   mark_SM_dirty(a);
    sm->vabits8[sm_off] = vabits8;
 }
 
@@ -1221,6 +1372,8 @@ static Bool modify_ignore_ranges ( Bool addRange, Addr start, Addr len )
    if (len == 0) {
       return False;
    }
+   // The leak search skips the ignored ranges.
+   mark_SM_dirty_range(start, len);
    if (addRange) {
       VG_(bindRangeMap)(gIgnoredAddressRanges,
                         start, start+len-1, IAR_ClientReq);
@@ -1571,6 +1724,7 @@ void mc_STOREVn_slow ( Addr a, SizeT nBits, ULong vbytes, Bool bigendian )
    Bool  ok;
 
    PROF_EVENT(MCPE_STOREVN_SLOW);
+   mark_SM_dirty_range(a, szB);
 
    /* ------------ BEGIN semi-fast cases ------------ */
    /* These deal quickly-ish with the common auxiliary primary map
@@ -1659,6 +1813,90 @@ void mc_STOREVn_slow ( Addr a, SizeT nBits, ULong vbytes, Bool bigendian )
 /*--- Setting permissions over address ranges.             ---*/
 /*------------------------------------------------------------*/
 
+/* --------------- SecMap compaction --------------- */
+
+// A non-distinguished SecMap only reverts to a distinguished one when
+// set_address_range_perms covers its whole 64k range in one go.  Areas
+// that become uniform piecewise -- a big buffer filled by many small
+// read() calls or by ordinary stores, a region freed block by block --
+// keep their 16k of shadow forever.  So, whenever the number of
+// non-distinguished SecMaps has grown enough since the last time, scan
+// them all and replace those that are uniformly noaccess, undefined or
+// defined by the matching distinguished SecMap.
+//
+// A sparse or run-length representation of nearly-uniform SecMaps would
+// save more, but would break the direct vabits8[] indexing which the
+// generated code and the LOADV/STOREV fast paths rely on.
+//
+// Compaction frees SecMaps, so it must not run while anybody holds a
+// pointer to one.  It is therefore only requested when allocating, and
+// done at the start of the next set_address_range_perms call.
+
+/* Return the distinguished SecMap with the same contents as sm, or
+   NULL if sm is not uniform. */
+static SecMap* uniform_dsm_for ( SecMap* sm )
+{
+   const UWord* w = (const UWord*)sm->vabits8;
+   UWord        first = w[0];
+   SecMap*      dsm;
+   UWord        i;
+
+   if      (first == (UWord)0)
+      dsm = &sm_distinguished[SM_DIST_NOACCESS];
+   else if (first == (UWord)0x5555555555555555ULL)
+      dsm = &sm_distinguished[SM_DIST_UNDEFINED];
+   else if (first == (UWord)0xaaaaaaaaaaaaaaaaULL)
+      dsm = &sm_distinguished[SM_DIST_DEFINED];
+   else
+      return NULL;
+
+   for (i = 1; i < sizeof(SecMap) / sizeof(UWord); i++) {
+      if (w[i] != first)
+         return NULL;
+   }
+   return dsm;
+}
+
+static void maybe_compact_SM ( SecMap** sm_ptr )
+{
+   SecMap* dsm;
+
+   if (is_distinguished_sm(*sm_ptr))
+      return;
+   dsm = uniform_dsm_for(*sm_ptr);
+   if (dsm == NULL)
+      return;
+   free_SecMap(*sm_ptr);
+   update_SM_counts(*sm_ptr, dsm);
+   *sm_ptr = dsm;
+   n_sm_compacted++;
+}
+
+static void compact_SMs ( void )
+{
+   UWord      i;
+   AuxMapEnt* elem;
+   Int        before = n_non_DSM_SMs;
+
+   n_sm_compactions++;
+   for (i = 0; i < N_PRIMARY_MAP; i++)
+      maybe_compact_SM(&primary_map[i]);
+
+   VG_(OSetGen_ResetIter)(auxmap_L2);
+   while ( (elem = VG_(OSetGen_Next)(auxmap_L2)) )
+      maybe_compact_SM(&elem->sm);
+
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg,
+                   "memcheck SM compaction: %d SMs, %d compacted\n",
+                   before, before - n_non_DSM_SMs);
+
+   sm_compact_limit = 2 * n_non_DSM_SMs;
+   if (sm_compact_limit < SM_COMPACT_MIN_LIMIT)
+      sm_compact_limit = SM_COMPACT_MIN_LIMIT;
+   sm_compact_pending = False;
+}
+
 static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
                                       UWord dsm_num )
 {
@@ -1671,6 +1909,7 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    SecMap*  example_dsm;
 
    PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS);
+   mark_SM_dirty_range(a, lenT);
 
    /* Check the V+A bits make sense. */
    tl_assert(VA_BITS16_NOACCESS  == vabits16 ||
@@ -1684,6 +1923,9 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    if (lenT == 0)
       return;
 
+   if (UNLIKELY(sm_compact_pending))
+      compact_SMs();
+
    if (lenT > 256 * 1024 * 1024) {
       if (VG_(clo_verbosity) > 0 && !VG_(clo_xml)) {
          const HChar* s = "unknown???";
@@ -1836,8 +2078,7 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
          PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP64K_FREE_DIST_SM);
          // Free the non-distinguished sec-map that we're replacing.  This
          // case happens moderately often, enough to be worthwhile.
-         SysRes sres = VG_(am_munmap_valgrind)((Addr)*sm_ptr, sizeof(SecMap));
-         tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+         free_SecMap(*sm_ptr);
       }
       update_SM_counts(*sm_ptr, example_dsm);
       // Make the sec-map entry point to the example DSM
@@ -2827,6 +3068,7 @@ static INLINE void set_aligned_word64_Origin_to_undef ( Addr a, UInt otag )
 static INLINE void make_aligned_word32_undefined ( Addr a )
 {
   PROF_EVENT(MCPE_MAKE_ALIGNED_WORD32_UNDEFINED);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STACK2
    make_mem_undefined(a, 4);
@@ -2870,6 +3112,7 @@ static INLINE
 void make_aligned_word32_noaccess ( Addr a )
 {
    PROF_EVENT(MCPE_MAKE_ALIGNED_WORD32_NOACCESS);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STACK2
    MC_(make_mem_noaccess)(a, 4);
@@ -2911,6 +3154,7 @@ void make_aligned_word32_noaccess ( Addr a )
 static INLINE void make_aligned_word64_undefined ( Addr a )
 {
    PROF_EVENT(MCPE_MAKE_ALIGNED_WORD64_UNDEFINED);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STACK2
    make_mem_undefined(a, 8);
@@ -2955,6 +3199,7 @@ static INLINE
 void make_aligned_word64_noaccess ( Addr a )
 {
    PROF_EVENT(MCPE_MAKE_ALIGNED_WORD64_NOACCESS);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STACK2
    MC_(make_mem_noaccess)(a, 8);
@@ -3742,6 +3987,7 @@ VG_REGPARM(3)
 void MC_(helperc_MAKE_STACK_UNINIT_w_o) ( Addr base, UWord len, Addr nia )
 {
    PROF_EVENT(MCPE_MAKE_STACK_UNINIT_W_O);
+   mark_SM_dirty_range(base, len);
    if (0)
       VG_(printf)("helperc_MAKE_STACK_UNINIT_w_o (%#lx,%lu,nia=%#lx)\n",
                   base, len, nia );
@@ -3944,6 +4190,7 @@ VG_REGPARM(2)
 void MC_(helperc_MAKE_STACK_UNINIT_no_o) ( Addr base, UWord len )
 {
    PROF_EVENT(MCPE_MAKE_STACK_UNINIT_NO_O);
+   mark_SM_dirty_range(base, len);
    if (0)
       VG_(printf)("helperc_MAKE_STACK_UNINIT_no_o (%#lx,%lu)\n",
                   base, len );
@@ -4089,6 +4336,7 @@ VG_REGPARM(1)
 void MC_(helperc_MAKE_STACK_UNINIT_128_no_o) ( Addr base )
 {
    PROF_EVENT(MCPE_MAKE_STACK_UNINIT_128_NO_O);
+   mark_SM_dirty_range(base, 128);
    if (0)
       VG_(printf)("helperc_MAKE_STACK_UNINIT_128_no_o (%#lx)\n", base );
 
@@ -5066,6 +5314,7 @@ static INLINE
 void mc_STOREV64 ( Addr a, ULong vbits64, Bool isBigEndian )
 {
    PROF_EVENT(MCPE_STOREV64);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STOREV
    // XXX: this slow case seems to be marginally faster than the fast case!
@@ -5202,6 +5451,7 @@ static INLINE
 void mc_STOREV32 ( Addr a, UWord vbits32, Bool isBigEndian )
 {
    PROF_EVENT(MCPE_STOREV32);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STOREV
    mc_STOREVn_slow( a, 32, (ULong)vbits32, isBigEndian );
@@ -5440,6 +5690,7 @@ static INLINE
 void mc_STOREV16 ( Addr a, UWord vbits16, Bool isBigEndian )
 {
    PROF_EVENT(MCPE_STOREV16);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STOREV
    mc_STOREVn_slow( a, 16, (ULong)vbits16, isBigEndian );
@@ -5654,6 +5905,7 @@ VG_REGPARM(2)
 void MC_(helperc_STOREV8) ( Addr a, UWord vbits8 )
 {
    PROF_EVENT(MCPE_STOREV8);
+   mark_SM_dirty(a);
 
 #ifndef PERF_FAST_STOREV
    mc_STOREVn_slow( a, 8, (ULong)vbits8, False/*irrelevant*/ );
@@ -6071,6 +6323,7 @@ UInt          MC_(clo_leak_check_heuristics)  =   H2S(LchStdString)
                                                 | H2S( LchLength64)
                                                 | H2S( LchNewArray)
                                                 | H2S( LchMultipleInheritance);
+Bool          MC_(clo_leak_check_incremental) = False;
 Bool          MC_(clo_xtree_leak)             = False;
 const HChar*  MC_(clo_xtree_leak_file) = "xtleak.kcg.%p";
 Bool          MC_(clo_workaround_gcc296_bugs) = False;
@@ -6079,6 +6332,7 @@ Int           MC_(clo_free_fill)              = -1;
 KeepStacktraces MC_(clo_keep_stacktraces)     = KS_alloc_and_free;
 Int           MC_(clo_mc_level)               = 2;
 Bool          MC_(clo_show_mismatched_frees)  = True;
+Bool          MC_(clo_shadow_hugepages)       = False;
 
 ExpensiveDefinednessChecks
               MC_(clo_expensive_definedness_checks) = EdcAUTO;
@@ -6279,6 +6533,11 @@ static Bool mc_process_cmd_line_options(const HChar* arg)
    else if VG_XACT_CLO(arg, "--expensive-definedness-checks=yes",
                             MC_(clo_expensive_definedness_checks), EdcYES) {}
 
+   else if VG_BOOL_CLO(arg, "--shadow-hugepages",
+                       MC_(clo_shadow_hugepages)) {}
+
+   else if VG_BOOL_CLO(arg, "--leak-check-incremental",
+                       MC_(clo_leak_check_incremental)) {}
    else if VG_BOOL_CLO(arg, "--xtree-leak",
                        MC_(clo_xtree_leak)) {}
    else if VG_STR_CLO (arg, "--xtree-leak-file",
@@ -6316,6 +6575,8 @@ static void mc_print_usage(void)
 "                                     same as --show-leak-kinds=definite,possible\n"
 "    --show-reachable=no --show-possibly-lost=no\n"
 "                                     same as --show-leak-kinds=definite\n"
+"    --leak-check-incremental=no|yes  only rescan the memory changed since\n"
+"                                     the previous leak search? [no]\n"
 "    --xtree-leak=no|yes              output leak result in xtree format? [no]\n"
 "    --xtree-leak-file=<file>         xtree leak report file [xtleak.kcg.%%p]\n"
 "    --undef-value-errors=no|yes      check for undefined value errors [yes]\n"
@@ -6335,6 +6596,8 @@ static void mc_print_usage(void)
 "    --keep-stacktraces=alloc|free|alloc-and-free|alloc-then-free|none\n"
 "        stack trace(s) to keep for malloc'd/free'd areas       [alloc-and-free]\n"
 "    --show-mismatched-frees=no|yes   show frees that don't match the allocator? [yes]\n"
+"    --shadow-hugepages=no|yes        allocate shadow memory in 2MB huge page\n"
+"                                     arenas? [no]\n"
    );
 }
 
@@ -8198,6 +8461,20 @@ static void mc_print_stats (void)
    print_SM_info("max_undefined", max_undefined_SMs);
    print_SM_info("max_defined  ", max_defined_SMs);
    print_SM_info("max_non_DSM  ", max_non_DSM_SMs);
+   print_SM_info("compacted    ", n_sm_compacted);
+   VG_(message)(Vg_DebugMsg,
+      " memcheck: SM compactions: %llu\n", n_sm_compactions);
+
+   if (MC_(clo_shadow_hugepages)) {
+      VG_(message)(Vg_DebugMsg,
+         " memcheck: SM arenas: %d x %dM (%lu SMs each), "
+         "%llu SMs carved, %llu reused\n",
+         n_sm_arenas, SM_ARENA_SIZE / (1024 * 1024),
+         (UWord)SMS_PER_SM_ARENA, n_sm_arena_carved, n_sm_arena_reused);
+      VG_(message)(Vg_DebugMsg,
+         " memcheck: SM arenas: %d mappings instead of %d\n",
+         n_sm_arenas, max_non_DSM_SMs);
+   }
 
    // Three DSMs, plus the non-DSM ones
    max_SMs_szB = (3 + max_non_DSM_SMs) * sizeof(SecMap);
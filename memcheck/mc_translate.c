@@ -1038,6 +1038,19 @@ static IRAtom* mkPCastTo( MCEnv* mce, IRType dst_ty, IRAtom* vbits )
                                        unop(Iop_CmpNEZ64, tmp4));
          break;
       }
+      case Ity_V256: {
+         /* Same again, but with four quarters. */
+         IRAtom* q0 = assignNew('V', mce, Ity_I64, unop(Iop_V256to64_0, vbits));
+         IRAtom* q1 = assignNew('V', mce, Ity_I64, unop(Iop_V256to64_1, vbits));
+         IRAtom* q2 = assignNew('V', mce, Ity_I64, unop(Iop_V256to64_2, vbits));
+         IRAtom* q3 = assignNew('V', mce, Ity_I64, unop(Iop_V256to64_3, vbits));
+         IRAtom* q01 = assignNew('V', mce, Ity_I64, binop(Iop_Or64, q0, q1));
+         IRAtom* q23 = assignNew('V', mce, Ity_I64, binop(Iop_Or64, q2, q3));
+         IRAtom* q   = assignNew('V', mce, Ity_I64, binop(Iop_Or64, q01, q23));
+         tmp1        = assignNew('V', mce, Ity_I1,
+                                      unop(Iop_CmpNEZ64, q));
+         break;
+      }
       default:
          ppIRType(src_ty);
          VG_(tool_panic)("mkPCastTo(1)");
@@ -7742,6 +7755,10 @@ static void schemeS ( MCEnv* mce, IRStmt* st )
       }
 
       case Ist_WrTmp:
+         /* Loads are handled by do_origins_WrTmp_Load, once their V
+            bits are known. */
+         if (st->Ist.WrTmp.data->tag == Iex_Load)
+            break;
          assign( 'B', mce, findShadowTmpB(mce, st->Ist.WrTmp.tmp),
                            schemeE(mce, st->Ist.WrTmp.data) );
          break;
@@ -7761,6 +7778,33 @@ static void schemeS ( MCEnv* mce, IRStmt* st )
 }
 
 
+/* Generate IR for the origin of a load into TMP.  The origin of a
+   value only matters if the value is at least partially undefined,
+   which is rare.  So the origin load is guarded by the V bits of the
+   loaded value: when it is fully defined the helper call is skipped
+   and the origin is zero ("unknown").  This must be called after the
+   V bits of TMP have been computed.
+
+   Only loads are treated this way.  Stores must always update the
+   origins, since a defined store has to clear the origins of the
+   bytes it overwrites. */
+static void do_origins_WrTmp_Load ( MCEnv* mce, IRTemp tmp, IRExpr* load )
+{
+   IRAtom* vatom;
+   IRAtom* guard;
+
+   tl_assert(MC_(clo_mc_level) == 3);
+   tl_assert(load->tag == Iex_Load);
+   tl_assert(isIRAtom(load->Iex.Load.addr));
+   vatom = mkexpr( findShadowTmpV(mce, tmp) );
+   guard = mkPCastTo( mce, Ity_I1, vatom );
+   assign( 'B', mce, findShadowTmpB(mce, tmp),
+           expr2ori_Load_guarded_General( mce, load->Iex.Load.ty,
+                                          load->Iex.Load.addr, 0/*bias*/,
+                                          guard, mkU32(0) ) );
+}
+
+
 /*------------------------------------------------------------*/
 /*--- Post-tree-build final tidying                        ---*/
 /*------------------------------------------------------------*/
@@ -8806,6 +8850,10 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
                                         : HuOth/*we don't know, so play safe*/;
             assign( 'V', &mce, findShadowTmpV(&mce, st->Ist.WrTmp.tmp), 
                                expr2vbits( &mce, st->Ist.WrTmp.data, hu ));
+            if (MC_(clo_mc_level) == 3
+                && st->Ist.WrTmp.data->tag == Iex_Load)
+               do_origins_WrTmp_Load( &mce, st->Ist.WrTmp.tmp,
+                                      st->Ist.WrTmp.data );
             break;
          }
 
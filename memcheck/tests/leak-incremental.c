@@ -0,0 +1,102 @@
+/* Check that --leak-check-incremental=yes finds the same leaks as a
+   full leak search, when the memory holding the pointers is changed
+   between searches in various ways. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../memcheck.h"
+
+#define N_ROOTS  (1 << 17)      /* 1MB of root pointers: 16 chunks */
+#define N_BLOCKS 1000
+
+static void* roots[N_ROOTS];
+static char  pool[64];
+
+/* The blocks allocated before main. */
+static long base_leaked, base_dubious, base_reachable;
+
+static void check(const char* what)
+{
+   long leaked = 0, dubious = 0, reachable = 0, suppressed = 0;
+
+   VALGRIND_DO_LEAK_CHECK;
+   VALGRIND_COUNT_LEAK_BLOCKS(leaked, dubious, reachable, suppressed);
+   printf("%-24s leaked %4ld, dubious %4ld, reachable %4ld blocks\n",
+          what, leaked - base_leaked, dubious - base_dubious,
+          reachable - base_reachable);
+}
+
+__attribute__((noinline))
+static void with_stack_pointer(void)
+{
+   void* volatile local[1024];
+
+   memset((void*)local, 0, sizeof(local));
+   local[512] = malloc(100);
+   check("pointer on the stack");
+}
+
+int main(void)
+{
+   void** big;
+   void*  p;
+   int    i;
+   long   suppressed = 0;
+
+   setbuf(stdout, NULL);
+   VALGRIND_DO_LEAK_CHECK;
+   VALGRIND_COUNT_LEAK_BLOCKS(base_leaked, base_dubious, base_reachable,
+                              suppressed);
+
+   for (i = 0; i < N_BLOCKS; i++)
+      roots[i * 100] = malloc(64);
+   /* A big block, scanned in pieces, holding the only pointers to
+      other blocks. */
+   big = malloc(256 * 1024);
+   memset(big, 0, 256 * 1024);
+   for (i = 0; i < 100; i++)
+      big[i * 300] = malloc(32);
+   roots[N_ROOTS - 1] = big;
+
+   check("initial");
+   check("unchanged");
+
+   /* Drop root pointers in one chunk. */
+   for (i = 0; i < 10; i++) {
+      free(roots[i * 100]);
+      roots[i * 100] = NULL;
+   }
+   for (i = 10; i < 20; i++)
+      roots[i * 100] = NULL;
+   check("root pointers dropped");
+
+   /* The only pointer to a block becomes undefined. */
+   (void) VALGRIND_MAKE_MEM_UNDEFINED(&roots[500 * 100], sizeof(void*));
+   check("root pointer undefined");
+
+   /* Drop pointers held by the big block. */
+   for (i = 0; i < 5; i++)
+      big[i * 300] = NULL;
+   check("block pointers dropped");
+
+   /* A dangling pointer in an unchanged chunk. */
+   p = roots[900 * 100];
+   free(p);
+   check("dangling pointer");
+
+   /* A block that comes back at the address of a freed one, which an
+      unchanged chunk still points to. */
+   VALGRIND_MALLOCLIKE_BLOCK(pool, 64, 0, 0);
+   roots[901 * 100] = pool;
+   check("custom block");
+   VALGRIND_FREELIKE_BLOCK(pool, 0);
+   check("custom block freed");
+   VALGRIND_MALLOCLIKE_BLOCK(pool, 64, 0, 0);
+   check("custom block again");
+
+   with_stack_pointer();
+   check("stack frame gone");
+
+   return 0;
+}
@@ -0,0 +1,46 @@
+/* Test looking up code addresses of objects that have been dlclose'd.
+   dlclose_epochs_a.so and dlclose_epochs_b.so have the same code at the
+   same offsets, and the second one is normally loaded where the first one
+   was.  The same code addresses must then be described with the object
+   loaded at the time of the lookup: a_ functions while the first object
+   is loaded, b_ functions after it has been unmapped, and the a_ functions
+   again for the block allocated by the first object (archived epoch). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <assert.h>
+
+static char* load_and_call(const char* so, const char* jump,
+                           const char* alloc)
+{
+   int (*jump_fn)(void);
+   char* (*alloc_fn)(void);
+   char* mem;
+   void* handle = dlopen(so, RTLD_NOW);
+
+   if (!handle) {
+      printf("FAILURE to dlopen %s\n", so);
+      exit(EXIT_FAILURE);
+   }
+   jump_fn = dlsym(handle, jump);
+   assert(jump_fn);
+   alloc_fn = dlsym(handle, alloc);
+   assert(alloc_fn);
+   (void)jump_fn();
+   mem = alloc_fn();
+   dlclose(handle);
+   return mem;
+}
+
+int main(void)
+{
+   char x __attribute__((unused));
+   char* a = load_and_call("./dlclose_epochs_a.so", "a_jump", "a_alloc");
+   char* b = load_and_call("./dlclose_epochs_b.so", "b_jump", "b_alloc");
+
+   x = a[-1];
+   x = b[-1];
+   fprintf(stderr, "done!\n");
+   return EXIT_SUCCESS;
+}
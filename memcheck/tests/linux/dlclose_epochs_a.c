@@ -0,0 +1,18 @@
+/* dlclose_epochs_a.c: same layout as dlclose_epochs_b.c, so that
+   both objects have the same code at the same offsets. */
+
+#include <stdlib.h>
+
+int a_jump(void)
+{
+   int uninit[27];
+   __asm__ __volatile("":::"cc","memory");
+   if (uninit[13])
+      return 1;
+   return 0;
+}
+
+char* a_alloc(void)
+{
+   return (char*)malloc(1);
+}
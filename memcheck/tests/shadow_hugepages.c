@@ -0,0 +1,40 @@
+/* Check that shadow memory carved out of huge page arenas behaves like
+   individually allocated shadow memory, including when the secondary
+   maps are released by munmap and reused by a later mapping. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "../memcheck.h"
+
+#define SZB (16 * 1024 * 1024)
+
+int main(void)
+{
+   int round;
+   long i;
+
+   for (round = 0; round < 2; round++) {
+      unsigned char vbits;
+      int n_undefined = 0;
+      char* p = mmap(NULL, SZB, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+         perror("mmap");
+         return 1;
+      }
+
+      /* Force a non-distinguished secondary map for every 64KB. */
+      for (i = 0; i < SZB; i += 65536)
+         (void) VALGRIND_MAKE_MEM_UNDEFINED(p + i + round, 1);
+
+      for (i = 0; i < SZB; i += 1) {
+         if (VALGRIND_GET_VBITS(p + i, &vbits, 1) == 1 && vbits != 0)
+            n_undefined++;
+      }
+      printf("round %d: %d undefined bytes\n", round, n_undefined);
+
+      munmap(p, SZB);
+   }
+   return 0;
+}
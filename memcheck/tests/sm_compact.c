@@ -0,0 +1,56 @@
+/* Check that SecMap compaction releases the secondary maps that have
+   become uniform piecewise, but keeps those that are nearly uniform:
+   a few undefined bytes in a defined 64KB chunk must stay visible. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "../memcheck.h"
+
+#define N_SMS 1536
+#define SM_SZB 65536
+
+static unsigned char vbits[SM_SZB];
+
+int main(void)
+{
+   long i, j;
+   int n_undefined = 0, n_misplaced = 0;
+   char* p = mmap(NULL, (size_t)N_SMS * SM_SZB, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (p == MAP_FAILED) {
+      perror("mmap");
+      return 1;
+   }
+
+   /* Every 64KB chunk gets its own secondary map.  The odd ones become
+      uniformly defined again, the even ones keep 2 undefined bytes. */
+   for (i = 0; i < N_SMS; i++) {
+      char* sm = p + i * SM_SZB;
+      (void) VALGRIND_MAKE_MEM_UNDEFINED(sm + (i * 37) % SM_SZB, 1);
+      (void) VALGRIND_MAKE_MEM_UNDEFINED(sm + (i * 101 + 7) % SM_SZB, 1);
+      if (i % 2 == 1) {
+         (void) VALGRIND_MAKE_MEM_DEFINED(sm + (i * 37) % SM_SZB, 1);
+         (void) VALGRIND_MAKE_MEM_DEFINED(sm + (i * 101 + 7) % SM_SZB, 1);
+      }
+   }
+
+   for (i = 0; i < N_SMS; i++) {
+      if (VALGRIND_GET_VBITS(p + i * SM_SZB, vbits, SM_SZB) != 1) {
+         printf("GET_VBITS failed\n");
+         return 1;
+      }
+      for (j = 0; j < SM_SZB; j++) {
+         if (vbits[j] == 0)
+            continue;
+         n_undefined++;
+         if (i % 2 == 1
+             || (j != (i * 37) % SM_SZB && j != (i * 101 + 7) % SM_SZB))
+            n_misplaced++;
+      }
+   }
+   printf("%d undefined bytes, %d misplaced\n", n_undefined, n_misplaced);
+
+   munmap(p, (size_t)N_SMS * SM_SZB);
+   return 0;
+}
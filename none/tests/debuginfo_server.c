@@ -0,0 +1,29 @@
+/* Print a stack trace, whose function names and line numbers can only
+   come from the separate debug file of this program when it is read
+   from a debuginfo server.  See debuginfo_server_post.  The functions
+   and types below are only there to make the debug file many blocks
+   long, so that the client reads ahead. */
+
+#include "../../include/valgrind.h"
+
+#define F(n) \
+   struct s##n { int a##n; long b##n; char c##n[n]; }; \
+   int f##n(struct s##n* p) { return p->a##n + (int)p->b##n + p->c##n[0]; }
+#define F10(n) F(n##0) F(n##1) F(n##2) F(n##3) F(n##4) \
+               F(n##5) F(n##6) F(n##7) F(n##8) F(n##9)
+#define F100(n) F10(n##0) F10(n##1) F10(n##2) F10(n##3) F10(n##4) \
+                F10(n##5) F10(n##6) F10(n##7) F10(n##8) F10(n##9)
+
+F100(1) F100(2) F100(3) F100(4) F100(5) F100(6)
+
+__attribute__((noinline))
+static void trace(void)
+{
+   VALGRIND_PRINTF_BACKTRACE("trace\n");
+}
+
+int main(void)
+{
+   trace();
+   return 0;
+}
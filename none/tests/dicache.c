@@ -0,0 +1,17 @@
+/* Print a stack trace, so that the function names, line numbers and
+   unwind information used for it come from the debuginfo cache entry
+   of this program when it is used.  See dicache_post. */
+
+#include "../../include/valgrind.h"
+
+__attribute__((noinline))
+static void trace(void)
+{
+   VALGRIND_PRINTF_BACKTRACE("trace\n");
+}
+
+int main(void)
+{
+   trace();
+   return 0;
+}
@@ -0,0 +1,79 @@
+/* Check that the stack traces taken from the shadow call stack
+   (--shadow-call-stack=yes) do not show frames of calls which have
+   returned, or which have been unwound by longjmp, and that they are
+   right in and after a signal handler.  In each case, SP is lowered
+   without a call before taking the trace, so that the dead frames
+   are above the new call.  --shadow-call-stack=yes is only available
+   on x86 and amd64. */
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include "../../include/valgrind.h"
+
+#define TRACE_BELOW_DEAD_FRAMES(msg)                 \
+   do {                                              \
+      char* volatile buf = __builtin_alloca(4096);   \
+      buf[0] = 0;                                    \
+      VALGRIND_PRINTF_BACKTRACE("%s\n", msg);        \
+   } while (0)
+
+static jmp_buf env;
+static volatile int depth;
+
+__attribute__((noinline))
+static int callee(int x)
+{
+   depth = x;
+   return x + 1;
+}
+
+__attribute__((noinline))
+static void return_then_trace(void)
+{
+   callee(1);
+   TRACE_BELOW_DEAD_FRAMES("after a return");
+}
+
+__attribute__((noinline))
+static void deep(int n)
+{
+   if (n < 0)
+      return;
+   if (n == 0)
+      longjmp(env, 1);
+   deep(n - 1);
+   depth = n;
+}
+
+__attribute__((noinline))
+static void longjmp_then_trace(void)
+{
+   if (setjmp(env) == 0)
+      deep(10);
+   TRACE_BELOW_DEAD_FRAMES("after a longjmp");
+}
+
+__attribute__((noinline))
+static void handler(int sig)
+{
+   VALGRIND_PRINTF_BACKTRACE("in a signal handler\n");
+}
+
+__attribute__((noinline))
+static void signal_then_trace(void)
+{
+   signal(SIGTRAP, handler);
+#if defined(__i386__) || defined(__x86_64__)
+   __asm__ __volatile__("int3");
+#endif
+   TRACE_BELOW_DEAD_FRAMES("after a signal handler");
+}
+
+int main(void)
+{
+   return_then_trace();
+   longjmp_then_trace();
+   signal_then_trace();
+   return 0;
+}
@@ -407,7 +407,8 @@ print_store_ip_desc(UInt n, DiEpoch ep, Addr ip, void *uu_opaque)
 static void
 pp_store_trace(const struct pmem_st *store, UInt n_ips)
 {
-    n_ips = n_ips == 0 ? VG_(get_ExeContext_n_ips)(store->context) : n_ips;
+    UInt ctx_n_ips = VG_(get_ExeContext_n_ips)(store->context);
+    n_ips = n_ips == 0 || n_ips > ctx_n_ips ? ctx_n_ips : n_ips;
 
     tl_assert( n_ips > 0 );
 
@@ -415,8 +416,9 @@ pp_store_trace(const struct pmem_st *store, UInt n_ips)
          VG_(printf_xml)("    <stack>\n");
 
     DiEpoch ep = VG_(current_DiEpoch)();
-    VG_(apply_StackTrace)(print_store_ip_desc, NULL, ep,
-         VG_(get_ExeContext_StackTrace(store->context)), n_ips);
+    Addr ips[n_ips];
+    VG_(get_ExeContext_ips)(store->context, 0, n_ips, ips);
+    VG_(apply_StackTrace)(print_store_ip_desc, NULL, ep, ips, n_ips);
 
     if (VG_(clo_xml))
          VG_(printf_xml)("    </stack>\n");
@@ -562,25 +564,26 @@ cmp_exe_context(const ExeContext* lhs, const ExeContext* rhs)
     if (lhs == rhs)
         return True;
 
-    /* retrieve stacktraces */
-    UInt n_ips1;
-    UInt n_ips2;
-    const Addr *ips1 = VG_(make_StackTrace_from_ExeContext)(lhs, &n_ips1);
-    const Addr *ips2 = VG_(make_StackTrace_from_ExeContext)(rhs, &n_ips2);
-
     /* Must be at least one address in each trace. */
-    tl_assert(n_ips1 >= 1 && n_ips2 >= 1);
+    tl_assert(VG_(get_ExeContext_n_ips)(lhs) >= 1
+              && VG_(get_ExeContext_n_ips)(rhs) >= 1);
 
-    /* different stacktrace depth */
-    if (n_ips1 != n_ips2)
+    /* same depth and same instruction pointers, starting from the
+     * _second_ */
+    if (!VG_(eq_ExeContext_from)(lhs, rhs, 1))
         return False;
 
-    /* compare instruction pointers, starting from the _second_ */
-    for (Int i = 1; i < n_ips1; i++)
-        if (ips1[i] != ips2[i])
-            return False;
-
-    return addresses_are_mergeable(ips1[0], ips2[0]);
+    /* compare the first instruction pointers */
+    ExeContextIter it1;
+    ExeContextIter it2;
+    Addr ip1;
+    Addr ip2;
+    VG_(init_ExeContext_iter)(&it1, lhs);
+    VG_(init_ExeContext_iter)(&it2, rhs);
+    VG_(next_ExeContext_ip)(&it1, &ip1);
+    VG_(next_ExeContext_ip)(&it2, &ip2);
+
+    return addresses_are_mergeable(ip1, ip2);
 }
 
 /**